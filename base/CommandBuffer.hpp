@@ -17,12 +17,17 @@
 #include "CommandPool.hpp"
 #include "RenderPass.hpp"
 #include "Framebuffer.hpp"
+#include "VulkanInstrumentation.hpp"
 
 class CommandBuffer {
 private:
 	VkDevice device;
 	CommandPool *pool = nullptr;
 	VkCommandBufferLevel level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	// Render pass state inherited by secondary command buffers
+	VkRenderPass inheritanceRenderPass = VK_NULL_HANDLE;
+	VkFramebuffer inheritanceFramebuffer = VK_NULL_HANDLE;
+	uint32_t inheritanceSubpass = 0;
 public:
 	VkCommandBuffer handle;
 	CommandBuffer(VkDevice device) {
@@ -42,17 +47,47 @@ public:
 	void setLevel(VkCommandBufferLevel level) {
 		this->level = level;
 	}
+	void setInheritanceInfo(RenderPass* renderPass, VkFramebuffer framebuffer, uint32_t subpass = 0) {
+		this->inheritanceRenderPass = renderPass->handle;
+		this->inheritanceFramebuffer = framebuffer;
+		this->inheritanceSubpass = subpass;
+	}
 	void begin() {
 		VkCommandBufferBeginInfo beginInfo = vks::initializers::commandBufferBeginInfo();
+		VkCommandBufferInheritanceInfo inheritanceInfo{};
+		if (level == VK_COMMAND_BUFFER_LEVEL_SECONDARY) {
+			// Secondary command buffers are executed entirely within the render pass set via setInheritanceInfo
+			assert(inheritanceRenderPass != VK_NULL_HANDLE);
+			inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+			inheritanceInfo.renderPass = inheritanceRenderPass;
+			inheritanceInfo.subpass = inheritanceSubpass;
+			inheritanceInfo.framebuffer = inheritanceFramebuffer;
+			beginInfo.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+			beginInfo.pInheritanceInfo = &inheritanceInfo;
+		}
 		VK_CHECK_RESULT(vkBeginCommandBuffer(handle, &beginInfo));
 	}
 	void end() {
 		VK_CHECK_RESULT(vkEndCommandBuffer(handle));
 	}
-	void beginRenderPass(RenderPass *rp, VkFramebuffer fb) {
-		rp->setFrameBuffer(fb);
-		VkRenderPassBeginInfo beginInfo = rp->getBeginInfo();
-		vkCmdBeginRenderPass(handle, &beginInfo, VK_SUBPASS_CONTENTS_INLINE);
+	// The render pass is only read, so passes sharing it (e.g. the shadow cascades) can be recorded on multiple threads with different frame buffers
+	void beginRenderPass(const RenderPass *rp, VkFramebuffer fb, VkSubpassContents contents = VK_SUBPASS_CONTENTS_INLINE) {
+		const std::vector<VkClearValue>& clearValues = rp->getClearValues();
+		VkRenderPassBeginInfo beginInfo = vks::initializers::renderPassBeginInfo();
+		beginInfo.renderPass = rp->handle;
+		beginInfo.framebuffer = fb;
+		beginInfo.renderArea.offset = { 0, 0 };
+		beginInfo.renderArea.extent = rp->getExtent();
+		beginInfo.clearValueCount = static_cast<uint32_t>(clearValues.size());
+		beginInfo.pClearValues = clearValues.data();
+		vkCmdBeginRenderPass(handle, &beginInfo, contents);
+	}
+	void executeCommands(std::vector<CommandBuffer*> commandBuffers) {
+		std::vector<VkCommandBuffer> handles;
+		for (auto commandBuffer : commandBuffers) {
+			handles.push_back(commandBuffer->handle);
+		}
+		vkCmdExecuteCommands(handle, static_cast<uint32_t>(handles.size()), handles.data());
 	}
 	void endRenderPass() {
 		vkCmdEndRenderPass(handle);
@@ -71,12 +106,14 @@ public:
 			descSets.push_back(set->handle);
 		}
 		vkCmdBindDescriptorSets(handle, VK_PIPELINE_BIND_POINT_GRAPHICS, layout->handle, firstSet, static_cast<uint32_t>(descSets.size()), descSets.data(), 0, nullptr);
+		VKS_COUNTER_ADD("Descriptor sets bound", descSets.size());
 	}
 	void bindPipeline(Pipeline* pipeline) {
 		vkCmdBindPipeline(handle, pipeline->getBindPoint(), pipeline->getHandle());
 	}
 	void draw(uint32_t vertexCount, uint32_t instanceCount, uint32_t firstVertex, uint32_t firstInstance) {
-		vkCmdDraw(handle, 6, 1, 0, 0);
+		vkCmdDraw(handle, vertexCount, instanceCount, firstVertex, firstInstance);
+		VKS_COUNTER_ADD("Draw calls recorded", 1);
 	}
 	void updatePushConstant(PipelineLayout *layout, uint32_t index, const void* values) {
 		VkPushConstantRange pushConstantRange = layout->getPushConstantRange(index);
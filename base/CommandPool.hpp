@@ -38,4 +38,8 @@ public:
 	void setFlags(VkCommandPoolCreateFlags flags) {
 		this->flags = flags;
 	}
+	// Resets all command buffers allocated from this pool at once, none of them may be pending
+	void reset(VkCommandPoolResetFlags resetFlags = 0) {
+		VK_CHECK_RESULT(vkResetCommandPool(device, handle, resetFlags));
+	}
 };
\ No newline at end of file
@@ -35,6 +35,10 @@ public:
 		for (auto& descriptor : descriptors) {
 			descriptor.dstSet = handle;
 		}
+		update();
+	}
+	// Rewrite all descriptors from the buffer and image infos they were added with, the set must not be in use by the device
+	void update() {
 		vkUpdateDescriptorSets(device, static_cast<uint32_t>(descriptors.size()), descriptors.data(), 0, nullptr);
 	}
 	operator VkDescriptorSet() const { 
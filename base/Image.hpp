@@ -17,7 +17,7 @@
 class Image {
 private:
 	vks::VulkanDevice* device;
-	VkDeviceMemory memory;
+	vks::Allocation memory;
 	VkImageType type;
 	VkFormat format;
 	VkExtent3D extent;
@@ -28,12 +28,15 @@ private:
 	VkImageUsageFlags usage;
 	VkSharingMode sharingMode = VK_SHARING_MODE_EXCLUSIVE;
 public:
-	VkImage handle;
+	VkImage handle = VK_NULL_HANDLE;
 	Image(vks::VulkanDevice* device) {
 		this->device = device;
 	}
 	~Image() {
-		// @todo
+		if (handle != VK_NULL_HANDLE) {
+			vkDestroyImage(device->logicalDevice, handle, nullptr);
+			device->freeMemory(memory);
+		}
 	}
 	void create() {
 		VkImageCreateInfo CI = vks::initializers::imageCreateInfo();
@@ -46,13 +49,7 @@ public:
 		CI.tiling = tiling;
 		CI.usage = usage;
 		VK_CHECK_RESULT(vkCreateImage(device->logicalDevice, &CI, nullptr, &handle));
-		VkMemoryRequirements memReqs;
-		vkGetImageMemoryRequirements(device->logicalDevice, handle, &memReqs);
-		VkMemoryAllocateInfo memAlloc = vks::initializers::memoryAllocateInfo();
-		memAlloc.allocationSize = memReqs.size;
-		memAlloc.memoryTypeIndex = device->getMemoryType(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-		VK_CHECK_RESULT(vkAllocateMemory(device->logicalDevice, &memAlloc, nullptr, &memory));
-		VK_CHECK_RESULT(vkBindImageMemory(device->logicalDevice, handle, memory, 0));
+		memory = device->allocateImageMemory(handle, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, tiling);
 	}
 	void setType(VkImageType type) {
 		this->type = type;
@@ -81,4 +78,13 @@ public:
 	void setSharingMode(VkSharingMode sharingMode) {
 		this->sharingMode = sharingMode;
 	}
+	VkFormat getFormat() {
+		return format;
+	}
+	VkExtent3D getExtent() {
+		return extent;
+	}
+	VkDeviceSize getMemorySize() {
+		return memory.size;
+	}
 };
\ No newline at end of file
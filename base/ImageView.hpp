@@ -23,12 +23,14 @@ private:
 	VkFormat format;
 	VkImageSubresourceRange range;
 public:
-	VkImageView handle;
+	VkImageView handle = VK_NULL_HANDLE;
 	ImageView(vks::VulkanDevice* device) {
 		this->device = device;
 	}
 	~ImageView() {
-		// @todo
+		if (handle != VK_NULL_HANDLE) {
+			vkDestroyImageView(device->logicalDevice, handle, nullptr);
+		}
 	}
 	void create() {
 		VkImageViewCreateInfo CI = vks::initializers::imageViewCreateInfo();
@@ -9,62 +9,183 @@
 #pragma once
 
 #include <vector>
+#include <list>
 #include "vulkan/vulkan.h"
 #include "VulkanInitializers.hpp"
 #include "VulkanTools.h"
 #include "PipelineLayout.hpp"
 #include "RenderPass.hpp"
+#include "threadpool.hpp"
+#include "VulkanShaderCache.hpp"
 
 class Pipeline {
 private:
 	VkDevice device = VK_NULL_HANDLE;
 	VkPipeline pso = VK_NULL_HANDLE;
-	VkPipelineBindPoint bindPoint;
+	// Set to compute by adding a compute shader, compute pipelines only use the shader, layout and cache
+	VkPipelineBindPoint bindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
 	PipelineLayout* layout = nullptr;
-	RenderPass* renderPass;
+	RenderPass* renderPass = nullptr;
 	VkGraphicsPipelineCreateInfo pipelineCI;
-	VkPipelineCache cache;
+	VkPipelineCache cache = VK_NULL_HANDLE;
 	std::vector<VkPipelineShaderStageCreateInfo> shaderStages;
 	std::vector<VkShaderModule> shaderModules;
+	// Specialization constants owned by the pipeline, a list keeps the infos the shader stages point to in place
+	std::list<vks::SpecializationConstants> specializationConstants;
+	// Copy of the state the create info points to, so the caller's structures can be changed or go out of scope before the pipeline is created
+	// pNext chains and sample masks are not copied and have to stay valid until then
+	struct {
+		VkPipelineVertexInputStateCreateInfo vertexInput;
+		std::vector<VkVertexInputBindingDescription> vertexBindings;
+		std::vector<VkVertexInputAttributeDescription> vertexAttributes;
+		VkPipelineInputAssemblyStateCreateInfo inputAssembly;
+		VkPipelineTessellationStateCreateInfo tessellation;
+		VkPipelineViewportStateCreateInfo viewport;
+		std::vector<VkViewport> viewports;
+		std::vector<VkRect2D> scissors;
+		VkPipelineRasterizationStateCreateInfo rasterization;
+		VkPipelineMultisampleStateCreateInfo multisample;
+		VkPipelineDepthStencilStateCreateInfo depthStencil;
+		VkPipelineColorBlendStateCreateInfo colorBlend;
+		std::vector<VkPipelineColorBlendAttachmentState> colorBlendAttachments;
+		VkPipelineDynamicStateCreateInfo dynamic;
+		std::vector<VkDynamicState> dynamicStates;
+	} state{};
+
+	template<typename T>
+	const T* copyState(const T* source, T& target) {
+		if (!source) {
+			return nullptr;
+		}
+		target = *source;
+		return &target;
+	}
+	template<typename T>
+	const T* copyArray(const T* source, uint32_t count, std::vector<T>& target) {
+		if (!source || count == 0) {
+			return source;
+		}
+		target.assign(source, source + count);
+		return target.data();
+	}
+
+	Pipeline(const Pipeline&) = delete;
+	Pipeline& operator=(const Pipeline&) = delete;
+
+	void prepareCreateInfo() {
+		assert(layout);
+		pipelineCI.stageCount = static_cast<uint32_t>(shaderStages.size());
+		pipelineCI.pStages = shaderStages.data();
+		pipelineCI.layout = layout->handle;
+		pipelineCI.renderPass = renderPass->handle;
+	}
+	void createCompute() {
+		assert(layout);
+		assert(shaderStages.size() == 1);
+		VkComputePipelineCreateInfo computePipelineCI{};
+		computePipelineCI.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+		computePipelineCI.stage = shaderStages[0];
+		computePipelineCI.layout = layout->handle;
+		VK_CHECK_RESULT(vkCreateComputePipelines(device, cache, 1, &computePipelineCI, nullptr, &pso));
+	}
 public:
 	Pipeline(VkDevice device) {
 		this->device = device;
 	}
 	~Pipeline() {
-		// @todo: destroy shader modules
 		vkDestroyPipeline(device, pso, nullptr);
+		for (auto shaderModule : shaderModules) {
+			vks::ShaderModuleCache::get().release(device, shaderModule);
+		}
 	}
 	void create() {
-		assert(layout);
-		pipelineCI.stageCount = static_cast<uint32_t>(shaderStages.size());
-		pipelineCI.pStages = shaderStages.data();
-		pipelineCI.layout = layout->handle;
-		pipelineCI.renderPass = renderPass->handle;
+		if (bindPoint == VK_PIPELINE_BIND_POINT_COMPUTE) {
+			createCompute();
+			return;
+		}
+		prepareCreateInfo();
 		VK_CHECK_RESULT(vkCreateGraphicsPipelines(device, cache, 1, &pipelineCI, nullptr, &pso));
 	}
-	void addShader(std::string filename) {
-		size_t extpos = filename.find('.');
+	/**
+	* Create multiple pipelines at once
+	* Without a thread pool, pipelines sharing a device and cache are passed to the driver in a single call
+	* With a thread pool, the pipelines are compiled in parallel on its workers (pipeline caches are internally synchronized)
+	*
+	* @param pipelines Pipelines to create, all of them need to be fully set up
+	* @param threadPool Optional thread pool, has to be called from the pool's main thread
+	*/
+	static void createPipelines(const std::vector<Pipeline*>& pipelines, vks::ThreadPool* threadPool = nullptr) {
+		if (threadPool && threadPool->getWorkerCount() > 1) {
+			threadPool->parallelFor(static_cast<uint32_t>(pipelines.size()), 1, [&pipelines](uint32_t begin, uint32_t end) {
+				for (uint32_t i = begin; i < end; i++) {
+					pipelines[i]->create();
+				}
+			});
+			return;
+		}
+		std::vector<bool> created(pipelines.size(), false);
+		for (size_t i = 0; i < pipelines.size(); i++) {
+			if (created[i]) {
+				continue;
+			}
+			// Graphics and compute pipelines are created with different calls, compute pipelines are created on their own
+			if (pipelines[i]->bindPoint == VK_PIPELINE_BIND_POINT_COMPUTE) {
+				pipelines[i]->createCompute();
+				created[i] = true;
+				continue;
+			}
+			std::vector<Pipeline*> batch;
+			for (size_t j = i; j < pipelines.size(); j++) {
+				if (!created[j] && pipelines[j]->bindPoint == VK_PIPELINE_BIND_POINT_GRAPHICS && pipelines[j]->device == pipelines[i]->device && pipelines[j]->cache == pipelines[i]->cache) {
+					batch.push_back(pipelines[j]);
+					created[j] = true;
+				}
+			}
+			std::vector<VkGraphicsPipelineCreateInfo> createInfos;
+			for (auto pipeline : batch) {
+				pipeline->prepareCreateInfo();
+				createInfos.push_back(pipeline->pipelineCI);
+			}
+			std::vector<VkPipeline> handles(batch.size(), VK_NULL_HANDLE);
+			VK_CHECK_RESULT(vkCreateGraphicsPipelines(pipelines[i]->device, pipelines[i]->cache, static_cast<uint32_t>(createInfos.size()), createInfos.data(), nullptr, handles.data()));
+			for (size_t j = 0; j < batch.size(); j++) {
+				batch[j]->pso = handles[j];
+			}
+		}
+	}
+	// The specialization info (if any) has to stay valid until the pipeline has been created
+	void addShader(std::string filename, const VkSpecializationInfo* specializationInfo = nullptr) {
+		// Stage is taken from the extension following the file name (e.g. terrain.tesc.spv), skip the directory part as it may contain dots
+		size_t namepos = filename.find_last_of("/\\");
+		size_t extpos = filename.find('.', namepos == std::string::npos ? 0 : namepos + 1);
 		size_t extend = filename.find('.', extpos + 1);
 		assert(extpos != std::string::npos);
 		std::string ext = filename.substr(extpos + 1, extend - extpos - 1);
 		VkShaderStageFlagBits shaderStage = VK_SHADER_STAGE_FLAG_BITS_MAX_ENUM;
 		if (ext == "vert") { shaderStage = VK_SHADER_STAGE_VERTEX_BIT; }
 		if (ext == "frag") { shaderStage = VK_SHADER_STAGE_FRAGMENT_BIT; }
+		if (ext == "tesc") { shaderStage = VK_SHADER_STAGE_TESSELLATION_CONTROL_BIT; }
+		if (ext == "tese") { shaderStage = VK_SHADER_STAGE_TESSELLATION_EVALUATION_BIT; }
+		if (ext == "geom") { shaderStage = VK_SHADER_STAGE_GEOMETRY_BIT; }
+		if (ext == "comp") { shaderStage = VK_SHADER_STAGE_COMPUTE_BIT; bindPoint = VK_PIPELINE_BIND_POINT_COMPUTE; }
 		assert(shaderStage != VK_SHADER_STAGE_FLAG_BITS_MAX_ENUM);
 
 		VkPipelineShaderStageCreateInfo shaderStageCI{};
 		shaderStageCI.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
 		shaderStageCI.stage = shaderStage;
 		shaderStageCI.pName = "main";
-#if defined(VK_USE_PLATFORM_ANDROID_KHR)
-		shaderStageCI.module = vks::tools::loadShader(androidApp->activity->assetManager, filename.c_str(), device);
-#else
-		shaderStageCI.module = vks::tools::loadShader(filename.c_str(), device);
-#endif
+		shaderStageCI.pSpecializationInfo = specializationInfo;
+		// Modules are shared with all other pipelines using the same file
+		shaderStageCI.module = vks::ShaderModuleCache::get().acquire(device, filename);
 		assert(shaderStageCI.module != VK_NULL_HANDLE);
 		shaderModules.push_back(shaderStageCI.module);
 		shaderStages.push_back(shaderStageCI);
 	}
+	// Adds a shader specialized with the given constants, the pipeline keeps its own copy of them
+	void addShader(std::string filename, const vks::SpecializationConstants& constants) {
+		specializationConstants.push_back(constants);
+		addShader(filename, specializationConstants.back().getInfo());
+	}
 	void setLayout(PipelineLayout* layout) {
 		this->layout = layout;
 	}
@@ -74,6 +195,22 @@ public:
 	void setCreateInfo(VkGraphicsPipelineCreateInfo pipelineCI) {
 		this->pipelineCI = pipelineCI;
 		this->bindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+		this->pipelineCI.pVertexInputState = copyState(pipelineCI.pVertexInputState, state.vertexInput);
+		this->pipelineCI.pInputAssemblyState = copyState(pipelineCI.pInputAssemblyState, state.inputAssembly);
+		this->pipelineCI.pTessellationState = copyState(pipelineCI.pTessellationState, state.tessellation);
+		this->pipelineCI.pViewportState = copyState(pipelineCI.pViewportState, state.viewport);
+		this->pipelineCI.pRasterizationState = copyState(pipelineCI.pRasterizationState, state.rasterization);
+		this->pipelineCI.pMultisampleState = copyState(pipelineCI.pMultisampleState, state.multisample);
+		this->pipelineCI.pDepthStencilState = copyState(pipelineCI.pDepthStencilState, state.depthStencil);
+		this->pipelineCI.pColorBlendState = copyState(pipelineCI.pColorBlendState, state.colorBlend);
+		this->pipelineCI.pDynamicState = copyState(pipelineCI.pDynamicState, state.dynamic);
+		// Arrays referenced by the copied state
+		state.vertexInput.pVertexBindingDescriptions = copyArray(state.vertexInput.pVertexBindingDescriptions, state.vertexInput.vertexBindingDescriptionCount, state.vertexBindings);
+		state.vertexInput.pVertexAttributeDescriptions = copyArray(state.vertexInput.pVertexAttributeDescriptions, state.vertexInput.vertexAttributeDescriptionCount, state.vertexAttributes);
+		state.viewport.pViewports = copyArray(state.viewport.pViewports, state.viewport.viewportCount, state.viewports);
+		state.viewport.pScissors = copyArray(state.viewport.pScissors, state.viewport.scissorCount, state.scissors);
+		state.colorBlend.pAttachments = copyArray(state.colorBlend.pAttachments, state.colorBlend.attachmentCount, state.colorBlendAttachments);
+		state.dynamic.pDynamicStates = copyArray(state.dynamic.pDynamicStates, state.dynamic.dynamicStateCount, state.dynamicStates);
 	}
 	void setCache(VkPipelineCache cache) {
 		this->cache = cache;
@@ -0,0 +1,614 @@
+/*
+* Render graph
+*
+* Passes declare the attachments they write and the textures they read, the graph then
+* - orders the passes so every attachment is written before it's read and culls passes that don't contribute to the frame
+* - creates the render passes and framebuffers (compatible with pipelines created for render passes with the same formats)
+* - aliases transient attachments whose lifetimes don't overlap onto the same image
+* - records the image layout transitions and barriers between passes, so render passes don't need subpass dependencies
+*
+* Copyright (C) by Sascha Willems - www.saschawillems.de
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <vector>
+#include <array>
+#include <string>
+#include <functional>
+#include <algorithm>
+#include <assert.h>
+#include <string.h>
+#include "vulkan/vulkan.h"
+#include "VulkanInitializers.hpp"
+#include "VulkanTools.h"
+#include "VulkanDevice.hpp"
+#include "Image.hpp"
+#include "ImageView.hpp"
+#include "RenderPass.hpp"
+#include "CommandBuffer.hpp"
+
+class RenderGraph {
+public:
+	typedef uint32_t ResourceHandle;
+	typedef uint32_t PassHandle;
+	// Called to record a pass, render pass begin and end are done by the graph unless the pass is external
+	typedef std::function<void(CommandBuffer* commandBuffer, uint32_t imageIndex)> RecordFunction;
+
+	struct Stats {
+		uint32_t passCount = 0;
+		uint32_t culledPassCount = 0;
+		uint32_t attachmentCount = 0;
+		// Images backing the attachments, less than the attachment count if attachments have been aliased
+		uint32_t imageCount = 0;
+		VkDeviceSize memorySize = 0;
+		// Memory of the attachments without aliasing
+		VkDeviceSize unaliasedMemorySize = 0;
+		uint32_t barrierCount = 0;
+	};
+
+private:
+	enum UsageType { usageColorAttachment, usageDepthAttachment, usageTexture };
+
+	struct Usage {
+		ResourceHandle resource;
+		UsageType type;
+		VkPipelineStageFlags stages;
+	};
+
+	// Layout and the last accesses of an image while walking through the passes
+	struct State {
+		VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED;
+		VkPipelineStageFlags stages = 0;
+		VkAccessFlags access = 0;
+	};
+
+	struct Resource {
+		std::string name;
+		VkFormat format;
+		uint32_t width;
+		uint32_t height;
+		VkImageAspectFlags aspectMask;
+		VkImageUsageFlags usage = 0;
+		// Execution order indices of the first and last pass using the attachment
+		uint32_t firstUse = UINT32_MAX;
+		uint32_t lastUse = 0;
+		uint32_t physical = UINT32_MAX;
+	};
+
+	struct Physical {
+		Image* image = nullptr;
+		ImageView* view = nullptr;
+		// Depth only view of sampled depth/stencil images, as sampled views can only have one aspect
+		ImageView* sampledView = nullptr;
+		VkFormat format;
+		uint32_t width;
+		uint32_t height;
+		VkImageAspectFlags aspectMask;
+		VkImageUsageFlags usage;
+		// Execution order index of the last pass using the image
+		uint32_t lastUse = 0;
+		VkDeviceSize memorySize = 0;
+	};
+
+	struct Barrier {
+		uint32_t physical;
+		State src;
+		State dst;
+	};
+
+	struct Pass {
+		std::string name;
+		RecordFunction record;
+		VkSubpassContents contents = VK_SUBPASS_CONTENTS_INLINE;
+		bool external = false;
+		std::vector<Usage> usages;
+		std::vector<VkClearValue> clearValues;
+		bool culled = false;
+		// Created by compile()
+		RenderPass* renderPass = nullptr;
+		VkFramebuffer framebuffer = VK_NULL_HANDLE;
+		uint32_t width = 0;
+		uint32_t height = 0;
+		VkPipelineStageFlags srcStages = 0;
+		VkPipelineStageFlags dstStages = 0;
+		std::vector<Barrier> barriers;
+	};
+
+	vks::VulkanDevice* device;
+	std::vector<Resource> resources;
+	std::vector<Pass> passes;
+	std::vector<Physical> physicals;
+	// Passes in execution order
+	std::vector<PassHandle> order;
+	Stats stats;
+	bool compiled = false;
+
+	static bool isWrite(UsageType type) {
+		return type != usageTexture;
+	}
+
+	static State getState(const Usage& usage, bool load) {
+		State state;
+		switch (usage.type) {
+		case usageColorAttachment:
+			state.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+			state.stages = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+			state.access = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | (load ? VK_ACCESS_COLOR_ATTACHMENT_READ_BIT : 0);
+			break;
+		case usageDepthAttachment:
+			state.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+			state.stages = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+			state.access = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT;
+			break;
+		case usageTexture:
+			state.layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+			state.stages = usage.stages;
+			state.access = VK_ACCESS_SHADER_READ_BIT;
+			break;
+		}
+		return state;
+	}
+
+	static const VkAccessFlags writeAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT | VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+
+	void addUsage(PassHandle pass, ResourceHandle resource, UsageType type, VkPipelineStageFlags stages) {
+		assert(!compiled);
+		assert(pass < passes.size() && resource < resources.size());
+		passes[pass].usages.push_back({ resource, type, stages });
+	}
+
+	void setClearValue(PassHandle pass, VkClearValue value) {
+		passes[pass].clearValues.push_back(value);
+	}
+
+	// Writers of an attachment run before its readers, writers and readers keep their declaration order otherwise
+	void sortPasses() {
+		const uint32_t passCount = static_cast<uint32_t>(passes.size());
+		std::vector<std::vector<PassHandle>> dependencies(passCount);
+		for (uint32_t i = 0; i < passCount; i++) {
+			for (auto& usage : passes[i].usages) {
+				for (uint32_t j = 0; j < passCount; j++) {
+					if (i == j) {
+						continue;
+					}
+					for (auto& other : passes[j].usages) {
+						if (other.resource != usage.resource) {
+							continue;
+						}
+						// Reads depend on all writes, writes on earlier declared writes
+						const bool dependency = (!isWrite(usage.type) && isWrite(other.type)) || (isWrite(usage.type) && isWrite(other.type) && j < i);
+						if (dependency && std::find(dependencies[i].begin(), dependencies[i].end(), j) == dependencies[i].end()) {
+							dependencies[i].push_back(j);
+						}
+					}
+				}
+			}
+		}
+
+		// Passes that don't (indirectly) contribute to an external pass are culled, graphs without external passes keep all passes
+		const bool hasExternal = std::find_if(passes.begin(), passes.end(), [](const Pass& pass) { return pass.external; }) != passes.end();
+		std::vector<bool> required(passCount, !hasExternal);
+		std::vector<PassHandle> stack;
+		for (uint32_t i = 0; i < passCount; i++) {
+			if (passes[i].external) {
+				required[i] = true;
+				stack.push_back(i);
+			}
+		}
+		while (!stack.empty()) {
+			const PassHandle pass = stack.back();
+			stack.pop_back();
+			for (auto dependency : dependencies[pass]) {
+				if (!required[dependency]) {
+					required[dependency] = true;
+					stack.push_back(dependency);
+				}
+			}
+		}
+
+		std::vector<bool> scheduled(passCount, false);
+		order.clear();
+		for (uint32_t i = 0; i < passCount; i++) {
+			passes[i].culled = !required[i];
+			if (passes[i].culled) {
+				stats.culledPassCount++;
+				scheduled[i] = true;
+			}
+		}
+		while (order.size() + stats.culledPassCount < passCount) {
+			bool progress = false;
+			for (uint32_t i = 0; i < passCount; i++) {
+				if (scheduled[i]) {
+					continue;
+				}
+				const bool ready = std::all_of(dependencies[i].begin(), dependencies[i].end(), [&scheduled](PassHandle dependency) { return scheduled[dependency]; });
+				if (ready) {
+					order.push_back(i);
+					scheduled[i] = true;
+					progress = true;
+					// Restart from the first declared pass to keep the declaration order wherever possible
+					break;
+				}
+			}
+			if (!progress) {
+				vks::tools::exitFatal("Render graph contains a cycle", -1);
+			}
+		}
+	}
+
+	// Attachments with disjoint lifetimes and the same format, size and usage share an image
+	void allocatePhysicalResources() {
+		for (uint32_t i = 0; i < order.size(); i++) {
+			for (auto& usage : passes[order[i]].usages) {
+				Resource& resource = resources[usage.resource];
+				resource.firstUse = std::min(resource.firstUse, i);
+				resource.lastUse = std::max(resource.lastUse, i);
+				resource.usage |= (usage.type == usageColorAttachment) ? VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT : (usage.type == usageDepthAttachment) ? VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT : VK_IMAGE_USAGE_SAMPLED_BIT;
+			}
+		}
+		std::vector<ResourceHandle> sorted;
+		for (uint32_t i = 0; i < resources.size(); i++) {
+			if (resources[i].firstUse != UINT32_MAX) {
+				sorted.push_back(i);
+			}
+		}
+		std::sort(sorted.begin(), sorted.end(), [this](ResourceHandle a, ResourceHandle b) { return resources[a].firstUse < resources[b].firstUse; });
+		for (auto handle : sorted) {
+			Resource& resource = resources[handle];
+			for (uint32_t i = 0; i < physicals.size(); i++) {
+				Physical& physical = physicals[i];
+				if (physical.lastUse < resource.firstUse && physical.format == resource.format && physical.width == resource.width && physical.height == resource.height && physical.usage == resource.usage) {
+					resource.physical = i;
+					break;
+				}
+			}
+			if (resource.physical == UINT32_MAX) {
+				Physical physical;
+				physical.format = resource.format;
+				physical.width = resource.width;
+				physical.height = resource.height;
+				physical.aspectMask = resource.aspectMask;
+				physical.usage = resource.usage;
+				resource.physical = static_cast<uint32_t>(physicals.size());
+				physicals.push_back(physical);
+			}
+			physicals[resource.physical].lastUse = resource.lastUse;
+		}
+
+		for (auto& physical : physicals) {
+			physical.image = new Image(device);
+			physical.image->setType(VK_IMAGE_TYPE_2D);
+			physical.image->setFormat(physical.format);
+			physical.image->setExtent({ physical.width, physical.height, 1 });
+			physical.image->setTiling(VK_IMAGE_TILING_OPTIMAL);
+			physical.image->setUsage(physical.usage);
+			physical.image->create();
+			physical.view = new ImageView(device);
+			physical.view->setImage(physical.image);
+			physical.view->setType(VK_IMAGE_VIEW_TYPE_2D);
+			physical.view->setFormat(physical.format);
+			physical.view->setSubResourceRange({ physical.aspectMask, 0, 1, 0, 1 });
+			physical.view->create();
+			if ((physical.usage & VK_IMAGE_USAGE_SAMPLED_BIT) && physical.aspectMask == (VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT)) {
+				physical.sampledView = new ImageView(device);
+				physical.sampledView->setImage(physical.image);
+				physical.sampledView->setType(VK_IMAGE_VIEW_TYPE_2D);
+				physical.sampledView->setFormat(physical.format);
+				physical.sampledView->setSubResourceRange({ VK_IMAGE_ASPECT_DEPTH_BIT, 0, 1, 0, 1 });
+				physical.sampledView->create();
+			}
+			physical.memorySize = physical.image->getMemorySize();
+			stats.memorySize += physical.memorySize;
+		}
+		for (auto& resource : resources) {
+			if (resource.physical != UINT32_MAX) {
+				stats.unaliasedMemorySize += physicals[resource.physical].memorySize;
+				stats.attachmentCount++;
+			}
+		}
+		stats.imageCount = static_cast<uint32_t>(physicals.size());
+	}
+
+	// Whether the contents an attachment has after pass orderIndex are read by a later pass
+	bool isReadLater(ResourceHandle resource, uint32_t orderIndex) {
+		for (uint32_t i = orderIndex + 1; i < order.size(); i++) {
+			for (auto& usage : passes[order[i]].usages) {
+				if (usage.resource == resource) {
+					return true;
+				}
+			}
+		}
+		return false;
+	}
+
+	void createRenderPass(Pass& pass, uint32_t orderIndex) {
+		pass.renderPass = new RenderPass(device->logicalDevice);
+		std::vector<VkAttachmentReference> colorReferences;
+		VkAttachmentReference depthReference{ VK_ATTACHMENT_UNUSED, VK_IMAGE_LAYOUT_UNDEFINED };
+		std::vector<VkImageView> views;
+		uint32_t clearIndex = 0;
+		for (auto& usage : pass.usages) {
+			if (!isWrite(usage.type)) {
+				continue;
+			}
+			const Resource& resource = resources[usage.resource];
+			const bool first = resource.firstUse == orderIndex;
+			const State state = getState(usage, !first);
+			VkAttachmentDescription description{};
+			description.format = resource.format;
+			description.samples = VK_SAMPLE_COUNT_1_BIT;
+			// Contents of aliased images are discarded on first use, so the first pass writing an attachment has to fully overwrite it
+			description.loadOp = first ? VK_ATTACHMENT_LOAD_OP_CLEAR : VK_ATTACHMENT_LOAD_OP_LOAD;
+			description.storeOp = isReadLater(usage.resource, orderIndex) ? VK_ATTACHMENT_STORE_OP_STORE : VK_ATTACHMENT_STORE_OP_DONT_CARE;
+			description.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+			description.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+			// Layout transitions are done by the barriers in front of the render pass
+			description.initialLayout = state.layout;
+			description.finalLayout = state.layout;
+			const uint32_t attachmentIndex = static_cast<uint32_t>(views.size());
+			pass.renderPass->addAttachmentDescription(description);
+			if (usage.type == usageColorAttachment) {
+				colorReferences.push_back({ attachmentIndex, state.layout });
+				const VkClearColorValue& color = pass.clearValues[clearIndex++].color;
+				pass.renderPass->setColorClearValue(attachmentIndex, { color.float32[0], color.float32[1], color.float32[2], color.float32[3] });
+			} else {
+				depthReference = { attachmentIndex, state.layout };
+				const VkClearDepthStencilValue& depthStencil = pass.clearValues[clearIndex++].depthStencil;
+				pass.renderPass->setDepthStencilClearValue(attachmentIndex, depthStencil.depth, depthStencil.stencil);
+			}
+			views.push_back(physicals[resource.physical].view->handle);
+			pass.width = resource.width;
+			pass.height = resource.height;
+		}
+		assert(!views.empty());
+		VkSubpassDescription subpassDescription{};
+		subpassDescription.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+		subpassDescription.colorAttachmentCount = static_cast<uint32_t>(colorReferences.size());
+		subpassDescription.pColorAttachments = colorReferences.data();
+		subpassDescription.pDepthStencilAttachment = (depthReference.attachment != VK_ATTACHMENT_UNUSED) ? &depthReference : nullptr;
+		pass.renderPass->addSubpassDescription(subpassDescription);
+		pass.renderPass->setDimensions(pass.width, pass.height);
+		pass.renderPass->create();
+
+		VkFramebufferCreateInfo framebufferCI = vks::initializers::framebufferCreateInfo();
+		framebufferCI.renderPass = pass.renderPass->handle;
+		framebufferCI.attachmentCount = static_cast<uint32_t>(views.size());
+		framebufferCI.pAttachments = views.data();
+		framebufferCI.width = pass.width;
+		framebufferCI.height = pass.height;
+		framebufferCI.layers = 1;
+		VK_CHECK_RESULT(vkCreateFramebuffer(device->logicalDevice, &framebufferCI, nullptr, &pass.framebuffer));
+	}
+
+	/*
+		Command buffers are recorded once and submitted every frame, so the state at the start of a frame is the state at the end of the frame before
+		Images are in the layout of their last use then, and barriers in front of their first use wait for the last accesses of the previous frame
+	*/
+	void createBarriers() {
+		std::vector<State> states(physicals.size());
+		// The first walk only finds the state at the end of the frame
+		for (int walk = 0; walk < 2; walk++) {
+			const bool record = walk == 1;
+			for (uint32_t i = 0; i < order.size(); i++) {
+				Pass& pass = passes[order[i]];
+				for (auto& usage : pass.usages) {
+					const Resource& resource = resources[usage.resource];
+					State& current = states[resource.physical];
+					const bool first = resource.firstUse == i;
+					const State next = getState(usage, !first);
+					// Nothing to synchronize for reads of an image that's already in the right layout
+					const bool needed = current.layout != next.layout || (current.access & writeAccessMask) || isWrite(usage.type);
+					if (record && current.stages != 0 && needed) {
+						Barrier barrier;
+						barrier.physical = resource.physical;
+						barrier.src = current;
+						// Discard the previous contents on the first write, which allows the transition from any layout
+						if (first) {
+							barrier.src.layout = VK_IMAGE_LAYOUT_UNDEFINED;
+						}
+						barrier.dst = next;
+						pass.barriers.push_back(barrier);
+						pass.srcStages |= current.stages;
+						pass.dstStages |= next.stages;
+						stats.barrierCount++;
+					}
+					if (current.layout == next.layout && !(current.access & writeAccessMask) && !isWrite(usage.type)) {
+						// Multiple reads in a row, later barriers need to wait for all of them
+						current.stages |= next.stages;
+						current.access |= next.access;
+					} else {
+						current = next;
+					}
+				}
+			}
+		}
+	}
+
+	void destroyResources() {
+		for (auto& pass : passes) {
+			if (pass.framebuffer != VK_NULL_HANDLE) {
+				vkDestroyFramebuffer(device->logicalDevice, pass.framebuffer, nullptr);
+				pass.framebuffer = VK_NULL_HANDLE;
+			}
+			delete pass.renderPass;
+			pass.renderPass = nullptr;
+			pass.barriers.clear();
+			pass.srcStages = 0;
+			pass.dstStages = 0;
+		}
+		for (auto& physical : physicals) {
+			delete physical.sampledView;
+			delete physical.view;
+			delete physical.image;
+		}
+		physicals.clear();
+		for (auto& resource : resources) {
+			resource.firstUse = UINT32_MAX;
+			resource.lastUse = 0;
+			resource.physical = UINT32_MAX;
+			resource.usage = 0;
+		}
+		stats = Stats();
+		compiled = false;
+	}
+
+public:
+	RenderGraph(vks::VulkanDevice* device) {
+		this->device = device;
+	}
+	~RenderGraph() {
+		destroyResources();
+	}
+
+	/** @brief Add a transient 2D attachment owned by the graph, the aspect is derived from the format */
+	ResourceHandle addAttachment(const std::string& name, VkFormat format, uint32_t width, uint32_t height) {
+		assert(!compiled);
+		Resource resource;
+		resource.name = name;
+		resource.format = format;
+		resource.width = width;
+		resource.height = height;
+		const bool stencil = (format == VK_FORMAT_D16_UNORM_S8_UINT || format == VK_FORMAT_D24_UNORM_S8_UINT || format == VK_FORMAT_D32_SFLOAT_S8_UINT);
+		const bool depth = stencil || (format == VK_FORMAT_D16_UNORM || format == VK_FORMAT_X8_D24_UNORM_PACK32 || format == VK_FORMAT_D32_SFLOAT);
+		resource.aspectMask = depth ? (VK_IMAGE_ASPECT_DEPTH_BIT | (stencil ? VK_IMAGE_ASPECT_STENCIL_BIT : 0)) : VK_IMAGE_ASPECT_COLOR_BIT;
+		resources.push_back(resource);
+		return static_cast<ResourceHandle>(resources.size() - 1);
+	}
+
+	/**
+	* Add a pass to the graph, passes may be added in any order
+	*
+	* @param name Name of the pass
+	* @param record Function recording the pass, it's called inside the render pass created by the graph
+	* @param contents Set to VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS if the pass executes secondary command buffers
+	*/
+	PassHandle addPass(const std::string& name, RecordFunction record, VkSubpassContents contents = VK_SUBPASS_CONTENTS_INLINE) {
+		assert(!compiled);
+		Pass pass;
+		pass.name = name;
+		pass.record = record;
+		pass.contents = contents;
+		passes.push_back(pass);
+		return static_cast<PassHandle>(passes.size() - 1);
+	}
+
+	/** @brief Add a pass rendering to attachments outside of the graph (e.g. the swap chain), it begins its own render pass and only declares its reads */
+	PassHandle addExternalPass(const std::string& name, RecordFunction record) {
+		PassHandle pass = addPass(name, record);
+		passes[pass].external = true;
+		return pass;
+	}
+
+	void addColorOutput(PassHandle pass, ResourceHandle resource, std::array<float, 4> clearColor = { 0.0f, 0.0f, 0.0f, 0.0f }) {
+		assert(!passes[pass].external);
+		addUsage(pass, resource, usageColorAttachment, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT);
+		VkClearValue value{};
+		memcpy(value.color.float32, clearColor.data(), sizeof(float) * 4);
+		setClearValue(pass, value);
+	}
+
+	void setDepthStencilOutput(PassHandle pass, ResourceHandle resource, float clearDepth = 1.0f, uint32_t clearStencil = 0) {
+		assert(!passes[pass].external);
+		addUsage(pass, resource, usageDepthAttachment, VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT);
+		VkClearValue value{};
+		value.depthStencil = { clearDepth, clearStencil };
+		setClearValue(pass, value);
+	}
+
+	/** @brief Declare an attachment written by another pass to be sampled in the given stages */
+	void addTextureInput(PassHandle pass, ResourceHandle resource, VkPipelineStageFlags stages = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT) {
+		addUsage(pass, resource, usageTexture, stages);
+	}
+
+	/** @brief Order and cull the passes, create the images, render passes and framebuffers and work out the barriers */
+	void compile() {
+		if (compiled) {
+			destroyResources();
+		}
+		sortPasses();
+		allocatePhysicalResources();
+		for (uint32_t i = 0; i < order.size(); i++) {
+			if (!passes[order[i]].external) {
+				createRenderPass(passes[order[i]], i);
+			}
+		}
+		createBarriers();
+		stats.passCount = static_cast<uint32_t>(order.size());
+		compiled = true;
+	}
+
+	/** @brief Change the size of an attachment, the graph has to be compiled again before it's executed */
+	void resizeAttachment(ResourceHandle resource, uint32_t width, uint32_t height) {
+		if (compiled) {
+			destroyResources();
+		}
+		resources[resource].width = width;
+		resources[resource].height = height;
+	}
+
+	/** @brief Record all passes with their barriers into a primary command buffer */
+	void execute(CommandBuffer* commandBuffer, uint32_t imageIndex) {
+		assert(compiled);
+		for (auto handle : order) {
+			Pass& pass = passes[handle];
+			if (!pass.barriers.empty()) {
+				std::vector<VkImageMemoryBarrier> imageBarriers;
+				for (auto& barrier : pass.barriers) {
+					const Physical& physical = physicals[barrier.physical];
+					VkImageMemoryBarrier imageBarrier = vks::initializers::imageMemoryBarrier();
+					imageBarrier.srcAccessMask = barrier.src.access & writeAccessMask;
+					imageBarrier.dstAccessMask = barrier.dst.access;
+					imageBarrier.oldLayout = barrier.src.layout;
+					imageBarrier.newLayout = barrier.dst.layout;
+					imageBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+					imageBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+					imageBarrier.image = physical.image->handle;
+					imageBarrier.subresourceRange = { physical.aspectMask, 0, 1, 0, 1 };
+					imageBarriers.push_back(imageBarrier);
+				}
+				vkCmdPipelineBarrier(commandBuffer->handle, pass.srcStages, pass.dstStages, 0, 0, nullptr, 0, nullptr, static_cast<uint32_t>(imageBarriers.size()), imageBarriers.data());
+			}
+			if (pass.external) {
+				pass.record(commandBuffer, imageIndex);
+				continue;
+			}
+			commandBuffer->beginRenderPass(pass.renderPass, pass.framebuffer, pass.contents);
+			pass.record(commandBuffer, imageIndex);
+			commandBuffer->endRenderPass();
+		}
+	}
+
+	RenderPass* getRenderPass(PassHandle pass) {
+		assert(compiled);
+		return passes[pass].renderPass;
+	}
+	VkFramebuffer getFramebuffer(PassHandle pass) {
+		assert(compiled);
+		return passes[pass].framebuffer;
+	}
+	VkExtent2D getExtent(PassHandle pass) {
+		assert(compiled);
+		return { passes[pass].width, passes[pass].height };
+	}
+	/** @brief View of the image backing an attachment, aliased attachments return the same view */
+	ImageView* getImageView(ResourceHandle resource) {
+		assert(compiled && resources[resource].physical != UINT32_MAX);
+		return physicals[resources[resource].physical].view;
+	}
+	/** @brief View for sampling an attachment, depth/stencil attachments are sampled through a view of their depth aspect */
+	ImageView* getSampledImageView(ResourceHandle resource) {
+		assert(compiled && resources[resource].physical != UINT32_MAX);
+		const Physical& physical = physicals[resources[resource].physical];
+		return physical.sampledView ? physical.sampledView : physical.view;
+	}
+	bool isCulled(PassHandle pass) {
+		assert(compiled);
+		return passes[pass].culled;
+	}
+	const Stats& getStats() {
+		return stats;
+	}
+};
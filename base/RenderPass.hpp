@@ -18,18 +18,19 @@ private:
 	VkDevice device;
 	int32_t width;
 	int32_t height;
-	VkFramebuffer framebuffer;
 	std::vector<VkAttachmentDescription> attachmentDescriptions;
 	std::vector<VkSubpassDependency> subpassDependencies;
 	std::vector<VkSubpassDescription> subpassDescriptions;
 	std::vector<VkClearValue> clearValues;
 public:
-	VkRenderPass handle;
+	VkRenderPass handle = VK_NULL_HANDLE;
 	RenderPass(VkDevice device) {
 		this->device = device;
 	}
 	~RenderPass() {
-		// @todo
+		if (handle != VK_NULL_HANDLE) {
+			vkDestroyRenderPass(device, handle, nullptr);
+		}
 	}
 	void create() {
 		VkRenderPassCreateInfo CI{};
@@ -42,25 +43,16 @@ public:
 		CI.pDependencies = subpassDependencies.data();
 		VK_CHECK_RESULT(vkCreateRenderPass(device, &CI, nullptr, &handle));
 	}
-	VkRenderPassBeginInfo getBeginInfo() {
-		VkRenderPassBeginInfo beginInfo = vks::initializers::renderPassBeginInfo();
-		beginInfo.renderPass = handle;
-		beginInfo.renderArea.offset.x = 0;
-		beginInfo.renderArea.offset.y = 0;
-		beginInfo.framebuffer = framebuffer;
-		beginInfo.renderArea.extent.width = width;
-		beginInfo.renderArea.extent.height = height;
-		beginInfo.clearValueCount = static_cast<uint32_t>(clearValues.size());
-		beginInfo.pClearValues = clearValues.data();
-		return beginInfo;
+	VkExtent2D getExtent() const {
+		return { static_cast<uint32_t>(width), static_cast<uint32_t>(height) };
+	}
+	const std::vector<VkClearValue>& getClearValues() const {
+		return clearValues;
 	}
 	void setDimensions(int32_t width, int32_t height) {
 		this->height = height;
 		this->width = width;
 	}
-	void setFrameBuffer(VkFramebuffer framebuffer) {
-		this->framebuffer = framebuffer;
-	}
 	void setColorClearValue(uint32_t index, std::array<float, 4> values) {
 		if (index + 1 > clearValues.size()) {
 			clearValues.resize(index + 1);
@@ -0,0 +1,307 @@
+/*
+* Asynchronous asset loader
+*
+* Files are read and decoded in parallel on the thread pool's workers, while the calling thread creates the Vulkan resources
+* for every asset as soon as its file is ready and passes the data on to the device's staging uploader
+* Files requested by multiple assets (e.g. a height map used as a texture and for generating the terrain mesh) are only loaded once
+*
+* Copyright (C) by Sascha Willems - www.saschawillems.de
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <functional>
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+#include <assert.h>
+
+#include "vulkan/vulkan.h"
+#include "VulkanDevice.hpp"
+#include "VulkanTexture.hpp"
+#include "VulkanglTFModel.hpp"
+#include "VulkanHeightmap.hpp"
+#include "VulkanTiledTexture.hpp"
+#include "VulkanStagingUploader.hpp"
+#include "threadpool.hpp"
+
+namespace vks
+{
+	class AssetLoader
+	{
+	public:
+		/** @brief Load times of a single asset in milliseconds */
+		struct Timing {
+			std::string name;
+			// Reading and decoding the file on a worker (shared files are only counted for their first user)
+			double decode = 0.0;
+			// Waiting for the file to be decoded on the loading thread
+			double wait = 0.0;
+			// Creating the Vulkan resources and copying the data to staging memory
+			double create = 0.0;
+			// From the end of create until the uploads have finished on the device
+			double upload = 0.0;
+			VkDeviceSize uploadSize = 0;
+		};
+
+	private:
+		enum FileType { fileTypeKTX, fileTypeglTF };
+
+		struct File {
+			std::string filename;
+			FileType type;
+			bool loaded = false;
+			vks::KTXSource ktx;
+			std::unique_ptr<tinygltf::Model> gltf;
+			// Set if a glTF file has an up to date cooked cache, the glTF file itself isn't parsed then
+			std::unique_ptr<vkglTF::cache::CookedModel> cooked;
+			bool useCache = false;
+			float scale = 1.0f;
+			Job* job = nullptr;
+			double decodeTime = 0.0;
+			bool decodeReported = false;
+			// Assets that still need the decoded data
+			uint32_t users = 0;
+		};
+
+		struct Asset {
+			File* file;
+			std::function<void(File&)> create;
+			Timing timing;
+			UploadTicket ticket = 0;
+			std::chrono::high_resolution_clock::time_point created;
+		};
+
+		vks::VulkanDevice* device;
+		VkQueue queue;
+		vks::ThreadPool* threadPool;
+		std::vector<std::unique_ptr<File>> files;
+		std::vector<Asset> assets;
+
+		File* getFile(const std::string& filename, FileType type)
+		{
+			for (auto& file : files) {
+				if (file->filename == filename) {
+					assert(file->type == type);
+					file->users++;
+					return file.get();
+				}
+			}
+			files.push_back(std::unique_ptr<File>(new File()));
+			File* file = files.back().get();
+			file->filename = filename;
+			file->type = type;
+			file->users = 1;
+			return file;
+		}
+
+		// Runs on a worker thread
+		static void decode(File* file)
+		{
+			auto tStart = std::chrono::high_resolution_clock::now();
+			if (file->type == fileTypeKTX) {
+				// Image data stays in the file mapping until it's copied to staging memory, page it in while other files are being decoded
+				file->loaded = file->ktx.load(file->filename);
+				if (file->loaded) {
+					file->ktx.prefetch();
+				}
+			} else {
+				if (file->useCache) {
+					file->cooked.reset(new vkglTF::cache::CookedModel());
+					if (vkglTF::Model::loadCachedFile(file->filename, *file->cooked, file->scale)) {
+						file->loaded = true;
+					} else {
+						file->cooked.reset();
+					}
+				}
+				if (!file->loaded) {
+					file->gltf.reset(new tinygltf::Model());
+					file->loaded = vkglTF::Model::loadglTFFile(file->filename, *file->gltf);
+				}
+			}
+			file->decodeTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - tStart).count();
+		}
+
+		static void release(File& file)
+		{
+			assert(file.users > 0);
+			if (--file.users > 0) {
+				return;
+			}
+			file.ktx.destroy();
+			file.gltf.reset();
+			file.cooked.reset();
+		}
+
+		File* addAsset(const std::string& filename, FileType type, std::function<void(File&)> create)
+		{
+			Asset asset;
+			asset.file = getFile(filename, type);
+			asset.create = create;
+			asset.timing.name = filename.substr(filename.find_last_of("/\\") + 1);
+			assets.push_back(std::move(asset));
+			return assets.back().file;
+		}
+
+	public:
+		/** @brief Timings of all assets from the last call to load() */
+		std::vector<Timing> timings;
+		/** @brief Total time of the last call to load() in milliseconds */
+		double totalTime = 0.0;
+
+		/**
+		* @param device Device to create the assets on, uploads go through its staging uploader
+		* @param queue Queue passed on to the loaders that still need one (e.g. for linear tiled textures)
+		* @param threadPool Pool that decodes the files, the thread calling load() has to be it's main thread
+		*/
+		AssetLoader(vks::VulkanDevice* device, VkQueue queue, vks::ThreadPool* threadPool)
+		{
+			assert(device->stagingUploader);
+			this->device = device;
+			this->queue = queue;
+			this->threadPool = threadPool;
+		}
+
+		void addTexture2D(vks::Texture2D* texture, const std::string& filename, VkFormat format, VkImageUsageFlags imageUsageFlags = VK_IMAGE_USAGE_SAMPLED_BIT, VkImageLayout imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL)
+		{
+			vks::VulkanDevice* device = this->device;
+			VkQueue queue = this->queue;
+			addAsset(filename, fileTypeKTX, [=](File& file) {
+				texture->loadFromKTX(file.ktx, format, device, queue, imageUsageFlags, imageLayout);
+			});
+		}
+
+		void addTexture2DArray(vks::Texture2DArray* texture, const std::string& filename, VkFormat format, VkImageUsageFlags imageUsageFlags = VK_IMAGE_USAGE_SAMPLED_BIT, VkImageLayout imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL)
+		{
+			vks::VulkanDevice* device = this->device;
+			VkQueue queue = this->queue;
+			addAsset(filename, fileTypeKTX, [=](File& file) {
+				texture->loadFromKTX(file.ktx, format, device, queue, imageUsageFlags, imageLayout);
+			});
+		}
+
+		void addTextureCubeMap(vks::TextureCubeMap* texture, const std::string& filename, VkFormat format, VkImageUsageFlags imageUsageFlags = VK_IMAGE_USAGE_SAMPLED_BIT, VkImageLayout imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL)
+		{
+			vks::VulkanDevice* device = this->device;
+			VkQueue queue = this->queue;
+			addAsset(filename, fileTypeKTX, [=](File& file) {
+				texture->loadFromKTX(file.ktx, format, device, queue, imageUsageFlags, imageLayout);
+			});
+		}
+
+		/** @brief If useCache is set, the model is loaded from its cooked cache if it's up to date, otherwise the cache is written after parsing the glTF file */
+		void addModel(vkglTF::Model* model, const std::string& filename, float scale = 1.0f, bool useCache = true)
+		{
+			vks::VulkanDevice* device = this->device;
+			VkQueue queue = this->queue;
+			File* modelFile = addAsset(filename, fileTypeglTF, [=](File& file) {
+				if (file.cooked) {
+					model->loadFromCookedModel(*file.cooked, device, queue);
+				} else {
+					model->loadFromglTFModel(*file.gltf, device, queue, scale, useCache ? filename : "");
+				}
+			});
+			// The cache depends on the scale, so models sharing a file need to agree on it
+			assert(modelFile->users == 1 || (modelFile->useCache == useCache && modelFile->scale == scale));
+			modelFile->useCache = useCache;
+			modelFile->scale = scale;
+		}
+
+		/** @brief The height map is built once its file has been loaded, setup (thread pool, index cache, vertex format) has to be done before calling load() */
+		void addHeightMap(vks::HeightMap* heightMap, const std::string& filename, uint32_t patchsize, glm::vec3 scale, vks::HeightMap::Topology topology)
+		{
+			addAsset(filename, fileTypeKTX, [=](File& file) {
+				heightMap->loadFromKTX(file.ktx, patchsize, scale, topology);
+			});
+		}
+
+		/** @brief The tile file is cooked from the KTX file if it's missing or outdated, only the coarse level is loaded in full into coarseTexture */
+		void addTiledTexture(vks::TiledTexture* texture, vks::Texture2D* coarseTexture, const std::string& filename, VkFormat format, uint32_t coarseSize)
+		{
+			addAsset(filename, fileTypeKTX, [=](File& file) {
+				texture->loadFromKTX(file.ktx, filename, format, coarseSize, *coarseTexture);
+			});
+		}
+
+		/**
+		* Load all assets added since the last call and wait for their uploads to finish
+		* Assets are created in the order their files finish decoding, so they must not depend on each other
+		*/
+		void load()
+		{
+			auto tStart = std::chrono::high_resolution_clock::now();
+			StagingUploader* uploader = device->stagingUploader;
+
+			for (auto& file : files) {
+				File* f = file.get();
+				file->job = threadPool->createJob([f]() { decode(f); });
+				threadPool->run(file->job);
+			}
+
+			// Create assets on this thread as soon as their files are ready, helping out with decoding while waiting
+			std::vector<Asset*> pending;
+			for (auto& asset : assets) {
+				pending.push_back(&asset);
+			}
+			while (!pending.empty()) {
+				auto it = std::find_if(pending.begin(), pending.end(), [this](Asset* asset) { return threadPool->finished(asset->file->job); });
+				auto tWait = std::chrono::high_resolution_clock::now();
+				if (it == pending.end()) {
+					it = pending.begin();
+					threadPool->wait((*it)->file->job);
+				}
+				Asset& asset = **it;
+				pending.erase(it);
+				File& file = *asset.file;
+				auto tCreate = std::chrono::high_resolution_clock::now();
+				asset.timing.wait = std::chrono::duration<double, std::milli>(tCreate - tWait).count();
+				if (!file.decodeReported) {
+					asset.timing.decode = file.decodeTime;
+					file.decodeReported = true;
+				}
+				if (!file.loaded) {
+					vks::tools::exitFatal("Could not load asset from " + file.filename, -1);
+				}
+				const VkDeviceSize uploadedBefore = uploader->stats.bytesUploaded;
+				asset.create(file);
+				// Submitting right away lets the device copy this asset while the next ones are still being decoded
+				asset.ticket = uploader->submit();
+				asset.created = std::chrono::high_resolution_clock::now();
+				asset.timing.create = std::chrono::duration<double, std::milli>(asset.created - tCreate).count();
+				asset.timing.uploadSize = uploader->stats.bytesUploaded - uploadedBefore;
+				release(file);
+			}
+
+			// Assets are submitted in creation order, so their uploads also finish in that order
+			std::sort(assets.begin(), assets.end(), [](const Asset& a, const Asset& b) { return a.ticket < b.ticket; });
+			for (auto& asset : assets) {
+				uploader->wait(asset.ticket);
+				asset.timing.upload = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - asset.created).count();
+			}
+
+			totalTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - tStart).count();
+			timings.clear();
+			for (auto& asset : assets) {
+				timings.push_back(asset.timing);
+			}
+			assets.clear();
+			files.clear();
+		}
+
+		/** @brief Print the timings of the last call to load() */
+		void printTimings()
+		{
+			std::cout << "Loaded " << timings.size() << " assets on " << threadPool->getWorkerCount() << " threads in " << std::fixed << std::setprecision(2) << totalTime << " ms" << std::endl;
+			std::cout << "  decode / wait / create / upload (ms), staged MB" << std::endl;
+			for (auto& timing : timings) {
+				std::cout << "  " << timing.name << ": " << timing.decode << " / " << timing.wait << " / " << timing.create << " / " << timing.upload << ", " << timing.uploadSize / (1024.0 * 1024.0) << std::endl;
+			}
+		}
+	};
+}
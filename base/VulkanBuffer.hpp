@@ -14,6 +14,7 @@
 
 #include "vulkan/vulkan.h"
 #include "VulkanTools.h"
+#include "VulkanMemoryAllocator.hpp"
 
 namespace vks
 {	
@@ -26,6 +27,9 @@ namespace vks
 		VkDevice device;
 		VkBuffer buffer = VK_NULL_HANDLE;
 		VkDeviceMemory memory = VK_NULL_HANDLE;
+		/** @brief Sub allocation backing the buffer, the buffer owns its memory if no allocator is set */
+		vks::Allocation allocation;
+		vks::MemoryAllocator* allocator = nullptr;
 		VkDescriptorBufferInfo descriptor;
 		VkDeviceSize size = 0;
 		VkDeviceSize alignment = 0;
@@ -46,7 +50,13 @@ namespace vks
 		*/
 		VkResult map(VkDeviceSize size = VK_WHOLE_SIZE, VkDeviceSize offset = 0)
 		{
-			return vkMapMemory(device, memory, offset, size, 0, &mapped);
+			// Sub allocated host visible memory is persistently mapped by the allocator
+			if (allocation.mapped)
+			{
+				mapped = static_cast<uint8_t*>(allocation.mapped) + offset;
+				return VK_SUCCESS;
+			}
+			return vkMapMemory(device, memory, allocation.offset + offset, size, 0, &mapped);
 		}
 
 		/**
@@ -58,7 +68,10 @@ namespace vks
 		{
 			if (mapped)
 			{
-				vkUnmapMemory(device, memory);
+				if (!allocation.mapped)
+				{
+					vkUnmapMemory(device, memory);
+				}
 				mapped = nullptr;
 			}
 		}
@@ -72,7 +85,7 @@ namespace vks
 		*/
 		VkResult bind(VkDeviceSize offset = 0)
 		{
-			return vkBindBufferMemory(device, buffer, memory, offset);
+			return vkBindBufferMemory(device, buffer, memory, allocation.offset + offset);
 		}
 
 		/**
@@ -117,8 +130,9 @@ namespace vks
 			VkMappedMemoryRange mappedRange = {};
 			mappedRange.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
 			mappedRange.memory = memory;
-			mappedRange.offset = offset;
-			mappedRange.size = size;
+			mappedRange.offset = allocation.offset + offset;
+			// The whole size of a sub allocation must not reach into the rest of the block
+			mappedRange.size = (size == VK_WHOLE_SIZE && allocation.block) ? allocation.size - offset : size;
 			return vkFlushMappedMemoryRanges(device, 1, &mappedRange);
 		}
 
@@ -137,8 +151,9 @@ namespace vks
 			VkMappedMemoryRange mappedRange = {};
 			mappedRange.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
 			mappedRange.memory = memory;
-			mappedRange.offset = offset;
-			mappedRange.size = size;
+			mappedRange.offset = allocation.offset + offset;
+			// The whole size of a sub allocation must not reach into the rest of the block
+			mappedRange.size = (size == VK_WHOLE_SIZE && allocation.block) ? allocation.size - offset : size;
 			return vkInvalidateMappedMemoryRanges(device, 1, &mappedRange);
 		}
 
@@ -151,10 +166,16 @@ namespace vks
 			{
 				vkDestroyBuffer(device, buffer, nullptr);
 			}
-			if (memory)
+			if (allocator)
+			{
+				allocator->free(allocation);
+			}
+			else if (memory)
 			{
 				vkFreeMemory(device, memory, nullptr);
 			}
+			memory = VK_NULL_HANDLE;
+			mapped = nullptr;
 		}
 
 	};
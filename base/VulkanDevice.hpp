@@ -16,9 +16,12 @@
 #include "vulkan/vulkan.h"
 #include "VulkanTools.h"
 #include "VulkanBuffer.hpp"
+#include "VulkanMemoryAllocator.hpp"
 
 namespace vks
 {	
+	class StagingUploader;
+
 	struct VulkanDevice
 	{
 		/** @brief Physical device representation */
@@ -38,6 +41,12 @@ namespace vks
 		/** @brief List of extensions supported by the device */
 		std::vector<std::string> supportedExtensions;
 
+		/** @brief Sub allocator used for all buffer and image memory created through the device */
+		vks::MemoryAllocator* memoryAllocator = nullptr;
+
+		/** @brief Uploader for staged buffer and image copies used by the resource loaders (not owned, set up by the application) */
+		vks::StagingUploader* stagingUploader = nullptr;
+
 		/** @brief Default command pool for the graphics queue family index */
 		VkCommandPool commandPool = VK_NULL_HANDLE;
 
@@ -106,6 +115,7 @@ namespace vks
 			{
 				vkDestroyCommandPool(logicalDevice, commandPool, nullptr);
 			}
+			delete memoryAllocator;
 			if (logicalDevice)
 			{
 				vkDestroyDevice(logicalDevice, nullptr);
@@ -328,6 +338,7 @@ namespace vks
 			{
 				// Create a default command pool for graphics command buffers
 				commandPool = createCommandPool(queueFamilyIndices.graphics);
+				memoryAllocator = new vks::MemoryAllocator(physicalDevice, logicalDevice);
 			}
 
 			this->enabledFeatures = enabledFeatures;
@@ -335,6 +346,83 @@ namespace vks
 			return result;
 		}
 
+		/**
+		* Sub allocate memory from the device's memory allocator
+		*
+		* @param memReqs Memory requirements of the resource
+		* @param memoryPropertyFlags Memory properties for the allocation (i.e. device local, host visible, coherent)
+		* @param tiling Linear for buffers and linear tiled images, optimal for optimal tiled images
+		* @param dedicated (Optional) Force a dedicated device memory allocation
+		*/
+		vks::Allocation allocateMemory(const VkMemoryRequirements& memReqs, VkMemoryPropertyFlags memoryPropertyFlags, vks::AllocationTiling tiling, bool dedicated = false)
+		{
+			assert(memoryAllocator);
+			return memoryAllocator->allocate(memReqs, getMemoryType(memReqs.memoryTypeBits, memoryPropertyFlags), tiling, dedicated);
+		}
+
+		/** @brief Allocate and bind the memory for a buffer */
+		vks::Allocation allocateBufferMemory(VkBuffer buffer, VkMemoryPropertyFlags memoryPropertyFlags)
+		{
+			VkMemoryRequirements memReqs;
+			vkGetBufferMemoryRequirements(logicalDevice, buffer, &memReqs);
+			vks::Allocation allocation = allocateMemory(memReqs, memoryPropertyFlags, vks::allocationTilingLinear);
+			VK_CHECK_RESULT(vkBindBufferMemory(logicalDevice, buffer, allocation.memory, allocation.offset));
+			return allocation;
+		}
+
+		/** @brief Allocate and bind the memory for an image, large images get a dedicated allocation */
+		vks::Allocation allocateImageMemory(VkImage image, VkMemoryPropertyFlags memoryPropertyFlags, VkImageTiling tiling = VK_IMAGE_TILING_OPTIMAL)
+		{
+			VkMemoryRequirements memReqs;
+			vkGetImageMemoryRequirements(logicalDevice, image, &memReqs);
+			const bool dedicated = memReqs.size >= memoryAllocator->dedicatedImageSize;
+			vks::Allocation allocation = allocateMemory(memReqs, memoryPropertyFlags, tiling == VK_IMAGE_TILING_OPTIMAL ? vks::allocationTilingOptimal : vks::allocationTilingLinear, dedicated);
+			VK_CHECK_RESULT(vkBindImageMemory(logicalDevice, image, allocation.memory, allocation.offset));
+			return allocation;
+		}
+
+		/** @brief Return memory allocated via allocateMemory to the allocator */
+		void freeMemory(vks::Allocation& allocation)
+		{
+			memoryAllocator->free(allocation);
+		}
+
+		/**
+		* Create a buffer on the device backed by sub allocated memory
+		*
+		* @param usageFlags Usage flag bitmask for the buffer (i.e. index, vertex, uniform buffer)
+		* @param memoryPropertyFlags Memory properties for this buffer (i.e. device local, host visible, coherent)
+		* @param size Size of the buffer in byes
+		* @param buffer Pointer to the buffer handle acquired by the function
+		* @param allocation Pointer to the allocation acquired by the function, has to be released with freeMemory
+		* @param data Pointer to the data that should be copied to the buffer after creation (optional, if not set, no data is copied over)
+		*
+		* @return VK_SUCCESS if buffer handle and memory have been created and (optionally passed) data has been copied
+		*/
+		VkResult createBuffer(VkBufferUsageFlags usageFlags, VkMemoryPropertyFlags memoryPropertyFlags, VkDeviceSize size, VkBuffer *buffer, vks::Allocation *allocation, void *data = nullptr)
+		{
+			VkBufferCreateInfo bufferCreateInfo = vks::initializers::bufferCreateInfo(usageFlags, size);
+			bufferCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+			VK_CHECK_RESULT(vkCreateBuffer(logicalDevice, &bufferCreateInfo, nullptr, buffer));
+			*allocation = allocateBufferMemory(*buffer, memoryPropertyFlags);
+
+			if (data != nullptr)
+			{
+				assert(allocation->mapped);
+				memcpy(allocation->mapped, data, size);
+				if ((memoryPropertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) == 0)
+				{
+					VkMappedMemoryRange mappedRange = vks::initializers::mappedMemoryRange();
+					mappedRange.memory = allocation->memory;
+					mappedRange.offset = allocation->offset;
+					mappedRange.size = allocation->size;
+					vkFlushMappedMemoryRanges(logicalDevice, 1, &mappedRange);
+				}
+			}
+
+			return VK_SUCCESS;
+		}
+
 		/**
 		* Create a buffer on the device
 		*
@@ -406,17 +494,15 @@ namespace vks
 			VkBufferCreateInfo bufferCreateInfo = vks::initializers::bufferCreateInfo(usageFlags, size);
 			VK_CHECK_RESULT(vkCreateBuffer(logicalDevice, &bufferCreateInfo, nullptr, &buffer->buffer));
 
-			// Create the memory backing up the buffer handle
+			// Sub allocate the memory backing up the buffer handle
 			VkMemoryRequirements memReqs;
-			VkMemoryAllocateInfo memAlloc = vks::initializers::memoryAllocateInfo();
 			vkGetBufferMemoryRequirements(logicalDevice, buffer->buffer, &memReqs);
-			memAlloc.allocationSize = memReqs.size;
-			// Find a memory type index that fits the properties of the buffer
-			memAlloc.memoryTypeIndex = getMemoryType(memReqs.memoryTypeBits, memoryPropertyFlags);
-			VK_CHECK_RESULT(vkAllocateMemory(logicalDevice, &memAlloc, nullptr, &buffer->memory));
+			buffer->allocator = memoryAllocator;
+			buffer->allocation = allocateMemory(memReqs, memoryPropertyFlags, vks::allocationTilingLinear);
+			buffer->memory = buffer->allocation.memory;
 
 			buffer->alignment = memReqs.alignment;
-			buffer->size = memAlloc.allocationSize;
+			buffer->size = memReqs.size;
 			buffer->usageFlags = usageFlags;
 			buffer->memoryPropertyFlags = memoryPropertyFlags;
 
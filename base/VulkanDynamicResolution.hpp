@@ -0,0 +1,91 @@
+/*
+* Dynamic resolution controller
+*
+* Picks a render target scale from a fixed set of levels based on the measured GPU frame time
+* The frame time is smoothed and level changes are rate limited, as switching levels causes a short stall (render targets are swapped and command buffers re-recorded)
+*
+* Copyright (C) by Sascha Willems - www.saschawillems.de
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <vector>
+#include <assert.h>
+#include <stdint.h>
+
+namespace vks
+{
+	class DynamicResolution
+	{
+	private:
+		std::vector<float> scales;
+		uint32_t level = 0;
+		float smoothedTime = 0.0f;
+		uint32_t samples = 0;
+		uint32_t framesSinceChange = 0;
+
+	public:
+		bool enabled = false;
+		/** @brief GPU frame time in milliseconds the controller tries to stay below */
+		float targetTime = 16.6f;
+		/** @brief The resolution is only increased again if the frame time is below this fraction of the target */
+		float increaseThreshold = 0.75f;
+		/** @brief Minimum number of frames between two level changes */
+		uint32_t cooldownFrames = 60;
+
+		/** @param scales Scale of each level, in descending order starting with the full resolution */
+		DynamicResolution(const std::vector<float>& scales = { 1.0f, 0.75f, 0.5f, 0.375f })
+		{
+			assert(!scales.empty());
+			this->scales = scales;
+		}
+
+		/**
+		* Feed the GPU time of a frame to the controller
+		*
+		* @param frameTime GPU frame time in milliseconds
+		*
+		* @return True if the level has changed and the render targets of the new level have to be used
+		*/
+		bool update(float frameTime)
+		{
+			// Exponential moving average, filters out single slow frames
+			smoothedTime = (samples == 0) ? frameTime : smoothedTime * 0.9f + frameTime * 0.1f;
+			samples++;
+			framesSinceChange++;
+			if (!enabled || framesSinceChange < cooldownFrames) {
+				return false;
+			}
+			uint32_t newLevel = level;
+			if (smoothedTime > targetTime && level + 1 < scales.size()) {
+				newLevel++;
+			}
+			if (smoothedTime < targetTime * increaseThreshold && level > 0) {
+				newLevel--;
+			}
+			return setLevel(newLevel);
+		}
+
+		/** @brief Select a level directly, returns true if it differs from the current level */
+		bool setLevel(uint32_t newLevel)
+		{
+			assert(newLevel < scales.size());
+			if (newLevel == level) {
+				return false;
+			}
+			level = newLevel;
+			framesSinceChange = 0;
+			// Times measured at the old level don't apply to the new one
+			samples = 0;
+			return true;
+		}
+
+		uint32_t getLevel() const { return level; }
+		uint32_t getLevelCount() const { return static_cast<uint32_t>(scales.size()); }
+		float getScale(uint32_t level) const { return scales[level]; }
+		float getScale() const { return scales[level]; }
+		float getSmoothedTime() const { return smoothedTime; }
+	};
+}
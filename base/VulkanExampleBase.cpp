@@ -25,24 +25,27 @@ VkResult VulkanExampleBase::createInstance(bool enableValidation)
 	appInfo.pEngineName = name.c_str();
 	appInfo.apiVersion = apiVersion;
 
-	std::vector<const char*> instanceExtensions = { VK_KHR_SURFACE_EXTENSION_NAME };
+	std::vector<const char*> instanceExtensions;
 
-	// Enable surface extensions depending on os
+	// Enable surface extensions depending on os, headless rendering doesn't need a surface
+	if (!settings.headless) {
+		instanceExtensions.push_back(VK_KHR_SURFACE_EXTENSION_NAME);
 #if defined(_WIN32)
-	instanceExtensions.push_back(VK_KHR_WIN32_SURFACE_EXTENSION_NAME);
+		instanceExtensions.push_back(VK_KHR_WIN32_SURFACE_EXTENSION_NAME);
 #elif defined(VK_USE_PLATFORM_ANDROID_KHR)
-	instanceExtensions.push_back(VK_KHR_ANDROID_SURFACE_EXTENSION_NAME);
+		instanceExtensions.push_back(VK_KHR_ANDROID_SURFACE_EXTENSION_NAME);
 #elif defined(_DIRECT2DISPLAY)
-	instanceExtensions.push_back(VK_KHR_DISPLAY_EXTENSION_NAME);
+		instanceExtensions.push_back(VK_KHR_DISPLAY_EXTENSION_NAME);
 #elif defined(VK_USE_PLATFORM_WAYLAND_KHR)
-	instanceExtensions.push_back(VK_KHR_WAYLAND_SURFACE_EXTENSION_NAME);
+		instanceExtensions.push_back(VK_KHR_WAYLAND_SURFACE_EXTENSION_NAME);
 #elif defined(VK_USE_PLATFORM_XCB_KHR)
-	instanceExtensions.push_back(VK_KHR_XCB_SURFACE_EXTENSION_NAME);
+		instanceExtensions.push_back(VK_KHR_XCB_SURFACE_EXTENSION_NAME);
 #elif defined(VK_USE_PLATFORM_IOS_MVK)
-	instanceExtensions.push_back(VK_MVK_IOS_SURFACE_EXTENSION_NAME);
+		instanceExtensions.push_back(VK_MVK_IOS_SURFACE_EXTENSION_NAME);
 #elif defined(VK_USE_PLATFORM_MACOS_MVK)
-	instanceExtensions.push_back(VK_MVK_MACOS_SURFACE_EXTENSION_NAME);
+		instanceExtensions.push_back(VK_MVK_MACOS_SURFACE_EXTENSION_NAME);
 #endif
+	}
 
 	if (enabledInstanceExtensions.size() > 0) {
 		for (auto enabledExtension : enabledInstanceExtensions) {
@@ -54,12 +57,12 @@ VkResult VulkanExampleBase::createInstance(bool enableValidation)
 	instanceCreateInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
 	instanceCreateInfo.pNext = NULL;
 	instanceCreateInfo.pApplicationInfo = &appInfo;
+	if (settings.validation)
+	{
+		instanceExtensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
+	}
 	if (instanceExtensions.size() > 0)
 	{
-		if (settings.validation)
-		{
-			instanceExtensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
-		}
 		instanceCreateInfo.enabledExtensionCount = (uint32_t)instanceExtensions.size();
 		instanceCreateInfo.ppEnabledExtensionNames = instanceExtensions.data();
 	}
@@ -181,11 +184,24 @@ void VulkanExampleBase::flushCommandBuffer(VkCommandBuffer commandBuffer, VkQueu
 
 void VulkanExampleBase::createPipelineCache()
 {
+	if (settings.persistentPipelineCache) {
+		pipelineCache = vks::pipelinecache::create(device, deviceProperties, vks::pipelinecache::getDefaultFilename());
+		return;
+	}
 	VkPipelineCacheCreateInfo pipelineCacheCreateInfo = {};
 	pipelineCacheCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
 	VK_CHECK_RESULT(vkCreatePipelineCache(device, &pipelineCacheCreateInfo, nullptr, &pipelineCache));
 }
 
+void VulkanExampleBase::savePipelineCache()
+{
+	if (settings.persistentPipelineCache && pipelineCache != VK_NULL_HANDLE) {
+		if (!vks::pipelinecache::save(device, pipelineCache, deviceProperties, vks::pipelinecache::getDefaultFilename())) {
+			std::cerr << "Could not store pipeline cache" << std::endl;
+		}
+	}
+}
+
 void VulkanExampleBase::prepare()
 {
 	if (vulkanDevice->enableDebugMarkers) {
@@ -200,7 +216,8 @@ void VulkanExampleBase::prepare()
 	setupRenderPass();
 	createPipelineCache();
 	setupFrameBuffer();
-	settings.overlay = settings.overlay && (!benchmark.active);
+	// The overlay shows timings and would make headless frames differ between runs
+	settings.overlay = settings.overlay && (!benchmark.active) && (!settings.headless);
 	if (settings.overlay) {
 		UIOverlay.device = vulkanDevice;
 		UIOverlay.queue = queue;
@@ -208,8 +225,19 @@ void VulkanExampleBase::prepare()
 			loadShader(getAssetPath() + "shaders/base/uioverlay.vert.spv", VK_SHADER_STAGE_VERTEX_BIT),
 			loadShader(getAssetPath() + "shaders/base/uioverlay.frag.spv", VK_SHADER_STAGE_FRAGMENT_BIT),
 		};
+		// Indirect draws with clip rects selected by their first instance
+		if (vulkanDevice->enabledFeatures.drawIndirectFirstInstance && vks::tools::fileExists(getAssetPath() + "shaders/base/uioverlay_indirect.vert.spv")) {
+			UIOverlay.indirectShaders = {
+				loadShader(getAssetPath() + "shaders/base/uioverlay_indirect.vert.spv", VK_SHADER_STAGE_VERTEX_BIT),
+				loadShader(getAssetPath() + "shaders/base/uioverlay_indirect.frag.spv", VK_SHADER_STAGE_FRAGMENT_BIT),
+			};
+		}
 		UIOverlay.prepareResources();
 		UIOverlay.preparePipeline(pipelineCache, renderPass->handle);
+		if (!UIOverlay.indirect()) {
+			setupOverlayRenderPass();
+			UIOverlay.renderPass = overlayRenderPass->handle;
+		}
 	}
 }
 
@@ -218,11 +246,7 @@ VkPipelineShaderStageCreateInfo VulkanExampleBase::loadShader(std::string fileNa
 	VkPipelineShaderStageCreateInfo shaderStage = {};
 	shaderStage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
 	shaderStage.stage = stage;
-#if defined(VK_USE_PLATFORM_ANDROID_KHR)
-	shaderStage.module = vks::tools::loadShader(androidApp->activity->assetManager, fileName.c_str(), device);
-#else
-	shaderStage.module = vks::tools::loadShader(fileName.c_str(), device);
-#endif
+	shaderStage.module = vks::ShaderModuleCache::get().acquire(device, fileName);
 	shaderStage.pName = "main"; // todo : make param
 	assert(shaderStage.module != VK_NULL_HANDLE);
 	shaderModules.push_back(shaderStage.module);
@@ -262,7 +286,7 @@ void VulkanExampleBase::renderFrame()
 	{
 		lastFPS = static_cast<uint32_t>((float)frameCounter * (1000.0f / fpsTimer));
 #if defined(_WIN32)
-		if (!settings.overlay)	{
+		if (!settings.overlay && !settings.headless)	{
 			std::string windowTitle = getWindowTitle();
 			SetWindowText(window, windowTitle.c_str());
 		}
@@ -277,11 +301,26 @@ void VulkanExampleBase::renderFrame()
 void VulkanExampleBase::renderLoop()
 {
 	if (benchmark.active) {
+		benchmark.setCamera = [this](const glm::vec3& position, const glm::vec3& rotation) {
+			camera.setPosition(position);
+			camera.setRotation(rotation);
+		};
 		benchmark.run([=] { render(); }, vulkanDevice->properties);
 		vkDeviceWaitIdle(device);
 		if (benchmark.filename != "") {
 			benchmark.saveResults();
 		}
+		if (benchmark.jsonFilename != "") {
+			benchmark.saveJsonResults();
+		}
+		if (settings.headless && (settings.headlessScreenshot != "")) {
+			saveScreenshot(settings.headlessScreenshot);
+		}
+		return;
+	}
+
+	if (settings.headless) {
+		headlessRenderLoop();
 		return;
 	}
 
@@ -563,13 +602,96 @@ void VulkanExampleBase::renderLoop()
 	}
 }
 
+void VulkanExampleBase::headlessRenderLoop()
+{
+#if defined(_WIN32)
+	AttachConsole(ATTACH_PARENT_PROCESS);
+	FILE* stream;
+	freopen_s(&stream, "CONOUT$", "w+", stdout);
+	freopen_s(&stream, "CONOUT$", "w+", stderr);
+#endif
+	lastTimestamp = std::chrono::high_resolution_clock::now();
+	auto tStart = std::chrono::high_resolution_clock::now();
+	for (uint32_t i = 0; i < settings.headlessFrames; i++) {
+		renderFrame();
+	}
+	// Frames still in flight count towards the throughput
+	vkDeviceWaitIdle(device);
+	const double runtime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - tStart).count();
+
+	std::cout << std::fixed << std::setprecision(3);
+	std::cout << "Headless run finished" << std::endl;
+	std::cout << "device : " << deviceProperties.deviceName << " (driver version: " << deviceProperties.driverVersion << ")" << std::endl;
+	std::cout << "size   : " << width << "x" << height << std::endl;
+	std::cout << "frames : " << settings.headlessFrames << std::endl;
+	std::cout << "runtime: " << (runtime / 1000.0) << std::endl;
+	std::cout << "fps    : " << settings.headlessFrames / (runtime / 1000.0) << std::endl;
+	std::cout << "frame  : " << runtime / settings.headlessFrames << " ms" << std::endl;
+
+	if (settings.headlessScreenshot != "") {
+		saveScreenshot(settings.headlessScreenshot);
+	}
+}
+
+void VulkanExampleBase::saveScreenshot(const std::string& filename)
+{
+	// The last submitted image has to be finished and in the render pass' final layout (transfer source in headless mode)
+	assert(settings.headless);
+	vkDeviceWaitIdle(device);
+
+	const VkDeviceSize size = width * height * 4;
+	vks::Buffer buffer;
+	VK_CHECK_RESULT(vulkanDevice->createBuffer(VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &buffer, size));
+
+	VkCommandBuffer copyCmd = createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
+	VkBufferImageCopy copyRegion{};
+	copyRegion.imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
+	copyRegion.imageExtent = { width, height, 1 };
+	vkCmdCopyImageToBuffer(copyCmd, swapChain.images[currentBuffer], VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, buffer.buffer, 1, &copyRegion);
+	flushCommandBuffer(copyCmd, queue, true);
+
+	VK_CHECK_RESULT(buffer.map());
+	std::ofstream file(filename, std::ios::out | std::ios::binary);
+	if (!file.is_open()) {
+		std::cerr << "Could not write screenshot to \"" << filename << "\"" << std::endl;
+	} else {
+		file << "P6\n" << width << "\n" << height << "\n" << 255 << "\n";
+		// PPM stores RGB, BGR formats need to be swizzled
+		const std::vector<VkFormat> formatsBGR = { VK_FORMAT_B8G8R8A8_SRGB, VK_FORMAT_B8G8R8A8_UNORM, VK_FORMAT_B8G8R8A8_SNORM };
+		const bool swizzle = (std::find(formatsBGR.begin(), formatsBGR.end(), swapChain.colorFormat) != formatsBGR.end());
+		const uint8_t* data = static_cast<const uint8_t*>(buffer.mapped);
+		std::vector<uint8_t> row(width * 3);
+		for (uint32_t y = 0; y < height; y++) {
+			for (uint32_t x = 0; x < width; x++) {
+				const uint8_t* pixel = data + (y * width + x) * 4;
+				row[x * 3 + 0] = pixel[swizzle ? 2 : 0];
+				row[x * 3 + 1] = pixel[1];
+				row[x * 3 + 2] = pixel[swizzle ? 0 : 2];
+			}
+			file.write(reinterpret_cast<const char*>(row.data()), row.size());
+		}
+		std::cout << "Screenshot saved to \"" << filename << "\"" << std::endl;
+	}
+	buffer.unmap();
+	buffer.destroy();
+}
+
 void VulkanExampleBase::updateOverlay()
 {
 	if (!settings.overlay)
 		return;
 
+	VKS_ZONE("UI overlay update");
 	ImGuiIO& io = ImGui::GetIO();
 
+	// Widgets may rebuild the command buffers from within the overlay, which is only safe once no frame is in flight
+	// Widgets only change while they are clicked or dragged, so the frames are only waited for while the mouse interacts with the overlay
+	const bool mouseDown = mouseButtons.left || mouseButtons.right;
+	if (!recordPerFrame && io.WantCaptureMouse && (mouseDown || overlayMouseDown)) {
+		VK_CHECK_RESULT(vkWaitForFences(device, static_cast<uint32_t>(waitFences.size()), waitFences.data(), VK_TRUE, UINT64_MAX));
+	}
+	overlayMouseDown = mouseDown;
+
 	io.DisplaySize = ImVec2((float)width, (float)height);
 	io.DeltaTime = frameTimer;
 
@@ -601,7 +723,8 @@ void VulkanExampleBase::updateOverlay()
 	ImGui::PopStyleVar();
 	ImGui::Render();
 
-	if (UIOverlay.update() || UIOverlay.updated) {
+	// The overlay's buffers are updated in prepareFrame once the next image's previous frame has finished
+	if (UIOverlay.updated) {
 		buildCommandBuffers();
 		UIOverlay.updated = false;
 	}
@@ -613,7 +736,7 @@ void VulkanExampleBase::updateOverlay()
 #endif
 }
 
-void VulkanExampleBase::drawUI(const VkCommandBuffer commandBuffer)
+void VulkanExampleBase::drawUI(const VkCommandBuffer commandBuffer, uint32_t imageIndex)
 {
 	if (settings.overlay) {
 		const VkViewport viewport = vks::initializers::viewport((float)width, (float)height, 0.0f, 1.0f);
@@ -621,14 +744,33 @@ void VulkanExampleBase::drawUI(const VkCommandBuffer commandBuffer)
 		vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
 		vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
 
-		UIOverlay.draw(commandBuffer);
+		UIOverlay.draw(commandBuffer, imageIndex);
+	}
+}
+
+void VulkanExampleBase::addUICommandBuffer(std::vector<VkCommandBuffer>& submitCommandBuffers, uint32_t imageIndex)
+{
+	if (settings.overlay) {
+		const VkCommandBuffer commandBuffer = UIOverlay.getCommandBuffer(imageIndex);
+		if (commandBuffer != VK_NULL_HANDLE) {
+			submitCommandBuffers.push_back(commandBuffer);
+		}
 	}
 }
 
 void VulkanExampleBase::prepareFrame()
 {
+	// Wait until the GPU has finished the last submission using this frame's semaphores and fence
+	{
+		VKS_ZONE("Frame fence wait");
+		VK_CHECK_RESULT(vkWaitForFences(device, 1, &waitFences[currentFrame], VK_TRUE, UINT64_MAX));
+	}
 	// Acquire the next image from the swap chain
-	VkResult result = swapChain.acquireNextImage(semaphores.presentComplete, &currentBuffer);
+	VkResult result;
+	{
+		VKS_ZONE("Acquire");
+		result = swapChain.acquireNextImage(semaphores.presentComplete[currentFrame], &currentBuffer);
+	}
 	// Recreate the swapchain if it's no longer compatible with the surface (OUT_OF_DATE) or no longer optimal for presentation (SUBOPTIMAL)
 	if ((result == VK_ERROR_OUT_OF_DATE_KHR) || (result == VK_SUBOPTIMAL_KHR)) {
 		windowResize();
@@ -636,11 +778,37 @@ void VulkanExampleBase::prepareFrame()
 	else {
 		VK_CHECK_RESULT(result);
 	}
+	// Command buffers and uniform buffers are per swap chain image, so an older frame may still be using them
+	if (imagesInFlight[currentBuffer] != VK_NULL_HANDLE) {
+		VKS_ZONE("Image fence wait");
+		VK_CHECK_RESULT(vkWaitForFences(device, 1, &imagesInFlight[currentBuffer], VK_TRUE, UINT64_MAX));
+	}
+	// The overlay's buffers for this image are no longer in use either
+	if (settings.overlay && UIOverlay.update(currentBuffer, frameBuffers[currentBuffer]) && !recordPerFrame) {
+		// Reallocated buffers have to be recorded into the command buffers of all images
+		VK_CHECK_RESULT(vkWaitForFences(device, static_cast<uint32_t>(waitFences.size()), waitFences.data(), VK_TRUE, UINT64_MAX));
+		buildCommandBuffers();
+	}
+	imagesInFlight[currentBuffer] = waitFences[currentFrame];
+	VK_CHECK_RESULT(vkResetFences(device, 1, &waitFences[currentFrame]));
+	// Uploads recorded since the last frame have to be on the graphics queue before the frame that uses them
+	vulkanDevice->stagingUploader->submit();
+	// Headless images are neither acquired nor presented, so there are no semaphores to wait on or signal
+	submitInfo.waitSemaphoreCount = settings.headless ? 0 : 1;
+	submitInfo.signalSemaphoreCount = settings.headless ? 0 : 1;
+	submitInfo.pWaitSemaphores = &semaphores.presentComplete[currentFrame];
+	submitInfo.pSignalSemaphores = &semaphores.renderComplete[currentFrame];
 }
 
 void VulkanExampleBase::submitFrame()
 {
-	VkResult result = swapChain.queuePresent(queue, currentBuffer, semaphores.renderComplete);
+	VkResult result;
+	{
+		VKS_ZONE("Present");
+		result = swapChain.queuePresent(queue, currentBuffer, semaphores.renderComplete[currentFrame]);
+	}
+	// No wait for the queue to become idle, the next frame's fence wait in prepareFrame throttles the CPU instead
+	currentFrame = (currentFrame + 1) % static_cast<uint32_t>(waitFences.size());
 	if (!((result == VK_SUCCESS) || (result == VK_SUBOPTIMAL_KHR))) {
 		if (result == VK_ERROR_OUT_OF_DATE_KHR) {
 			// Swap chain is no longer compatible with the surface and needs to be recreated
@@ -650,7 +818,6 @@ void VulkanExampleBase::submitFrame()
 			VK_CHECK_RESULT(result);
 		}
 	}
-	VK_CHECK_RESULT(vkQueueWaitIdle(queue));
 }
 
 VulkanExampleBase::VulkanExampleBase(bool enableValidation)
@@ -736,6 +903,94 @@ VulkanExampleBase::VulkanExampleBase(bool enableValidation)
 		if ((args[i] == std::string("-bt")) || (args[i] == std::string("--benchframetimes"))) {
 			benchmark.outputFrameTimes = true;
 		}
+		// Machine readable benchmark results
+		if ((args[i] == std::string("-bj")) || (args[i] == std::string("--benchjson"))) {
+			if (args.size() > i + 1) {
+				if (args[i + 1][0] == '-') {
+					std::cerr << "Filename for benchmark results must not start with a hyphen!" << std::endl;
+				} else {
+					benchmark.jsonFilename = args[i + 1];
+				}
+			}
+		}
+		// Camera path replayed by the benchmark (overrides the runtime)
+		if ((args[i] == std::string("-bp")) || (args[i] == std::string("--benchpath"))) {
+			if (args.size() > i + 1) {
+				if (!benchmark.loadCameraPath(args[i + 1])) {
+					std::cerr << "Benchmark will use the default camera position" << std::endl;
+				}
+			}
+		}
+		// Don't load or store the pipeline cache
+		if ((args[i] == std::string("-npc")) || (args[i] == std::string("--nopipelinecache"))) {
+			settings.persistentPipelineCache = false;
+		}
+		// Render without a window into offscreen images
+		if (args[i] == std::string("--headless")) {
+			settings.headless = true;
+		}
+		// Number of frames rendered in headless mode
+		if ((args[i] == std::string("-hf")) || (args[i] == std::string("--headlessframes"))) {
+			if (args.size() > i + 1) {
+				uint32_t num = strtol(args[i + 1], &numConvPtr, 10);
+				if ((numConvPtr != args[i + 1]) && (num > 0)) {
+					settings.headlessFrames = num;
+				} else {
+					std::cerr << "Number of headless frames must be specified as a number greater than zero!" << std::endl;
+				}
+			}
+		}
+		// Store the last headless frame
+		if ((args[i] == std::string("-hs")) || (args[i] == std::string("--headlessscreenshot"))) {
+			if (args.size() > i + 1) {
+				if (args[i + 1][0] == '-') {
+					std::cerr << "Filename for the headless screenshot must not start with a hyphen!" << std::endl;
+				} else {
+					settings.headlessScreenshot = args[i + 1];
+				}
+			}
+		}
+		// Number of frames in flight
+		if ((args[i] == std::string("-fif")) || (args[i] == std::string("--framesinflight"))) {
+			if (args.size() > i + 1) {
+				uint32_t num = strtol(args[i + 1], &numConvPtr, 10);
+				if ((numConvPtr != args[i + 1]) && (num > 0)) {
+					settings.framesInFlight = num;
+				} else {
+					std::cerr << "Number of frames in flight must be specified as a number greater than zero!" << std::endl;
+				}
+			}
+		}
+		// Write CPU zones and counters to a trace file in the Chrome trace event format
+		if ((args[i] == std::string("-tf")) || (args[i] == std::string("--tracefile"))) {
+			if (args.size() > i + 1) {
+				if (args[i + 1][0] == '-') {
+					std::cerr << "Filename for the trace must not start with a hyphen!" << std::endl;
+				} else {
+					settings.traceFile = args[i + 1];
+				}
+			}
+		}
+		// Number of frames written to the trace file
+		if ((args[i] == std::string("-tn")) || (args[i] == std::string("--traceframes"))) {
+			if (args.size() > i + 1) {
+				uint32_t num = strtol(args[i + 1], &numConvPtr, 10);
+				if ((numConvPtr != args[i + 1]) && (num > 0)) {
+					settings.traceFrames = num;
+				} else {
+					std::cerr << "Number of traced frames must be specified as a number greater than zero!" << std::endl;
+				}
+			}
+		}
+	}
+
+	if (settings.traceFile != "") {
+#if defined(VKS_INSTRUMENTATION)
+		// Started right away, so the trace also covers loading and pipeline creation
+		vks::Instrumentation::get().startTrace(settings.traceFile, settings.traceFrames);
+#else
+		std::cerr << "Tracing requires building with instrumentation (USE_INSTRUMENTATION), no trace will be written" << std::endl;
+#endif
 	}
 	
 #if defined(VK_USE_PLATFORM_ANDROID_KHR)
@@ -745,9 +1000,13 @@ VulkanExampleBase::VulkanExampleBase(bool enableValidation)
 #elif defined(_DIRECT2DISPLAY)
 
 #elif defined(VK_USE_PLATFORM_WAYLAND_KHR)
-	initWaylandConnection();
+	if (!settings.headless) {
+		initWaylandConnection();
+	}
 #elif defined(VK_USE_PLATFORM_XCB_KHR)
-	initxcbConnection();
+	if (!settings.headless) {
+		initxcbConnection();
+	}
 #endif
 
 #if defined(_WIN32)
@@ -763,6 +1022,10 @@ VulkanExampleBase::VulkanExampleBase(bool enableValidation)
 
 VulkanExampleBase::~VulkanExampleBase()
 {
+#if defined(VKS_INSTRUMENTATION)
+	// Traces without a frame limit end with the example
+	vks::Instrumentation::get().stopTrace();
+#endif
 	// Clean up Vulkan resources
 	swapChain.cleanup();
 	destroyCommandBuffers();
@@ -774,16 +1037,21 @@ VulkanExampleBase::~VulkanExampleBase()
 
 	for (auto& shaderModule : shaderModules)
 	{
-		vkDestroyShaderModule(device, shaderModule, nullptr);
+		vks::ShaderModuleCache::get().release(device, shaderModule);
 	}
 	vkDestroyImageView(device, depthStencil.view, nullptr);
 	vkDestroyImage(device, depthStencil.image, nullptr);
 	vkFreeMemory(device, depthStencil.mem, nullptr);
 
+	savePipelineCache();
 	vkDestroyPipelineCache(device, pipelineCache, nullptr);
 
-	vkDestroySemaphore(device, semaphores.presentComplete, nullptr);
-	vkDestroySemaphore(device, semaphores.renderComplete, nullptr);
+	for (auto& semaphore : semaphores.presentComplete) {
+		vkDestroySemaphore(device, semaphore, nullptr);
+	}
+	for (auto& semaphore : semaphores.renderComplete) {
+		vkDestroySemaphore(device, semaphore, nullptr);
+	}
 	for (auto& fence : waitFences) {
 		vkDestroyFence(device, fence, nullptr);
 	}
@@ -791,7 +1059,9 @@ VulkanExampleBase::~VulkanExampleBase()
 	if (settings.overlay) {
 		UIOverlay.freeResources();
 	}
+	delete overlayRenderPass;
 
+	delete vulkanDevice->stagingUploader;
 	delete vulkanDevice;
 
 	if (settings.validation)
@@ -804,23 +1074,27 @@ VulkanExampleBase::~VulkanExampleBase()
 #if defined(_DIRECT2DISPLAY)
 
 #elif defined(VK_USE_PLATFORM_WAYLAND_KHR)
-	xdg_toplevel_destroy(xdg_toplevel);
-	xdg_surface_destroy(xdg_surface);
-	wl_surface_destroy(surface);
-	if (keyboard)
-		wl_keyboard_destroy(keyboard);
-	if (pointer)
-		wl_pointer_destroy(pointer);
-	wl_seat_destroy(seat);
-	xdg_wm_base_destroy(shell);
-	wl_compositor_destroy(compositor);
-	wl_registry_destroy(registry);
-	wl_display_disconnect(display);
+	if (!settings.headless) {
+		xdg_toplevel_destroy(xdg_toplevel);
+		xdg_surface_destroy(xdg_surface);
+		wl_surface_destroy(surface);
+		if (keyboard)
+			wl_keyboard_destroy(keyboard);
+		if (pointer)
+			wl_pointer_destroy(pointer);
+		wl_seat_destroy(seat);
+		xdg_wm_base_destroy(shell);
+		wl_compositor_destroy(compositor);
+		wl_registry_destroy(registry);
+		wl_display_disconnect(display);
+	}
 #elif defined(VK_USE_PLATFORM_ANDROID_KHR)
 	// todo : android cleanup (if required)
 #elif defined(VK_USE_PLATFORM_XCB_KHR)
-	xcb_destroy_window(connection, window);
-	xcb_disconnect(connection);
+	if (!settings.headless) {
+		xcb_destroy_window(connection, window);
+		xcb_disconnect(connection);
+	}
 #endif
 }
 
@@ -925,14 +1199,17 @@ bool VulkanExampleBase::initVulkan()
 	vkGetPhysicalDeviceFeatures(physicalDevice, &deviceFeatures);
 	vkGetPhysicalDeviceMemoryProperties(physicalDevice, &deviceMemoryProperties);
 
-	// Derived examples can override this to set actual features (based on above readings) to enable for logical device creation
-	getEnabledFeatures();
-
 	// Vulkan device creation
 	// This is handled by a separate class that gets a logical device representation
 	// and encapsulates functions related to a device
+	// Created before querying the enabled features, so derived examples can check for supported extensions
 	vulkanDevice = new vks::VulkanDevice(physicalDevice);
-	VkResult res = vulkanDevice->createLogicalDevice(enabledFeatures, enabledDeviceExtensions, deviceCreatepNextChain);
+
+	// Derived examples can override this to set actual features (based on above readings) to enable for logical device creation
+	getEnabledFeatures();
+
+	// A transfer queue is requested for the staging uploader, which uses a dedicated transfer queue family if the device has one
+	VkResult res = vulkanDevice->createLogicalDevice(enabledFeatures, enabledDeviceExtensions, deviceCreatepNextChain, !settings.headless, VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT | VK_QUEUE_TRANSFER_BIT);
 	if (res != VK_SUCCESS) {
 		vks::tools::exitFatal("Could not create Vulkan device: \n" + vks::tools::errorString(res), res);
 		return false;
@@ -942,30 +1219,22 @@ bool VulkanExampleBase::initVulkan()
 	// Get a graphics queue from the device
 	vkGetDeviceQueue(device, vulkanDevice->queueFamilyIndices.graphics, 0, &queue);
 
+	// All loaders stage their uploads through the device's uploader
+	vulkanDevice->stagingUploader = new vks::StagingUploader(vulkanDevice, queue);
+
 	// Find a suitable depth format
 	VkBool32 validDepthFormat = vks::tools::getSupportedDepthFormat(physicalDevice, &depthFormat);
 	assert(validDepthFormat);
 
-	swapChain.connect(instance, physicalDevice, device);
-
-	// Create synchronization objects
-	VkSemaphoreCreateInfo semaphoreCreateInfo = vks::initializers::semaphoreCreateInfo();
-	// Create a semaphore used to synchronize image presentation
-	// Ensures that the image is displayed before we start submitting new commands to the queu
-	VK_CHECK_RESULT(vkCreateSemaphore(device, &semaphoreCreateInfo, nullptr, &semaphores.presentComplete));
-	// Create a semaphore used to synchronize command submission
-	// Ensures that the image is not presented until all commands have been sumbitted and executed
-	VK_CHECK_RESULT(vkCreateSemaphore(device, &semaphoreCreateInfo, nullptr, &semaphores.renderComplete));
+	swapChain.connect(instance, physicalDevice, device, settings.headless, vulkanDevice->memoryAllocator);
 
 	// Set up submit info structure
-	// Semaphores will stay the same during application lifetime
+	// The semaphores of the current frame in flight are set in prepareFrame
 	// Command buffer submission info is set by each example
 	submitInfo = vks::initializers::submitInfo();
 	submitInfo.pWaitDstStageMask = &submitPipelineStages;
 	submitInfo.waitSemaphoreCount = 1;
-	submitInfo.pWaitSemaphores = &semaphores.presentComplete;
 	submitInfo.signalSemaphoreCount = 1;
-	submitInfo.pSignalSemaphores = &semaphores.renderComplete;
 
 #if defined(VK_USE_PLATFORM_ANDROID_KHR)
 	// Get Android device name and manufacturer (to display along GPU name)
@@ -1990,12 +2259,28 @@ void VulkanExampleBase::buildCommandBuffers() {}
 
 void VulkanExampleBase::createSynchronizationPrimitives()
 {
-	// Wait fences to sync command buffer access
+	// More frames in flight than swap chain images would only block in image acquisition
+	const uint32_t frameCount = std::max(1u, std::min(settings.framesInFlight, swapChain.imageCount));
+	settings.framesInFlight = frameCount;
+	currentFrame = 0;
+
+	VkSemaphoreCreateInfo semaphoreCreateInfo = vks::initializers::semaphoreCreateInfo();
+	semaphores.presentComplete.resize(frameCount);
+	semaphores.renderComplete.resize(frameCount);
+	for (uint32_t i = 0; i < frameCount; i++) {
+		// Ensures that the image is displayed before we start submitting new commands to the queue
+		VK_CHECK_RESULT(vkCreateSemaphore(device, &semaphoreCreateInfo, nullptr, &semaphores.presentComplete[i]));
+		// Ensures that the image is not presented until all commands have been sumbitted and executed
+		VK_CHECK_RESULT(vkCreateSemaphore(device, &semaphoreCreateInfo, nullptr, &semaphores.renderComplete[i]));
+	}
+
+	// Wait fences to sync access to the per-frame resources, start signaled so the first wait passes
 	VkFenceCreateInfo fenceCreateInfo = vks::initializers::fenceCreateInfo(VK_FENCE_CREATE_SIGNALED_BIT);
-	waitFences.resize(commandBuffers.size());
+	waitFences.resize(frameCount);
 	for (auto& fence : waitFences) {
 		VK_CHECK_RESULT(vkCreateFence(device, &fenceCreateInfo, nullptr, &fence));
 	}
+	imagesInFlight.assign(swapChain.imageCount, VK_NULL_HANDLE);
 }
 
 void VulkanExampleBase::createCommandPool()
@@ -2102,7 +2387,8 @@ void VulkanExampleBase::setupRenderPass()
 		VK_ATTACHMENT_LOAD_OP_DONT_CARE,
 		VK_ATTACHMENT_STORE_OP_DONT_CARE,
 		VK_IMAGE_LAYOUT_UNDEFINED,
-		VK_IMAGE_LAYOUT_PRESENT_SRC_KHR
+		// Headless images are never presented, but may be copied from for screenshots
+		settings.headless ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR
 	});
 	// Depth attachment
 	renderPass->addAttachmentDescription({
@@ -2140,6 +2426,72 @@ void VulkanExampleBase::setupRenderPass()
 	renderPass->create();
 }
 
+void VulkanExampleBase::setupOverlayRenderPass()
+{
+	// Same attachments as the default render pass, so the overlay's pipeline and the frame buffers can be used with both
+	const VkAttachmentReference colorReference = { 0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL };
+	const VkAttachmentReference depthReference = { 1, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL };
+	const VkImageLayout colorLayout = settings.headless ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+
+	overlayRenderPass = new RenderPass(device);
+	overlayRenderPass->addSubpassDescription({
+		0,
+		VK_PIPELINE_BIND_POINT_GRAPHICS,
+		0,
+		nullptr,
+		1,
+		&colorReference,
+		nullptr,
+		&depthReference,
+		0,
+		nullptr
+	});
+	// Color attachment, keeps what the example rendered
+	overlayRenderPass->addAttachmentDescription({
+		0,
+		swapChain.colorFormat,
+		VK_SAMPLE_COUNT_1_BIT,
+		VK_ATTACHMENT_LOAD_OP_LOAD,
+		VK_ATTACHMENT_STORE_OP_STORE,
+		VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+		VK_ATTACHMENT_STORE_OP_DONT_CARE,
+		colorLayout,
+		colorLayout
+	});
+	// Depth attachment, not used by the overlay
+	overlayRenderPass->addAttachmentDescription({
+		0,
+		depthFormat,
+		VK_SAMPLE_COUNT_1_BIT,
+		VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+		VK_ATTACHMENT_STORE_OP_DONT_CARE,
+		VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+		VK_ATTACHMENT_STORE_OP_DONT_CARE,
+		VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+		VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL
+	});
+	// The example's render pass has to be finished writing the color attachment
+	overlayRenderPass->addSubpassDependency({
+		VK_SUBPASS_EXTERNAL,
+		0,
+		VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+		VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+		VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+		VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+		VK_DEPENDENCY_BY_REGION_BIT,
+	});
+	overlayRenderPass->addSubpassDependency({
+		0,
+		VK_SUBPASS_EXTERNAL,
+		VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+		VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+		VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+		VK_ACCESS_MEMORY_READ_BIT,
+		VK_DEPENDENCY_BY_REGION_BIT,
+	});
+	overlayRenderPass->create();
+}
+
 void VulkanExampleBase::getEnabledFeatures()
 {
 	// Can be overriden in derived class
@@ -2181,6 +2533,8 @@ void VulkanExampleBase::windowResize()
 	// references to the recreated frame buffer
 	destroyCommandBuffers();
 	createCommandBuffers();
+	// The device is idle, so no image is in use by a frame anymore (the image count may also have changed)
+	imagesInFlight.assign(swapChain.imageCount, VK_NULL_HANDLE);
 	buildCommandBuffers();
 
 	vkDeviceWaitIdle(device);
@@ -2241,6 +2595,10 @@ void VulkanExampleBase::windowResized()
 
 void VulkanExampleBase::initSwapchain()
 {
+	if (settings.headless) {
+		swapChain.initHeadless(vulkanDevice->queueFamilyIndices.graphics);
+		return;
+	}
 #if defined(_WIN32)
 	swapChain.initSurface(windowInstance, window);
 #elif defined(VK_USE_PLATFORM_ANDROID_KHR)	
@@ -40,6 +40,7 @@
 #include <string>
 #include <array>
 #include <numeric>
+#include <algorithm>
 
 #include "vulkan/vulkan.h"
 
@@ -50,6 +51,10 @@
 
 #include "VulkanInitializers.hpp"
 #include "VulkanDevice.hpp"
+#include "VulkanStagingUploader.hpp"
+#include "VulkanPipelineCache.hpp"
+#include "VulkanShaderCache.hpp"
+#include "VulkanInstrumentation.hpp"
 #include "VulkanSwapChain.hpp"
 #include "camera.hpp"
 #include "benchmark.hpp"
@@ -72,6 +77,8 @@ private:
 	// Called if the window is resized and some resources have to be recreatesd
 	void windowResize();
 	void handleMouseMove(int32_t x, int32_t y);
+	// Mouse button state of the last overlay update, to detect clicks released over the overlay
+	bool overlayMouseDown = false;
 protected:
 	// Frame counter to display fps
 	uint32_t frameCounter = 0;
@@ -107,27 +114,35 @@ protected:
 	CommandPool* commandPool;
 	std::vector<CommandBuffer*> commandBuffers;
 	RenderPass* renderPass;
+	// Compatible with renderPass, but loads the color attachment, used by the overlay without indirect drawing
+	RenderPass* overlayRenderPass = nullptr;
 	// List of available frame buffers (same as number of swap chain images)
 	std::vector<VkFramebuffer>frameBuffers;
 	// Active frame buffer index
 	uint32_t currentBuffer = 0;
-	// List of shader modules created (stored for cleanup)
-	// @todo: remove/replace
+	// Shader modules acquired from the shader module cache by loadShader (released on destruction)
 	std::vector<VkShaderModule> shaderModules;
 	// Pipeline cache object
-	VkPipelineCache pipelineCache;
+	VkPipelineCache pipelineCache = VK_NULL_HANDLE;
 	// Wraps the swap chain to present images (framebuffers) to the windowing system
 	VulkanSwapChain swapChain;
-	// Synchronization semaphores
+	// Synchronization semaphores (one set per frame in flight)
 	struct {
 		// Swap chain image presentation
-		VkSemaphore presentComplete;
+		std::vector<VkSemaphore> presentComplete;
 		// Command buffer submission and execution
-		VkSemaphore renderComplete;
+		std::vector<VkSemaphore> renderComplete;
 	} semaphores;
+	// Fences signaled once the GPU has finished a frame in flight
 	std::vector<VkFence> waitFences;
+	// Fence of the frame currently using a swap chain image (and its command buffer), VK_NULL_HANDLE if none
+	std::vector<VkFence> imagesInFlight;
+	// Index of the frame in flight whose synchronization primitives are used for the current frame
+	uint32_t currentFrame = 0;
 public: 
 	bool prepared = false;
+	/** @brief Set by examples that record their command buffers every frame, changes then don't require rebuilding (and waiting for) the command buffers of all images */
+	bool recordPerFrame = false;
 	uint32_t width = 1280;
 	uint32_t height = 720;
 
@@ -153,6 +168,20 @@ public:
 		bool vsync = false;
 		/** @brief Enable UI overlay */
 		bool overlay = false;
+		/** @brief Number of frames the CPU may record and submit ahead of the GPU (clamped to the swap chain image count) */
+		uint32_t framesInFlight = 2;
+		/** @brief Load the pipeline cache from disk at startup and store it on exit (disable to measure cold start pipeline creation) */
+		bool persistentPipelineCache = true;
+		/** @brief Render into offscreen images without a window, surface or presentation (e.g. for measuring GPU throughput on CI machines) */
+		bool headless = false;
+		/** @brief Number of frames rendered in headless mode if not running a benchmark */
+		uint32_t headlessFrames = 1000;
+		/** @brief If set, the last frame rendered in headless mode is stored to this file (binary PPM) */
+		std::string headlessScreenshot = "";
+		/** @brief If set, CPU zones and counters are written to this file in the Chrome trace event format (requires building with instrumentation) */
+		std::string traceFile = "";
+		/** @brief Number of frames written to the trace file, 0 traces until the example exits */
+		uint32_t traceFrames = 0;
 	} settings;
 
 	VkClearColorValue defaultClearColor = { { 0.025f, 0.025f, 0.025f, 1.0f } };
@@ -350,8 +379,10 @@ public:
 	// Setup a default render pass
 	// Can be overriden in derived class to setup a custom render pass (e.g. for MSAA)
 	virtual void setupRenderPass();
+	// Setup the render pass the overlay draws with if it doesn't draw indirectly from within the example's render pass
+	void setupOverlayRenderPass();
 
-	/** @brief (Virtual) Called after the physical device features have been read, can be used to set features to enable on the device */
+	/** @brief (Virtual) Called after the physical device features have been read, can be used to set features and extensions (see vulkanDevice->extensionSupported) to enable on the device */
 	virtual void getEnabledFeatures();
 
 	// Connect and prepare the swap chain
@@ -372,8 +403,10 @@ public:
 	// Note : Waits for the queue to become idle
 	void flushCommandBuffer(VkCommandBuffer commandBuffer, VkQueue queue, bool free);
 
-	// Create a cache pool for rendering pipelines
+	// Create a cache pool for rendering pipelines, initialized with the data stored in the last run
 	void createPipelineCache();
+	// Store the pipeline cache's data on disk
+	void savePipelineCache();
 
 	// Prepare commonly used Vulkan functions
 	virtual void prepare();
@@ -387,15 +420,25 @@ public:
 	// Render one frame of a render loop on platforms that sync rendering
 	void renderFrame();
 
+	// Render a fixed number of frames as fast as possible into the headless images and report the throughput
+	void headlessRenderLoop();
+	// Read back the last rendered swap chain image and store it as a binary PPM
+	void saveScreenshot(const std::string& filename);
+
 	void updateOverlay();
-	void drawUI(const VkCommandBuffer commandBuffer);
+	// Record the overlay's draws using the buffers of a swap chain image
+	void drawUI(const VkCommandBuffer commandBuffer, uint32_t imageIndex);
+	// Add the overlay's own command buffer of a swap chain image (if it has one) to the command buffers submitted for that image
+	void addUICommandBuffer(std::vector<VkCommandBuffer>& submitCommandBuffers, uint32_t imageIndex);
 
 	// Prepare the frame for workload submission
+	// - Waits until the GPU has finished the frame that last used the current frame's resources
 	// - Acquires the next image from the swap chain 
-	// - Sets the default wait and signal semaphores
+	// - Sets the wait and signal semaphores of the current frame
 	void prepareFrame();
 
 	// Submit the frames' workload 
+	// - Presents the current image and advances to the next frame in flight
 	void submitFrame();
 
 	/** @brief (Virtual) Called when the UI overlay is updating, can be used to add custom elements to the overlay */
@@ -420,7 +463,7 @@ int APIENTRY WinMain(HINSTANCE hInstance, HINSTANCE, LPSTR, int)									\
 	for (int32_t i = 0; i < __argc; i++) { VulkanExample::args.push_back(__argv[i]); };  			\
 	vulkanExample = new VulkanExample();															\
 	vulkanExample->initVulkan();																	\
-	vulkanExample->setupWindow(hInstance, WndProc);													\
+	if (!vulkanExample->settings.headless) { vulkanExample->setupWindow(hInstance, WndProc); }		\
 	vulkanExample->prepare();																		\
 	vulkanExample->renderLoop();																	\
 	delete(vulkanExample);																			\
@@ -466,7 +509,7 @@ int main(const int argc, const char *argv[])													    \
 	for (size_t i = 0; i < argc; i++) { VulkanExample::args.push_back(argv[i]); };  				\
 	vulkanExample = new VulkanExample();															\
 	vulkanExample->initVulkan();																	\
-	vulkanExample->setupWindow();					 												\
+	if (!vulkanExample->settings.headless) { vulkanExample->setupWindow(); }						\
 	vulkanExample->prepare();																		\
 	vulkanExample->renderLoop();																	\
 	delete(vulkanExample);																			\
@@ -487,7 +530,7 @@ int main(const int argc, const char *argv[])													    \
 	for (size_t i = 0; i < argc; i++) { VulkanExample::args.push_back(argv[i]); };  				\
 	vulkanExample = new VulkanExample();															\
 	vulkanExample->initVulkan();																	\
-	vulkanExample->setupWindow();					 												\
+	if (!vulkanExample->settings.headless) { vulkanExample->setupWindow(); }						\
 	vulkanExample->prepare();																		\
 	vulkanExample->renderLoop();																	\
 	delete(vulkanExample);																			\
@@ -0,0 +1,176 @@
+/*
+* GPU profiler based on timestamp queries
+*
+* Scopes are pairs of timestamps written into command buffers, with a separate set of queries per frame in flight
+* Results of a frame are read once its fence has been waited on, so reading them never stalls
+* As command buffers are recorded once and submitted many times, the example has to tell the profiler which scopes were submitted with a frame
+*
+* Copyright (C) by Sascha Willems - www.saschawillems.de
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <vector>
+#include <string>
+#include <iostream>
+#include <assert.h>
+#include <stdint.h>
+
+#include "vulkan/vulkan.h"
+#include "VulkanTools.h"
+#include "VulkanDevice.hpp"
+
+namespace vks
+{
+	class GpuProfiler
+	{
+	public:
+		struct Scope {
+			std::string name;
+			// GPU time of the last frame the scope was submitted with in milliseconds
+			double time = 0.0;
+			// Moving average of the time, for display
+			double average = 0.0;
+			// Set once the scope has returned a result
+			bool valid = false;
+			// Set if the last call to collect() returned a new result for the scope
+			bool updated = false;
+		};
+
+	private:
+		VkDevice device;
+		VkQueryPool queryPool = VK_NULL_HANDLE;
+		double timestampPeriod;
+		uint64_t timestampMask;
+		uint32_t frameCount;
+		uint32_t maxScopes;
+		std::vector<Scope> scopes;
+		// Scopes submitted with each frame since its results were last read
+		std::vector<std::vector<bool>> submittedScopes;
+
+		uint32_t getQuery(uint32_t frame, uint32_t scope) const
+		{
+			assert(scope < maxScopes);
+			return (frame * maxScopes + scope) * 2;
+		}
+
+		// Frames beyond the frame count (e.g. after the swap chain grew) aren't profiled
+		bool enabled(uint32_t frame) const
+		{
+			return queryPool != VK_NULL_HANDLE && frame < frameCount;
+		}
+
+	public:
+		/**
+		* @param device Device to create the query pool on, the profiler is disabled if timestamps are not supported by its graphics queue
+		* @param frameCount Number of frames that may be in flight (e.g. the number of swap chain images)
+		* @param maxScopes Maximum number of scopes per frame
+		*/
+		GpuProfiler(vks::VulkanDevice* device, uint32_t frameCount, uint32_t maxScopes = 32)
+		{
+			this->device = device->logicalDevice;
+			this->frameCount = frameCount;
+			this->maxScopes = maxScopes;
+			const uint32_t validBits = device->queueFamilyProperties[device->queueFamilyIndices.graphics].timestampValidBits;
+			if (!device->properties.limits.timestampComputeAndGraphics || validBits == 0) {
+				std::cout << "GPU profiler: timestamp queries are not supported" << std::endl;
+				return;
+			}
+			timestampPeriod = device->properties.limits.timestampPeriod;
+			timestampMask = (validBits >= 64) ? UINT64_MAX : ((1ull << validBits) - 1);
+			VkQueryPoolCreateInfo queryPoolCI{};
+			queryPoolCI.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+			queryPoolCI.queryType = VK_QUERY_TYPE_TIMESTAMP;
+			queryPoolCI.queryCount = frameCount * maxScopes * 2;
+			VK_CHECK_RESULT(vkCreateQueryPool(this->device, &queryPoolCI, nullptr, &queryPool));
+			submittedScopes.resize(frameCount, std::vector<bool>(maxScopes, false));
+		}
+
+		~GpuProfiler()
+		{
+			if (queryPool != VK_NULL_HANDLE) {
+				vkDestroyQueryPool(device, queryPool, nullptr);
+			}
+		}
+
+		bool supported() const { return queryPool != VK_NULL_HANDLE; }
+
+		/** @brief Add a scope, scopes have to be added before recording command buffers using them */
+		uint32_t addScope(const std::string& name)
+		{
+			assert(scopes.size() < maxScopes);
+			Scope scope;
+			scope.name = name;
+			scopes.push_back(scope);
+			return static_cast<uint32_t>(scopes.size() - 1);
+		}
+
+		/** @brief Record the reset of a scope's queries, has to be recorded outside of a render pass and before the scope's timestamps are written */
+		void reset(VkCommandBuffer commandBuffer, uint32_t frame, uint32_t scope)
+		{
+			if (enabled(frame)) {
+				vkCmdResetQueryPool(commandBuffer, queryPool, getQuery(frame, scope), 2);
+			}
+		}
+
+		/** @brief Start a scope, may be recorded inside render passes and secondary command buffers */
+		void begin(VkCommandBuffer commandBuffer, uint32_t frame, uint32_t scope)
+		{
+			if (enabled(frame)) {
+				vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, queryPool, getQuery(frame, scope));
+			}
+		}
+
+		void end(VkCommandBuffer commandBuffer, uint32_t frame, uint32_t scope)
+		{
+			if (enabled(frame)) {
+				vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, queryPool, getQuery(frame, scope) + 1);
+			}
+		}
+
+		/** @brief Mark a scope as submitted with a frame, scopes that weren't submitted keep their last result */
+		void submitted(uint32_t frame, uint32_t scope)
+		{
+			if (enabled(frame)) {
+				submittedScopes[frame][scope] = true;
+			}
+		}
+
+		/**
+		* Read the results of all scopes submitted with a frame
+		* Has to be called after the frame's fence has been waited on, results that aren't available yet are skipped instead of waiting for them
+		*
+		* @return True if any scope has a new result
+		*/
+		bool collect(uint32_t frame)
+		{
+			if (!enabled(frame)) {
+				return false;
+			}
+			bool updated = false;
+			for (uint32_t i = 0; i < scopes.size(); i++) {
+				scopes[i].updated = false;
+				if (!submittedScopes[frame][i]) {
+					continue;
+				}
+				uint64_t timestamps[2];
+				if (vkGetQueryPoolResults(device, queryPool, getQuery(frame, i), 2, sizeof(timestamps), timestamps, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT) != VK_SUCCESS) {
+					continue;
+				}
+				submittedScopes[frame][i] = false;
+				Scope& scope = scopes[i];
+				scope.time = static_cast<double>((timestamps[1] - timestamps[0]) & timestampMask) * timestampPeriod / 1000000.0;
+				scope.average = scope.valid ? scope.average * 0.95 + scope.time * 0.05 : scope.time;
+				scope.valid = true;
+				scope.updated = true;
+				updated = true;
+			}
+			return updated;
+		}
+
+		const std::vector<Scope>& getScopes() const { return scopes; }
+		const Scope& getScope(uint32_t scope) const { return scopes[scope]; }
+	};
+}
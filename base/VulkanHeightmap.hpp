@@ -6,47 +6,517 @@
 * This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
 */
 
-#include <glm/glm.hpp>
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <unordered_map>
+#include <algorithm>
+#include <cmath>
 #include <glm/glm.hpp>
 
 #include "vulkan/vulkan.h"
 #include "VulkanDevice.hpp"
 #include "VulkanBuffer.hpp"
+#include "VulkanStagingUploader.hpp"
+#include "VulkanTexture.hpp"
+#include "VulkanTiledTexture.hpp"
+#include "frustum.hpp"
+#include "heightmapbuilder.hpp"
+#include "heightmapquadtree.hpp"
+#include "threadpool.hpp"
+#include "VulkanInstrumentation.hpp"
 #include <ktx.h>
-#include <ktxvulkan.h>
 
 namespace vks 
 {
+	/*
+		Index lists for terrain chunks, shared by all chunks and height maps
+
+		Chunk indices are local to the chunk's vertex block (see chunkVertexCount), so the topology only depends on
+		the chunk's size, the level of detail and the primitive type
+		Chunks with fewer than 65535 vertices use 16 bit indices
+	*/
+	class HeightMapIndexCache
+	{
+	public:
+		struct Range {
+			uint32_t firstIndex;
+			uint32_t indexCount;
+		};
+	private:
+		struct Key {
+			uint32_t width;
+			uint32_t height;
+			uint32_t step;
+			bool quads;
+			bool strip;
+			VkIndexType indexType;
+			bool operator==(const Key &other) const {
+				return width == other.width && height == other.height && step == other.step && quads == other.quads && strip == other.strip && indexType == other.indexType;
+			}
+		};
+		std::vector<std::pair<Key, Range>> ranges;
+		std::vector<uint16_t> indices16;
+		std::vector<uint32_t> indices32;
+		bool dirty = false;
+		vks::Buffer buffers[2];
+		vks::UploadTicket uploadTicket = 0;
+
+		// Index of the vertex at grid position x, y of a chunk with width by height quads
+		static uint32_t gridVertex(uint32_t width, uint32_t x, uint32_t y) {
+			return x + y * (width + 1);
+		}
+
+		void generate(const Key &key, std::vector<uint32_t> &indices) {
+			const uint32_t w = key.width;
+			const uint32_t h = key.height;
+			const uint32_t step = key.step;
+			// Grid steps for this level, the last step is shortened to end at the chunk border
+			std::vector<uint32_t> xs, ys;
+			for (uint32_t x = 0; x < w; x += step) xs.push_back(x);
+			xs.push_back(w);
+			for (uint32_t y = 0; y < h; y += step) ys.push_back(y);
+			ys.push_back(h);
+
+			// Grid
+			for (size_t j = 0; j + 1 < ys.size(); j++) {
+				const uint32_t y = ys[j];
+				const uint32_t yn = ys[j + 1];
+				if (key.strip) {
+					// One strip per row
+					for (size_t i = 0; i < xs.size(); i++) {
+						indices.push_back(gridVertex(w, xs[i], y));
+						indices.push_back(gridVertex(w, xs[i], yn));
+					}
+					indices.push_back(restartIndex);
+					continue;
+				}
+				for (size_t i = 0; i + 1 < xs.size(); i++) {
+					const uint32_t x = xs[i];
+					const uint32_t xn = xs[i + 1];
+					const uint32_t i0 = gridVertex(w, x, y);
+					const uint32_t i1 = gridVertex(w, x, yn);
+					const uint32_t i2 = gridVertex(w, xn, yn);
+					const uint32_t i3 = gridVertex(w, xn, y);
+					if (key.quads) {
+						// Quad patches (tessellation)
+						const uint32_t quad[4] = { i0, i1, i2, i3 };
+						indices.insert(indices.end(), quad, quad + 4);
+					} else {
+						const uint32_t quad[6] = { i0, i1, i2, i2, i3, i0 };
+						indices.insert(indices.end(), quad, quad + 6);
+					}
+				}
+			}
+			if (key.quads) {
+				return;
+			}
+
+			// Skirts below each border, with both windings as chunk borders can be seen from either side
+			const uint32_t skirtBase = (w + 1) * (h + 1);
+			std::vector<std::pair<uint32_t, uint32_t>> edge;
+			auto addSkirt = [&]() {
+				if (key.strip) {
+					for (auto &v : edge) {
+						indices.push_back(v.first);
+						indices.push_back(v.second);
+					}
+					indices.push_back(restartIndex);
+					for (auto &v : edge) {
+						indices.push_back(v.second);
+						indices.push_back(v.first);
+					}
+					indices.push_back(restartIndex);
+				} else {
+					for (size_t i = 0; i + 1 < edge.size(); i++) {
+						const uint32_t a = edge[i].first, b = edge[i + 1].first;
+						const uint32_t sa = edge[i].second, sb = edge[i + 1].second;
+						const uint32_t skirt[12] = { a, b, sb, sb, sa, a, a, sa, sb, sb, b, a };
+						indices.insert(indices.end(), skirt, skirt + 12);
+					}
+				}
+				edge.clear();
+			};
+			// Top and bottom rows
+			for (uint32_t x : xs) edge.push_back({ gridVertex(w, x, 0), skirtBase + x });
+			addSkirt();
+			for (uint32_t x : xs) edge.push_back({ gridVertex(w, x, h), skirtBase + (w + 1) + x });
+			addSkirt();
+			// Left and right columns
+			for (uint32_t y : ys) edge.push_back({ gridVertex(w, 0, y), skirtBase + 2 * (w + 1) + y });
+			addSkirt();
+			for (uint32_t y : ys) edge.push_back({ gridVertex(w, w, y), skirtBase + 2 * (w + 1) + (h + 1) + y });
+			addSkirt();
+		}
+
+	public:
+		static const uint32_t restartIndex = 0xFFFFFFFF;
+
+		// Number of vertices in the vertex block of a chunk with width by height quads: the grid followed by the skirt vertices for the top, bottom, left and right borders
+		static uint32_t chunkVertexCount(uint32_t width, uint32_t height, bool skirts) {
+			return (width + 1) * (height + 1) + (skirts ? 2 * (width + 1) + 2 * (height + 1) : 0);
+		}
+
+		static VkIndexType chunkIndexType(uint32_t width, uint32_t height, bool skirts) {
+			// 0xFFFF is reserved for primitive restart
+			return chunkVertexCount(width, height, skirts) < 0xFFFF ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32;
+		}
+
+		/**
+		* Get the index range for a chunk, generating the indices on first use
+		*
+		* @param width Number of quads along x
+		* @param height Number of quads along y
+		* @param step Grid step of the level of detail
+		* @param quads Generate quad patches instead of triangles (no skirts)
+		* @param strip Generate triangle strips separated by restart indices instead of a triangle list
+		* @param indexType Index type of the height map, all of its chunks need to use the same index buffer
+		*/
+		Range get(uint32_t width, uint32_t height, uint32_t step, bool quads, bool strip, VkIndexType indexType) {
+			assert(indexType == VK_INDEX_TYPE_UINT32 || chunkIndexType(width, height, !quads) == VK_INDEX_TYPE_UINT16);
+			const Key key = { width, height, step, quads, strip && !quads, indexType };
+			for (auto &range : ranges) {
+				if (range.first == key) {
+					return range.second;
+				}
+			}
+			std::vector<uint32_t> indices;
+			generate(key, indices);
+			Range range;
+			range.indexCount = static_cast<uint32_t>(indices.size());
+			if (key.indexType == VK_INDEX_TYPE_UINT16) {
+				range.firstIndex = static_cast<uint32_t>(indices16.size());
+				for (uint32_t index : indices) {
+					indices16.push_back(index == restartIndex ? 0xFFFF : static_cast<uint16_t>(index));
+				}
+			} else {
+				range.firstIndex = static_cast<uint32_t>(indices32.size());
+				indices32.insert(indices32.end(), indices.begin(), indices.end());
+			}
+			ranges.push_back({ key, range });
+			dirty = true;
+			return range;
+		}
+
+		// (Re)creates the device buffers if new ranges have been added, must not be called while the buffers are in use
+		void upload(vks::VulkanDevice *device) {
+			if (!dirty) {
+				return;
+			}
+			assert(device->stagingUploader);
+			// The buffers to be replaced may still be the destination of a pending upload
+			device->stagingUploader->wait(uploadTicket);
+			const void* data[2] = { indices16.data(), indices32.data() };
+			const VkDeviceSize sizes[2] = { indices16.size() * sizeof(uint16_t), indices32.size() * sizeof(uint32_t) };
+			for (uint32_t i = 0; i < 2; i++) {
+				if (sizes[i] == 0) {
+					continue;
+				}
+				buffers[i].destroy();
+				buffers[i] = vks::Buffer();
+				device->createBuffer(VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &buffers[i], sizes[i]);
+				uploadTicket = device->stagingUploader->uploadBuffer(buffers[i].buffer, data[i], sizes[i], 0, VK_ACCESS_INDEX_READ_BIT);
+			}
+			dirty = false;
+		}
+
+		VkBuffer getBuffer(VkIndexType indexType) {
+			return buffers[indexType == VK_INDEX_TYPE_UINT16 ? 0 : 1].buffer;
+		}
+
+		// Size of the index data of all cached ranges
+		size_t size() {
+			return indices16.size() * sizeof(uint16_t) + indices32.size() * sizeof(uint32_t);
+		}
+
+		void destroy() {
+			buffers[0].destroy();
+			buffers[1].destroy();
+		}
+	};
+
+	// Heights read from the tiles of a 16 bit tiled texture, tiles are paged in from the mapped tile file as they are read
+	class TiledHeightSource : public HeightSource
+	{
+	private:
+		const TiledTexture* texture;
+	public:
+		TiledHeightSource(const TiledTexture* texture) : texture(texture) {}
+
+		virtual uint16_t getHeight(uint32_t x, uint32_t y) const
+		{
+			return *static_cast<const uint16_t*>(texture->getTexel(x, y));
+		}
+	};
+
 	class HeightMap
 	{
 	private:
-		uint16_t *heightdata;
+		uint16_t *heightdata = nullptr;
 		uint32_t dim;
 		uint32_t scale;
+		// Grid size and mesh scale passed to loadFromKTX, needed for building streamed chunks
+		uint32_t patchsize = 0;
+		glm::vec3 meshScale;
+		bool skirts = false;
 
 		vks::VulkanDevice *device = nullptr;
 		VkQueue copyQueue = VK_NULL_HANDLE;
+
+		std::unique_ptr<HeightMapIndexCache> ownedIndexCache;
+
+		VkSpecializationMapEntry vertexDecodeMapEntries[7];
+		VkSpecializationInfo vertexDecodeSpecializationInfo{};
+
+		// Streaming state, slots are blocks of the vertex buffer following the coarse vertex blocks
+		struct RetiredSlot {
+			uint32_t slot;
+			uint64_t frame;
+		};
+		std::vector<uint32_t> freeSlots;
+		std::vector<RetiredSlot> retiredSlots;
+		uint32_t slotBaseVertex = 0;
+		uint32_t slotVertexCount = 0;
+		uint64_t streamingFrame = 0;
+
 	public:
 		enum Topology { topologyTriangles, topologyQuads };
+		enum VertexFormat { vertexFormatFloat, vertexFormatPacked };
 
 		float heightScale = 4.0f;
 		float uvScale = 1.0f;
 
 		vks::Buffer vertexBuffer;
-		vks::Buffer indexBuffer;
 
 		struct Vertex {
 			glm::vec3 pos;
 			glm::vec3 normal;
 			glm::vec2 uv;
-			glm::vec4 pad0;
-			glm::vec4 pad1;
 		};
 
+		// Grid position, quantized height and octahedral encoded normal
+		// Positions and uvs are reconstructed in the vertex shader using the decode constants
+		struct PackedVertex {
+			uint16_t gridPos[2];
+			uint16_t height;
+			int8_t normal[2];
+		};
+
+		// Passed to the vertex shader as specialization constants 0..6 for decoding packed vertices
+		struct VertexDecodeConstants {
+			float gridScale[2];
+			float gridOffset[2];
+			float heightMin;
+			float heightRange;
+			float uvScale;
+		} vertexDecode;
+
+		// Layout of the vertices uploaded to the vertex buffer (must be set before loading)
+		VertexFormat vertexFormat = vertexFormatFloat;
+
+		// The terrain is split into square chunks that are culled and LOD selected individually
+		struct Chunk {
+			glm::vec3 min;
+			glm::vec3 max;
+			// Index range for each level of detail
+			struct LOD {
+				uint32_t firstIndex;
+				uint32_t indexCount;
+			};
+			std::vector<LOD> lods;
+			// First vertex of the chunk's vertex block, chunk indices are relative to this
+			int32_t vertexOffset;
+			// First grid vertex and number of grid quads of the chunk
+			uint32_t x0, y0;
+			uint32_t width, height;
+			// Streaming only: always resident block sampling the grid at the step of the lowest level of detail
+			int32_t coarseVertexOffset = 0;
+			LOD coarseLod;
+			// Streaming only: set while the full detail block is resident in a slot, vertexOffset then points to the slot
+			bool resident = false;
+			uint32_t slot = 0;
+			// Streaming frame in which the chunk was last requested
+			uint64_t lastRequested = 0;
+		};
+		std::vector<Chunk> chunks;
+
+		// Min/max hierarchy over the grid heights for CPU height queries and ray casts, also provides the chunk bounds (built on load)
+		HeightMapQuadtree quadtree;
+
+		// Number of grid quads along each side of a chunk (must be set before loading)
+		uint32_t chunkSize = 32;
+		// Number of detail levels per chunk, each level doubles the grid step (must be set before loading)
+		uint32_t lodCount = 3;
+		// Distance from the viewer at which the next lower level of detail is selected
+		float lodDistance = 4.0f;
+		// Chunks outside the view frustum are skipped by updateDrawCommands if enabled
+		bool frustumCulling = true;
+		// Skirts hang down from the chunk borders to hide cracks between chunks with different detail levels
+		float skirtDepth = 0.25f;
+		// If set, vertex generation is split across the pool's workers
+		vks::ThreadPool* threadPool = nullptr;
+		// Number of grid rows built by a single job
+		uint32_t rowsPerJob = 32;
+
+		// Indices are shared with all height maps using the same cache, if not set the height map creates it's own
+		HeightMapIndexCache* indexCache = nullptr;
+		// Keep a copy of the height data on the host for getHeight (must be set before loading)
+		bool keepHeightData = false;
+		// Compute vertex normals on the host (must be set before loading), can be disabled if the shaders derive the normals from the height map themselves
+		// Vertices get an upward facing normal if disabled
+		bool vertexNormals = true;
+		// Use triangle strips with primitive restart instead of triangle lists (must be set before loading, ignored for quad patches)
+		bool triangleStrips = false;
+		// Only keep the full detail vertices of chunks near the viewer on the device (must be set before loading, ignored for quad patches)
+		// Chunks are requested once the viewer gets close enough for them to use a higher level of detail than the lowest one, all other chunks are drawn from coarse blocks
+		bool streaming = false;
+		// Tiles of the height map's file the full detail blocks of streamed chunks are read from (must be loaded before the height map)
+		// If not set, a copy of the full resolution heights is kept on the host for building the blocks instead
+		const vks::TiledTexture* streamingTiles = nullptr;
+		// Number of full detail chunks that can be resident at the same time (must be set before loading)
+		uint32_t streamingSlotCount = 32;
+		// Maximum number of chunks built and uploaded by a single call to updateStreaming
+		uint32_t streamingUploadsPerFrame = 4;
+		struct StreamingStats {
+			uint32_t residentChunks = 0;
+			uint32_t requestedChunks = 0;
+			uint32_t uploads = 0;
+			uint32_t evictions = 0;
+		} streamingStats;
+		// Set by loadFromFile, pipelines drawing the height map need to match these
+		bool primitiveRestart = false;
+		VkIndexType indexType = VK_INDEX_TYPE_UINT32;
+
 		size_t vertexBufferSize = 0;
+		// Size of the (possibly shared) index cache
 		size_t indexBufferSize = 0;
+		// Index count of the full detail level for all chunks
 		uint32_t indexCount = 0;
 
+	private:
+		// Number of quads along a chunk side with the given number of grid quads when sampling every step'th grid vertex
+		static uint32_t sampledQuads(uint32_t quads, uint32_t step)
+		{
+			return (quads + step - 1) / step;
+		}
+
+		// Grid vertices of the columns [x0, x1) and rows [y0, y1), row by row
+		void buildGrid(const HeightMapBuilder &builder, uint32_t x0, uint32_t x1, uint32_t y0, uint32_t y1, Vertex *dst) const
+		{
+			const float wx = 2.0f;
+			const float wy = 2.0f;
+			const uint32_t count = x1 - x0;
+			std::vector<float> heights((y1 - y0) * count);
+			std::vector<glm::vec3> normals(vertexNormals ? (y1 - y0) * count : 0);
+			builder.build(x0, x1, y0, y1, heights.data(), vertexNormals ? normals.data() : nullptr);
+			for (uint32_t y = y0; y < y1; y++) {
+				for (uint32_t x = x0; x < x1; x++) {
+					const uint32_t src = (x - x0) + (y - y0) * count;
+					Vertex &vertex = dst[src];
+					vertex.pos[0] = (x * wx + wx / 2.0f - (float)patchsize * wx / 2.0f) * meshScale.x;
+					vertex.pos[1] = -heights[src] * meshScale.y + 1.0f;
+					vertex.pos[2] = (y * wy + wy / 2.0f - (float)patchsize * wy / 2.0f) * meshScale.z;
+					vertex.uv = glm::vec2((float)x / patchsize, (float)y / patchsize) * uvScale;
+					vertex.normal = vertexNormals ? normals[src] : glm::vec3(0.0f, 0.0f, 1.0f);
+				}
+			}
+		}
+
+		/**
+		* Append the vertex block of a chunk (see HeightMapIndexCache::chunkVertexCount)
+		* Samples every step'th grid vertex of the chunk, the last row and column are always included so that coarse blocks keep the chunk's borders
+		*/
+		template <typename GridVertex>
+		void appendChunkVertices(std::vector<Vertex> &vertices, const Chunk &chunk, uint32_t step, GridVertex gridVertex) const
+		{
+			const uint32_t cw = sampledQuads(chunk.width, step);
+			const uint32_t ch = sampledQuads(chunk.height, step);
+			auto sample = [&](uint32_t x, uint32_t y) {
+				return gridVertex(chunk.x0 + std::min(x * step, chunk.width), chunk.y0 + std::min(y * step, chunk.height));
+			};
+			const size_t first = vertices.size();
+			// Grid vertices of the chunk, including the borders shared with the neighbouring chunks
+			for (uint32_t y = 0; y <= ch; y++) {
+				for (uint32_t x = 0; x <= cw; x++) {
+					vertices.push_back(sample(x, y));
+				}
+			}
+			// Lowered copies of the top, bottom, left and right border vertices for the skirts (positive y points downwards in this scene)
+			if (skirts) {
+				auto addSkirtVertex = [&](uint32_t x, uint32_t y) {
+					Vertex vertex = sample(x, y);
+					vertex.pos.y += skirtDepth * meshScale.y;
+					vertices.push_back(vertex);
+				};
+				for (uint32_t x = 0; x <= cw; x++) addSkirtVertex(x, 0);
+				for (uint32_t x = 0; x <= cw; x++) addSkirtVertex(x, ch);
+				for (uint32_t y = 0; y <= ch; y++) addSkirtVertex(0, y);
+				for (uint32_t y = 0; y <= ch; y++) addSkirtVertex(cw, y);
+			}
+			assert(vertices.size() - first == HeightMapIndexCache::chunkVertexCount(cw, ch, skirts));
+		}
+
+		uint32_t getVertexStride() const
+		{
+			return (vertexFormat == vertexFormatPacked) ? sizeof(PackedVertex) : sizeof(Vertex);
+		}
+
+		// Level of detail for a chunk based on the distance from the viewer to the closest point of its bounding box
+		uint32_t selectLod(const Chunk &chunk, const glm::vec3 &viewPos) const
+		{
+			const float distance = getChunkDistance(chunk, viewPos);
+			if (distance <= lodDistance) {
+				return 0;
+			}
+			return std::min(static_cast<uint32_t>(std::log2(distance / lodDistance)) + 1, static_cast<uint32_t>(chunk.lods.size()) - 1);
+		}
+
+		// Build the full detail block of a chunk and upload it to a slot, only the heights of the chunk and its neighbouring grid vertices are read
+		void uploadChunk(Chunk &chunk, uint32_t slot, const HeightMapBuilder &builder)
+		{
+			const uint32_t rowSize = chunk.width + 1;
+			std::vector<Vertex> grid(rowSize * (chunk.height + 1));
+			buildGrid(builder, chunk.x0, chunk.x0 + rowSize, chunk.y0, chunk.y0 + chunk.height + 1, grid.data());
+			std::vector<Vertex> vertices;
+			appendChunkVertices(vertices, chunk, 1, [&](uint32_t x, uint32_t y) { return grid[(x - chunk.x0) + (y - chunk.y0) * rowSize]; });
+			std::vector<PackedVertex> packedVertices;
+			if (vertexFormat == vertexFormatPacked) {
+				packedVertices = packVertices(vertices);
+			}
+			const uint32_t firstVertex = slotBaseVertex + slot * slotVertexCount;
+			device->stagingUploader->uploadBuffer(
+				vertexBuffer.buffer,
+				(vertexFormat == vertexFormatPacked) ? (void*)packedVertices.data() : (void*)vertices.data(),
+				vertices.size() * getVertexStride(),
+				(VkDeviceSize)firstVertex * getVertexStride(),
+				VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT);
+			chunk.vertexOffset = static_cast<int32_t>(firstVertex);
+			chunk.slot = slot;
+			chunk.resident = true;
+			streamingStats.uploads++;
+		}
+
+		// Evict the resident chunk requested the longest time ago, its slot can be reused once no frame in flight draws from it
+		bool evictChunk()
+		{
+			Chunk* victim = nullptr;
+			for (auto &chunk : chunks) {
+				if (chunk.resident && chunk.lastRequested < streamingFrame && (!victim || chunk.lastRequested < victim->lastRequested)) {
+					victim = &chunk;
+				}
+			}
+			if (!victim) {
+				return false;
+			}
+			victim->resident = false;
+			victim->vertexOffset = victim->coarseVertexOffset;
+			retiredSlots.push_back({ victim->slot, streamingFrame });
+			streamingStats.evictions++;
+			return true;
+		}
+
+	public:
 		HeightMap(vks::VulkanDevice *device, VkQueue copyQueue)
 		{
 			this->device = device;
@@ -56,12 +526,16 @@ namespace vks
 		~HeightMap()
 		{
 			vertexBuffer.destroy();
-			indexBuffer.destroy();
+			if (ownedIndexCache) {
+				ownedIndexCache->destroy();
+			}
 			delete[] heightdata;
 		}
 
+		// Nearest height map sample, requires keepHeightData to be set before loading (see quadtree for bilinear world space queries)
 		float getHeight(uint32_t x, uint32_t y)
 		{
+			assert(heightdata);
 			glm::ivec2 rpos = glm::ivec2(x, y) * glm::ivec2(scale);
 			rpos.x = std::max(0, std::min(rpos.x, (int)dim - 1));
 			rpos.y = std::max(0, std::min(rpos.y, (int)dim - 1));
@@ -74,176 +548,386 @@ namespace vks
 #else
 		void loadFromFile(const std::string filename, uint32_t patchsize, glm::vec3 scale, Topology topology)
 #endif
+		{
+			KTXSource source;
+			bool loaded = source.load(filename);
+			assert(loaded);
+			loadFromKTX(source, patchsize, scale, topology);
+		}
+
+		// Builds the height map from the first level of a 16 bit KTX file, heights are read straight from the file's data
+		void loadFromKTX(const KTXSource &source, uint32_t patchsize, glm::vec3 scale, Topology topology)
 		{
 			assert(device);
-			assert(copyQueue != VK_NULL_HANDLE);
+			assert(device->stagingUploader);
 
-			ktxResult result;
-			ktxTexture* ktxTexture;
-#if defined(__ANDROID__)
-			AAsset* asset = AAssetManager_open(androidApp->activity->assetManager, filename.c_str(), AASSET_MODE_STREAMING);
-			assert(asset);
-			size_t size = AAsset_getLength(asset);
-			assert(size > 0);
-			void *textureData = malloc(size);
-			AAsset_read(asset, textureData, size);
-			AAsset_close(asset);
-			result = ktxTexture_CreateFromMemory(textureData, size, KTX_TEXTURE_CREATE_LOAD_IMAGE_DATA_BIT, target);
-			free(textureData);
-#else
-			result = ktxTexture_CreateFromNamedFile(filename.c_str(), KTX_TEXTURE_CREATE_LOAD_IMAGE_DATA_BIT, &ktxTexture);
-#endif
-			assert(result == KTX_SUCCESS);
-			ktx_size_t ktxSize = ktxTexture_GetImageSize(ktxTexture, 0);
-			ktx_uint8_t* ktxImage = ktxTexture_GetData(ktxTexture);
-			dim = ktxTexture->baseWidth;
-			heightdata = new uint16_t[dim * dim];
-			memcpy(heightdata, ktxImage, ktxSize);
-			this->scale = dim / patchsize;
-			ktxTexture_Destroy(ktxTexture);
+			// Tessellation generates the detail for quad patches, so they only use a single level and have nothing to stream
+			const bool quads = (topology == topologyQuads);
+			if (quads) {
+				lodCount = 1;
+				streaming = false;
+			}
 
-			// Generate vertices
-			Vertex * vertices = new Vertex[patchsize * patchsize * 4];
+			const uint16_t* sourceHeights = reinterpret_cast<const uint16_t*>(source.data + source.getImageOffset(0, 0, 0));
+			dim = source.texture->baseWidth;
+			this->scale = dim / patchsize;
+			this->patchsize = patchsize;
+			meshScale = scale;
+			skirts = !quads;
+			delete[] heightdata;
+			heightdata = nullptr;
+			// Streamed chunks are built after the file has been released, from the tiles if there are any
+			assert(!streaming || !streamingTiles || (streamingTiles->loaded && streamingTiles->width == dim));
+			if (keepHeightData || (streaming && !streamingTiles)) {
+				heightdata = new uint16_t[dim * dim];
+				memcpy(heightdata, sourceHeights, dim * dim * sizeof(uint16_t));
+			}
 
-			const float wx = 2.0f;
-			const float wy = 2.0f;
+			// Generate grid vertices in row order, ranges of rows are built in parallel if a thread pool has been set
+			std::vector<Vertex> grid(patchsize * patchsize);
+			HeightMapBuilder builder(sourceHeights, dim, patchsize, heightScale);
+			auto buildRows = [&](uint32_t y0, uint32_t y1) {
+				buildGrid(builder, 0, patchsize, y0, y1, &grid[y0 * patchsize]);
+			};
+			if (threadPool) {
+				threadPool->parallelFor(patchsize, rowsPerJob, buildRows);
+			} else {
+				buildRows(0, patchsize);
+			}
 
-			for (uint32_t x = 0; x < patchsize; x++) {
-				for (uint32_t y = 0; y < patchsize; y++) {
-					uint32_t index = (x + y * patchsize);
-					vertices[index].pos[0] = (x * wx + wx / 2.0f - (float)patchsize * wx / 2.0f) * scale.x;
-					vertices[index].pos[1] = -getHeight(x, y) * scale.y + 1.0f;
-					vertices[index].pos[2] = (y * wy + wy / 2.0f - (float)patchsize * wy / 2.0f) * scale.z;
-					vertices[index].uv = glm::vec2((float)x / patchsize, (float)y / patchsize) * uvScale;
-					// Normal
-					float dx = getHeight(x < patchsize - 1 ? x + 1 : x, y) - getHeight(x > 0 ? x - 1 : x, y);
-					if (x == 0 || x == patchsize - 1)
-						dx *= 2.0f;
-					float dy = getHeight(x, y < patchsize - 1 ? y + 1 : y) - getHeight(x, y > 0 ? y - 1 : y);
-					if (y == 0 || y == patchsize - 1)
-						dy *= 2.0f;
-					glm::vec3 A = glm::vec3(1.0f, 0.0f, dx);
-					glm::vec3 B = glm::vec3(0.0f, 1.0f, dy);
-					glm::vec3 normal = (glm::normalize(glm::cross(A, B)) + 1.0f) * 0.5f;
-					normal = (glm::normalize(glm::cross(A, B)));
-					vertices[x + y * patchsize].normal = glm::vec3(normal.x, normal.y, normal.z);
-				}
-			}
-
-			// Generate indices
+			// Height queries use the same heights as the mesh
+			std::vector<float> gridHeights(grid.size());
+			for (size_t i = 0; i < grid.size(); i++) {
+				gridHeights[i] = grid[i].pos.y;
+			}
+			quadtree.build(gridHeights.data(), patchsize, glm::vec2(grid[0].pos.x, grid[0].pos.z), glm::vec2(2.0f * scale.x, 2.0f * scale.z));
 
+			// Each chunk gets its own block of vertices (see HeightMapIndexCache::chunkVertexCount), so all chunks of the same size share their indices
+			if (!indexCache) {
+				ownedIndexCache.reset(new HeightMapIndexCache());
+				indexCache = ownedIndexCache.get();
+			}
 			const uint32_t w = (patchsize - 1);
-			uint32_t *indices;
-
-			switch (topology)
-			{
-			// Indices for triangles
-			case topologyTriangles:
-			{
-				indices = new uint32_t[w * w * 6];
-				for (uint32_t x = 0; x < w; x++) {
-					for (uint32_t y = 0; y < w; y++) {
-						uint32_t index = (x + y * w) * 6;
-						indices[index] = (x + y * patchsize);
-						indices[index + 1] = indices[index] + patchsize;
-						indices[index + 2] = indices[index + 1] + 1;
-						indices[index + 3] = indices[index + 1] + 1;
-						indices[index + 4] = indices[index] + 1;
-						indices[index + 5] = indices[index];
+			const uint32_t chunksPerSide = (w + chunkSize - 1) / chunkSize;
+			indexType = HeightMapIndexCache::chunkIndexType(std::min(chunkSize, w), std::min(chunkSize, w), skirts);
+			primitiveRestart = triangleStrips && !quads;
+			std::vector<Vertex> vertices;
+			indexCount = 0;
+			auto gridVertex = [&](uint32_t x, uint32_t y) { return grid[x + y * patchsize]; };
+			const uint32_t coarseStep = 1 << (lodCount - 1);
+
+			chunks.resize(chunksPerSide * chunksPerSide);
+			for (uint32_t cy = 0; cy < chunksPerSide; cy++) {
+				for (uint32_t cx = 0; cx < chunksPerSide; cx++) {
+					Chunk &chunk = chunks[cx + cy * chunksPerSide];
+					chunk.x0 = cx * chunkSize;
+					chunk.y0 = cy * chunkSize;
+					chunk.width = std::min(chunk.x0 + chunkSize, w) - chunk.x0;
+					chunk.height = std::min(chunk.y0 + chunkSize, w) - chunk.y0;
+					chunk.resident = false;
+					chunk.lastRequested = 0;
+
+					// Streamed chunks only get their coarse block at load time, full detail blocks are built once they are requested
+					if (streaming) {
+						chunk.coarseVertexOffset = static_cast<int32_t>(vertices.size());
+						chunk.vertexOffset = chunk.coarseVertexOffset;
+						appendChunkVertices(vertices, chunk, coarseStep, gridVertex);
+						const HeightMapIndexCache::Range range = indexCache->get(sampledQuads(chunk.width, coarseStep), sampledQuads(chunk.height, coarseStep), 1, quads, primitiveRestart, indexType);
+						chunk.coarseLod.firstIndex = range.firstIndex;
+						chunk.coarseLod.indexCount = range.indexCount;
+					} else {
+						chunk.vertexOffset = static_cast<int32_t>(vertices.size());
+						appendChunkVertices(vertices, chunk, 1, gridVertex);
 					}
-				}
-				indexCount = (patchsize - 1) * (patchsize - 1) * 6;
-				indexBufferSize = (w * w * 6) * sizeof(uint32_t);
-				break;
-			}
-			// Indices for quad patches (tessellation)
-			case topologyQuads:
-			{
-				indices = new uint32_t[w * w * 4];
-				for (uint32_t x = 0; x < w; x++) {
-					for (uint32_t y = 0; y < w; y++) {
-						uint32_t index = (x + y * w) * 4;
-						indices[index] = (x + y * patchsize);
-						indices[index + 1] = indices[index] + patchsize;
-						indices[index + 2] = indices[index + 1] + 1;
-						indices[index + 3] = indices[index] + 1;
+
+					chunk.lods.clear();
+					for (uint32_t lod = 0; lod < lodCount; lod++) {
+						const HeightMapIndexCache::Range range = indexCache->get(chunk.width, chunk.height, 1 << lod, quads, primitiveRestart, indexType);
+						Chunk::LOD chunkLod;
+						chunkLod.firstIndex = range.firstIndex;
+						chunkLod.indexCount = range.indexCount;
+						chunk.lods.push_back(chunkLod);
 					}
+					indexCount += chunk.lods[0].indexCount;
+
+					// Bounding box (including the skirts), chunks cover whole nodes of the quadtree if the chunk size is a power of two
+					const glm::vec3 &first = grid[chunk.x0 + chunk.y0 * patchsize].pos;
+					const glm::vec3 &last = grid[(chunk.x0 + chunk.width) + (chunk.y0 + chunk.height) * patchsize].pos;
+					const glm::vec2 heightRange = quadtree.getHeightRange(chunk.x0, chunk.y0, chunk.x0 + chunk.width, chunk.y0 + chunk.height);
+					chunk.min = glm::vec3(std::min(first.x, last.x), heightRange.x, std::min(first.z, last.z));
+					chunk.max = glm::vec3(std::max(first.x, last.x), heightRange.y + skirtDepth * scale.y, std::max(first.z, last.z));
 				}
-				indexCount = (patchsize - 1) * (patchsize - 1) * 4;
-				indexBufferSize = (w * w * 4) * sizeof(uint32_t);
-				break;
 			}
+
+			// The full detail blocks of streamed chunks go into fixed size slots following the coarse blocks
+			uint32_t vertexCount = static_cast<uint32_t>(vertices.size());
+			if (streaming) {
+				slotBaseVertex = vertexCount;
+				slotVertexCount = HeightMapIndexCache::chunkVertexCount(std::min(chunkSize, w), std::min(chunkSize, w), skirts);
+				vertexCount += streamingSlotCount * slotVertexCount;
+				freeSlots.clear();
+				retiredSlots.clear();
+				for (uint32_t i = streamingSlotCount; i-- > 0;) {
+					freeSlots.push_back(i);
+				}
+				streamingFrame = 0;
+				streamingStats = StreamingStats();
 			}
 
-			assert(indexBufferSize > 0);
+			std::vector<PackedVertex> packedVertices;
+			if (vertexFormat == vertexFormatPacked) {
+				// Grid positions are shared by the skirts, so the height range has to include them
+				float heightMin = vertices[0].pos.y;
+				float heightMax = vertices[0].pos.y;
+				for (auto &vertex : vertices) {
+					heightMin = std::min(heightMin, vertex.pos.y);
+					heightMax = std::max(heightMax, vertex.pos.y);
+				}
+				// Coarse blocks skip most of the grid, the range has to cover the blocks streamed in later
+				if (streaming) {
+					for (auto &vertex : grid) {
+						heightMin = std::min(heightMin, vertex.pos.y);
+						heightMax = std::max(heightMax, vertex.pos.y + (skirts ? skirtDepth * scale.y : 0.0f));
+					}
+				}
+				setupVertexDecode(heightMin, heightMax, patchsize, scale);
+				packedVertices = packVertices(vertices);
+			}
 
-			vertexBufferSize = (patchsize * patchsize * 4) * sizeof(Vertex);
+			vertexBufferSize = (size_t)vertexCount * getVertexStride();
 
 			// Generate Vulkan buffers
 
-			vks::Buffer vertexStaging, indexStaging;
-
-			// Create staging buffers
-			device->createBuffer(
-				VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-				VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-				&vertexStaging,
-				vertexBufferSize,
-				vertices);
-
-			device->createBuffer(
-				VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-				VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-				&indexStaging,
-				indexBufferSize,
-				indices);
-
-			// Device local (target) buffer
 			device->createBuffer(
 				VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
 				VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
 				&vertexBuffer,
 				vertexBufferSize);
+			device->stagingUploader->uploadBuffer(
+				vertexBuffer.buffer,
+				(vertexFormat == vertexFormatPacked) ? (void*)packedVertices.data() : (void*)vertices.data(),
+				vertices.size() * getVertexStride(),
+				0,
+				VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT);
+
+			// Uploads the indices for chunk sizes that haven't been used by other height maps yet
+			indexCache->upload(device);
+			indexBufferSize = indexCache->size();
+		}
 
-			device->createBuffer(
-				VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
-				VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-				&indexBuffer,
-				indexBufferSize);
+		// Encodes a unit vector to the octahedron, folding the lower hemisphere over
+		static glm::vec2 encodeOctahedral(glm::vec3 n)
+		{
+			n /= (std::abs(n.x) + std::abs(n.y) + std::abs(n.z));
+			glm::vec2 e = glm::vec2(n.x, n.y);
+			if (n.z < 0.0f) {
+				e.x = (1.0f - std::abs(n.y)) * (n.x >= 0.0f ? 1.0f : -1.0f);
+				e.y = (1.0f - std::abs(n.x)) * (n.y >= 0.0f ? 1.0f : -1.0f);
+			}
+			return e;
+		}
 
-			// Copy from staging buffers
-			VkCommandBuffer copyCmd = device->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
+		void setupVertexDecode(float heightMin, float heightMax, uint32_t patchsize, glm::vec3 scale)
+		{
+			// pos.xz = (grid * 2 + 1 - patchsize) * scale.xz
+			vertexDecode.gridScale[0] = 2.0f * scale.x;
+			vertexDecode.gridScale[1] = 2.0f * scale.z;
+			vertexDecode.gridOffset[0] = (1.0f - (float)patchsize) * scale.x;
+			vertexDecode.gridOffset[1] = (1.0f - (float)patchsize) * scale.z;
+			vertexDecode.heightMin = heightMin;
+			vertexDecode.heightRange = std::max(heightMax - heightMin, 1e-6f);
+			vertexDecode.uvScale = uvScale / (float)patchsize;
+		}
 
-			VkBufferCopy copyRegion = {};
+		// Quantizes vertices using the decode constants set up by setupVertexDecode
+		std::vector<PackedVertex> packVertices(const std::vector<Vertex> &vertices) const
+		{
+			std::vector<PackedVertex> packedVertices(vertices.size());
+			for (size_t i = 0; i < vertices.size(); i++) {
+				const Vertex &vertex = vertices[i];
+				PackedVertex &packed = packedVertices[i];
+				packed.gridPos[0] = (uint16_t)std::round((vertex.pos.x - vertexDecode.gridOffset[0]) / vertexDecode.gridScale[0]);
+				packed.gridPos[1] = (uint16_t)std::round((vertex.pos.z - vertexDecode.gridOffset[1]) / vertexDecode.gridScale[1]);
+				packed.height = (uint16_t)std::round((vertex.pos.y - vertexDecode.heightMin) / vertexDecode.heightRange * 65535.0f);
+				const glm::vec2 normal = encodeOctahedral(vertex.normal);
+				packed.normal[0] = (int8_t)std::round(glm::clamp(normal.x, -1.0f, 1.0f) * 127.0f);
+				packed.normal[1] = (int8_t)std::round(glm::clamp(normal.y, -1.0f, 1.0f) * 127.0f);
+			}
+			return packedVertices;
+		}
 
-			copyRegion.size = vertexBufferSize;
-			vkCmdCopyBuffer(
-				copyCmd,
-				vertexStaging.buffer,
-				vertexBuffer.buffer,
-				1,
-				&copyRegion);
+		/**
+		* Vertex input bindings and attributes matching the vertex format
+		* Float: position (location 0), normal (location 1), uv (location 2)
+		* Packed: grid position (location 0, uvec2), octahedral normal (location 1, vec2), normalized height (location 2, float)
+		*/
+		void getVertexInputDescriptions(std::vector<VkVertexInputBindingDescription> &bindings, std::vector<VkVertexInputAttributeDescription> &attributes)
+		{
+			if (vertexFormat == vertexFormatPacked) {
+				bindings = { vks::initializers::vertexInputBindingDescription(0, sizeof(PackedVertex), VK_VERTEX_INPUT_RATE_VERTEX) };
+				attributes = {
+					vks::initializers::vertexInputAttributeDescription(0, 0, VK_FORMAT_R16G16_UINT, offsetof(PackedVertex, gridPos)),
+					vks::initializers::vertexInputAttributeDescription(0, 1, VK_FORMAT_R8G8_SNORM, offsetof(PackedVertex, normal)),
+					vks::initializers::vertexInputAttributeDescription(0, 2, VK_FORMAT_R16_UNORM, offsetof(PackedVertex, height)),
+				};
+			} else {
+				bindings = { vks::initializers::vertexInputBindingDescription(0, sizeof(Vertex), VK_VERTEX_INPUT_RATE_VERTEX) };
+				attributes = {
+					vks::initializers::vertexInputAttributeDescription(0, 0, VK_FORMAT_R32G32B32_SFLOAT, offsetof(Vertex, pos)),
+					vks::initializers::vertexInputAttributeDescription(0, 1, VK_FORMAT_R32G32B32_SFLOAT, offsetof(Vertex, normal)),
+					vks::initializers::vertexInputAttributeDescription(0, 2, VK_FORMAT_R32G32_SFLOAT, offsetof(Vertex, uv)),
+				};
+			}
+		}
+
+		// Specialization constants for decoding packed vertices, stays valid for the lifetime of the height map
+		const VkSpecializationInfo* getVertexSpecializationInfo()
+		{
+			for (uint32_t i = 0; i < 7; i++) {
+				vertexDecodeMapEntries[i] = { i, static_cast<uint32_t>(i * sizeof(float)), sizeof(float) };
+			}
+			vertexDecodeSpecializationInfo.mapEntryCount = 7;
+			vertexDecodeSpecializationInfo.pMapEntries = vertexDecodeMapEntries;
+			vertexDecodeSpecializationInfo.dataSize = sizeof(VertexDecodeConstants);
+			vertexDecodeSpecializationInfo.pData = &vertexDecode;
+			return &vertexDecodeSpecializationInfo;
+		}
+
+		/**
+		* Write one indexed indirect draw command per chunk
+		* Chunks outside the frustum get an instance count of zero, so the number of draws recorded in a command buffer stays the same
+		*
+		* @param commands Destination for chunks.size() draw commands (e.g. a mapped indirect buffer)
+		* @param viewProjection Matrix transforming terrain positions into clip space
+		* @param viewPos Viewer position used for selecting the level of detail
+		* @param ignoreDepth Skip the near and far planes (e.g. for shadow passes using depth clamp)
+		*
+		* @return Number of visible chunks
+		*/
+		uint32_t updateDrawCommands(VkDrawIndexedIndirectCommand *commands, const glm::mat4 &viewProjection, const glm::vec3 &viewPos, bool ignoreDepth = false)
+		{
+			vks::Frustum frustum;
+			frustum.update(viewProjection);
+			uint32_t visibleCount = 0;
+			for (size_t i = 0; i < chunks.size(); i++) {
+				const Chunk &chunk = chunks[i];
+				VkDrawIndexedIndirectCommand &command = commands[i];
+				// Streamed chunks that aren't resident are drawn from their coarse block
+				const Chunk::LOD &lod = (streaming && !chunk.resident) ? chunk.coarseLod : chunk.lods[selectLod(chunk, viewPos)];
+				command.indexCount = lod.indexCount;
+				command.firstIndex = lod.firstIndex;
+				command.vertexOffset = chunk.vertexOffset;
+				command.firstInstance = 0;
+				command.instanceCount = (!frustumCulling || frustum.checkBox(chunk.min, chunk.max, ignoreDepth)) ? 1 : 0;
+				visibleCount += command.instanceCount;
+			}
+			return visibleCount;
+		}
+
+		/** @brief Distance from the viewer to the closest point of a chunk's bounding box */
+		float getChunkDistance(const Chunk &chunk, const glm::vec3 &viewPos) const
+		{
+			return glm::length(glm::max(glm::max(chunk.min - viewPos, viewPos - chunk.max), glm::vec3(0.0f)));
+		}
 
-			copyRegion.size = indexBufferSize;
-			vkCmdCopyBuffer(
-				copyCmd,
-				indexStaging.buffer,
-				indexBuffer.buffer,
-				1,
-				&copyRegion);
+		/** @brief True if the viewer is close enough for the chunk to use a higher level of detail than the lowest one */
+		bool isDetailRequested(const Chunk &chunk, const glm::vec3 &viewPos) const
+		{
+			return selectLod(chunk, viewPos) + 1 < chunk.lods.size();
+		}
 
-			device->flushCommandBuffer(copyCmd, copyQueue, true);
+		/**
+		* Request the chunks that need their full detail block, evict the chunks requested the longest time ago if all slots are in use and upload up to streamingUploadsPerFrame requested chunks
+		* Has to be called before writing the frame's draw commands and from the thread that submits to the graphics queue, the uploads are submitted before returning
+		*
+		* @param viewPos Viewer position, chunks are requested while they are close enough to use a higher level of detail than the lowest one
+		* @param framesInFlight Number of frames that may still be drawing from the slots, slots of evicted chunks are reused after that many calls
+		*/
+		void updateStreaming(const glm::vec3 &viewPos, uint32_t framesInFlight)
+		{
+			if (!streaming) {
+				return;
+			}
+			streamingFrame++;
+			for (auto it = retiredSlots.begin(); it != retiredSlots.end();) {
+				if (streamingFrame - it->frame > framesInFlight) {
+					freeSlots.push_back(it->slot);
+					it = retiredSlots.erase(it);
+				} else {
+					++it;
+				}
+			}
+
+			// Closest chunks first, so the detail around the viewer arrives before the detail further away
+			std::vector<std::pair<float, uint32_t>> requests;
+			streamingStats.requestedChunks = 0;
+			for (uint32_t i = 0; i < chunks.size(); i++) {
+				Chunk &chunk = chunks[i];
+				if (!isDetailRequested(chunk, viewPos)) {
+					continue;
+				}
+				chunk.lastRequested = streamingFrame;
+				streamingStats.requestedChunks++;
+				if (!chunk.resident) {
+					requests.push_back({ getChunkDistance(chunk, viewPos), i });
+				}
+			}
+			std::sort(requests.begin(), requests.end());
+
+			// Evicted slots only become free after the frames in flight, so evict ahead of the requests queued up this frame
+			const size_t needed = std::min<size_t>(requests.size(), streamingUploadsPerFrame);
+			while (freeSlots.size() + retiredSlots.size() < needed && evictChunk()) {}
+
+			TiledHeightSource tileSource(streamingTiles);
+			HeightMapBuilder builder = streamingTiles ? HeightMapBuilder(&tileSource, dim, patchsize, heightScale) : HeightMapBuilder(heightdata, dim, patchsize, heightScale);
+			uint32_t uploads = 0;
+			for (auto &request : requests) {
+				if (uploads == streamingUploadsPerFrame || freeSlots.empty()) {
+					break;
+				}
+				const uint32_t slot = freeSlots.back();
+				freeSlots.pop_back();
+				uploadChunk(chunks[request.second], slot, builder);
+				uploads++;
+			}
+			if (uploads > 0) {
+				// Draws submitted afterwards are ordered after the uploads
+				device->stagingUploader->submit();
+			}
+			streamingStats.residentChunks = streamingSlotCount - static_cast<uint32_t>(freeSlots.size() + retiredSlots.size());
+		}
 
-			vkDestroyBuffer(device->logicalDevice, vertexStaging.buffer, nullptr);
-			vkFreeMemory(device->logicalDevice, vertexStaging.memory, nullptr);
-			vkDestroyBuffer(device->logicalDevice, indexStaging.buffer, nullptr);
-			vkFreeMemory(device->logicalDevice, indexStaging.memory, nullptr);
+		VkPrimitiveTopology getPrimitiveTopology() {
+			return primitiveRestart ? VK_PRIMITIVE_TOPOLOGY_TRIANGLE_STRIP : VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
 		}
+
+		// Draw all chunks at full detail (streamed chunks at the detail they are resident with when recording)
 		void draw(VkCommandBuffer cb) {
 			const VkDeviceSize offsets[1] = { 0 };
 			vkCmdBindVertexBuffers(cb, 0, 1, &vertexBuffer.buffer, offsets);
-			vkCmdBindIndexBuffer(cb, indexBuffer.buffer, 0, VK_INDEX_TYPE_UINT32);
-			vkCmdDrawIndexed(cb, indexCount, 1, 0, 0, 0);
+			vkCmdBindIndexBuffer(cb, indexCache->getBuffer(indexType), 0, indexType);
+			for (auto &chunk : chunks) {
+				const Chunk::LOD &lod = (streaming && !chunk.resident) ? chunk.coarseLod : chunk.lods[0];
+				vkCmdDrawIndexed(cb, lod.indexCount, 1, lod.firstIndex, chunk.vertexOffset, 0);
+			}
+			VKS_COUNTER_ADD("Draw calls recorded", chunks.size());
+		}
+
+		// Draw the chunks using the commands written by updateDrawCommands
+		void drawIndirect(VkCommandBuffer cb, VkBuffer buffer, VkDeviceSize offset) {
+			const VkDeviceSize offsets[1] = { 0 };
+			vkCmdBindVertexBuffers(cb, 0, 1, &vertexBuffer.buffer, offsets);
+			vkCmdBindIndexBuffer(cb, indexCache->getBuffer(indexType), 0, indexType);
+			const uint32_t stride = sizeof(VkDrawIndexedIndirectCommand);
+			if (device->enabledFeatures.multiDrawIndirect) {
+				vkCmdDrawIndexedIndirect(cb, buffer, offset, static_cast<uint32_t>(chunks.size()), stride);
+				VKS_COUNTER_ADD("Draw calls recorded", 1);
+			} else {
+				for (uint32_t i = 0; i < chunks.size(); i++) {
+					vkCmdDrawIndexedIndirect(cb, buffer, offset + i * stride, 1, stride);
+				}
+				VKS_COUNTER_ADD("Draw calls recorded", chunks.size());
+			}
 		}
 	};
 }
@@ -0,0 +1,352 @@
+/*
+* CPU instrumentation with scoped zones and counters
+*
+* Zones and counters are accumulated per frame and flushed by endFrame, optionally into a trace file in the Chrome trace event format (chrome://tracing, ui.perfetto.dev)
+* The VKS_ZONE and VKS_COUNTER_ADD macros compile to nothing unless VKS_INSTRUMENTATION is defined (see the USE_INSTRUMENTATION CMake option)
+*
+* Copyright (C) by Sascha Willems - www.saschawillems.de
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <vector>
+#include <string>
+#include <array>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <assert.h>
+#include <stdint.h>
+
+namespace vks
+{
+	class Instrumentation
+	{
+	public:
+		static const uint32_t MAX_ZONES = 64;
+		static const uint32_t MAX_COUNTERS = 64;
+
+		/** @brief Time spent in a zone during the last flushed frame */
+		struct ZoneStats {
+			const char* name = nullptr;
+			// Summed up over all threads and calls of the frame
+			double time = 0.0;
+			// Moving average of the time, for display
+			double average = 0.0;
+			uint32_t calls = 0;
+		};
+
+		/** @brief Value of a counter summed up over the last flushed frame */
+		struct CounterStats {
+			const char* name = nullptr;
+			int64_t value = 0;
+			double average = 0.0;
+		};
+
+		/** @brief Measures the time between construction and destruction, use VKS_ZONE instead of creating these directly */
+		class ScopedZone
+		{
+		public:
+			ScopedZone(uint32_t zone) : zone(zone), start(Instrumentation::get().now()) {}
+			~ScopedZone()
+			{
+				Instrumentation::get().recordZone(zone, start, Instrumentation::get().now());
+			}
+		private:
+			uint32_t zone;
+			int64_t start;
+		};
+
+	private:
+		struct Zone {
+			const char* name = nullptr;
+			std::atomic<int64_t> time{ 0 };
+			std::atomic<uint32_t> calls{ 0 };
+		};
+
+		struct Counter {
+			const char* name = nullptr;
+			std::atomic<int64_t> value{ 0 };
+		};
+
+		struct TraceEvent {
+			uint32_t zone;
+			uint32_t thread;
+			int64_t start;
+			int64_t duration;
+		};
+
+		std::array<Zone, MAX_ZONES> zones;
+		std::array<Counter, MAX_COUNTERS> counters;
+		std::atomic<uint32_t> zoneCount{ 0 };
+		std::atomic<uint32_t> counterCount{ 0 };
+		std::atomic<uint32_t> threadCount{ 0 };
+		std::vector<ZoneStats> zoneStats;
+		std::vector<CounterStats> counterStats;
+		std::chrono::steady_clock::time_point startTime;
+
+		// Zones are only collected as events while a trace file is open
+		std::atomic<bool> tracing{ false };
+		std::vector<TraceEvent> traceEvents;
+		std::ofstream traceFile;
+		std::string traceFilename;
+		uint32_t tracedFrames = 0;
+		uint32_t maxTracedFrames = 0;
+		std::vector<bool> namedThreads;
+		// The thread flushing the frames
+		uint32_t mainThread = 0;
+
+		std::mutex lock;
+
+		Instrumentation() : startTime(std::chrono::steady_clock::now()) {}
+		Instrumentation(const Instrumentation&) = delete;
+		Instrumentation& operator=(const Instrumentation&) = delete;
+
+		// Small sequential ids for the trace in the order threads first record a zone
+		uint32_t getThreadId()
+		{
+			static thread_local uint32_t id = threadCount++;
+			return id;
+		}
+
+		static std::string escapeJson(const char* value)
+		{
+			std::string escaped;
+			for (const char* c = value; *c; c++) {
+				if (*c == '"' || *c == '\\') {
+					escaped += '\\';
+				}
+				escaped += *c;
+			}
+			return escaped;
+		}
+
+		// Trace timestamps are in microseconds
+		static double toMicroseconds(int64_t nanoseconds)
+		{
+			return nanoseconds / 1000.0;
+		}
+
+		void writeTraceFrame(int64_t frameEnd)
+		{
+			for (const TraceEvent& event : traceEvents) {
+				if (event.thread >= namedThreads.size()) {
+					namedThreads.resize(event.thread + 1, false);
+				}
+				if (!namedThreads[event.thread]) {
+					const std::string threadName = (event.thread == mainThread) ? "Main thread" : "Thread " + std::to_string(event.thread);
+					traceFile << ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":" << event.thread << ",\"args\":{\"name\":\"" << threadName << "\"}}";
+					namedThreads[event.thread] = true;
+				}
+				traceFile << ",\n{\"name\":\"" << escapeJson(zones[event.zone].name) << "\",\"cat\":\"cpu\",\"ph\":\"X\",\"pid\":0,\"tid\":" << event.thread
+					<< ",\"ts\":" << toMicroseconds(event.start) << ",\"dur\":" << toMicroseconds(event.duration) << "}";
+			}
+			// Counters are written as one track each at the end of the frame they were summed up over
+			for (const CounterStats& counter : counterStats) {
+				traceFile << ",\n{\"name\":\"" << escapeJson(counter.name) << "\",\"ph\":\"C\",\"pid\":0,\"tid\":0,\"ts\":" << toMicroseconds(frameEnd)
+					<< ",\"args\":{\"value\":" << counter.value << "}}";
+			}
+			traceEvents.clear();
+		}
+
+	public:
+		~Instrumentation()
+		{
+			stopTrace();
+		}
+
+		/** @brief The process wide instrumentation */
+		static Instrumentation& get()
+		{
+			static Instrumentation instance;
+			return instance;
+		}
+
+		/** @brief Nanoseconds since the instrumentation was created */
+		int64_t now() const
+		{
+			return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - startTime).count();
+		}
+
+		/** @brief Register a zone name, names must outlive the instrumentation (e.g. string literals) */
+		uint32_t registerZone(const char* name)
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			const uint32_t count = zoneCount;
+			for (uint32_t i = 0; i < count; i++) {
+				if (zones[i].name == name || std::string(zones[i].name) == name) {
+					return i;
+				}
+			}
+			assert(count < MAX_ZONES);
+			zones[count].name = name;
+			zoneCount = count + 1;
+			return count;
+		}
+
+		/** @brief Register a counter name, names must outlive the instrumentation (e.g. string literals) */
+		uint32_t registerCounter(const char* name)
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			const uint32_t count = counterCount;
+			for (uint32_t i = 0; i < count; i++) {
+				if (counters[i].name == name || std::string(counters[i].name) == name) {
+					return i;
+				}
+			}
+			assert(count < MAX_COUNTERS);
+			counters[count].name = name;
+			counterCount = count + 1;
+			return count;
+		}
+
+		/** @brief Add a zone's time to the current frame, may be called from any thread */
+		void recordZone(uint32_t zone, int64_t start, int64_t end)
+		{
+			zones[zone].time.fetch_add(end - start, std::memory_order_relaxed);
+			zones[zone].calls.fetch_add(1, std::memory_order_relaxed);
+			if (tracing.load(std::memory_order_relaxed)) {
+				const TraceEvent event = { zone, getThreadId(), start, end - start };
+				std::lock_guard<std::mutex> guard(lock);
+				traceEvents.push_back(event);
+			}
+		}
+
+		/** @brief Add to a counter of the current frame, may be called from any thread */
+		void addCounter(uint32_t counter, int64_t value)
+		{
+			counters[counter].value.fetch_add(value, std::memory_order_relaxed);
+		}
+
+		/**
+		* Start writing zones and counters to a trace file in the Chrome trace event format
+		*
+		* @param filename Trace file to (over)write
+		* @param maxFrames (Optional) Stop tracing after this number of frames, 0 traces until stopTrace is called
+		*
+		* @return False if the file could not be opened
+		*/
+		bool startTrace(const std::string& filename, uint32_t maxFrames = 0)
+		{
+			stopTrace();
+			std::lock_guard<std::mutex> guard(lock);
+			traceFile.open(filename, std::ios::out | std::ios::trunc);
+			if (!traceFile.is_open()) {
+				std::cerr << "Could not open trace file \"" << filename << "\"" << std::endl;
+				return false;
+			}
+			// The process name doubles as the first event, so all further events can be prefixed with a separator
+			traceFile << "{\"traceEvents\":[\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":0,\"args\":{\"name\":\"VulkanPlayground\"}}";
+			traceFilename = filename;
+			tracedFrames = 0;
+			maxTracedFrames = maxFrames;
+			namedThreads.clear();
+			traceEvents.clear();
+			tracing = true;
+			return true;
+		}
+
+		/** @brief Finish and close the trace file, zones recorded since the last flush are discarded */
+		void stopTrace()
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			if (!traceFile.is_open()) {
+				return;
+			}
+			tracing = false;
+			traceEvents.clear();
+			traceFile << "\n],\"displayTimeUnit\":\"ms\"}\n";
+			traceFile.close();
+			std::cout << "Trace with " << tracedFrames << " frames written to \"" << traceFilename << "\"" << std::endl;
+		}
+
+		bool isTracing() const
+		{
+			return tracing;
+		}
+
+		const std::string& getTraceFilename() const
+		{
+			return traceFilename;
+		}
+
+		uint32_t getTracedFrames() const
+		{
+			return tracedFrames;
+		}
+
+		/** @brief Flush the zones and counters of the current frame into the frame statistics (and the trace), call once per frame on the main thread */
+		void endFrame()
+		{
+			bool traceFinished = false;
+			{
+				std::lock_guard<std::mutex> guard(lock);
+				const int64_t frameEnd = now();
+				mainThread = getThreadId();
+				const uint32_t zoneTotal = zoneCount;
+				const uint32_t counterTotal = counterCount;
+				// Zones and counters registered during the frame start their averages with their first value
+				zoneStats.resize(zoneTotal);
+				counterStats.resize(counterTotal);
+				for (uint32_t i = 0; i < zoneTotal; i++) {
+					ZoneStats& stats = zoneStats[i];
+					const bool first = (stats.name == nullptr);
+					stats.name = zones[i].name;
+					stats.time = zones[i].time.exchange(0, std::memory_order_relaxed) / 1000000.0;
+					stats.calls = zones[i].calls.exchange(0, std::memory_order_relaxed);
+					stats.average = first ? stats.time : stats.average * 0.95 + stats.time * 0.05;
+				}
+				for (uint32_t i = 0; i < counterTotal; i++) {
+					CounterStats& stats = counterStats[i];
+					const bool first = (stats.name == nullptr);
+					stats.name = counters[i].name;
+					stats.value = counters[i].value.exchange(0, std::memory_order_relaxed);
+					stats.average = first ? (double)stats.value : stats.average * 0.95 + stats.value * 0.05;
+				}
+				if (tracing) {
+					writeTraceFrame(frameEnd);
+					tracedFrames++;
+					traceFinished = (maxTracedFrames > 0) && (tracedFrames >= maxTracedFrames);
+				}
+			}
+			if (traceFinished) {
+				stopTrace();
+			}
+		}
+
+		/** @brief Zones of the last flushed frame in registration order */
+		const std::vector<ZoneStats>& getZoneStats() const
+		{
+			return zoneStats;
+		}
+
+		/** @brief Counters of the last flushed frame in registration order */
+		const std::vector<CounterStats>& getCounterStats() const
+		{
+			return counterStats;
+		}
+	};
+}
+
+#if defined(VKS_INSTRUMENTATION)
+#define VKS_INSTRUMENTATION_CONCAT_(a, b) a##b
+#define VKS_INSTRUMENTATION_CONCAT(a, b) VKS_INSTRUMENTATION_CONCAT_(a, b)
+// Times the rest of the enclosing scope, the name is registered once per call site
+#define VKS_ZONE(name) \
+	static const uint32_t VKS_INSTRUMENTATION_CONCAT(vksZoneId, __LINE__) = vks::Instrumentation::get().registerZone(name); \
+	vks::Instrumentation::ScopedZone VKS_INSTRUMENTATION_CONCAT(vksZone, __LINE__)(VKS_INSTRUMENTATION_CONCAT(vksZoneId, __LINE__))
+#define VKS_COUNTER_ADD(name, value) \
+	do { \
+		static const uint32_t vksCounterId = vks::Instrumentation::get().registerCounter(name); \
+		vks::Instrumentation::get().addCounter(vksCounterId, (int64_t)(value)); \
+	} while (0)
+#define VKS_FRAME_END() vks::Instrumentation::get().endFrame()
+#else
+#define VKS_ZONE(name)
+#define VKS_COUNTER_ADD(name, value) do {} while (0)
+#define VKS_FRAME_END() do {} while (0)
+#endif
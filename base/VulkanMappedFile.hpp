@@ -0,0 +1,163 @@
+/*
+* Read only memory mapped files
+*
+* Maps asset files into the address space so loaders can read from them without copying them to the heap first
+* Uses mmap on Linux, file mappings on Windows and asset buffers on Android
+*
+* Copyright (C) by Sascha Willems - www.saschawillems.de
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <string>
+#include <algorithm>
+#include <stdint.h>
+#include <stddef.h>
+
+#if defined(_WIN32)
+#include <windows.h>
+#elif defined(__ANDROID__)
+#include "VulkanAndroid.h"
+#include <android/asset_manager.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace vks
+{
+	class MappedFile
+	{
+	private:
+#if defined(_WIN32)
+		HANDLE fileHandle = INVALID_HANDLE_VALUE;
+		HANDLE mappingHandle = nullptr;
+#elif defined(__ANDROID__)
+		AAsset* asset = nullptr;
+#endif
+		const uint8_t* mappedData = nullptr;
+		size_t mappedSize = 0;
+
+		MappedFile(const MappedFile&) = delete;
+		MappedFile& operator=(const MappedFile&) = delete;
+	public:
+		MappedFile() {}
+
+		~MappedFile()
+		{
+			close();
+		}
+
+		/**
+		* Map a file for reading
+		*
+		* @param filename File to map (asset path on Android)
+		*
+		* @return True if the file could be opened and mapped
+		*/
+		bool open(const std::string& filename)
+		{
+			close();
+#if defined(_WIN32)
+			fileHandle = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+			if (fileHandle == INVALID_HANDLE_VALUE) {
+				return false;
+			}
+			LARGE_INTEGER fileSize;
+			if (!GetFileSizeEx(fileHandle, &fileSize) || fileSize.QuadPart == 0) {
+				close();
+				return false;
+			}
+			mappingHandle = CreateFileMappingA(fileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+			if (!mappingHandle) {
+				close();
+				return false;
+			}
+			mappedData = static_cast<const uint8_t*>(MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0));
+			mappedSize = static_cast<size_t>(fileSize.QuadPart);
+#elif defined(__ANDROID__)
+			// Uncompressed assets are mapped directly from the apk
+			asset = AAssetManager_open(androidApp->activity->assetManager, filename.c_str(), AASSET_MODE_BUFFER);
+			if (!asset) {
+				return false;
+			}
+			mappedData = static_cast<const uint8_t*>(AAsset_getBuffer(asset));
+			mappedSize = static_cast<size_t>(AAsset_getLength(asset));
+#else
+			int fd = ::open(filename.c_str(), O_RDONLY);
+			if (fd < 0) {
+				return false;
+			}
+			struct stat fileStat;
+			if (fstat(fd, &fileStat) != 0 || fileStat.st_size == 0) {
+				::close(fd);
+				return false;
+			}
+			void* data = mmap(nullptr, static_cast<size_t>(fileStat.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+			// The mapping stays valid after closing the descriptor
+			::close(fd);
+			if (data == MAP_FAILED) {
+				return false;
+			}
+			mappedData = static_cast<const uint8_t*>(data);
+			mappedSize = static_cast<size_t>(fileStat.st_size);
+#endif
+			if (!mappedData) {
+				close();
+				return false;
+			}
+			return true;
+		}
+
+		void close()
+		{
+#if defined(_WIN32)
+			if (mappedData) {
+				UnmapViewOfFile(mappedData);
+			}
+			if (mappingHandle) {
+				CloseHandle(mappingHandle);
+				mappingHandle = nullptr;
+			}
+			if (fileHandle != INVALID_HANDLE_VALUE) {
+				CloseHandle(fileHandle);
+				fileHandle = INVALID_HANDLE_VALUE;
+			}
+#elif defined(__ANDROID__)
+			if (asset) {
+				AAsset_close(asset);
+				asset = nullptr;
+			}
+#else
+			if (mappedData) {
+				munmap(const_cast<uint8_t*>(mappedData), mappedSize);
+			}
+#endif
+			mappedData = nullptr;
+			mappedSize = 0;
+		}
+
+		/** @brief Hint that a range of the file is about to be read, so it can be paged in ahead of time (e.g. from a loader thread) */
+		void prefetch(size_t offset, size_t size) const
+		{
+#if !defined(_WIN32) && !defined(__ANDROID__)
+			if (!mappedData || offset >= mappedSize) {
+				return;
+			}
+			// madvise needs a page aligned address
+			const size_t pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+			const size_t begin = offset / pageSize * pageSize;
+			const size_t end = std::min(offset + size, mappedSize);
+			madvise(const_cast<uint8_t*>(mappedData) + begin, end - begin, MADV_WILLNEED);
+#endif
+		}
+
+		bool isOpen() const { return mappedData != nullptr; }
+		const uint8_t* data() const { return mappedData; }
+		size_t size() const { return mappedSize; }
+	};
+}
@@ -0,0 +1,316 @@
+/*
+* Vulkan device memory sub-allocator
+*
+* Resources are placed into large memory blocks instead of getting a device memory allocation each
+* Blocks are kept per memory type, with linear (buffers, linear images) and optimal (optimal tiled images) resources in separate blocks
+* so the buffer image granularity never has to be taken into account
+*
+* Copyright (C) by Sascha Willems - www.saschawillems.de
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <vector>
+#include <mutex>
+#include <algorithm>
+#include <assert.h>
+#include "vulkan/vulkan.h"
+#include "VulkanTools.h"
+#include "VulkanInstrumentation.hpp"
+
+namespace vks
+{
+	enum AllocationTiling { allocationTilingLinear = 0, allocationTilingOptimal = 1 };
+
+	struct MemoryBlock;
+
+	/** @brief Sub range of a device memory block (or a dedicated device memory allocation) */
+	struct Allocation
+	{
+		VkDeviceMemory memory = VK_NULL_HANDLE;
+		VkDeviceSize offset = 0;
+		VkDeviceSize size = 0;
+		/** @brief Persistent host mapping of the allocation start, nullptr for memory that's not host visible */
+		void* mapped = nullptr;
+		uint32_t memoryTypeIndex = 0;
+		/** @brief Owning block, nullptr for dedicated allocations */
+		MemoryBlock* block = nullptr;
+	};
+
+	struct MemoryBlock
+	{
+		struct Range {
+			VkDeviceSize offset;
+			VkDeviceSize size;
+		};
+		VkDeviceMemory memory = VK_NULL_HANDLE;
+		VkDeviceSize size = 0;
+		VkDeviceSize used = 0;
+		void* mapped = nullptr;
+		uint32_t memoryTypeIndex = 0;
+		AllocationTiling tiling = allocationTilingLinear;
+		uint32_t allocationCount = 0;
+		// Free ranges sorted by offset, adjacent ranges are always merged
+		std::vector<Range> freeRanges;
+
+		bool allocate(VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize* offset)
+		{
+			for (size_t i = 0; i < freeRanges.size(); i++) {
+				Range range = freeRanges[i];
+				const VkDeviceSize alignedOffset = (range.offset + alignment - 1) / alignment * alignment;
+				if (alignedOffset + size > range.offset + range.size) {
+					continue;
+				}
+				// Split into the alignment padding in front and the remainder behind the allocation
+				const Range front = { range.offset, alignedOffset - range.offset };
+				const Range back = { alignedOffset + size, range.offset + range.size - (alignedOffset + size) };
+				freeRanges.erase(freeRanges.begin() + i);
+				if (back.size > 0) {
+					freeRanges.insert(freeRanges.begin() + i, back);
+				}
+				if (front.size > 0) {
+					freeRanges.insert(freeRanges.begin() + i, front);
+				}
+				*offset = alignedOffset;
+				used += size;
+				allocationCount++;
+				return true;
+			}
+			return false;
+		}
+
+		void free(VkDeviceSize offset, VkDeviceSize size)
+		{
+			auto it = std::lower_bound(freeRanges.begin(), freeRanges.end(), offset, [](const Range& range, VkDeviceSize value) { return range.offset < value; });
+			it = freeRanges.insert(it, { offset, size });
+			// Merge with the following range
+			if (it + 1 != freeRanges.end() && it->offset + it->size == (it + 1)->offset) {
+				it->size += (it + 1)->size;
+				freeRanges.erase(it + 1);
+			}
+			// Merge with the preceding range
+			if (it != freeRanges.begin() && (it - 1)->offset + (it - 1)->size == it->offset) {
+				(it - 1)->size += it->size;
+				freeRanges.erase(it);
+			}
+			used -= size;
+			allocationCount--;
+		}
+	};
+
+	class MemoryAllocator
+	{
+	public:
+		/** @brief Used and reserved memory of a memory heap */
+		struct HeapStats {
+			VkDeviceSize used = 0;
+			VkDeviceSize reserved = 0;
+			uint32_t blockCount = 0;
+			uint32_t dedicatedCount = 0;
+			uint32_t allocationCount = 0;
+		};
+
+		/** @brief Preferred size of new blocks (clamped to an eighth of the heap size so small heaps don't get exhausted) */
+		VkDeviceSize preferredBlockSize = 64 * 1024 * 1024;
+		/** @brief Images of at least this size get a dedicated allocation */
+		VkDeviceSize dedicatedImageSize = 16 * 1024 * 1024;
+
+		MemoryAllocator(VkPhysicalDevice physicalDevice, VkDevice device)
+		{
+			this->device = device;
+			vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+			VkPhysicalDeviceProperties properties;
+			vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+			nonCoherentAtomSize = std::max<VkDeviceSize>(properties.limits.nonCoherentAtomSize, 1);
+			dedicatedAllocations.resize(memoryProperties.memoryHeapCount);
+		}
+
+		~MemoryAllocator()
+		{
+			for (uint32_t i = 0; i < VK_MAX_MEMORY_TYPES; i++) {
+				for (uint32_t j = 0; j < 2; j++) {
+					for (auto block : blocks[i][j]) {
+						destroyBlock(block);
+					}
+				}
+			}
+		}
+
+		/**
+		* Allocate memory for a resource
+		*
+		* @param memReqs Memory requirements of the resource
+		* @param memoryTypeIndex Memory type to allocate from
+		* @param tiling Linear for buffers and linear tiled images, optimal for optimal tiled images
+		* @param dedicated (Optional) Force a dedicated device memory allocation
+		*
+		* @return Allocation with the memory handle and offset to bind the resource at
+		*/
+		Allocation allocate(const VkMemoryRequirements& memReqs, uint32_t memoryTypeIndex, AllocationTiling tiling, bool dedicated = false)
+		{
+			VKS_ZONE("Memory allocation");
+			assert(memoryTypeIndex < memoryProperties.memoryTypeCount);
+			const VkMemoryPropertyFlags typeFlags = memoryProperties.memoryTypes[memoryTypeIndex].propertyFlags;
+			const bool hostVisible = (typeFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) != 0;
+			VkDeviceSize alignment = std::max<VkDeviceSize>(memReqs.alignment, 1);
+			VkDeviceSize size = memReqs.size;
+			// Keep non-coherent allocations on atom boundaries so flushing one never touches a neighbour
+			if (hostVisible && (typeFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) == 0) {
+				alignment = std::max(alignment, nonCoherentAtomSize);
+				size = (size + nonCoherentAtomSize - 1) / nonCoherentAtomSize * nonCoherentAtomSize;
+			}
+
+			VKS_COUNTER_ADD("Memory allocations", 1);
+			VKS_COUNTER_ADD("Memory allocated (bytes)", size);
+
+			std::lock_guard<std::mutex> lock(mutex);
+			const uint32_t heapIndex = memoryProperties.memoryTypes[memoryTypeIndex].heapIndex;
+			const VkDeviceSize blockSize = getBlockSize(heapIndex);
+
+			Allocation allocation;
+			allocation.memoryTypeIndex = memoryTypeIndex;
+			allocation.size = size;
+
+			if (dedicated || size > blockSize / 2) {
+				VkMemoryAllocateInfo memAlloc = vks::initializers::memoryAllocateInfo();
+				memAlloc.allocationSize = size;
+				memAlloc.memoryTypeIndex = memoryTypeIndex;
+				VK_CHECK_RESULT(vkAllocateMemory(device, &memAlloc, nullptr, &allocation.memory));
+				VKS_COUNTER_ADD("Device memory allocations", 1);
+				if (hostVisible) {
+					VK_CHECK_RESULT(vkMapMemory(device, allocation.memory, 0, VK_WHOLE_SIZE, 0, &allocation.mapped));
+				}
+				HeapStats& stats = dedicatedAllocations[heapIndex];
+				stats.used += size;
+				stats.reserved += size;
+				stats.dedicatedCount++;
+				stats.allocationCount++;
+				return allocation;
+			}
+
+			std::vector<MemoryBlock*>& pool = blocks[memoryTypeIndex][tiling];
+			MemoryBlock* target = nullptr;
+			VkDeviceSize offset = 0;
+			for (auto block : pool) {
+				if (block->size - block->used >= size && block->allocate(size, alignment, &offset)) {
+					target = block;
+					break;
+				}
+			}
+			if (!target) {
+				target = createBlock(memoryTypeIndex, tiling, blockSize);
+				pool.push_back(target);
+				bool fits = target->allocate(size, alignment, &offset);
+				assert(fits);
+				(void)fits;
+			}
+
+			allocation.memory = target->memory;
+			allocation.offset = offset;
+			allocation.block = target;
+			if (target->mapped) {
+				allocation.mapped = static_cast<uint8_t*>(target->mapped) + offset;
+			}
+			return allocation;
+		}
+
+		/** @brief Return an allocation to its block (or release its dedicated device memory) */
+		void free(Allocation& allocation)
+		{
+			if (allocation.memory == VK_NULL_HANDLE) {
+				return;
+			}
+			std::lock_guard<std::mutex> lock(mutex);
+			const uint32_t heapIndex = memoryProperties.memoryTypes[allocation.memoryTypeIndex].heapIndex;
+			if (!allocation.block) {
+				if (allocation.mapped) {
+					vkUnmapMemory(device, allocation.memory);
+				}
+				vkFreeMemory(device, allocation.memory, nullptr);
+				HeapStats& stats = dedicatedAllocations[heapIndex];
+				stats.used -= allocation.size;
+				stats.reserved -= allocation.size;
+				stats.dedicatedCount--;
+				stats.allocationCount--;
+			} else {
+				MemoryBlock* block = allocation.block;
+				block->free(allocation.offset, allocation.size);
+				// Release empty blocks, but keep the last one of a pool around to avoid reallocating for short lived resources
+				std::vector<MemoryBlock*>& pool = blocks[block->memoryTypeIndex][block->tiling];
+				if (block->allocationCount == 0 && pool.size() > 1) {
+					pool.erase(std::find(pool.begin(), pool.end(), block));
+					destroyBlock(block);
+				}
+			}
+			allocation = Allocation();
+		}
+
+		/** @brief Used vs. reserved memory for each memory heap of the device */
+		std::vector<HeapStats> getHeapStats()
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			std::vector<HeapStats> stats(dedicatedAllocations);
+			for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++) {
+				HeapStats& heap = stats[memoryProperties.memoryTypes[i].heapIndex];
+				for (uint32_t j = 0; j < 2; j++) {
+					for (auto block : blocks[i][j]) {
+						heap.used += block->used;
+						heap.reserved += block->size;
+						heap.blockCount++;
+						heap.allocationCount += block->allocationCount;
+					}
+				}
+			}
+			return stats;
+		}
+
+		bool isDeviceLocalHeap(uint32_t heapIndex) const
+		{
+			return (memoryProperties.memoryHeaps[heapIndex].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) != 0;
+		}
+
+	private:
+		VkDevice device;
+		VkPhysicalDeviceMemoryProperties memoryProperties;
+		VkDeviceSize nonCoherentAtomSize;
+		std::vector<MemoryBlock*> blocks[VK_MAX_MEMORY_TYPES][2];
+		// Dedicated allocations are only tracked in the heap statistics
+		std::vector<HeapStats> dedicatedAllocations;
+		std::mutex mutex;
+
+		VkDeviceSize getBlockSize(uint32_t heapIndex) const
+		{
+			return std::min(preferredBlockSize, memoryProperties.memoryHeaps[heapIndex].size / 8);
+		}
+
+		MemoryBlock* createBlock(uint32_t memoryTypeIndex, AllocationTiling tiling, VkDeviceSize size)
+		{
+			MemoryBlock* block = new MemoryBlock();
+			VkMemoryAllocateInfo memAlloc = vks::initializers::memoryAllocateInfo();
+			memAlloc.allocationSize = size;
+			memAlloc.memoryTypeIndex = memoryTypeIndex;
+			VK_CHECK_RESULT(vkAllocateMemory(device, &memAlloc, nullptr, &block->memory));
+			VKS_COUNTER_ADD("Device memory allocations", 1);
+			// Host visible blocks stay mapped for their whole lifetime, as a memory object can only be mapped once
+			if (memoryProperties.memoryTypes[memoryTypeIndex].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+				VK_CHECK_RESULT(vkMapMemory(device, block->memory, 0, VK_WHOLE_SIZE, 0, &block->mapped));
+			}
+			block->size = size;
+			block->memoryTypeIndex = memoryTypeIndex;
+			block->tiling = tiling;
+			block->freeRanges.push_back({ 0, size });
+			return block;
+		}
+
+		void destroyBlock(MemoryBlock* block)
+		{
+			if (block->mapped) {
+				vkUnmapMemory(device, block->memory);
+			}
+			vkFreeMemory(device, block->memory, nullptr);
+			delete block;
+		}
+	};
+}
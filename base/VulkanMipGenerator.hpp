@@ -0,0 +1,223 @@
+/*
+* Compute based mip chain generation
+*
+* Generates all levels of an image from its first level with a single dispatch (single pass downsampler)
+* Each workgroup reduces a 64x64 tile of the first level to the next six levels, the last workgroup to finish reduces the remaining levels
+* Used for images created on the GPU at runtime, which don't have a mip chain stored in a file
+*
+* Copyright (C) by Sascha Willems - www.saschawillems.de
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <assert.h>
+#include <stdint.h>
+
+#include "vulkan/vulkan.h"
+#include "VulkanTools.h"
+#include "VulkanDevice.hpp"
+#include "VulkanBuffer.hpp"
+#include "Pipeline.hpp"
+#include "PipelineLayout.hpp"
+#include "DescriptorSetLayout.hpp"
+#include "DescriptorPool.hpp"
+
+namespace vks
+{
+	class MipGenerator
+	{
+	public:
+		// Number of storage image bindings in the shader, limits images to 4096 x 4096
+		static const uint32_t maxMipLevels = 13;
+
+	private:
+		// Image views and descriptor set of an image mips have been generated for, kept until the generator is destroyed
+		struct Target {
+			std::vector<VkImageView> views;
+			VkDescriptorSet descriptorSet;
+		};
+
+		struct PushConstants {
+			int32_t width;
+			int32_t height;
+			int32_t mipLevels;
+			uint32_t workgroupCount;
+		};
+
+		vks::VulkanDevice* device;
+		DescriptorSetLayout* descriptorSetLayout = nullptr;
+		PipelineLayout* pipelineLayout = nullptr;
+		Pipeline* pipeline = nullptr;
+		DescriptorPool* descriptorPool = nullptr;
+		// Number of workgroups that have finished their tile, reset by the last one
+		vks::Buffer counterBuffer;
+		std::vector<Target> targets;
+		uint32_t maxTargets;
+
+	public:
+		/** @brief Checks the workgroup size required by the shader, 256 invocations exceed the guaranteed minimum limits */
+		static bool supported(vks::VulkanDevice* device)
+		{
+			const VkPhysicalDeviceLimits& limits = device->properties.limits;
+			VkFormatProperties formatProperties;
+			vkGetPhysicalDeviceFormatProperties(device->physicalDevice, VK_FORMAT_R8G8B8A8_UNORM, &formatProperties);
+			return limits.maxComputeWorkGroupInvocations >= 256 && limits.maxComputeWorkGroupSize[0] >= 256 && (formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_STORAGE_IMAGE_BIT);
+		}
+
+		/**
+		* @param device Device to create the pipeline on
+		* @param shaderFile SPIR-V file of the downsampling compute shader (downsample.comp.spv)
+		* @param pipelineCache Pipeline cache used for the compute pipeline
+		* @param maxTargets Maximum number of images mips can be generated for during the generator's lifetime
+		*/
+		MipGenerator(vks::VulkanDevice* device, const std::string& shaderFile, VkPipelineCache pipelineCache, uint32_t maxTargets = 8)
+		{
+			assert(supported(device));
+			this->device = device;
+			this->maxTargets = maxTargets;
+			VkDevice logicalDevice = device->logicalDevice;
+
+			descriptorSetLayout = new DescriptorSetLayout(logicalDevice);
+			descriptorSetLayout->addBinding(0, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, VK_SHADER_STAGE_COMPUTE_BIT, maxMipLevels);
+			descriptorSetLayout->addBinding(1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT);
+			descriptorSetLayout->create();
+
+			pipelineLayout = new PipelineLayout(logicalDevice);
+			pipelineLayout->addLayout(descriptorSetLayout);
+			pipelineLayout->addPushConstantRange(sizeof(PushConstants), 0, VK_SHADER_STAGE_COMPUTE_BIT);
+			pipelineLayout->create();
+
+			pipeline = new Pipeline(logicalDevice);
+			pipeline->setCache(pipelineCache);
+			pipeline->setLayout(pipelineLayout);
+			pipeline->addShader(shaderFile);
+			pipeline->create();
+
+			descriptorPool = new DescriptorPool(logicalDevice);
+			descriptorPool->setMaxSets(maxTargets);
+			descriptorPool->addPoolSize(VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, maxTargets * maxMipLevels);
+			descriptorPool->addPoolSize(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, maxTargets);
+			descriptorPool->create();
+
+			uint32_t zero = 0;
+			VK_CHECK_RESULT(device->createBuffer(VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &counterBuffer, sizeof(uint32_t), &zero));
+			counterBuffer.setupDescriptor();
+		}
+
+		/** @note The command buffers the generator recorded to must have finished executing */
+		~MipGenerator()
+		{
+			VkDevice logicalDevice = device->logicalDevice;
+			for (auto& target : targets) {
+				for (auto view : target.views) {
+					vkDestroyImageView(logicalDevice, view, nullptr);
+				}
+			}
+			vkDestroyDescriptorPool(logicalDevice, descriptorPool->handle, nullptr);
+			vkDestroyPipelineLayout(logicalDevice, pipelineLayout->handle, nullptr);
+			vkDestroyDescriptorSetLayout(logicalDevice, descriptorSetLayout->handle, nullptr);
+			delete pipeline;
+			delete pipelineLayout;
+			delete descriptorSetLayout;
+			delete descriptorPool;
+			counterBuffer.destroy();
+		}
+
+		/**
+		* Record the generation of all mip levels of an image from its first level
+		*
+		* @param commandBuffer Command buffer to record to, has to be submitted to a queue with compute support
+		* @param image Single layer VK_FORMAT_R8G8B8A8_UNORM image created with VK_IMAGE_USAGE_STORAGE_BIT
+		* @param width Width of the first level
+		* @param height Height of the first level
+		* @param mipLevels Number of levels to fill, including the first one
+		* @param oldLayout Layout of the first level, the contents of all other levels are discarded
+		* @param finalLayout Layout all levels are transitioned to once the dispatch has finished
+		*/
+		void generate(VkCommandBuffer commandBuffer, VkImage image, uint32_t width, uint32_t height, uint32_t mipLevels, VkImageLayout oldLayout, VkImageLayout finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL)
+		{
+			assert(mipLevels > 0 && mipLevels <= maxMipLevels);
+			assert(targets.size() < maxTargets);
+			VkDevice logicalDevice = device->logicalDevice;
+
+			// One storage view per level, the bindings of levels the image doesn't have point to its last level and are never written
+			Target target;
+			std::vector<VkDescriptorImageInfo> imageInfos(maxMipLevels);
+			for (uint32_t i = 0; i < mipLevels; i++) {
+				VkImageViewCreateInfo viewCI = vks::initializers::imageViewCreateInfo();
+				viewCI.viewType = VK_IMAGE_VIEW_TYPE_2D;
+				viewCI.format = VK_FORMAT_R8G8B8A8_UNORM;
+				viewCI.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, i, 1, 0, 1 };
+				viewCI.image = image;
+				VkImageView view;
+				VK_CHECK_RESULT(vkCreateImageView(logicalDevice, &viewCI, nullptr, &view));
+				target.views.push_back(view);
+			}
+			for (uint32_t i = 0; i < maxMipLevels; i++) {
+				imageInfos[i] = { VK_NULL_HANDLE, target.views[std::min(i, mipLevels - 1)], VK_IMAGE_LAYOUT_GENERAL };
+			}
+			VkDescriptorSetAllocateInfo allocInfo = vks::initializers::descriptorSetAllocateInfo(descriptorPool->handle, &descriptorSetLayout->handle, 1);
+			VK_CHECK_RESULT(vkAllocateDescriptorSets(logicalDevice, &allocInfo, &target.descriptorSet));
+			std::vector<VkWriteDescriptorSet> writes = {
+				vks::initializers::writeDescriptorSet(target.descriptorSet, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 0, imageInfos.data(), maxMipLevels),
+				vks::initializers::writeDescriptorSet(target.descriptorSet, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, &counterBuffer.descriptor),
+			};
+			vkUpdateDescriptorSets(logicalDevice, static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
+			targets.push_back(target);
+
+			// The first level keeps its contents, all levels are read and written in the general layout
+			VkImageMemoryBarrier barriers[2];
+			barriers[0] = vks::initializers::imageMemoryBarrier();
+			barriers[0].image = image;
+			barriers[0].subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+			barriers[0].oldLayout = oldLayout;
+			barriers[0].newLayout = VK_IMAGE_LAYOUT_GENERAL;
+			barriers[0].srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT;
+			barriers[0].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+			uint32_t barrierCount = 1;
+			if (mipLevels > 1) {
+				barriers[1] = barriers[0];
+				barriers[1].subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 1, mipLevels - 1, 0, 1 };
+				barriers[1].oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+				barriers[1].srcAccessMask = 0;
+				barriers[1].dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+				barrierCount++;
+			}
+			vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0, nullptr, barrierCount, barriers);
+
+			if (mipLevels > 1) {
+				PushConstants pushConstants;
+				pushConstants.width = static_cast<int32_t>(width);
+				pushConstants.height = static_cast<int32_t>(height);
+				pushConstants.mipLevels = static_cast<int32_t>(mipLevels);
+				const uint32_t groupsX = (width + 63) / 64;
+				const uint32_t groupsY = (height + 63) / 64;
+				pushConstants.workgroupCount = groupsX * groupsY;
+				// Level six of a tile needs to fit into a single tile for the last workgroup
+				assert(groupsX <= 64 && groupsY <= 64);
+				vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline->getHandle());
+				vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout->handle, 0, 1, &target.descriptorSet, 0, nullptr);
+				vkCmdPushConstants(commandBuffer, pipelineLayout->handle, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(PushConstants), &pushConstants);
+				vkCmdDispatch(commandBuffer, groupsX, groupsY, 1);
+			}
+
+			// Also orders the counter reset of the last workgroup before the next dispatch using it
+			VkMemoryBarrier memoryBarrier = vks::initializers::memoryBarrier();
+			memoryBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+			memoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+			VkImageMemoryBarrier finalBarrier = vks::initializers::imageMemoryBarrier();
+			finalBarrier.image = image;
+			finalBarrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, mipLevels, 0, 1 };
+			finalBarrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+			finalBarrier.newLayout = finalLayout;
+			finalBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+			finalBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+			vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 1, &memoryBarrier, 0, nullptr, 1, &finalBarrier);
+		}
+	};
+}
@@ -0,0 +1,175 @@
+/*
+* Persistent pipeline cache
+*
+* Stores the contents of a pipeline cache on disk, so pipelines compiled in an earlier run don't need to be compiled again
+* The data is prefixed with a header identifying the device and driver it was created with, and is discarded if any of them differ
+*
+* Copyright (C) by Sascha Willems - www.saschawillems.de
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "vulkan/vulkan.h"
+#include "VulkanTools.h"
+
+#if defined(__ANDROID__)
+#include "VulkanAndroid.h"
+#endif
+
+namespace vks
+{
+	namespace pipelinecache
+	{
+		// "VKPC"
+		const uint32_t magic = 0x43504B56;
+		const uint32_t version = 1;
+
+		struct Header {
+			uint32_t magic;
+			uint32_t version;
+			uint32_t vendorID;
+			uint32_t deviceID;
+			uint32_t driverVersion;
+			uint8_t pipelineCacheUUID[VK_UUID_SIZE];
+			uint64_t dataSize;
+			// Detects truncated or otherwise corrupted files, drivers don't necessarily validate the data themselves
+			uint64_t hash;
+		};
+
+		inline uint64_t hash(const uint8_t* data, size_t size)
+		{
+			// FNV-1a
+			uint64_t hash = 14695981039346656037ull;
+			for (size_t i = 0; i < size; i++) {
+				hash = (hash ^ data[i]) * 1099511628211ull;
+			}
+			return hash;
+		}
+
+		/** @brief Default location of the cache file, Android assets are read only so it's stored in the app's internal data path there */
+		inline std::string getDefaultFilename()
+		{
+#if defined(__ANDROID__)
+			return std::string(androidApp->activity->internalDataPath) + "/pipelinecache.bin";
+#else
+			return "pipelinecache.bin";
+#endif
+		}
+
+		/**
+		* Read the cache data stored for a device
+		*
+		* @param filename File to load the data from
+		* @param properties Properties of the device the cache will be created on
+		* @param data Receives the pipeline cache data
+		*
+		* @return False if there is no cache file or it was created on a different device or driver
+		*/
+		inline bool load(const std::string& filename, const VkPhysicalDeviceProperties& properties, std::vector<uint8_t>& data)
+		{
+			std::ifstream file(filename, std::ios::binary);
+			if (!file.is_open()) {
+				return false;
+			}
+			Header header;
+			if (!file.read(reinterpret_cast<char*>(&header), sizeof(header))) {
+				return false;
+			}
+			if (header.magic != magic || header.version != version || header.vendorID != properties.vendorID || header.deviceID != properties.deviceID
+				|| header.driverVersion != properties.driverVersion || memcmp(header.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE) != 0) {
+				return false;
+			}
+			data.resize(static_cast<size_t>(header.dataSize));
+			if (!file.read(reinterpret_cast<char*>(data.data()), static_cast<std::streamsize>(data.size())) || hash(data.data(), data.size()) != header.hash) {
+				data.clear();
+				return false;
+			}
+			return true;
+		}
+
+		/**
+		* Create a pipeline cache, initialized from the cache file if it matches the device
+		*
+		* @param device Logical device to create the cache on
+		* @param properties Properties of the device's physical device
+		* @param filename Cache file to initialize the pipeline cache with
+		*/
+		inline VkPipelineCache create(VkDevice device, const VkPhysicalDeviceProperties& properties, const std::string& filename)
+		{
+			std::vector<uint8_t> data;
+			const bool loaded = load(filename, properties, data);
+			VkPipelineCacheCreateInfo pipelineCacheCreateInfo = {};
+			pipelineCacheCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+			pipelineCacheCreateInfo.initialDataSize = data.size();
+			pipelineCacheCreateInfo.pInitialData = data.empty() ? nullptr : data.data();
+			VkPipelineCache pipelineCache = VK_NULL_HANDLE;
+			VkResult result = vkCreatePipelineCache(device, &pipelineCacheCreateInfo, nullptr, &pipelineCache);
+			if (result != VK_SUCCESS && loaded) {
+				// Fall back to an empty cache if the driver rejects the data
+				pipelineCacheCreateInfo.initialDataSize = 0;
+				pipelineCacheCreateInfo.pInitialData = nullptr;
+				result = vkCreatePipelineCache(device, &pipelineCacheCreateInfo, nullptr, &pipelineCache);
+			}
+			VK_CHECK_RESULT(result);
+			if (loaded) {
+				std::cout << "Pipeline cache: loaded " << data.size() << " bytes from " << filename << std::endl;
+			}
+			return pipelineCache;
+		}
+
+		/**
+		* Write the contents of a pipeline cache to disk
+		* The data is written to a temporary file first, so an interrupted write doesn't leave a broken cache behind
+		*
+		* @return True if the cache file has been written
+		*/
+		inline bool save(VkDevice device, VkPipelineCache pipelineCache, const VkPhysicalDeviceProperties& properties, const std::string& filename)
+		{
+			size_t dataSize = 0;
+			if (vkGetPipelineCacheData(device, pipelineCache, &dataSize, nullptr) != VK_SUCCESS || dataSize == 0) {
+				return false;
+			}
+			std::vector<uint8_t> data(dataSize);
+			if (vkGetPipelineCacheData(device, pipelineCache, &dataSize, data.data()) != VK_SUCCESS) {
+				return false;
+			}
+			data.resize(dataSize);
+
+			Header header{};
+			header.magic = magic;
+			header.version = version;
+			header.vendorID = properties.vendorID;
+			header.deviceID = properties.deviceID;
+			header.driverVersion = properties.driverVersion;
+			memcpy(header.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE);
+			header.dataSize = data.size();
+			header.hash = hash(data.data(), data.size());
+
+			const std::string tempFilename = filename + ".tmp";
+			std::ofstream file(tempFilename, std::ios::binary | std::ios::trunc);
+			if (!file.is_open()) {
+				return false;
+			}
+			file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+			file.write(reinterpret_cast<const char*>(data.data()), static_cast<std::streamsize>(data.size()));
+			file.close();
+			if (!file.good()) {
+				remove(tempFilename.c_str());
+				return false;
+			}
+			// rename doesn't replace existing files on Windows
+			remove(filename.c_str());
+			return rename(tempFilename.c_str(), filename.c_str()) == 0;
+		}
+	}
+}
@@ -0,0 +1,210 @@
+/*
+* Shader module cache and specialization constants
+*
+* Shader modules are shared by all pipelines using the same SPIR-V file, files with identical contents share a single module
+* Modules are reference counted and destroyed once the last pipeline using them releases them
+*
+* Copyright (C) by Sascha Willems - www.saschawillems.de
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <vector>
+#include <string>
+#include <mutex>
+#include <iostream>
+#include <algorithm>
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "vulkan/vulkan.h"
+#include "VulkanTools.h"
+#include "VulkanMappedFile.hpp"
+
+namespace vks
+{
+	class ShaderModuleCache
+	{
+	public:
+		struct Stats {
+			// Modules currently alive
+			uint32_t moduleCount = 0;
+			// Number of shader files read from disk
+			uint32_t fileReads = 0;
+			// Requests served without reading the file
+			uint32_t pathHits = 0;
+			// Files that were read but had the same contents as an existing module
+			uint32_t contentHits = 0;
+		};
+
+	private:
+		struct Entry {
+			VkDevice device;
+			VkShaderModule module;
+			uint64_t hash;
+			uint64_t size;
+			std::vector<std::string> filenames;
+			uint32_t references;
+		};
+
+		std::mutex lock;
+		std::vector<Entry> entries;
+		Stats stats;
+
+		ShaderModuleCache() {}
+		ShaderModuleCache(const ShaderModuleCache&) = delete;
+		ShaderModuleCache& operator=(const ShaderModuleCache&) = delete;
+
+		static uint64_t hash(const uint8_t* data, size_t size)
+		{
+			// FNV-1a
+			uint64_t hash = 14695981039346656037ull;
+			for (size_t i = 0; i < size; i++) {
+				hash = (hash ^ data[i]) * 1099511628211ull;
+			}
+			return hash;
+		}
+
+	public:
+		~ShaderModuleCache()
+		{
+			if (!entries.empty()) {
+				std::cerr << "Shader module cache: " << entries.size() << " modules have not been released" << std::endl;
+			}
+		}
+
+		/** @brief The process wide cache */
+		static ShaderModuleCache& get()
+		{
+			static ShaderModuleCache cache;
+			return cache;
+		}
+
+		/**
+		* Get the shader module for a SPIR-V file, only reads the file if no module has been created for it yet
+		* Each call has to be matched by a call to release()
+		*
+		* @param device Logical device to create the module on
+		* @param filename SPIR-V file (asset path on Android)
+		*
+		* @return Handle of the shader module or VK_NULL_HANDLE if the file could not be loaded
+		*/
+		VkShaderModule acquire(VkDevice device, const std::string& filename)
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			for (auto& entry : entries) {
+				if (entry.device == device && std::find(entry.filenames.begin(), entry.filenames.end(), filename) != entry.filenames.end()) {
+					entry.references++;
+					stats.pathHits++;
+					return entry.module;
+				}
+			}
+
+			vks::MappedFile file;
+			if (!file.open(filename) || file.size() % sizeof(uint32_t) != 0) {
+				std::cerr << "Error: Could not open shader file \"" << filename << "\"" << std::endl;
+				return VK_NULL_HANDLE;
+			}
+			stats.fileReads++;
+			const uint64_t fileHash = hash(file.data(), file.size());
+			for (auto& entry : entries) {
+				if (entry.device == device && entry.hash == fileHash && entry.size == file.size()) {
+					entry.filenames.push_back(filename);
+					entry.references++;
+					stats.contentHits++;
+					return entry.module;
+				}
+			}
+
+			// File mappings are page aligned, so the code can be passed to the driver as is
+			VkShaderModuleCreateInfo moduleCreateInfo{};
+			moduleCreateInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+			moduleCreateInfo.codeSize = file.size();
+			moduleCreateInfo.pCode = reinterpret_cast<const uint32_t*>(file.data());
+			Entry entry;
+			entry.device = device;
+			entry.hash = fileHash;
+			entry.size = file.size();
+			entry.filenames.push_back(filename);
+			entry.references = 1;
+			VK_CHECK_RESULT(vkCreateShaderModule(device, &moduleCreateInfo, nullptr, &entry.module));
+			entries.push_back(entry);
+			stats.moduleCount++;
+			return entry.module;
+		}
+
+		/** @brief Release a module returned by acquire(), the module is destroyed when it's no longer referenced */
+		void release(VkDevice device, VkShaderModule module)
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			auto it = std::find_if(entries.begin(), entries.end(), [device, module](const Entry& entry) { return entry.device == device && entry.module == module; });
+			assert(it != entries.end());
+			if (it == entries.end()) {
+				return;
+			}
+			assert(it->references > 0);
+			if (--it->references == 0) {
+				vkDestroyShaderModule(device, module, nullptr);
+				entries.erase(it);
+				stats.moduleCount--;
+			}
+		}
+
+		Stats getStats()
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			return stats;
+		}
+	};
+
+	/**
+	* Owns a set of specialization constants and the specialization info pointing to them
+	* Allows compiling variants of a shader (e.g. with different loop counts or feature toggles) from a single SPIR-V file
+	*/
+	class SpecializationConstants
+	{
+	private:
+		std::vector<VkSpecializationMapEntry> entries;
+		std::vector<uint8_t> data;
+		VkSpecializationInfo info{};
+
+		void set(uint32_t constantID, const void* value, size_t size)
+		{
+			for (auto& entry : entries) {
+				if (entry.constantID == constantID) {
+					assert(entry.size == size);
+					memcpy(data.data() + entry.offset, value, size);
+					return;
+				}
+			}
+			VkSpecializationMapEntry entry{};
+			entry.constantID = constantID;
+			entry.offset = static_cast<uint32_t>(data.size());
+			entry.size = size;
+			entries.push_back(entry);
+			data.resize(data.size() + size);
+			memcpy(data.data() + entry.offset, value, size);
+		}
+
+	public:
+		// Scalar constants are 32 bits wide, booleans have to be passed as VkBool32
+		void set(uint32_t constantID, uint32_t value) { set(constantID, &value, sizeof(value)); }
+		void set(uint32_t constantID, int32_t value) { set(constantID, &value, sizeof(value)); }
+		void set(uint32_t constantID, float value) { set(constantID, &value, sizeof(value)); }
+
+		bool empty() const { return entries.empty(); }
+
+		/** @brief Specialization info for a shader stage, stays valid until the constants are changed or destroyed */
+		const VkSpecializationInfo* getInfo()
+		{
+			info.mapEntryCount = static_cast<uint32_t>(entries.size());
+			info.pMapEntries = entries.data();
+			info.dataSize = data.size();
+			info.pData = data.data();
+			return &info;
+		}
+	};
+}
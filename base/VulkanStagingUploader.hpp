@@ -0,0 +1,408 @@
+/*
+* Vulkan staging uploader
+*
+* Copies buffer and image data to device local memory through a persistently mapped staging ring buffer
+* Copies are batched into a single command buffer and submitted on a dedicated transfer queue (if the device has one)
+* Batches are reclaimed via fences, callers get a ticket for each upload they can poll or wait on
+*
+* Copyright (C) by Sascha Willems - www.saschawillems.de
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include <assert.h>
+#include "vulkan/vulkan.h"
+#include "VulkanTools.h"
+#include "VulkanDevice.hpp"
+#include "VulkanBuffer.hpp"
+
+namespace vks
+{
+	typedef uint64_t UploadTicket;
+
+	/**
+	* @brief Batched staging uploads
+	* @note Not thread safe, uploads have to be issued from the thread that submits to the graphics queue
+	*/
+	class StagingUploader
+	{
+	private:
+		struct Batch {
+			UploadTicket ticket = 0;
+			// Copies recorded for the transfer queue
+			VkCommandBuffer transferCommandBuffer = VK_NULL_HANDLE;
+			// Ownership acquires and follow up commands for the graphics queue (same as the transfer command buffer if both share a queue family)
+			VkCommandBuffer graphicsCommandBuffer = VK_NULL_HANDLE;
+			VkSemaphore semaphore = VK_NULL_HANDLE;
+			VkFence fence = VK_NULL_HANDLE;
+			// Ring position after the last staging allocation of this batch
+			VkDeviceSize ringEnd = 0;
+			// Temporary staging buffers for uploads that don't fit into the ring
+			std::vector<vks::Buffer> overflowBuffers;
+		};
+
+		vks::VulkanDevice* device;
+		VkQueue graphicsQueue;
+		VkQueue transferQueue;
+		VkCommandPool graphicsCommandPool = VK_NULL_HANDLE;
+		VkCommandPool transferCommandPool = VK_NULL_HANDLE;
+		// Resources need a queue family ownership transfer if the transfer queue is from a different queue family
+		bool ownershipTransfer;
+		vks::Buffer ring;
+		VkDeviceSize ringSize;
+		// Monotonic positions, the ring offset is position modulo the ring size
+		VkDeviceSize ringHead = 0;
+		VkDeviceSize ringTail = 0;
+		VkDeviceSize copyOffsetAlignment;
+		Batch* current = nullptr;
+		std::deque<Batch*> inFlight;
+		std::vector<Batch*> freeBatches;
+		UploadTicket nextTicket = 1;
+		UploadTicket completedTicket = 0;
+
+		Batch* getBatch()
+		{
+			if (current) {
+				return current;
+			}
+			if (freeBatches.empty()) {
+				Batch* batch = new Batch();
+				VkCommandBufferAllocateInfo cmdBufAllocateInfo = vks::initializers::commandBufferAllocateInfo(transferCommandPool, VK_COMMAND_BUFFER_LEVEL_PRIMARY, 1);
+				VK_CHECK_RESULT(vkAllocateCommandBuffers(device->logicalDevice, &cmdBufAllocateInfo, &batch->transferCommandBuffer));
+				batch->graphicsCommandBuffer = batch->transferCommandBuffer;
+				if (ownershipTransfer) {
+					cmdBufAllocateInfo.commandPool = graphicsCommandPool;
+					VK_CHECK_RESULT(vkAllocateCommandBuffers(device->logicalDevice, &cmdBufAllocateInfo, &batch->graphicsCommandBuffer));
+					VkSemaphoreCreateInfo semaphoreCI = vks::initializers::semaphoreCreateInfo();
+					VK_CHECK_RESULT(vkCreateSemaphore(device->logicalDevice, &semaphoreCI, nullptr, &batch->semaphore));
+				}
+				VkFenceCreateInfo fenceCI = vks::initializers::fenceCreateInfo(VK_FLAGS_NONE);
+				VK_CHECK_RESULT(vkCreateFence(device->logicalDevice, &fenceCI, nullptr, &batch->fence));
+				freeBatches.push_back(batch);
+			}
+			current = freeBatches.back();
+			freeBatches.pop_back();
+			current->ticket = nextTicket++;
+			current->ringEnd = ringHead;
+			VkCommandBufferBeginInfo cmdBufInfo = vks::initializers::commandBufferBeginInfo();
+			cmdBufInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+			VK_CHECK_RESULT(vkBeginCommandBuffer(current->transferCommandBuffer, &cmdBufInfo));
+			if (ownershipTransfer) {
+				VK_CHECK_RESULT(vkBeginCommandBuffer(current->graphicsCommandBuffer, &cmdBufInfo));
+			}
+			return current;
+		}
+
+		// Reclaim the staging space and resources of all finished batches
+		void retire(bool waitForOldest)
+		{
+			while (!inFlight.empty()) {
+				Batch* batch = inFlight.front();
+				if (waitForOldest) {
+					VK_CHECK_RESULT(vkWaitForFences(device->logicalDevice, 1, &batch->fence, VK_TRUE, UINT64_MAX));
+					waitForOldest = false;
+				} else if (vkGetFenceStatus(device->logicalDevice, batch->fence) != VK_SUCCESS) {
+					break;
+				}
+				VK_CHECK_RESULT(vkResetFences(device->logicalDevice, 1, &batch->fence));
+				for (auto& buffer : batch->overflowBuffers) {
+					buffer.destroy();
+				}
+				batch->overflowBuffers.clear();
+				ringTail = batch->ringEnd;
+				completedTicket = batch->ticket;
+				inFlight.pop_front();
+				freeBatches.push_back(batch);
+			}
+		}
+
+		// Copy data into staging memory, returns the staging buffer and offset to copy from
+		void stage(const void* data, VkDeviceSize size, VkBuffer* srcBuffer, VkDeviceSize* srcOffset)
+		{
+			if (size > ringSize) {
+				vks::Buffer overflow;
+				VK_CHECK_RESULT(device->createBuffer(VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &overflow, size, const_cast<void*>(data)));
+				getBatch()->overflowBuffers.push_back(overflow);
+				*srcBuffer = overflow.buffer;
+				*srcOffset = 0;
+				return;
+			}
+			VkDeviceSize offset;
+			for (;;) {
+				offset = (ringHead + copyOffsetAlignment - 1) / copyOffsetAlignment * copyOffsetAlignment;
+				// Allocations never wrap around the end of the ring
+				const VkDeviceSize ringOffset = offset % ringSize;
+				if (ringOffset + size > ringSize) {
+					offset += ringSize - ringOffset;
+				}
+				if (offset + size - ringTail <= ringSize) {
+					break;
+				}
+				// Ring is full, make sure the pending copies are submitted and wait for the oldest batch to finish
+				if (inFlight.empty()) {
+					if (!current) {
+						// Nothing pending, so the whole ring is free again
+						ringHead = ringTail = (ringHead + ringSize - 1) / ringSize * ringSize;
+						continue;
+					}
+					submit();
+				}
+				stats.stalls++;
+				retire(true);
+			}
+			ringHead = offset + size;
+			Batch* batch = getBatch();
+			batch->ringEnd = ringHead;
+			memcpy(static_cast<uint8_t*>(ring.mapped) + offset % ringSize, data, size);
+			*srcBuffer = ring.buffer;
+			*srcOffset = offset % ringSize;
+		}
+
+		static VkAccessFlags getLayoutAccessMask(VkImageLayout layout)
+		{
+			switch (layout) {
+			case VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL:
+				return VK_ACCESS_SHADER_READ_BIT;
+			case VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL:
+				return VK_ACCESS_TRANSFER_READ_BIT;
+			case VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL:
+				return VK_ACCESS_TRANSFER_WRITE_BIT;
+			default:
+				return VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+			}
+		}
+
+	public:
+		/** @brief Number of submitted batches and uploaded bytes */
+		struct Stats {
+			uint32_t submits = 0;
+			uint32_t stalls = 0;
+			VkDeviceSize bytesUploaded = 0;
+		} stats;
+
+		/**
+		* Create the uploader
+		*
+		* @param device Vulkan device to upload to, the transfer queue family is taken from its queue family indices
+		* @param graphicsQueue Queue that uploaded resources will be used on
+		* @param ringSize (Optional) Size of the persistently mapped staging ring buffer
+		*/
+		StagingUploader(vks::VulkanDevice* device, VkQueue graphicsQueue, VkDeviceSize ringSize = 64 * 1024 * 1024)
+		{
+			this->device = device;
+			this->graphicsQueue = graphicsQueue;
+			ownershipTransfer = device->queueFamilyIndices.transfer != device->queueFamilyIndices.graphics;
+			if (ownershipTransfer) {
+				vkGetDeviceQueue(device->logicalDevice, device->queueFamilyIndices.transfer, 0, &transferQueue);
+				graphicsCommandPool = device->createCommandPool(device->queueFamilyIndices.graphics);
+			} else {
+				transferQueue = graphicsQueue;
+			}
+			transferCommandPool = device->createCommandPool(device->queueFamilyIndices.transfer);
+			// Buffer offsets for image copies need to be a multiple of the texel block size (16 bytes for block compressed formats)
+			copyOffsetAlignment = std::max<VkDeviceSize>(16, device->properties.limits.optimalBufferCopyOffsetAlignment);
+			this->ringSize = (ringSize + copyOffsetAlignment - 1) / copyOffsetAlignment * copyOffsetAlignment;
+			VK_CHECK_RESULT(device->createBuffer(VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &ring, this->ringSize));
+			VK_CHECK_RESULT(ring.map());
+		}
+
+		~StagingUploader()
+		{
+			waitIdle();
+			for (auto batch : freeBatches) {
+				if (batch->semaphore) {
+					vkDestroySemaphore(device->logicalDevice, batch->semaphore, nullptr);
+				}
+				vkDestroyFence(device->logicalDevice, batch->fence, nullptr);
+				delete batch;
+			}
+			// Command buffers are freed along with their pools
+			vkDestroyCommandPool(device->logicalDevice, transferCommandPool, nullptr);
+			if (graphicsCommandPool) {
+				vkDestroyCommandPool(device->logicalDevice, graphicsCommandPool, nullptr);
+			}
+			ring.destroy();
+		}
+
+		/** @brief True if the transfer queue is from a different queue family than the graphics queue */
+		bool hasDedicatedTransferQueue() const
+		{
+			return ownershipTransfer;
+		}
+
+		/**
+		* Upload data to a device local buffer
+		*
+		* @param dst Destination buffer (requires VK_BUFFER_USAGE_TRANSFER_DST_BIT)
+		* @param data Source data, copied to staging memory before returning
+		* @param size Size of the data in bytes
+		* @param dstOffset (Optional) Byte offset into the destination buffer
+		* @param dstAccessMask (Optional) How the buffer's contents are accessed after the upload
+		*
+		* @return Ticket of the batch containing the upload
+		*/
+		UploadTicket uploadBuffer(VkBuffer dst, const void* data, VkDeviceSize size, VkDeviceSize dstOffset = 0, VkAccessFlags dstAccessMask = VK_ACCESS_MEMORY_READ_BIT)
+		{
+			VkBuffer srcBuffer;
+			VkBufferCopy copyRegion{};
+			stage(data, size, &srcBuffer, &copyRegion.srcOffset);
+			copyRegion.dstOffset = dstOffset;
+			copyRegion.size = size;
+			Batch* batch = getBatch();
+			vkCmdCopyBuffer(batch->transferCommandBuffer, srcBuffer, dst, 1, &copyRegion);
+
+			VkBufferMemoryBarrier barrier = vks::initializers::bufferMemoryBarrier();
+			barrier.buffer = dst;
+			barrier.offset = dstOffset;
+			barrier.size = size;
+			barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+			barrier.dstAccessMask = dstAccessMask;
+			if (ownershipTransfer) {
+				// Release on the transfer queue, acquire on the graphics queue
+				barrier.srcQueueFamilyIndex = device->queueFamilyIndices.transfer;
+				barrier.dstQueueFamilyIndex = device->queueFamilyIndices.graphics;
+				barrier.dstAccessMask = 0;
+				vkCmdPipelineBarrier(batch->transferCommandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+				barrier.srcAccessMask = 0;
+				barrier.dstAccessMask = dstAccessMask;
+				vkCmdPipelineBarrier(batch->graphicsCommandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+			} else {
+				vkCmdPipelineBarrier(batch->transferCommandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+			}
+			stats.bytesUploaded += size;
+			return batch->ticket;
+		}
+
+		/**
+		* Upload data to an optimal tiled image
+		*
+		* @param image Destination image (requires VK_IMAGE_USAGE_TRANSFER_DST_BIT), its previous contents are discarded
+		* @param data Source data, copied to staging memory before returning
+		* @param size Size of the data in bytes
+		* @param regions Copy regions with buffer offsets relative to the start of data
+		* @param subresourceRange Subresources of the image that are uploaded
+		* @param finalLayout Layout the image is transitioned to after the copies
+		*
+		* @return Ticket of the batch containing the upload
+		*/
+		UploadTicket uploadImage(VkImage image, const void* data, VkDeviceSize size, std::vector<VkBufferImageCopy> regions, VkImageSubresourceRange subresourceRange, VkImageLayout finalLayout)
+		{
+			VkBuffer srcBuffer;
+			VkDeviceSize srcOffset;
+			stage(data, size, &srcBuffer, &srcOffset);
+			for (auto& region : regions) {
+				region.bufferOffset += srcOffset;
+			}
+			Batch* batch = getBatch();
+
+			VkImageMemoryBarrier barrier = vks::initializers::imageMemoryBarrier();
+			barrier.image = image;
+			barrier.subresourceRange = subresourceRange;
+			barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+			barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+			barrier.srcAccessMask = 0;
+			barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+			vkCmdPipelineBarrier(batch->transferCommandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+			vkCmdCopyBufferToImage(batch->transferCommandBuffer, srcBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, static_cast<uint32_t>(regions.size()), regions.data());
+
+			barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+			barrier.newLayout = finalLayout;
+			barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+			barrier.dstAccessMask = getLayoutAccessMask(finalLayout);
+			if (ownershipTransfer) {
+				// The layout transition is part of the release / acquire pair
+				barrier.srcQueueFamilyIndex = device->queueFamilyIndices.transfer;
+				barrier.dstQueueFamilyIndex = device->queueFamilyIndices.graphics;
+				barrier.dstAccessMask = 0;
+				vkCmdPipelineBarrier(batch->transferCommandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+				barrier.srcAccessMask = 0;
+				barrier.dstAccessMask = getLayoutAccessMask(finalLayout);
+				vkCmdPipelineBarrier(batch->graphicsCommandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+			} else {
+				vkCmdPipelineBarrier(batch->transferCommandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+			}
+			stats.bytesUploaded += size;
+			return batch->ticket;
+		}
+
+		/**
+		* Get the command buffer of the current batch that's executed on the graphics queue
+		*
+		* @note Commands recorded here run after all uploads of the batch have been recorded (e.g. mip map generation for uploaded images)
+		*/
+		VkCommandBuffer getGraphicsCommandBuffer()
+		{
+			return getBatch()->graphicsCommandBuffer;
+		}
+
+		/**
+		* Submit all pending uploads
+		*
+		* @note Doesn't wait for the uploads to finish, work on the graphics queue submitted afterwards is ordered after them
+		*
+		* @return Ticket of the submitted batch
+		*/
+		UploadTicket submit()
+		{
+			if (!current) {
+				return nextTicket - 1;
+			}
+			Batch* batch = current;
+			current = nullptr;
+			VK_CHECK_RESULT(vkEndCommandBuffer(batch->transferCommandBuffer));
+			VkSubmitInfo submitInfo = vks::initializers::submitInfo();
+			submitInfo.commandBufferCount = 1;
+			submitInfo.pCommandBuffers = &batch->transferCommandBuffer;
+			if (ownershipTransfer) {
+				VK_CHECK_RESULT(vkEndCommandBuffer(batch->graphicsCommandBuffer));
+				submitInfo.signalSemaphoreCount = 1;
+				submitInfo.pSignalSemaphores = &batch->semaphore;
+				VK_CHECK_RESULT(vkQueueSubmit(transferQueue, 1, &submitInfo, VK_NULL_HANDLE));
+				const VkPipelineStageFlags waitStageMask = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+				submitInfo = vks::initializers::submitInfo();
+				submitInfo.waitSemaphoreCount = 1;
+				submitInfo.pWaitSemaphores = &batch->semaphore;
+				submitInfo.pWaitDstStageMask = &waitStageMask;
+				submitInfo.commandBufferCount = 1;
+				submitInfo.pCommandBuffers = &batch->graphicsCommandBuffer;
+				VK_CHECK_RESULT(vkQueueSubmit(graphicsQueue, 1, &submitInfo, batch->fence));
+			} else {
+				VK_CHECK_RESULT(vkQueueSubmit(transferQueue, 1, &submitInfo, batch->fence));
+			}
+			inFlight.push_back(batch);
+			stats.submits++;
+			return batch->ticket;
+		}
+
+		/** @brief Check if the uploads of a ticket have finished on the device */
+		bool isComplete(UploadTicket ticket)
+		{
+			retire(false);
+			return ticket <= completedTicket;
+		}
+
+		/** @brief Wait for the uploads of a ticket to finish, submits them if still pending */
+		void wait(UploadTicket ticket)
+		{
+			if (current && ticket >= current->ticket) {
+				submit();
+			}
+			while (ticket > completedTicket && !inFlight.empty()) {
+				stats.stalls++;
+				retire(true);
+			}
+		}
+
+		/** @brief Submit and wait for all pending uploads */
+		void waitIdle()
+		{
+			wait(nextTicket - 1);
+		}
+	};
+}
@@ -18,6 +18,7 @@
 
 #include <vulkan/vulkan.h>
 #include "VulkanTools.h"
+#include "VulkanMemoryAllocator.hpp"
 
 #ifdef __ANDROID__
 #include "VulkanAndroid.h"
@@ -54,7 +55,11 @@ private:
 	VkInstance instance;
 	VkDevice device;
 	VkPhysicalDevice physicalDevice;
-	VkSurfaceKHR surface;
+	VkSurfaceKHR surface = VK_NULL_HANDLE;
+	// Sub allocator used for the offscreen images in headless mode
+	vks::MemoryAllocator* memoryAllocator = nullptr;
+	// Memory backing the offscreen images in headless mode
+	std::vector<vks::Allocation> headlessMemory;
 	// Function pointers
 	PFN_vkGetPhysicalDeviceSurfaceSupportKHR fpGetPhysicalDeviceSurfaceSupportKHR;
 	PFN_vkGetPhysicalDeviceSurfaceCapabilitiesKHR fpGetPhysicalDeviceSurfaceCapabilitiesKHR; 
@@ -70,11 +75,13 @@ public:
 	VkColorSpaceKHR colorSpace;
 	/** @brief Handle to the current swap chain, required for recreation */
 	VkSwapchainKHR swapChain = VK_NULL_HANDLE;	
-	uint32_t imageCount;
+	uint32_t imageCount = 0;
 	std::vector<VkImage> images;
 	std::vector<SwapChainBuffer> buffers;
 	/** @brief Queue family index of the detected graphics and presenting device queue */
 	uint32_t queueNodeIndex = UINT32_MAX;
+	/** @brief Set if the images are plain offscreen images that are never presented (headless mode, no surface) */
+	bool headless = false;
 
 	/** @brief Creates the platform specific surface abstraction of the native platform window used for presentation */	
 #if defined(VK_USE_PLATFORM_WIN32_KHR)
@@ -253,13 +260,21 @@ public:
 	* @param instance Vulkan instance to use
 	* @param physicalDevice Physical device used to query properties and formats relevant to the swapchain
 	* @param device Logical representation of the device to create the swapchain for
+	* @param headless (Optional) Use offscreen images instead of a surface and swap chain
+	* @param memoryAllocator (Optional) Allocator for the offscreen images, required in headless mode
 	*
 	*/
-	void connect(VkInstance instance, VkPhysicalDevice physicalDevice, VkDevice device)
+	void connect(VkInstance instance, VkPhysicalDevice physicalDevice, VkDevice device, bool headless = false, vks::MemoryAllocator* memoryAllocator = nullptr)
 	{
 		this->instance = instance;
 		this->physicalDevice = physicalDevice;
 		this->device = device;
+		this->headless = headless;
+		this->memoryAllocator = memoryAllocator;
+		// Surface and swap chain extensions aren't enabled in headless mode
+		if (headless) {
+			return;
+		}
 		GET_INSTANCE_PROC_ADDR(instance, GetPhysicalDeviceSurfaceSupportKHR);
 		GET_INSTANCE_PROC_ADDR(instance, GetPhysicalDeviceSurfaceCapabilitiesKHR);
 		GET_INSTANCE_PROC_ADDR(instance, GetPhysicalDeviceSurfaceFormatsKHR);
@@ -271,6 +286,76 @@ public:
 		GET_DEVICE_PROC_ADDR(device, QueuePresentKHR);
 	}
 
+	/**
+	* Select the queue and format for headless rendering, replaces initSurface
+	*
+	* @param queueNodeIndex Queue family index of the graphics queue
+	* @param format Color format of the offscreen images
+	*/
+	void initHeadless(uint32_t queueNodeIndex, VkFormat format = VK_FORMAT_B8G8R8A8_UNORM)
+	{
+		assert(headless);
+		this->queueNodeIndex = queueNodeIndex;
+		colorFormat = format;
+		colorSpace = VK_COLOR_SPACE_SRGB_NONLINEAR_KHR;
+	}
+
+	/**
+	* Create the offscreen images used instead of swap chain images in headless mode
+	* The images can also be used as transfer sources, e.g. to read back a frame for image comparisons
+	*/
+	void createHeadless(uint32_t width, uint32_t height, uint32_t count = 3)
+	{
+		assert(headless);
+		assert(memoryAllocator);
+		cleanupHeadless();
+
+		VkPhysicalDeviceMemoryProperties memoryProperties;
+		vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+
+		imageCount = count;
+		images.resize(imageCount);
+		buffers.resize(imageCount);
+		headlessMemory.resize(imageCount);
+		for (uint32_t i = 0; i < imageCount; i++)
+		{
+			VkImageCreateInfo imageCI{};
+			imageCI.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+			imageCI.imageType = VK_IMAGE_TYPE_2D;
+			imageCI.format = colorFormat;
+			imageCI.extent = { width, height, 1 };
+			imageCI.mipLevels = 1;
+			imageCI.arrayLayers = 1;
+			imageCI.samples = VK_SAMPLE_COUNT_1_BIT;
+			imageCI.tiling = VK_IMAGE_TILING_OPTIMAL;
+			imageCI.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+			imageCI.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+			VK_CHECK_RESULT(vkCreateImage(device, &imageCI, nullptr, &images[i]));
+
+			VkMemoryRequirements memReqs;
+			vkGetImageMemoryRequirements(device, images[i], &memReqs);
+			uint32_t memoryTypeIndex = UINT32_MAX;
+			for (uint32_t j = 0; j < memoryProperties.memoryTypeCount; j++) {
+				if ((memReqs.memoryTypeBits & (1 << j)) && (memoryProperties.memoryTypes[j].propertyFlags & VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT)) {
+					memoryTypeIndex = j;
+					break;
+				}
+			}
+			assert(memoryTypeIndex != UINT32_MAX);
+			headlessMemory[i] = memoryAllocator->allocate(memReqs, memoryTypeIndex, vks::allocationTilingOptimal, memReqs.size >= memoryAllocator->dedicatedImageSize);
+			VK_CHECK_RESULT(vkBindImageMemory(device, images[i], headlessMemory[i].memory, headlessMemory[i].offset));
+
+			VkImageViewCreateInfo viewCI{};
+			viewCI.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+			viewCI.viewType = VK_IMAGE_VIEW_TYPE_2D;
+			viewCI.format = colorFormat;
+			viewCI.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+			viewCI.image = images[i];
+			buffers[i].image = images[i];
+			VK_CHECK_RESULT(vkCreateImageView(device, &viewCI, nullptr, &buffers[i].view));
+		}
+	}
+
 	/** 
 	* Create the swapchain and get it's images with given width and height
 	* 
@@ -280,6 +365,11 @@ public:
 	*/
 	void create(uint32_t *width, uint32_t *height, bool vsync = false)
 	{
+		if (headless) {
+			createHeadless(*width, *height, imageCount > 0 ? imageCount : 3);
+			return;
+		}
+
 		VkSwapchainKHR oldSwapchain = swapChain;
 
 		// Get physical device surface properties and formats
@@ -461,6 +551,11 @@ public:
 	*/
 	VkResult acquireNextImage(VkSemaphore presentCompleteSemaphore, uint32_t *imageIndex)
 	{
+		// Headless images are used round robin, nothing signals the semaphore
+		if (headless) {
+			*imageIndex = (*imageIndex + 1) % imageCount;
+			return VK_SUCCESS;
+		}
 		// By setting timeout to UINT64_MAX we will always wait until the next image has been acquired or an actual error is thrown
 		// With that we don't have to handle VK_NOT_READY
 		return fpAcquireNextImageKHR(device, swapChain, UINT64_MAX, presentCompleteSemaphore, (VkFence)nullptr, imageIndex);
@@ -477,6 +572,9 @@ public:
 	*/
 	VkResult queuePresent(VkQueue queue, uint32_t imageIndex, VkSemaphore waitSemaphore = VK_NULL_HANDLE)
 	{
+		if (headless) {
+			return VK_SUCCESS;
+		}
 		VkPresentInfoKHR presentInfo = {};
 		presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
 		presentInfo.pNext = NULL;
@@ -498,6 +596,11 @@ public:
 	*/
 	void cleanup()
 	{
+		if (headless)
+		{
+			cleanupHeadless();
+			return;
+		}
 		if (swapChain != VK_NULL_HANDLE)
 		{
 			for (uint32_t i = 0; i < imageCount; i++)
@@ -514,6 +617,20 @@ public:
 		swapChain = VK_NULL_HANDLE;
 	}
 
+	/**
+	* Destroy the offscreen images created for headless mode
+	*/
+	void cleanupHeadless()
+	{
+		for (size_t i = 0; i < headlessMemory.size(); i++)
+		{
+			vkDestroyImageView(device, buffers[i].view, nullptr);
+			vkDestroyImage(device, images[i], nullptr);
+			memoryAllocator->free(headlessMemory[i]);
+		}
+		headlessMemory.clear();
+	}
+
 #if defined(_DIRECT2DISPLAY)
 	/**
 	* Create direct to display surface
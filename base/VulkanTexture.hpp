@@ -21,6 +21,8 @@
 #include "VulkanTools.h"
 #include "VulkanDevice.hpp"
 #include "VulkanBuffer.hpp"
+#include "VulkanStagingUploader.hpp"
+#include "VulkanMappedFile.hpp"
 
 #if defined(__ANDROID__)
 #include <android/asset_manager.h>
@@ -28,13 +30,195 @@
 
 namespace vks
 {
+	/**
+	* @brief KTX file with the image data read straight from a memory mapping of the file
+	* Only the header is parsed by libktx, the image data is loaded through libktx only if the file's layout can't be used as is (e.g. different endianness)
+	* Doesn't touch any Vulkan objects, so files can be loaded from any thread
+	*/
+	class KTXSource
+	{
+	private:
+		// 12 byte identifier, endianness and 12 more header fields
+		static const size_t headerSize = 64;
+
+		KTXSource(const KTXSource&) = delete;
+		KTXSource& operator=(const KTXSource&) = delete;
+
+		bool setupMappedData()
+		{
+			static const uint8_t identifier[12] = { 0xAB, 0x4B, 0x54, 0x58, 0x20, 0x31, 0x31, 0xBB, 0x0D, 0x0A, 0x1A, 0x0A };
+			const uint8_t* fileData = file.data();
+			if (file.size() < headerSize || memcmp(fileData, identifier, sizeof(identifier)) != 0) {
+				return false;
+			}
+			uint32_t endianness, bytesOfKeyValueData;
+			memcpy(&endianness, fileData + 12, sizeof(uint32_t));
+			memcpy(&bytesOfKeyValueData, fileData + 60, sizeof(uint32_t));
+			if (endianness != 0x04030201) {
+				return false;
+			}
+			// Copy regions of block compressed formats have to start at a multiple of the block size, which the size in front of each level breaks
+			// The image data of compressed files is small enough to be loaded through libktx instead, which packs the levels
+			if (texture->isCompressed) {
+				return false;
+			}
+			const size_t dataStart = headerSize + bytesOfKeyValueData;
+			// Check that the levels are where libktx's layout puts them, with the size of each level in front of it
+			for (uint32_t level = 0; level < texture->numLevels; level++) {
+				ktx_size_t offset;
+				if (ktxTexture_GetImageOffset(texture, level, 0, 0, &offset) != KTX_SUCCESS) {
+					return false;
+				}
+				const size_t levelOffset = dataStart + offset + (level + 1) * sizeof(uint32_t);
+				if (levelOffset > file.size()) {
+					return false;
+				}
+				// Size of one face for non array cube maps, size of the whole level otherwise
+				uint32_t imageSize;
+				memcpy(&imageSize, fileData + levelOffset - sizeof(uint32_t), sizeof(uint32_t));
+				const ktx_size_t faceSize = ktxTexture_GetImageSize(texture, level);
+				const ktx_size_t levelSize = faceSize * texture->numLayers * texture->numFaces;
+				const bool nonArrayCubeMap = texture->isCubemap && !texture->isArray;
+				if (imageSize != (nonArrayCubeMap ? faceSize : levelSize) || levelOffset + levelSize > file.size()) {
+					return false;
+				}
+			}
+			data = fileData + dataStart;
+			size = file.size() - dataStart;
+			return true;
+		}
+
+	public:
+		ktxTexture* texture = nullptr;
+		vks::MappedFile file;
+		// Image data of all levels, layers and faces
+		const ktx_uint8_t* data = nullptr;
+		ktx_size_t size = 0;
+		// True if data points into the file mapping
+		bool mapped = false;
+
+		KTXSource() {}
+
+		~KTXSource()
+		{
+			destroy();
+		}
+
+		/**
+		* Map a KTX file and parse its header
+		*
+		* @param filename File to load (supports .ktx)
+		*
+		* @return True if the file could be loaded
+		*/
+		bool load(const std::string& filename)
+		{
+			destroy();
+			if (!file.open(filename)) {
+				vks::tools::exitFatal("Could not load texture from " + filename + "\n\nThe file may be part of the additional asset pack.\n\nRun \"download_assets.py\" in the repository root to download the latest version.", -1);
+				return false;
+			}
+			if (ktxTexture_CreateFromMemory(file.data(), file.size(), KTX_TEXTURE_CREATE_NO_FLAGS, &texture) != KTX_SUCCESS) {
+				destroy();
+				return false;
+			}
+			mapped = setupMappedData();
+			if (!mapped) {
+				if (ktxTexture_LoadImageData(texture, nullptr, 0) != KTX_SUCCESS) {
+					destroy();
+					return false;
+				}
+				data = ktxTexture_GetData(texture);
+				size = ktxTexture_GetSize(texture);
+				file.close();
+			}
+			return true;
+		}
+
+		/** @brief Hint that all image data is about to be read */
+		void prefetch() const
+		{
+			if (mapped) {
+				file.prefetch(data - file.data(), size);
+			}
+		}
+
+		/** @brief Offset of an image relative to data */
+		ktx_size_t getImageOffset(uint32_t level, uint32_t layer, uint32_t face) const
+		{
+			ktx_size_t offset = 0;
+			KTX_error_code result = ktxTexture_GetImageOffset(texture, level, layer, face, &offset);
+			assert(result == KTX_SUCCESS);
+			// Each level in the file starts with its size
+			return mapped ? offset + (level + 1) * sizeof(uint32_t) : offset;
+		}
+
+		void destroy()
+		{
+			if (texture) {
+				ktxTexture_Destroy(texture);
+				texture = nullptr;
+			}
+			file.close();
+			data = nullptr;
+			size = 0;
+			mapped = false;
+		}
+	};
+
+	/** @brief A file containing one texture's image data in a specific format, e.g. a block compressed copy of an uncompressed texture */
+	struct TextureVariant {
+		// Appended to the texture's base name to get the file name, e.g. "_bc7" for "terrain_layers_01_bc7.ktx"
+		std::string suffix;
+		VkFormat format;
+	};
+
+	/**
+	* @brief Block compressed variants for color textures in order of preference
+	* Desktop GPUs usually only support BC formats, mobile GPUs only ASTC and ETC2
+	*/
+	inline std::vector<TextureVariant> getCompressedColorVariants()
+	{
+#if defined(__ANDROID__)
+		return { { "_astc_8x8", VK_FORMAT_ASTC_8x8_UNORM_BLOCK }, { "_etc2", VK_FORMAT_ETC2_R8G8B8A8_UNORM_BLOCK }, { "_bc7", VK_FORMAT_BC7_UNORM_BLOCK } };
+#else
+		return { { "_bc7", VK_FORMAT_BC7_UNORM_BLOCK }, { "_bc3", VK_FORMAT_BC3_UNORM_BLOCK }, { "_astc_8x8", VK_FORMAT_ASTC_8x8_UNORM_BLOCK }, { "_etc2", VK_FORMAT_ETC2_R8G8B8A8_UNORM_BLOCK } };
+#endif
+	}
+
+	/**
+	* Select the first variant of a texture that exists and can be sampled with linear filtering on the device
+	*
+	* @param physicalDevice Device to check the format support for
+	* @param basename Path of the texture without suffix and extension
+	* @param variants Variants in order of preference, the last one should be an uncompressed format that every device supports
+	* @param filename Set to the file of the selected variant
+	*
+	* @return Format of the selected variant
+	*/
+	inline VkFormat selectTextureVariant(VkPhysicalDevice physicalDevice, const std::string& basename, const std::vector<TextureVariant>& variants, std::string& filename)
+	{
+		const VkFormatFeatureFlags requiredFeatures = VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+		for (auto& variant : variants) {
+			VkFormatProperties formatProperties;
+			vkGetPhysicalDeviceFormatProperties(physicalDevice, variant.format, &formatProperties);
+			const std::string variantFilename = basename + variant.suffix + ".ktx";
+			if ((formatProperties.optimalTilingFeatures & requiredFeatures) == requiredFeatures && vks::tools::fileExists(variantFilename)) {
+				filename = variantFilename;
+				return variant.format;
+			}
+		}
+		vks::tools::exitFatal("No supported format found for texture " + basename, -1);
+		return VK_FORMAT_UNDEFINED;
+	}
+
 	/** @brief Vulkan texture base class */
 	class Texture {
 	public:
 		vks::VulkanDevice *device;
 		VkImage image;
 		VkImageLayout imageLayout;
-		VkDeviceMemory deviceMemory;
+		vks::Allocation deviceMemory;
 		VkImageView view;
 		uint32_t width, height;
 		uint32_t mipLevels;
@@ -57,31 +241,7 @@ namespace vks
 			{
 				vkDestroySampler(device->logicalDevice, sampler, nullptr);
 			}
-			vkFreeMemory(device->logicalDevice, deviceMemory, nullptr);
-		}
-
-		ktxResult loadKTXFile(std::string filename, ktxTexture **target)
-		{
-			ktxResult result = KTX_SUCCESS;
-#if defined(__ANDROID__)
-			AAsset* asset = AAssetManager_open(androidApp->activity->assetManager, filename.c_str(), AASSET_MODE_STREAMING);
-			if (!asset) {
-				vks::tools::exitFatal("Could not load texture from " + filename + "\n\nThe file may be part of the additional asset pack.\n\nRun \"download_assets.py\" in the repository root to download the latest version.", -1);
-			}
-			size_t size = AAsset_getLength(asset);
-			assert(size > 0);
-			ktx_uint8_t *textureData = new ktx_uint8_t[size];
-			AAsset_read(asset, textureData, size);
-			AAsset_close(asset);
-			result = ktxTexture_CreateFromMemory(textureData, size, KTX_TEXTURE_CREATE_LOAD_IMAGE_DATA_BIT, target);
-			delete[] textureData;
-#else
-			if (!vks::tools::fileExists(filename)) {
-				vks::tools::exitFatal("Could not load texture from " + filename + "\n\nThe file may be part of the additional asset pack.\n\nRun \"download_assets.py\" in the repository root to download the latest version.", -1);
-			}
-			result = ktxTexture_CreateFromNamedFile(filename.c_str(), KTX_TEXTURE_CREATE_LOAD_IMAGE_DATA_BIT, target);			
-#endif		
-			return result;
+			device->freeMemory(deviceMemory);
 		}
 	};
 
@@ -94,7 +254,7 @@ namespace vks
 		* @param filename File to load (supports .ktx)
 		* @param format Vulkan format of the image data stored in the file
 		* @param device Vulkan device to create the texture on
-		* @param copyQueue Queue used for the texture staging copy commands (must support transfer)
+		* @param copyQueue Queue used for the layout transition of linear tiled textures (staged uploads go through the device's staging uploader)
 		* @param (Optional) imageUsageFlags Usage flags for the texture's image (defaults to VK_IMAGE_USAGE_SAMPLED_BIT)
 		* @param (Optional) imageLayout Usage layout for the texture (defaults VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL)
 		* @param (Optional) forceLinear Force linear tiling (not advised, defaults to false)
@@ -109,17 +269,41 @@ namespace vks
 			VkImageLayout imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, 
 			bool forceLinear = false)
 		{
-			ktxTexture* ktxTexture;
-			ktxResult result = loadKTXFile(filename, &ktxTexture);
-			assert(result == KTX_SUCCESS);
+			KTXSource source;
+			bool loaded = source.load(filename);
+			assert(loaded);
+			loadFromKTX(source, format, device, copyQueue, imageUsageFlags, imageLayout, forceLinear);
+		}
 
+		/**
+		* Create a 2D texture including all mip levels
+		*
+		* @param source KTX file to read the image data from
+		* @param format Vulkan format of the image data stored in the file
+		* @param device Vulkan device to create the texture on
+		* @param copyQueue Queue used for the layout transition of linear tiled textures (staged uploads go through the device's staging uploader)
+		* @param (Optional) imageUsageFlags Usage flags for the texture's image (defaults to VK_IMAGE_USAGE_SAMPLED_BIT)
+		* @param (Optional) imageLayout Usage layout for the texture (defaults VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL)
+		* @param (Optional) forceLinear Force linear tiling (not advised, defaults to false)
+		*
+		*/
+		void loadFromKTX(
+			const KTXSource &source,
+			VkFormat format,
+			vks::VulkanDevice *device,
+			VkQueue copyQueue,
+			VkImageUsageFlags imageUsageFlags = VK_IMAGE_USAGE_SAMPLED_BIT,
+			VkImageLayout imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, 
+			bool forceLinear = false)
+		{
+			ktxTexture* ktxTexture = source.texture;
 			this->device = device;
 			width = ktxTexture->baseWidth;
 			height = ktxTexture->baseHeight;
 			mipLevels = ktxTexture->numLevels;
 
-			ktx_uint8_t *ktxTextureData = ktxTexture_GetData(ktxTexture);
-			ktx_size_t ktxTextureSize = ktxTexture_GetSize(ktxTexture);
+			const ktx_uint8_t *ktxTextureData = source.data;
+			ktx_size_t ktxTextureSize = source.size;
 
 			// Get device properites for the requested texture format
 			VkFormatProperties formatProperties;
@@ -132,50 +316,16 @@ namespace vks
 			// limited amount of formats and features (mip maps, cubemaps, arrays, etc.)
 			VkBool32 useStaging = !forceLinear;
 
-			VkMemoryAllocateInfo memAllocInfo = vks::initializers::memoryAllocateInfo();
 			VkMemoryRequirements memReqs;
 
-			// Use a separate command buffer for texture loading
-			VkCommandBuffer copyCmd = device->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
-
 			if (useStaging)
 			{
-				// Create a host-visible staging buffer that contains the raw image data
-				VkBuffer stagingBuffer;
-				VkDeviceMemory stagingMemory;
-
-				VkBufferCreateInfo bufferCreateInfo = vks::initializers::bufferCreateInfo();
-				bufferCreateInfo.size = ktxTextureSize;
-				// This buffer is used as a transfer source for the buffer copy
-				bufferCreateInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
-				bufferCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-
-				VK_CHECK_RESULT(vkCreateBuffer(device->logicalDevice, &bufferCreateInfo, nullptr, &stagingBuffer));
-
-				// Get memory requirements for the staging buffer (alignment, memory type bits)
-				vkGetBufferMemoryRequirements(device->logicalDevice, stagingBuffer, &memReqs);
-
-				memAllocInfo.allocationSize = memReqs.size;
-				// Get memory type index for a host visible buffer
-				memAllocInfo.memoryTypeIndex = device->getMemoryType(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-
-				VK_CHECK_RESULT(vkAllocateMemory(device->logicalDevice, &memAllocInfo, nullptr, &stagingMemory));
-				VK_CHECK_RESULT(vkBindBufferMemory(device->logicalDevice, stagingBuffer, stagingMemory, 0));
-
-				// Copy texture data into staging buffer
-				uint8_t *data;
-				VK_CHECK_RESULT(vkMapMemory(device->logicalDevice, stagingMemory, 0, memReqs.size, 0, (void **)&data));
-				memcpy(data, ktxTextureData, ktxTextureSize);
-				vkUnmapMemory(device->logicalDevice, stagingMemory);
-
 				// Setup buffer copy regions for each mip level
 				std::vector<VkBufferImageCopy> bufferCopyRegions;
 
 				for (uint32_t i = 0; i < mipLevels; i++)
 				{
-					ktx_size_t offset;
-					KTX_error_code result = ktxTexture_GetImageOffset(ktxTexture, i, 0, 0, &offset);
-					assert(result == KTX_SUCCESS);
+					ktx_size_t offset = source.getImageOffset(i, 0, 0);
 
 					VkBufferImageCopy bufferCopyRegion = {};
 					bufferCopyRegion.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
@@ -209,13 +359,7 @@ namespace vks
 				}
 				VK_CHECK_RESULT(vkCreateImage(device->logicalDevice, &imageCreateInfo, nullptr, &image));
 
-				vkGetImageMemoryRequirements(device->logicalDevice, image, &memReqs);
-
-				memAllocInfo.allocationSize = memReqs.size;
-
-				memAllocInfo.memoryTypeIndex = device->getMemoryType(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-				VK_CHECK_RESULT(vkAllocateMemory(device->logicalDevice, &memAllocInfo, nullptr, &deviceMemory));
-				VK_CHECK_RESULT(vkBindImageMemory(device->logicalDevice, image, deviceMemory, 0));
+				deviceMemory = device->allocateImageMemory(image, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
 
 				VkImageSubresourceRange subresourceRange = {};
 				subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
@@ -223,39 +367,9 @@ namespace vks
 				subresourceRange.levelCount = mipLevels;
 				subresourceRange.layerCount = 1;
 
-				// Image barrier for optimal image (target)
-				// Optimal image will be used as destination for the copy
-				vks::tools::setImageLayout(
-					copyCmd,
-					image,
-					VK_IMAGE_LAYOUT_UNDEFINED,
-					VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-					subresourceRange);
-
-				// Copy mip levels from staging buffer
-				vkCmdCopyBufferToImage(
-					copyCmd,
-					stagingBuffer,
-					image,
-					VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-					static_cast<uint32_t>(bufferCopyRegions.size()),
-					bufferCopyRegions.data()
-				);
-
-				// Change texture image layout to shader read after all mip levels have been copied
+				// Stage the image data, the copies and layout transitions are submitted in a batch with other uploads
 				this->imageLayout = imageLayout;
-				vks::tools::setImageLayout(
-					copyCmd,
-					image,
-					VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-					imageLayout,
-					subresourceRange);
-
-				device->flushCommandBuffer(copyCmd, copyQueue);
-
-				// Clean up staging resources
-				vkFreeMemory(device->logicalDevice, stagingMemory, nullptr);
-				vkDestroyBuffer(device->logicalDevice, stagingBuffer, nullptr);
+				device->stagingUploader->uploadImage(image, ktxTextureData, ktxTextureSize, bufferCopyRegions, subresourceRange, imageLayout);
 			}
 			else
 			{
@@ -267,7 +381,6 @@ namespace vks
 				assert(formatProperties.linearTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT);
 
 				VkImage mappableImage;
-				VkDeviceMemory mappableMemory;
 
 				VkImageCreateInfo imageCreateInfo = vks::initializers::imageCreateInfo();
 				imageCreateInfo.imageType = VK_IMAGE_TYPE_2D;
@@ -287,17 +400,9 @@ namespace vks
 				// Get memory requirements for this image 
 				// like size and alignment
 				vkGetImageMemoryRequirements(device->logicalDevice, mappableImage, &memReqs);
-				// Set memory allocation size to required memory size
-				memAllocInfo.allocationSize = memReqs.size;
 
-				// Get memory type that can be mapped to host memory
-				memAllocInfo.memoryTypeIndex = device->getMemoryType(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-
-				// Allocate host memory
-				VK_CHECK_RESULT(vkAllocateMemory(device->logicalDevice, &memAllocInfo, nullptr, &mappableMemory));
-
-				// Bind allocated image for use
-				VK_CHECK_RESULT(vkBindImageMemory(device->logicalDevice, mappableImage, mappableMemory, 0));
+				// Allocate and bind memory that can be mapped to host memory
+				vks::Allocation mappableMemory = device->allocateImageMemory(mappableImage, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, VK_IMAGE_TILING_LINEAR);
 
 				// Get sub resource layout
 				// Mip map count, array layer, etc.
@@ -306,19 +411,13 @@ namespace vks
 				subRes.mipLevel = 0;
 
 				VkSubresourceLayout subResLayout;
-				void *data;
 
 				// Get sub resources layout 
 				// Includes row pitch, size offsets, etc.
 				vkGetImageSubresourceLayout(device->logicalDevice, mappableImage, &subRes, &subResLayout);
 
-				// Map image memory
-				VK_CHECK_RESULT(vkMapMemory(device->logicalDevice, mappableMemory, 0, memReqs.size, 0, &data));
-
-				// Copy image data into memory
-				memcpy(data, ktxTextureData, memReqs.size);
-
-				vkUnmapMemory(device->logicalDevice, mappableMemory);
+				// Copy image data into the persistently mapped memory
+				memcpy(mappableMemory.mapped, ktxTextureData + source.getImageOffset(0, 0, 0), std::min<VkDeviceSize>(memReqs.size, ktxTexture_GetImageSize(ktxTexture, 0)));
 
 				// Linear tiled images don't need to be staged
 				// and can be directly used as textures
@@ -327,13 +426,12 @@ namespace vks
 				this->imageLayout = imageLayout;
 
 				// Setup image memory barrier
+				VkCommandBuffer copyCmd = device->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
 				vks::tools::setImageLayout(copyCmd, image, VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_UNDEFINED, imageLayout);
 
 				device->flushCommandBuffer(copyCmd, copyQueue);
 			}
 
-			ktxTexture_Destroy(ktxTexture);
-
 			// Create a defaultsampler
 			VkSamplerCreateInfo samplerCreateInfo = {};
 			samplerCreateInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
@@ -383,7 +481,7 @@ namespace vks
 		* @param height Height of the texture to create
 		* @param format Vulkan format of the image data stored in the file
 		* @param device Vulkan device to create the texture on
-		* @param copyQueue Queue used for the texture staging copy commands (must support transfer)
+		* @param copyQueue Unused, uploads go through the device's staging uploader
 		* @param (Optional) filter Texture filtering for the sampler (defaults to VK_FILTER_LINEAR)
 		* @param (Optional) imageUsageFlags Usage flags for the texture's image (defaults to VK_IMAGE_USAGE_SAMPLED_BIT)
 		* @param (Optional) imageLayout Usage layout for the texture (defaults VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL)
@@ -407,40 +505,6 @@ namespace vks
 			height = texHeight;
 			mipLevels = 1;
 
-			VkMemoryAllocateInfo memAllocInfo = vks::initializers::memoryAllocateInfo();
-			VkMemoryRequirements memReqs;
-
-			// Use a separate command buffer for texture loading
-			VkCommandBuffer copyCmd = device->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
-
-			// Create a host-visible staging buffer that contains the raw image data
-			VkBuffer stagingBuffer;
-			VkDeviceMemory stagingMemory;
-
-			VkBufferCreateInfo bufferCreateInfo = vks::initializers::bufferCreateInfo();
-			bufferCreateInfo.size = bufferSize;
-			// This buffer is used as a transfer source for the buffer copy
-			bufferCreateInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
-			bufferCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-
-			VK_CHECK_RESULT(vkCreateBuffer(device->logicalDevice, &bufferCreateInfo, nullptr, &stagingBuffer));
-
-			// Get memory requirements for the staging buffer (alignment, memory type bits)
-			vkGetBufferMemoryRequirements(device->logicalDevice, stagingBuffer, &memReqs);
-
-			memAllocInfo.allocationSize = memReqs.size;
-			// Get memory type index for a host visible buffer
-			memAllocInfo.memoryTypeIndex = device->getMemoryType(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-
-			VK_CHECK_RESULT(vkAllocateMemory(device->logicalDevice, &memAllocInfo, nullptr, &stagingMemory));
-			VK_CHECK_RESULT(vkBindBufferMemory(device->logicalDevice, stagingBuffer, stagingMemory, 0));
-
-			// Copy texture data into staging buffer
-			uint8_t *data;
-			VK_CHECK_RESULT(vkMapMemory(device->logicalDevice, stagingMemory, 0, memReqs.size, 0, (void **)&data));
-			memcpy(data, buffer, bufferSize);
-			vkUnmapMemory(device->logicalDevice, stagingMemory);
-
 			VkBufferImageCopy bufferCopyRegion = {};
 			bufferCopyRegion.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
 			bufferCopyRegion.imageSubresource.mipLevel = 0;
@@ -470,13 +534,7 @@ namespace vks
 			}
 			VK_CHECK_RESULT(vkCreateImage(device->logicalDevice, &imageCreateInfo, nullptr, &image));
 
-			vkGetImageMemoryRequirements(device->logicalDevice, image, &memReqs);
-
-			memAllocInfo.allocationSize = memReqs.size;
-
-			memAllocInfo.memoryTypeIndex = device->getMemoryType(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-			VK_CHECK_RESULT(vkAllocateMemory(device->logicalDevice, &memAllocInfo, nullptr, &deviceMemory));
-			VK_CHECK_RESULT(vkBindImageMemory(device->logicalDevice, image, deviceMemory, 0));
+			deviceMemory = device->allocateImageMemory(image, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
 
 			VkImageSubresourceRange subresourceRange = {};
 			subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
@@ -484,39 +542,9 @@ namespace vks
 			subresourceRange.levelCount = mipLevels;
 			subresourceRange.layerCount = 1;
 
-			// Image barrier for optimal image (target)
-			// Optimal image will be used as destination for the copy
-			vks::tools::setImageLayout(
-				copyCmd,
-				image,
-				VK_IMAGE_LAYOUT_UNDEFINED,
-				VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-				subresourceRange);
-
-			// Copy mip levels from staging buffer
-			vkCmdCopyBufferToImage(
-				copyCmd,
-				stagingBuffer,
-				image,
-				VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-				1,
-				&bufferCopyRegion
-			);
-
-			// Change texture image layout to shader read after all mip levels have been copied
+			// Stage the image data, the copies and layout transitions are submitted in a batch with other uploads
 			this->imageLayout = imageLayout;
-			vks::tools::setImageLayout(
-				copyCmd,
-				image,
-				VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-				imageLayout,
-				subresourceRange);
-
-			device->flushCommandBuffer(copyCmd, copyQueue);
-
-			// Clean up staging resources
-			vkFreeMemory(device->logicalDevice, stagingMemory, nullptr);
-			vkDestroyBuffer(device->logicalDevice, stagingBuffer, nullptr);
+			device->stagingUploader->uploadImage(image, buffer, bufferSize, { bufferCopyRegion }, subresourceRange, imageLayout);
 
 			// Create sampler
 			VkSamplerCreateInfo samplerCreateInfo = {};
@@ -561,7 +589,7 @@ namespace vks
 		* @param filename File to load (supports .ktx)
 		* @param format Vulkan format of the image data stored in the file
 		* @param device Vulkan device to create the texture on
-		* @param copyQueue Queue used for the texture staging copy commands (must support transfer)
+		* @param copyQueue Unused, uploads go through the device's staging uploader
 		* @param (Optional) imageUsageFlags Usage flags for the texture's image (defaults to VK_IMAGE_USAGE_SAMPLED_BIT)
 		* @param (Optional) imageLayout Usage layout for the texture (defaults VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL)
 		*
@@ -574,49 +602,40 @@ namespace vks
 			VkImageUsageFlags imageUsageFlags = VK_IMAGE_USAGE_SAMPLED_BIT,
 			VkImageLayout imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL)
 		{
-			ktxTexture* ktxTexture;
-			ktxResult result = loadKTXFile(filename, &ktxTexture);
-			assert(result == KTX_SUCCESS);
+			KTXSource source;
+			bool loaded = source.load(filename);
+			assert(loaded);
+			loadFromKTX(source, format, device, copyQueue, imageUsageFlags, imageLayout);
+		}
 
+		/**
+		* Create a 2D texture array including all mip levels
+		*
+		* @param source KTX file to read the image data from
+		* @param format Vulkan format of the image data stored in the file
+		* @param device Vulkan device to create the texture on
+		* @param copyQueue Unused, uploads go through the device's staging uploader
+		* @param (Optional) imageUsageFlags Usage flags for the texture's image (defaults to VK_IMAGE_USAGE_SAMPLED_BIT)
+		* @param (Optional) imageLayout Usage layout for the texture (defaults VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL)
+		*
+		*/
+		void loadFromKTX(
+			const KTXSource &source,
+			VkFormat format,
+			vks::VulkanDevice *device,
+			VkQueue copyQueue,
+			VkImageUsageFlags imageUsageFlags = VK_IMAGE_USAGE_SAMPLED_BIT,
+			VkImageLayout imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL)
+		{
+			ktxTexture* ktxTexture = source.texture;
 			this->device = device;
 			width = ktxTexture->baseWidth;
 			height = ktxTexture->baseHeight;
 			layerCount = ktxTexture->numLayers;
 			mipLevels = ktxTexture->numLevels;
 
-			ktx_uint8_t *ktxTextureData = ktxTexture_GetData(ktxTexture);
-			ktx_size_t ktxTextureSize = ktxTexture_GetSize(ktxTexture);
-
-			VkMemoryAllocateInfo memAllocInfo = vks::initializers::memoryAllocateInfo();
-			VkMemoryRequirements memReqs;
-
-			// Create a host-visible staging buffer that contains the raw image data
-			VkBuffer stagingBuffer;
-			VkDeviceMemory stagingMemory;
-
-			VkBufferCreateInfo bufferCreateInfo = vks::initializers::bufferCreateInfo();
-			bufferCreateInfo.size = ktxTextureSize;
-			// This buffer is used as a transfer source for the buffer copy
-			bufferCreateInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
-			bufferCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-
-			VK_CHECK_RESULT(vkCreateBuffer(device->logicalDevice, &bufferCreateInfo, nullptr, &stagingBuffer));
-
-			// Get memory requirements for the staging buffer (alignment, memory type bits)
-			vkGetBufferMemoryRequirements(device->logicalDevice, stagingBuffer, &memReqs);
-
-			memAllocInfo.allocationSize = memReqs.size;
-			// Get memory type index for a host visible buffer
-			memAllocInfo.memoryTypeIndex = device->getMemoryType(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-
-			VK_CHECK_RESULT(vkAllocateMemory(device->logicalDevice, &memAllocInfo, nullptr, &stagingMemory));
-			VK_CHECK_RESULT(vkBindBufferMemory(device->logicalDevice, stagingBuffer, stagingMemory, 0));
-
-			// Copy texture data into staging buffer
-			uint8_t *data;
-			VK_CHECK_RESULT(vkMapMemory(device->logicalDevice, stagingMemory, 0, memReqs.size, 0, (void **)&data));
-			memcpy(data, ktxTextureData, ktxTextureSize);
-			vkUnmapMemory(device->logicalDevice, stagingMemory);
+			const ktx_uint8_t *ktxTextureData = source.data;
+			ktx_size_t ktxTextureSize = source.size;
 
 			// Setup buffer copy regions for each layer including all of it's miplevels
 			std::vector<VkBufferImageCopy> bufferCopyRegions;
@@ -625,9 +644,7 @@ namespace vks
 			{
 				for (uint32_t level = 0; level < mipLevels; level++)
 				{
-					ktx_size_t offset;
-					KTX_error_code result = ktxTexture_GetImageOffset(ktxTexture, level, layer, 0, &offset);
-					assert(result == KTX_SUCCESS);
+					ktx_size_t offset = source.getImageOffset(level, layer, 0);
 
 					VkBufferImageCopy bufferCopyRegion = {};
 					bufferCopyRegion.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
@@ -663,51 +680,18 @@ namespace vks
 
 			VK_CHECK_RESULT(vkCreateImage(device->logicalDevice, &imageCreateInfo, nullptr, &image));
 
-			vkGetImageMemoryRequirements(device->logicalDevice, image, &memReqs);
-
-			memAllocInfo.allocationSize = memReqs.size;
-			memAllocInfo.memoryTypeIndex = device->getMemoryType(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-
-			VK_CHECK_RESULT(vkAllocateMemory(device->logicalDevice, &memAllocInfo, nullptr, &deviceMemory));
-			VK_CHECK_RESULT(vkBindImageMemory(device->logicalDevice, image, deviceMemory, 0));
+			deviceMemory = device->allocateImageMemory(image, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
 
-			// Use a separate command buffer for texture loading
-			VkCommandBuffer copyCmd = device->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
-
-			// Image barrier for optimal image (target)
-			// Set initial layout for all array layers (faces) of the optimal (target) tiled texture
+			// Upload all array layers (faces) of the optimal tiled texture
 			VkImageSubresourceRange subresourceRange = {};
 			subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
 			subresourceRange.baseMipLevel = 0;
 			subresourceRange.levelCount = mipLevels;
 			subresourceRange.layerCount = layerCount;
 
-			vks::tools::setImageLayout(
-				copyCmd,
-				image,
-				VK_IMAGE_LAYOUT_UNDEFINED,
-				VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-				subresourceRange);
-
-			// Copy the layers and mip levels from the staging buffer to the optimal tiled image
-			vkCmdCopyBufferToImage(
-				copyCmd,
-				stagingBuffer,
-				image,
-				VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-				static_cast<uint32_t>(bufferCopyRegions.size()),
-				bufferCopyRegions.data());
-
-			// Change texture image layout to shader read after all faces have been copied
+			// Stage the image data, the copies and layout transitions are submitted in a batch with other uploads
 			this->imageLayout = imageLayout;
-			vks::tools::setImageLayout(
-				copyCmd,
-				image,
-				VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-				imageLayout,
-				subresourceRange);
-
-			device->flushCommandBuffer(copyCmd, copyQueue);
+			device->stagingUploader->uploadImage(image, ktxTextureData, ktxTextureSize, bufferCopyRegions, subresourceRange, imageLayout);
 
 			// Create sampler
 			VkSamplerCreateInfo samplerCreateInfo = vks::initializers::samplerCreateInfo();
@@ -737,11 +721,6 @@ namespace vks
 			viewCreateInfo.image = image;
 			VK_CHECK_RESULT(vkCreateImageView(device->logicalDevice, &viewCreateInfo, nullptr, &view));
 
-			// Clean up staging resources
-			ktxTexture_Destroy(ktxTexture);
-			vkFreeMemory(device->logicalDevice, stagingMemory, nullptr);
-			vkDestroyBuffer(device->logicalDevice, stagingBuffer, nullptr);
-
 			// Update descriptor image info member that can be used for setting up descriptor sets
 			updateDescriptor();
 		}
@@ -756,7 +735,7 @@ namespace vks
 		* @param filename File to load (supports .ktx)
 		* @param format Vulkan format of the image data stored in the file
 		* @param device Vulkan device to create the texture on
-		* @param copyQueue Queue used for the texture staging copy commands (must support transfer)
+		* @param copyQueue Unused, uploads go through the device's staging uploader
 		* @param (Optional) imageUsageFlags Usage flags for the texture's image (defaults to VK_IMAGE_USAGE_SAMPLED_BIT)
 		* @param (Optional) imageLayout Usage layout for the texture (defaults VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL)
 		*
@@ -769,48 +748,39 @@ namespace vks
 			VkImageUsageFlags imageUsageFlags = VK_IMAGE_USAGE_SAMPLED_BIT,
 			VkImageLayout imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL)
 		{
-			ktxTexture* ktxTexture;
-			ktxResult result = loadKTXFile(filename, &ktxTexture);
-			assert(result == KTX_SUCCESS);
+			KTXSource source;
+			bool loaded = source.load(filename);
+			assert(loaded);
+			loadFromKTX(source, format, device, copyQueue, imageUsageFlags, imageLayout);
+		}
 
+		/**
+		* Create a cubemap texture including all mip levels
+		*
+		* @param source KTX file to read the image data from
+		* @param format Vulkan format of the image data stored in the file
+		* @param device Vulkan device to create the texture on
+		* @param copyQueue Unused, uploads go through the device's staging uploader
+		* @param (Optional) imageUsageFlags Usage flags for the texture's image (defaults to VK_IMAGE_USAGE_SAMPLED_BIT)
+		* @param (Optional) imageLayout Usage layout for the texture (defaults VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL)
+		*
+		*/
+		void loadFromKTX(
+			const KTXSource &source,
+			VkFormat format,
+			vks::VulkanDevice *device,
+			VkQueue copyQueue,
+			VkImageUsageFlags imageUsageFlags = VK_IMAGE_USAGE_SAMPLED_BIT,
+			VkImageLayout imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL)
+		{
+			ktxTexture* ktxTexture = source.texture;
 			this->device = device;
 			width = ktxTexture->baseWidth;
 			height = ktxTexture->baseHeight;
 			mipLevels = ktxTexture->numLevels;
 
-			ktx_uint8_t *ktxTextureData = ktxTexture_GetData(ktxTexture);
-			ktx_size_t ktxTextureSize = ktxTexture_GetSize(ktxTexture);
-
-			VkMemoryAllocateInfo memAllocInfo = vks::initializers::memoryAllocateInfo();
-			VkMemoryRequirements memReqs;
-
-			// Create a host-visible staging buffer that contains the raw image data
-			VkBuffer stagingBuffer;
-			VkDeviceMemory stagingMemory;
-
-			VkBufferCreateInfo bufferCreateInfo = vks::initializers::bufferCreateInfo();
-			bufferCreateInfo.size = ktxTextureSize;
-			// This buffer is used as a transfer source for the buffer copy
-			bufferCreateInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
-			bufferCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-
-			VK_CHECK_RESULT(vkCreateBuffer(device->logicalDevice, &bufferCreateInfo, nullptr, &stagingBuffer));
-
-			// Get memory requirements for the staging buffer (alignment, memory type bits)
-			vkGetBufferMemoryRequirements(device->logicalDevice, stagingBuffer, &memReqs);
-
-			memAllocInfo.allocationSize = memReqs.size;
-			// Get memory type index for a host visible buffer
-			memAllocInfo.memoryTypeIndex = device->getMemoryType(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-
-			VK_CHECK_RESULT(vkAllocateMemory(device->logicalDevice, &memAllocInfo, nullptr, &stagingMemory));
-			VK_CHECK_RESULT(vkBindBufferMemory(device->logicalDevice, stagingBuffer, stagingMemory, 0));
-
-			// Copy texture data into staging buffer
-			uint8_t *data;
-			VK_CHECK_RESULT(vkMapMemory(device->logicalDevice, stagingMemory, 0, memReqs.size, 0, (void **)&data));
-			memcpy(data, ktxTextureData, ktxTextureSize);
-			vkUnmapMemory(device->logicalDevice, stagingMemory);
+			const ktx_uint8_t *ktxTextureData = source.data;
+			ktx_size_t ktxTextureSize = source.size;
 
 			// Setup buffer copy regions for each face including all of it's miplevels
 			std::vector<VkBufferImageCopy> bufferCopyRegions;
@@ -819,9 +789,7 @@ namespace vks
 			{
 				for (uint32_t level = 0; level < mipLevels; level++)
 				{
-					ktx_size_t offset;
-					KTX_error_code result = ktxTexture_GetImageOffset(ktxTexture, level, 0, face, &offset);
-					assert(result == KTX_SUCCESS);
+					ktx_size_t offset = source.getImageOffset(level, 0, face);
 
 					VkBufferImageCopy bufferCopyRegion = {};
 					bufferCopyRegion.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
@@ -861,51 +829,18 @@ namespace vks
 
 			VK_CHECK_RESULT(vkCreateImage(device->logicalDevice, &imageCreateInfo, nullptr, &image));
 
-			vkGetImageMemoryRequirements(device->logicalDevice, image, &memReqs);
+			deviceMemory = device->allocateImageMemory(image, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
 
-			memAllocInfo.allocationSize = memReqs.size;
-			memAllocInfo.memoryTypeIndex = device->getMemoryType(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-
-			VK_CHECK_RESULT(vkAllocateMemory(device->logicalDevice, &memAllocInfo, nullptr, &deviceMemory));
-			VK_CHECK_RESULT(vkBindImageMemory(device->logicalDevice, image, deviceMemory, 0));
-
-			// Use a separate command buffer for texture loading
-			VkCommandBuffer copyCmd = device->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
-
-			// Image barrier for optimal image (target)
-			// Set initial layout for all array layers (faces) of the optimal (target) tiled texture
+			// Upload all array layers (faces) of the optimal tiled texture
 			VkImageSubresourceRange subresourceRange = {};
 			subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
 			subresourceRange.baseMipLevel = 0;
 			subresourceRange.levelCount = mipLevels;
 			subresourceRange.layerCount = 6;
 
-			vks::tools::setImageLayout(
-				copyCmd,
-				image,
-				VK_IMAGE_LAYOUT_UNDEFINED,
-				VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-				subresourceRange);
-
-			// Copy the cube map faces from the staging buffer to the optimal tiled image
-			vkCmdCopyBufferToImage(
-				copyCmd,
-				stagingBuffer,
-				image,
-				VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-				static_cast<uint32_t>(bufferCopyRegions.size()),
-				bufferCopyRegions.data());
-
-			// Change texture image layout to shader read after all faces have been copied
+			// Stage the image data, the copies and layout transitions are submitted in a batch with other uploads
 			this->imageLayout = imageLayout;
-			vks::tools::setImageLayout(
-				copyCmd,
-				image,
-				VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-				imageLayout,
-				subresourceRange);
-
-			device->flushCommandBuffer(copyCmd, copyQueue);
+			device->stagingUploader->uploadImage(image, ktxTextureData, ktxTextureSize, bufferCopyRegions, subresourceRange, imageLayout);
 
 			// Create sampler
 			VkSamplerCreateInfo samplerCreateInfo = vks::initializers::samplerCreateInfo();
@@ -935,11 +870,6 @@ namespace vks
 			viewCreateInfo.image = image;
 			VK_CHECK_RESULT(vkCreateImageView(device->logicalDevice, &viewCreateInfo, nullptr, &view));
 
-			// Clean up staging resources
-			ktxTexture_Destroy(ktxTexture);
-			vkFreeMemory(device->logicalDevice, stagingMemory, nullptr);
-			vkDestroyBuffer(device->logicalDevice, stagingBuffer, nullptr);
-
 			// Update descriptor image info member that can be used for setting up descriptor sets
 			updateDescriptor();
 		}
@@ -0,0 +1,486 @@
+/*
+* Tiled texture streaming
+*
+* Splits the first level of a single layer KTX texture into square tiles with a one texel border, so filtering inside a tile
+* matches filtering the full texture. The tiles and a point sampled coarse level are cooked into a versioned tile file next
+* to the KTX file, tiles are read from a mapping of that file when they are requested
+* The coarse level of the whole texture stays resident, requested tiles are uploaded to the layers of a fixed size array
+* image and looked up in the shaders through a page table with one entry per tile (slot + 1, 0 if not resident)
+*
+* Copyright (C) by Sascha Willems - www.saschawillems.de
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <algorithm>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+#include "vulkan/vulkan.h"
+#include "VulkanDevice.hpp"
+#include "VulkanBuffer.hpp"
+#include "VulkanTexture.hpp"
+#include "VulkanMappedFile.hpp"
+#include "VulkanglTFCache.hpp"
+#include "VulkanStagingUploader.hpp"
+
+namespace vks
+{
+	namespace tiles
+	{
+		// "VKTL"
+		const uint32_t magic = 0x4C544B56;
+		// Increase whenever the layout changes
+		const uint32_t version = 1;
+		// Offsets of the coarse level and all tiles are aligned to this
+		const uint32_t sectionAlignment = 16;
+
+		struct Header {
+			uint32_t magic;
+			uint32_t version;
+			uint32_t format;
+			uint32_t texelSize;
+			uint32_t width;
+			uint32_t tileSize;
+			uint32_t coarseStep;
+			uint32_t tileCount;
+			// Size, modification time and content hash of the KTX file the tiles were cooked from
+			uint64_t sourceSize;
+			int64_t sourceTime;
+			uint64_t sourceHash;
+			// Byte offsets from the start of the file, tiles are stored row by row at tileStride
+			uint64_t coarseOffset;
+			uint64_t tileOffset;
+			uint64_t tileStride;
+		};
+
+		/** @brief Get the tile file name for a KTX file */
+		inline std::string getTileFilename(const std::string& filename)
+		{
+			return filename + ".tiles";
+		}
+
+		inline uint64_t align(uint64_t offset)
+		{
+			return (offset + sectionAlignment - 1) / sectionAlignment * sectionAlignment;
+		}
+	}
+
+	class TiledTexture
+	{
+	private:
+		vks::VulkanDevice* device = nullptr;
+		VkQueue copyQueue = VK_NULL_HANDLE;
+
+		// Tiles are read from the mapped tile file, or from the cooked copy on the heap if the file couldn't be written
+		vks::MappedFile file;
+		std::vector<uint8_t> cooked;
+		const tiles::Header* header = nullptr;
+
+		struct Tile {
+			bool resident = false;
+			uint32_t slot = 0;
+			// Streaming frame in which the tile was last requested and the closest distance it was requested with in that frame
+			uint64_t lastRequested = 0;
+			float distance = 0.0f;
+		};
+		std::vector<Tile> tileStates;
+		struct RetiredSlot {
+			uint32_t slot;
+			uint64_t frame;
+		};
+		std::vector<uint32_t> freeSlots;
+		std::vector<RetiredSlot> retiredSlots;
+		uint64_t streamingFrame = 0;
+
+		const uint8_t* getData() const
+		{
+			return cooked.empty() ? file.data() : cooked.data();
+		}
+
+		uint32_t getTileDataSize() const
+		{
+			return (tileSize + 2) * (tileSize + 2) * header->texelSize;
+		}
+
+		bool isUpToDate(const tiles::Header& cachedHeader, const std::string& filename, uint32_t texelSize, uint32_t coarseStep) const
+		{
+			if (cachedHeader.magic != tiles::magic || cachedHeader.version != tiles::version || cachedHeader.format != static_cast<uint32_t>(format)
+				|| cachedHeader.texelSize != texelSize || cachedHeader.width != width || cachedHeader.tileSize != tileSize || cachedHeader.coarseStep != coarseStep
+				|| cachedHeader.tileCount != tilesPerSide * tilesPerSide) {
+				return false;
+			}
+			const uint64_t coarseWidth = width / coarseStep;
+			if (cachedHeader.coarseOffset + coarseWidth * coarseWidth * texelSize > file.size()
+				|| cachedHeader.tileOffset + (uint64_t)cachedHeader.tileCount * cachedHeader.tileStride > file.size()) {
+				return false;
+			}
+			uint64_t size;
+			int64_t time;
+			if (!vkglTF::cache::getFileStamp(filename, size, time) || size != cachedHeader.sourceSize) {
+				return false;
+			}
+			// Time stamps change on copies and checkouts, so compare the contents before cooking the tiles again
+			return time == cachedHeader.sourceTime || vkglTF::cache::hashFile(filename) == cachedHeader.sourceHash;
+		}
+
+		// Pack the coarse level and all tiles into the tile file layout, borders are clamped at the texture's edges
+		void cook(const uint8_t* src, const std::string& filename, uint32_t texelSize, uint32_t coarseStep)
+		{
+			tiles::Header cookedHeader{};
+			cookedHeader.magic = tiles::magic;
+			cookedHeader.version = tiles::version;
+			cookedHeader.format = static_cast<uint32_t>(format);
+			cookedHeader.texelSize = texelSize;
+			cookedHeader.width = width;
+			cookedHeader.tileSize = tileSize;
+			cookedHeader.coarseStep = coarseStep;
+			cookedHeader.tileCount = tilesPerSide * tilesPerSide;
+			if (vkglTF::cache::getFileStamp(filename, cookedHeader.sourceSize, cookedHeader.sourceTime)) {
+				cookedHeader.sourceHash = vkglTF::cache::hashFile(filename);
+			}
+			const uint32_t coarseWidth = width / coarseStep;
+			const uint32_t borderedSize = tileSize + 2;
+			cookedHeader.coarseOffset = tiles::align(sizeof(tiles::Header));
+			cookedHeader.tileStride = tiles::align((uint64_t)borderedSize * borderedSize * texelSize);
+			cookedHeader.tileOffset = tiles::align(cookedHeader.coarseOffset + (uint64_t)coarseWidth * coarseWidth * texelSize);
+
+			cooked.assign(cookedHeader.tileOffset + cookedHeader.tileCount * cookedHeader.tileStride, 0);
+			memcpy(cooked.data(), &cookedHeader, sizeof(tiles::Header));
+			uint8_t* coarse = cooked.data() + cookedHeader.coarseOffset;
+			for (uint32_t y = 0; y < coarseWidth; y++) {
+				for (uint32_t x = 0; x < coarseWidth; x++) {
+					memcpy(coarse + ((size_t)x + (size_t)y * coarseWidth) * texelSize, src + ((size_t)x * coarseStep + (size_t)y * coarseStep * width) * texelSize, texelSize);
+				}
+			}
+			for (uint32_t ty = 0; ty < tilesPerSide; ty++) {
+				for (uint32_t tx = 0; tx < tilesPerSide; tx++) {
+					uint8_t* tile = cooked.data() + cookedHeader.tileOffset + (tx + ty * tilesPerSide) * cookedHeader.tileStride;
+					for (uint32_t y = 0; y < borderedSize; y++) {
+						const int32_t srcY = std::min(std::max(static_cast<int32_t>(ty * tileSize + y) - 1, 0), static_cast<int32_t>(width) - 1);
+						for (uint32_t x = 0; x < borderedSize; x++) {
+							const int32_t srcX = std::min(std::max(static_cast<int32_t>(tx * tileSize + x) - 1, 0), static_cast<int32_t>(width) - 1);
+							memcpy(tile + ((size_t)x + (size_t)y * borderedSize) * texelSize, src + ((size_t)srcX + (size_t)srcY * width) * texelSize, texelSize);
+						}
+					}
+				}
+			}
+		}
+
+		// Written to a temporary file first, so a partially written tile file is never picked up
+		bool write(const std::string& filename) const
+		{
+			const std::string tempFilename = filename + ".tmp";
+			std::ofstream out(tempFilename, std::ios::binary | std::ios::trunc);
+			if (!out.is_open()) {
+				return false;
+			}
+			out.write(reinterpret_cast<const char*>(cooked.data()), static_cast<std::streamsize>(cooked.size()));
+			const bool written = out.good();
+			out.close();
+			if (!written) {
+				remove(tempFilename.c_str());
+				return false;
+			}
+			remove(filename.c_str());
+			return rename(tempFilename.c_str(), filename.c_str()) == 0;
+		}
+
+		void createCache()
+		{
+			const uint32_t borderedSize = tileSize + 2;
+			VkImageCreateInfo imageCreateInfo = vks::initializers::imageCreateInfo();
+			imageCreateInfo.imageType = VK_IMAGE_TYPE_2D;
+			imageCreateInfo.format = format;
+			imageCreateInfo.mipLevels = 1;
+			imageCreateInfo.arrayLayers = slotCount;
+			imageCreateInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+			imageCreateInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+			imageCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+			imageCreateInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+			imageCreateInfo.extent = { borderedSize, borderedSize, 1 };
+			imageCreateInfo.usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+			VK_CHECK_RESULT(vkCreateImage(device->logicalDevice, &imageCreateInfo, nullptr, &cache.image));
+			cache.device = device;
+			cache.deviceMemory = device->allocateImageMemory(cache.image, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+			cache.width = borderedSize;
+			cache.height = borderedSize;
+			cache.mipLevels = 1;
+			cache.layerCount = slotCount;
+			cache.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+			// Clear all slots once, so every layer is in the layout of the descriptor before its first tile arrives
+			std::vector<uint8_t> zeros((size_t)getTileDataSize() * slotCount, 0);
+			VkBufferImageCopy region{};
+			region.imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, slotCount };
+			region.imageExtent = { borderedSize, borderedSize, 1 };
+			device->stagingUploader->uploadImage(cache.image, zeros.data(), zeros.size(), { region }, { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, slotCount }, cache.imageLayout);
+
+			// Tiles carry their own borders, so clamping only applies outside of the texture
+			VkSamplerCreateInfo samplerCreateInfo = vks::initializers::samplerCreateInfo();
+			samplerCreateInfo.magFilter = VK_FILTER_LINEAR;
+			samplerCreateInfo.minFilter = VK_FILTER_LINEAR;
+			samplerCreateInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+			samplerCreateInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+			samplerCreateInfo.addressModeV = samplerCreateInfo.addressModeU;
+			samplerCreateInfo.addressModeW = samplerCreateInfo.addressModeU;
+			samplerCreateInfo.compareOp = VK_COMPARE_OP_NEVER;
+			samplerCreateInfo.minLod = 0.0f;
+			samplerCreateInfo.maxLod = 0.0f;
+			samplerCreateInfo.maxAnisotropy = 1.0f;
+			samplerCreateInfo.borderColor = VK_BORDER_COLOR_FLOAT_OPAQUE_WHITE;
+			VK_CHECK_RESULT(vkCreateSampler(device->logicalDevice, &samplerCreateInfo, nullptr, &cache.sampler));
+
+			VkImageViewCreateInfo viewCreateInfo = vks::initializers::imageViewCreateInfo();
+			viewCreateInfo.viewType = VK_IMAGE_VIEW_TYPE_2D_ARRAY;
+			viewCreateInfo.format = format;
+			viewCreateInfo.components = { VK_COMPONENT_SWIZZLE_R, VK_COMPONENT_SWIZZLE_G, VK_COMPONENT_SWIZZLE_B, VK_COMPONENT_SWIZZLE_A };
+			viewCreateInfo.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, slotCount };
+			viewCreateInfo.image = cache.image;
+			VK_CHECK_RESULT(vkCreateImageView(device->logicalDevice, &viewCreateInfo, nullptr, &cache.view));
+			cache.updateDescriptor();
+		}
+
+		void uploadTile(uint32_t index, uint32_t slot)
+		{
+			const uint32_t borderedSize = tileSize + 2;
+			VkBufferImageCopy region{};
+			region.imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, slot, 1 };
+			region.imageExtent = { borderedSize, borderedSize, 1 };
+			// Reading the tile from the mapping pages it in from the tile file
+			const uint8_t* data = getData() + header->tileOffset + index * header->tileStride;
+			device->stagingUploader->uploadImage(cache.image, data, getTileDataSize(), { region }, { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, slot, 1 }, cache.imageLayout);
+			Tile& tile = tileStates[index];
+			tile.resident = true;
+			tile.slot = slot;
+			stats.uploads++;
+		}
+
+		// Evict the resident tile requested the longest time ago, its slot can be reused once no frame in flight samples from it
+		bool evictTile()
+		{
+			Tile* victim = nullptr;
+			for (auto& tile : tileStates) {
+				if (tile.resident && tile.lastRequested < streamingFrame && (!victim || tile.lastRequested < victim->lastRequested)) {
+					victim = &tile;
+				}
+			}
+			if (!victim) {
+				return false;
+			}
+			victim->resident = false;
+			retiredSlots.push_back({ victim->slot, streamingFrame });
+			stats.evictions++;
+			return true;
+		}
+
+	public:
+		VkFormat format = VK_FORMAT_UNDEFINED;
+		// Texels per side of the first level, set on load
+		uint32_t width = 0;
+		// Texels per side of a tile without its border (must be set before loading, the texture's width needs to be a multiple of it)
+		uint32_t tileSize = 64;
+		uint32_t tilesPerSide = 0;
+		// Number of tiles that can be resident at the same time (must be set before loading)
+		uint32_t slotCount = 64;
+		// Maximum number of tiles uploaded by a single call to update
+		uint32_t uploadsPerFrame = 8;
+		// Set if the tiles were loaded and can be streamed
+		bool loaded = false;
+
+		// Resident tiles, one layer per slot with the tile's border
+		vks::Texture cache{};
+		// Per swap chain image, one uint per tile holding the tile's slot + 1 (0 if the coarse level has to be sampled)
+		std::vector<vks::Buffer> pageTables;
+
+		struct Stats {
+			uint32_t residentTiles = 0;
+			uint32_t requestedTiles = 0;
+			uint32_t uploads = 0;
+			uint32_t evictions = 0;
+		} stats;
+
+		TiledTexture(vks::VulkanDevice* device, VkQueue copyQueue)
+		{
+			this->device = device;
+			this->copyQueue = copyQueue;
+		}
+
+		~TiledTexture()
+		{
+			for (auto& buffer : pageTables) {
+				buffer.destroy();
+			}
+			if (loaded) {
+				cache.destroy();
+			}
+		}
+
+		/**
+		* Load the tiles of a KTX file from its tile file, cooking and writing the tile file first if there is none or it's outdated
+		* Creates the coarse level of the whole texture in coarseTexture and the tile cache, the uploads go through the device's staging uploader
+		*
+		* @param source KTX file to cook the tiles from (single layer, uncompressed)
+		* @param filename Name of the KTX file, the tile file is stored next to it
+		* @param format Vulkan format of the image data stored in the file
+		* @param coarseSize Texels per side of the coarse level, every (width / coarseSize)'th texel of the first level is kept
+		* @param coarseTexture Texture the coarse level is loaded into
+		*/
+		void loadFromKTX(const KTXSource& source, const std::string& filename, VkFormat format, uint32_t coarseSize, vks::Texture2D& coarseTexture)
+		{
+			ktxTexture* ktxTexture = source.texture;
+			assert(ktxTexture->baseWidth == ktxTexture->baseHeight && ktxTexture->numLayers == 1 && !ktxTexture->isCompressed && !ktxTexture->isCubemap);
+			this->format = format;
+			width = ktxTexture->baseWidth;
+			assert(width % tileSize == 0 && width % coarseSize == 0);
+			tilesPerSide = width / tileSize;
+			const uint32_t coarseStep = width / coarseSize;
+			const uint32_t texelSize = static_cast<uint32_t>(ktxTexture_GetImageSize(ktxTexture, 0) / ((ktx_size_t)width * width));
+
+			const std::string tileFilename = tiles::getTileFilename(filename);
+			if (!file.open(tileFilename) || file.size() < sizeof(tiles::Header) || !isUpToDate(*reinterpret_cast<const tiles::Header*>(file.data()), filename, texelSize, coarseStep)) {
+				file.close();
+				cook(source.data + source.getImageOffset(0, 0, 0), filename, texelSize, coarseStep);
+				// The tiles are served from the cooked copy if the tile file can't be written or mapped (e.g. read only asset directory)
+				if (write(tileFilename) && file.open(tileFilename) && file.size() == cooked.size()) {
+					cooked.clear();
+					cooked.shrink_to_fit();
+				} else {
+					file.close();
+				}
+			}
+			header = reinterpret_cast<const tiles::Header*>(getData());
+
+			coarseTexture.fromBuffer((void*)(getData() + header->coarseOffset), (VkDeviceSize)coarseSize * coarseSize * texelSize, format, coarseSize, coarseSize, device, copyQueue);
+
+			createCache();
+			tileStates.assign(tilesPerSide * tilesPerSide, Tile());
+			freeSlots.clear();
+			retiredSlots.clear();
+			for (uint32_t slot = slotCount; slot > 0; slot--) {
+				freeSlots.push_back(slot - 1);
+			}
+			stats = Stats();
+			loaded = true;
+		}
+
+		/** @brief Texel of the first level, read from the tile containing it (reading pages in the tile from the mapped tile file) */
+		const void* getTexel(uint32_t x, uint32_t y) const
+		{
+			assert(loaded && x < width && y < width);
+			const uint32_t borderedSize = tileSize + 2;
+			const uint8_t* tile = getData() + header->tileOffset + (uint64_t)(x / tileSize + (y / tileSize) * tilesPerSide) * header->tileStride;
+			return tile + ((size_t)(x % tileSize + 1) + (size_t)(y % tileSize + 1) * borderedSize) * header->texelSize;
+		}
+
+		/** @brief Create the host visible page tables, a single entry is kept if the texture isn't loaded so they can still be bound */
+		void createPageTables(uint32_t count)
+		{
+			for (auto& buffer : pageTables) {
+				buffer.destroy();
+			}
+			pageTables.resize(count);
+			const VkDeviceSize size = std::max<VkDeviceSize>(tileStates.size(), 1) * sizeof(uint32_t);
+			for (auto& buffer : pageTables) {
+				VK_CHECK_RESULT(device->createBuffer(VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &buffer, size));
+				VK_CHECK_RESULT(buffer.map());
+				memset(buffer.mapped, 0, size);
+			}
+		}
+
+		/**
+		* Request the tiles overlapping a rectangle of the first level for the next call to update
+		*
+		* @param x0, y0 First texel of the rectangle
+		* @param x1, y1 Texel after the last one of the rectangle
+		* @param distance Distance to the viewer, tiles requested closer to the viewer are uploaded first
+		*/
+		void request(uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1, float distance)
+		{
+			if (!loaded || x1 <= x0 || y1 <= y0) {
+				return;
+			}
+			const uint32_t tx1 = std::min((x1 - 1) / tileSize, tilesPerSide - 1);
+			const uint32_t ty1 = std::min((y1 - 1) / tileSize, tilesPerSide - 1);
+			for (uint32_t ty = y0 / tileSize; ty <= ty1; ty++) {
+				for (uint32_t tx = x0 / tileSize; tx <= tx1; tx++) {
+					Tile& tile = tileStates[tx + ty * tilesPerSide];
+					if (tile.lastRequested != streamingFrame + 1 || distance < tile.distance) {
+						tile.distance = distance;
+					}
+					tile.lastRequested = streamingFrame + 1;
+				}
+			}
+		}
+
+		/**
+		* Evict the tiles requested the longest time ago if all slots are in use, upload up to uploadsPerFrame of the tiles requested since the last call and write the page table of a swap chain image
+		* Has to be called before submitting the frame sampling the texture and from the thread that submits to the graphics queue, the uploads are submitted before returning
+		*
+		* @param imageIndex Swap chain image whose page table is written
+		* @param framesInFlight Number of frames that may still be sampling from the slots, slots of evicted tiles are reused after that many calls
+		*/
+		void update(uint32_t imageIndex, uint32_t framesInFlight)
+		{
+			if (!loaded) {
+				return;
+			}
+			streamingFrame++;
+			for (auto it = retiredSlots.begin(); it != retiredSlots.end();) {
+				if (streamingFrame - it->frame > framesInFlight) {
+					freeSlots.push_back(it->slot);
+					it = retiredSlots.erase(it);
+				} else {
+					++it;
+				}
+			}
+
+			// Closest tiles first, so the detail around the viewer arrives before the detail further away
+			std::vector<std::pair<float, uint32_t>> requests;
+			stats.requestedTiles = 0;
+			for (uint32_t i = 0; i < tileStates.size(); i++) {
+				const Tile& tile = tileStates[i];
+				if (tile.lastRequested != streamingFrame) {
+					continue;
+				}
+				stats.requestedTiles++;
+				if (!tile.resident) {
+					requests.push_back({ tile.distance, i });
+				}
+			}
+			std::sort(requests.begin(), requests.end());
+
+			// Evicted slots only become free after the frames in flight, so evict ahead of the requests queued up this frame
+			const size_t needed = std::min<size_t>(requests.size(), uploadsPerFrame);
+			while (freeSlots.size() + retiredSlots.size() < needed && evictTile()) {}
+
+			uint32_t uploads = 0;
+			for (auto& request : requests) {
+				if (uploads == uploadsPerFrame || freeSlots.empty()) {
+					break;
+				}
+				const uint32_t slot = freeSlots.back();
+				freeSlots.pop_back();
+				uploadTile(request.second, slot);
+				uploads++;
+			}
+			if (uploads > 0) {
+				// Draws submitted afterwards are ordered after the uploads
+				device->stagingUploader->submit();
+			}
+			stats.residentTiles = slotCount - static_cast<uint32_t>(freeSlots.size() + retiredSlots.size());
+
+			uint32_t* pages = static_cast<uint32_t*>(pageTables[imageIndex].mapped);
+			for (size_t i = 0; i < tileStates.size(); i++) {
+				pages[i] = tileStates[i].resident ? tileStates[i].slot + 1 : 0;
+			}
+		}
+	};
+}
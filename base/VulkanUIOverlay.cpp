@@ -92,13 +92,7 @@ namespace vks
 		imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
 		imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
 		VK_CHECK_RESULT(vkCreateImage(device->logicalDevice, &imageInfo, nullptr, &fontImage));
-		VkMemoryRequirements memReqs;
-		vkGetImageMemoryRequirements(device->logicalDevice, fontImage, &memReqs);
-		VkMemoryAllocateInfo memAllocInfo = vks::initializers::memoryAllocateInfo();
-		memAllocInfo.allocationSize = memReqs.size;
-		memAllocInfo.memoryTypeIndex = device->getMemoryType(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-		VK_CHECK_RESULT(vkAllocateMemory(device->logicalDevice, &memAllocInfo, nullptr, &fontMemory));
-		VK_CHECK_RESULT(vkBindImageMemory(device->logicalDevice, fontImage, fontMemory, 0));
+		fontMemory = device->allocateImageMemory(fontImage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
 
 		// Image view
 		VkImageViewCreateInfo viewInfo = vks::initializers::imageViewCreateInfo();
@@ -110,33 +104,7 @@ namespace vks
 		viewInfo.subresourceRange.layerCount = 1;
 		VK_CHECK_RESULT(vkCreateImageView(device->logicalDevice, &viewInfo, nullptr, &fontView));
 
-		// Staging buffers for font data upload
-		vks::Buffer stagingBuffer;
-
-		VK_CHECK_RESULT(device->createBuffer(
-			VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-			&stagingBuffer,
-			uploadSize));
-
-		stagingBuffer.map();
-		memcpy(stagingBuffer.mapped, fontData, uploadSize);
-		stagingBuffer.unmap();
-
-		// Copy buffer data to font image
-		VkCommandBuffer copyCmd = device->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
-
-		// Prepare for transfer
-		vks::tools::setImageLayout(
-			copyCmd,
-			fontImage,
-			VK_IMAGE_ASPECT_COLOR_BIT,
-			VK_IMAGE_LAYOUT_UNDEFINED,
-			VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-			VK_PIPELINE_STAGE_HOST_BIT,
-			VK_PIPELINE_STAGE_TRANSFER_BIT);
-
-		// Copy
+		// Upload font data
 		VkBufferImageCopy bufferCopyRegion = {};
 		bufferCopyRegion.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
 		bufferCopyRegion.imageSubresource.layerCount = 1;
@@ -144,28 +112,12 @@ namespace vks
 		bufferCopyRegion.imageExtent.height = texHeight;
 		bufferCopyRegion.imageExtent.depth = 1;
 
-		vkCmdCopyBufferToImage(
-			copyCmd,
-			stagingBuffer.buffer,
-			fontImage,
-			VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-			1,
-			&bufferCopyRegion
-		);
-
-		// Prepare for shader read
-		vks::tools::setImageLayout(
-			copyCmd,
-			fontImage,
-			VK_IMAGE_ASPECT_COLOR_BIT,
-			VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-			VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
-			VK_PIPELINE_STAGE_TRANSFER_BIT,
-			VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
-
-		device->flushCommandBuffer(copyCmd, queue, true);
+		VkImageSubresourceRange subresourceRange = {};
+		subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		subresourceRange.levelCount = 1;
+		subresourceRange.layerCount = 1;
 
-		stagingBuffer.destroy();
+		device->stagingUploader->uploadImage(fontImage, fontData, uploadSize, { bufferCopyRegion }, subresourceRange, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
 
 		// Font texture Sampler
 		VkSamplerCreateInfo samplerInfo = vks::initializers::samplerCreateInfo();
@@ -285,50 +237,79 @@ namespace vks
 		pipelineCreateInfo.pVertexInputState = &vertexInputState;
 
 		VK_CHECK_RESULT(vkCreateGraphicsPipelines(device->logicalDevice, pipelineCache, 1, &pipelineCreateInfo, nullptr, &pipeline));
+
+		// Indirect drawing reads the clip rect of each draw as a per instance attribute
+		if (!indirectShaders.empty()) {
+			vertexInputBindings.push_back(vks::initializers::vertexInputBindingDescription(1, sizeof(glm::vec4), VK_VERTEX_INPUT_RATE_INSTANCE));
+			vertexInputAttributes.push_back(vks::initializers::vertexInputAttributeDescription(1, 3, VK_FORMAT_R32G32B32A32_SFLOAT, 0));	// Location 3: Clip rect
+			vertexInputState.vertexBindingDescriptionCount = static_cast<uint32_t>(vertexInputBindings.size());
+			vertexInputState.pVertexBindingDescriptions = vertexInputBindings.data();
+			vertexInputState.vertexAttributeDescriptionCount = static_cast<uint32_t>(vertexInputAttributes.size());
+			vertexInputState.pVertexAttributeDescriptions = vertexInputAttributes.data();
+			pipelineCreateInfo.stageCount = static_cast<uint32_t>(indirectShaders.size());
+			pipelineCreateInfo.pStages = indirectShaders.data();
+			VK_CHECK_RESULT(vkCreateGraphicsPipelines(device->logicalDevice, pipelineCache, 1, &pipelineCreateInfo, nullptr, &indirectPipeline));
+		}
 	}
 
-	/** Update vertex and index buffer containing the imGui elements when required */
-	bool UIOverlay::update()
+	/** Make sure a frame buffer holds at least size bytes, returns true if it had to be (re)created */
+	bool UIOverlay::reserve(vks::Buffer &buffer, VkBufferUsageFlags usage, VkDeviceSize size)
 	{
-		ImDrawData* imDrawData = ImGui::GetDrawData();
-		bool updateCmdBuffers = false;
-
-		if (!imDrawData) { return false; };
-
-		// Note: Alignment is done inside buffer creation
-		VkDeviceSize vertexBufferSize = imDrawData->TotalVtxCount * sizeof(ImDrawVert);
-		VkDeviceSize indexBufferSize = imDrawData->TotalIdxCount * sizeof(ImDrawIdx);
+		if ((buffer.buffer != VK_NULL_HANDLE) && (buffer.size >= size)) {
+			return false;
+		}
+		// Capacity is doubled, so a growing UI only causes a few reallocations
+		VkDeviceSize capacity = size;
+		if (buffer.buffer != VK_NULL_HANDLE) {
+			capacity = std::max(buffer.size * 2, size);
+			buffer.unmap();
+			buffer.destroy();
+			stats.bufferGrows++;
+		}
+		VK_CHECK_RESULT(device->createBuffer(usage, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, &buffer, capacity));
+		VK_CHECK_RESULT(buffer.map());
+		return true;
+	}
 
-		// Update buffers only if vertex or index count has been changed compared to current buffer size
-		if ((vertexBufferSize == 0) || (indexBufferSize == 0)) {
+	/**
+	* Write the current ImGui draw data to the buffers of a frame
+	* Must only be called once the frame's previous submission has finished executing
+	*
+	* @param frameIndex Frame (swap chain image) to update
+	* @param framebuffer Frame buffer of the frame, the overlay's own command buffer renders into it without indirect drawing
+	*
+	* @return True if the command buffers have to be recorded again (buffers were reallocated with indirect drawing)
+	*/
+	bool UIOverlay::update(uint32_t frameIndex, VkFramebuffer framebuffer)
+	{
+		ImDrawData* imDrawData = ImGui::GetDrawData();
+		if (!imDrawData) {
 			return false;
 		}
 
-		// Vertex buffer
-		if ((vertexBuffer.buffer == VK_NULL_HANDLE) || (vertexCount != imDrawData->TotalVtxCount)) {
-			vertexBuffer.unmap();
-			vertexBuffer.destroy();
-			VK_CHECK_RESULT(device->createBuffer(VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, &vertexBuffer, vertexBufferSize));
-			vertexCount = imDrawData->TotalVtxCount;
-			vertexBuffer.unmap();
-			vertexBuffer.map();
-			updateCmdBuffers = true;
+		if (frameIndex >= frames.size()) {
+			frames.resize(frameIndex + 1);
+		}
+		FrameBuffers& frame = frames[frameIndex];
+
+		uint32_t drawCount = 0;
+		for (int32_t i = 0; i < imDrawData->CmdListsCount; i++) {
+			drawCount += imDrawData->CmdLists[i]->CmdBuffer.Size;
 		}
 
-		// Index buffer
-		VkDeviceSize indexSize = imDrawData->TotalIdxCount * sizeof(ImDrawIdx);
-		if ((indexBuffer.buffer == VK_NULL_HANDLE) || (indexCount < imDrawData->TotalIdxCount)) {
-			indexBuffer.unmap();
-			indexBuffer.destroy();
-			VK_CHECK_RESULT(device->createBuffer(VK_BUFFER_USAGE_INDEX_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, &indexBuffer, indexBufferSize));
-			indexCount = imDrawData->TotalIdxCount;
-			indexBuffer.map();
-			updateCmdBuffers = true;
+		// Minimum sizes avoid a series of reallocations while the UI is built up
+		bool rebuild = false;
+		rebuild |= reserve(frame.vertexBuffer, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, std::max(imDrawData->TotalVtxCount, 4096) * sizeof(ImDrawVert));
+		rebuild |= reserve(frame.indexBuffer, VK_BUFFER_USAGE_INDEX_BUFFER_BIT, std::max(imDrawData->TotalIdxCount, 8192) * sizeof(ImDrawIdx));
+		if (indirect()) {
+			rebuild |= reserve(frame.drawBuffer, VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, std::max(drawCount, drawCapacity) * sizeof(VkDrawIndexedIndirectCommand));
+			const VkDeviceSize capacity = frame.drawBuffer.size / sizeof(VkDrawIndexedIndirectCommand);
+			rebuild |= reserve(frame.clipRectBuffer, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, capacity * sizeof(glm::vec4));
 		}
 
 		// Upload data
-		ImDrawVert* vtxDst = (ImDrawVert*)vertexBuffer.mapped;
-		ImDrawIdx* idxDst = (ImDrawIdx*)indexBuffer.mapped;
+		ImDrawVert* vtxDst = (ImDrawVert*)frame.vertexBuffer.mapped;
+		ImDrawIdx* idxDst = (ImDrawIdx*)frame.indexBuffer.mapped;
 
 		for (int n = 0; n < imDrawData->CmdListsCount; n++) {
 			const ImDrawList* cmd_list = imDrawData->CmdLists[n];
@@ -338,35 +319,164 @@ namespace vks
 			idxDst += cmd_list->IdxBuffer.Size;
 		}
 
+		if (indirect()) {
+			// One command per ImGui draw, the command's first instance selects it's clip rect
+			const uint32_t capacity = getDrawCapacity(frameIndex);
+			VkDrawIndexedIndirectCommand* drawDst = (VkDrawIndexedIndirectCommand*)frame.drawBuffer.mapped;
+			glm::vec4* clipRectDst = (glm::vec4*)frame.clipRectBuffer.mapped;
+			uint32_t drawIndex = 0;
+			int32_t vertexOffset = 0;
+			uint32_t indexOffset = 0;
+			for (int32_t i = 0; i < imDrawData->CmdListsCount; i++) {
+				const ImDrawList* cmd_list = imDrawData->CmdLists[i];
+				for (int32_t j = 0; j < cmd_list->CmdBuffer.Size; j++) {
+					const ImDrawCmd* pcmd = &cmd_list->CmdBuffer[j];
+					drawDst[drawIndex] = { pcmd->ElemCount, 1, indexOffset, vertexOffset, drawIndex };
+					clipRectDst[drawIndex] = glm::vec4(pcmd->ClipRect.x, pcmd->ClipRect.y, pcmd->ClipRect.z, pcmd->ClipRect.w);
+					indexOffset += pcmd->ElemCount;
+					drawIndex++;
+				}
+				vertexOffset += cmd_list->VtxBuffer.Size;
+			}
+			memset(drawDst + drawIndex, 0, (capacity - drawIndex) * sizeof(VkDrawIndexedIndirectCommand));
+			frame.drawBuffer.flush();
+			frame.clipRectBuffer.flush();
+		} else {
+			// The draws are recorded into the frame's own command buffer, which is only recorded again if they (or the frame's buffers) changed
+			std::vector<uint32_t> draws;
+			for (int32_t i = 0; i < imDrawData->CmdListsCount; i++) {
+				const ImDrawList* cmd_list = imDrawData->CmdLists[i];
+				draws.push_back(cmd_list->VtxBuffer.Size);
+				for (int32_t j = 0; j < cmd_list->CmdBuffer.Size; j++) {
+					const ImDrawCmd* pcmd = &cmd_list->CmdBuffer[j];
+					draws.insert(draws.end(), { pcmd->ElemCount, (uint32_t)(int32_t)pcmd->ClipRect.x, (uint32_t)(int32_t)pcmd->ClipRect.y, (uint32_t)(int32_t)pcmd->ClipRect.z, (uint32_t)(int32_t)pcmd->ClipRect.w });
+				}
+			}
+			if (rebuild || (draws != frame.recordedDraws) || (framebuffer != frame.framebuffer)) {
+				frame.recordedDraws = draws;
+				recordCommandBuffer(frameIndex, framebuffer);
+			}
+			rebuild = false;
+		}
+
 		// Flush to make writes visible to GPU
-		vertexBuffer.flush();
-		indexBuffer.flush();
+		frame.vertexBuffer.flush();
+		frame.indexBuffer.flush();
 
-		return updateCmdBuffers;
+		if (rebuild) {
+			stats.rebuilds++;
+		}
+		return rebuild;
 	}
 
-	void UIOverlay::draw(const VkCommandBuffer commandBuffer)
+	/** @brief Number of indirect draw commands recorded for a frame */
+	uint32_t UIOverlay::getDrawCapacity(uint32_t frameIndex) const
+	{
+		const FrameBuffers& frame = frames[frameIndex];
+		return static_cast<uint32_t>(std::min(frame.drawBuffer.size / sizeof(VkDrawIndexedIndirectCommand), frame.clipRectBuffer.size / sizeof(glm::vec4)));
+	}
+
+	/**
+	* Record the direct draws of a frame into the overlay's own command buffer for that frame
+	* The render pass loads the color attachment, so the UI is drawn on top of whatever the example's command buffers rendered before
+	*/
+	void UIOverlay::recordCommandBuffer(uint32_t frameIndex, VkFramebuffer framebuffer)
+	{
+		assert(renderPass != VK_NULL_HANDLE);
+		assert(framebuffer != VK_NULL_HANDLE);
+		FrameBuffers& frame = frames[frameIndex];
+		if (commandPool == VK_NULL_HANDLE) {
+			commandPool = device->createCommandPool(device->queueFamilyIndices.graphics);
+		}
+		if (frame.commandBuffer == VK_NULL_HANDLE) {
+			VkCommandBufferAllocateInfo allocateInfo = vks::initializers::commandBufferAllocateInfo(commandPool, VK_COMMAND_BUFFER_LEVEL_PRIMARY, 1);
+			VK_CHECK_RESULT(vkAllocateCommandBuffers(device->logicalDevice, &allocateInfo, &frame.commandBuffer));
+		}
+
+		ImGuiIO& io = ImGui::GetIO();
+		const uint32_t width = static_cast<uint32_t>(io.DisplaySize.x);
+		const uint32_t height = static_cast<uint32_t>(io.DisplaySize.y);
+
+		VkCommandBufferBeginInfo beginInfo = vks::initializers::commandBufferBeginInfo();
+		VK_CHECK_RESULT(vkBeginCommandBuffer(frame.commandBuffer, &beginInfo));
+		VkRenderPassBeginInfo renderPassBeginInfo = vks::initializers::renderPassBeginInfo();
+		renderPassBeginInfo.renderPass = renderPass;
+		renderPassBeginInfo.framebuffer = framebuffer;
+		renderPassBeginInfo.renderArea.extent = { width, height };
+		vkCmdBeginRenderPass(frame.commandBuffer, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+		const VkViewport viewport = vks::initializers::viewport((float)width, (float)height, 0.0f, 1.0f);
+		vkCmdSetViewport(frame.commandBuffer, 0, 1, &viewport);
+		recordDraws(frame.commandBuffer, frameIndex);
+		vkCmdEndRenderPass(frame.commandBuffer);
+		VK_CHECK_RESULT(vkEndCommandBuffer(frame.commandBuffer));
+
+		frame.framebuffer = framebuffer;
+		stats.recordings++;
+	}
+
+	/**
+	* Command buffer with the direct draws of a frame, has to be submitted after the example's command buffers for that frame
+	*
+	* @return VK_NULL_HANDLE with indirect drawing (the example's command buffers draw the overlay) or while the frame has no recorded command buffer
+	*/
+	VkCommandBuffer UIOverlay::getCommandBuffer(uint32_t frameIndex) const
+	{
+		if (indirect() || (frameIndex >= frames.size()) || (frames[frameIndex].framebuffer == VK_NULL_HANDLE)) {
+			return VK_NULL_HANDLE;
+		}
+		return frames[frameIndex].commandBuffer;
+	}
+
+	/** Draw the overlay within the example's render pass, only does something with indirect drawing (see getCommandBuffer) */
+	void UIOverlay::draw(const VkCommandBuffer commandBuffer, uint32_t frameIndex)
+	{
+		if (indirect()) {
+			recordDraws(commandBuffer, frameIndex);
+		}
+	}
+
+	void UIOverlay::recordDraws(const VkCommandBuffer commandBuffer, uint32_t frameIndex)
 	{
 		ImDrawData* imDrawData = ImGui::GetDrawData();
 		int32_t vertexOffset = 0;
 		int32_t indexOffset = 0;
 
-		if ((!imDrawData) || (imDrawData->CmdListsCount == 0)) {
+		// The frame's buffers are created by it's first update, which requests the command buffers to be recorded again
+		if ((!imDrawData) || (frameIndex >= frames.size()) || (frames[frameIndex].vertexBuffer.buffer == VK_NULL_HANDLE)) {
 			return;
 		}
+		const FrameBuffers& frame = frames[frameIndex];
 
 		ImGuiIO& io = ImGui::GetIO();
 
-		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, indirect() ? indirectPipeline : pipeline);
 		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSet, 0, NULL);
+		VKS_COUNTER_ADD("Descriptor sets bound", 1);
 
 		pushConstBlock.scale = glm::vec2(2.0f / io.DisplaySize.x, 2.0f / io.DisplaySize.y);
 		pushConstBlock.translate = glm::vec2(-1.0f);
 		vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(PushConstBlock), &pushConstBlock);
 
 		VkDeviceSize offsets[1] = { 0 };
-		vkCmdBindVertexBuffers(commandBuffer, 0, 1, &vertexBuffer.buffer, offsets);
-		vkCmdBindIndexBuffer(commandBuffer, indexBuffer.buffer, 0, VK_INDEX_TYPE_UINT16);
+		vkCmdBindVertexBuffers(commandBuffer, 0, 1, &frame.vertexBuffer.buffer, offsets);
+		vkCmdBindIndexBuffer(commandBuffer, frame.indexBuffer.buffer, 0, VK_INDEX_TYPE_UINT16);
+
+		if (indirect()) {
+			// Clipping is done in the fragment shader, the scissor covers the whole viewport
+			vkCmdBindVertexBuffers(commandBuffer, 1, 1, &frame.clipRectBuffer.buffer, offsets);
+			const uint32_t capacity = getDrawCapacity(frameIndex);
+			const uint32_t stride = sizeof(VkDrawIndexedIndirectCommand);
+			if (device->enabledFeatures.multiDrawIndirect) {
+				vkCmdDrawIndexedIndirect(commandBuffer, frame.drawBuffer.buffer, 0, capacity, stride);
+				VKS_COUNTER_ADD("Draw calls recorded", 1);
+			} else {
+				for (uint32_t i = 0; i < capacity; i++) {
+					vkCmdDrawIndexedIndirect(commandBuffer, frame.drawBuffer.buffer, i * stride, 1, stride);
+				}
+				VKS_COUNTER_ADD("Draw calls recorded", capacity);
+			}
+			return;
+		}
 
 		for (int32_t i = 0; i < imDrawData->CmdListsCount; i++)
 		{
@@ -384,6 +494,7 @@ namespace vks
 				indexOffset += pcmd->ElemCount;
 			}
 			vertexOffset += cmd_list->VtxBuffer.Size;
+			VKS_COUNTER_ADD("Draw calls recorded", cmd_list->CmdBuffer.Size);
 		}
 	}
 
@@ -391,21 +502,35 @@ namespace vks
 	{
 		ImGuiIO& io = ImGui::GetIO();
 		io.DisplaySize = ImVec2((float)(width), (float)(height));
+		// The frame buffers are recreated on resize, so the overlay's own command buffers have to be recorded again
+		for (auto& frame : frames) {
+			frame.framebuffer = VK_NULL_HANDLE;
+		}
 	}
 
 	void UIOverlay::freeResources()
 	{
 		ImGui::DestroyContext();
-		vertexBuffer.destroy();
-		indexBuffer.destroy();
+		for (auto& frame : frames) {
+			frame.vertexBuffer.destroy();
+			frame.indexBuffer.destroy();
+			frame.drawBuffer.destroy();
+			frame.clipRectBuffer.destroy();
+		}
 		vkDestroyImageView(device->logicalDevice, fontView, nullptr);
 		vkDestroyImage(device->logicalDevice, fontImage, nullptr);
-		vkFreeMemory(device->logicalDevice, fontMemory, nullptr);
+		device->freeMemory(fontMemory);
 		vkDestroySampler(device->logicalDevice, sampler, nullptr);
 		vkDestroyDescriptorSetLayout(device->logicalDevice, descriptorSetLayout, nullptr);
 		vkDestroyDescriptorPool(device->logicalDevice, descriptorPool, nullptr);
 		vkDestroyPipelineLayout(device->logicalDevice, pipelineLayout, nullptr);
 		vkDestroyPipeline(device->logicalDevice, pipeline, nullptr);
+		if (indirectPipeline != VK_NULL_HANDLE) {
+			vkDestroyPipeline(device->logicalDevice, indirectPipeline, nullptr);
+		}
+		if (commandPool != VK_NULL_HANDLE) {
+			vkDestroyCommandPool(device->logicalDevice, commandPool, nullptr);
+		}
 	}
 
 	bool UIOverlay::header(const char *caption)
@@ -1,6 +1,11 @@
 /*
 * UI overlay class using ImGui
 *
+* Geometry is written to persistently mapped buffers per frame (swap chain image), that grow geometrically and never shrink
+* If supported, the draws are issued indirectly with per draw clip rects, so changes to the UI's contents don't require command buffers to be recorded again
+* Otherwise the draws are recorded into a command buffer per frame with a render pass of it's own, which is submitted after the example's command buffers
+* and recorded again by update() whenever the UI changes, so the example's command buffers don't have to be recorded again either
+*
 * Copyright (C) 2017 by Sascha Willems - www.saschawillems.de
 *
 * This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
@@ -21,6 +26,8 @@
 #include "VulkanDebug.h"
 #include "VulkanBuffer.hpp"
 #include "VulkanDevice.hpp"
+#include "VulkanStagingUploader.hpp"
+#include "VulkanInstrumentation.hpp"
 
 #include "../external/imgui/imgui.h"
 
@@ -39,20 +46,47 @@ namespace vks
 		VkSampleCountFlagBits rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
 		uint32_t subpass = 0;
 
-		vks::Buffer vertexBuffer;
-		vks::Buffer indexBuffer;
-		int32_t vertexCount = 0;
-		int32_t indexCount = 0;
+		// Buffers of a single frame, only written once the frame's previous submission has finished
+		struct FrameBuffers {
+			vks::Buffer vertexBuffer;
+			vks::Buffer indexBuffer;
+			// Indirect draw commands and their clip rects (per instance attribute selected by the command's first instance)
+			vks::Buffer drawBuffer;
+			vks::Buffer clipRectBuffer;
+			// Command buffer with the direct draws, only used without indirect drawing
+			VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+			// Frame buffer and draws the command buffer was last recorded with
+			VkFramebuffer framebuffer = VK_NULL_HANDLE;
+			std::vector<uint32_t> recordedDraws;
+		};
+		std::vector<FrameBuffers> frames;
+		// Number of draw commands recorded for indirect drawing, unused commands are zero
+		uint32_t drawCapacity = 64;
+
+		struct Stats {
+			// Number of times a frame buffer had to be reallocated, each requires the command buffers to be recorded again
+			uint32_t bufferGrows = 0;
+			// Number of times the command buffers had to be recorded again due to the overlay
+			uint32_t rebuilds = 0;
+			// Number of times the overlay's own command buffer of a frame was recorded (only without indirect drawing)
+			uint32_t recordings = 0;
+		} stats;
 
 		std::vector<VkPipelineShaderStageCreateInfo> shaders;
+		// Optional shaders for indirect drawing, which needs drawIndirectFirstInstance
+		std::vector<VkPipelineShaderStageCreateInfo> indirectShaders;
 
 		VkDescriptorPool descriptorPool;
 		VkDescriptorSetLayout descriptorSetLayout;
 		VkDescriptorSet descriptorSet;
 		VkPipelineLayout pipelineLayout;
 		VkPipeline pipeline;
+		VkPipeline indirectPipeline = VK_NULL_HANDLE;
+		// Render pass the direct draws are recorded with, has to load the color attachment and be compatible with the one passed to preparePipeline
+		VkRenderPass renderPass = VK_NULL_HANDLE;
+		VkCommandPool commandPool = VK_NULL_HANDLE;
 
-		VkDeviceMemory fontMemory = VK_NULL_HANDLE;
+		vks::Allocation fontMemory;
 		VkImage fontImage = VK_NULL_HANDLE;
 		VkImageView fontView = VK_NULL_HANDLE;
 		VkSampler sampler;
@@ -66,14 +100,23 @@ namespace vks
 		bool updated = false;
 		float scale = 1.0f;
 
+	private:
+		bool reserve(vks::Buffer &buffer, VkBufferUsageFlags usage, VkDeviceSize size);
+		void recordCommandBuffer(uint32_t frameIndex, VkFramebuffer framebuffer);
+		void recordDraws(const VkCommandBuffer commandBuffer, uint32_t frameIndex);
+
+	public:
 		UIOverlay();
 		~UIOverlay();
 
 		void preparePipeline(const VkPipelineCache pipelineCache, const VkRenderPass renderPass);
 		void prepareResources();
 
-		bool update();
-		void draw(const VkCommandBuffer commandBuffer);
+		bool update(uint32_t frameIndex, VkFramebuffer framebuffer = VK_NULL_HANDLE);
+		void draw(const VkCommandBuffer commandBuffer, uint32_t frameIndex);
+		bool indirect() const { return indirectPipeline != VK_NULL_HANDLE; }
+		VkCommandBuffer getCommandBuffer(uint32_t frameIndex) const;
+		uint32_t getDrawCapacity(uint32_t frameIndex) const;
 		void resize(uint32_t width, uint32_t height);
 
 		void freeResources();
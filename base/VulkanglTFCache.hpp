@@ -0,0 +1,371 @@
+/*
+* Cooked glTF model cache
+*
+* Stores the final interleaved vertex and index data, decoded images, materials and the node hierarchy of a glTF model
+* in a single versioned file that can be mapped and uploaded without parsing the glTF file again
+* Caches are tied to the files they were created from by file size and modification time, and a content hash
+* as fallback if the time stamps don't match
+*
+* Copyright (C) by Sascha Willems - www.saschawillems.de
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <stdint.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "VulkanMappedFile.hpp"
+
+namespace vkglTF
+{
+	namespace cache
+	{
+		// "VKGC"
+		const uint32_t magic = 0x43474B56;
+		// Increase whenever a record layout changes
+		const uint32_t version = 2;
+		// Offsets of all sections are aligned to this
+		const uint32_t sectionAlignment = 16;
+
+		const uint32_t flagMetallicRoughnessWorkflow = 0x1;
+
+		struct Header {
+			uint32_t magic;
+			uint32_t version;
+			uint32_t vertexSize;
+			uint32_t flags;
+			float scale;
+			uint32_t dependencyCount;
+			uint32_t imageCount;
+			uint32_t materialCount;
+			uint32_t nodeCount;
+			uint32_t primitiveCount;
+			uint32_t vertexCount;
+			uint32_t indexCount;
+			uint64_t stringsSize;
+			// Byte offsets from the start of the file
+			uint64_t dependencyOffset;
+			uint64_t imageOffset;
+			uint64_t materialOffset;
+			uint64_t nodeOffset;
+			uint64_t primitiveOffset;
+			uint64_t stringsOffset;
+			uint64_t vertexOffset;
+			uint64_t indexOffset;
+		};
+
+		// Files the cache was created from (the glTF file first, followed by external buffers and images)
+		struct DependencyRecord {
+			uint32_t nameOffset;
+			uint32_t nameLength;
+			uint64_t size;
+			int64_t time;
+			uint64_t hash;
+		};
+
+		// RGBA8 pixels of the first mip level
+		struct ImageRecord {
+			uint32_t width;
+			uint32_t height;
+			uint64_t offset;
+			uint64_t size;
+		};
+
+		// Texture slots in the order of vkglTF::Material's texture members
+		enum TextureSlot {
+			textureBaseColor, textureMetallicRoughness, textureNormal, textureOcclusion, textureEmissive, textureSpecularGlossiness, textureDiffuse,
+			textureSlotCount
+		};
+
+		struct MaterialRecord {
+			uint32_t alphaMode;
+			float alphaCutoff;
+			float metallicFactor;
+			float roughnessFactor;
+			float baseColorFactor[4];
+			// Image index for each slot, -1 if not set
+			int32_t textures[textureSlotCount];
+		};
+
+		// Nodes are stored in the model's linear node order, children come before their parents
+		struct NodeRecord {
+			int32_t parent;
+			uint32_t index;
+			int32_t skinIndex;
+			uint32_t nameOffset;
+			uint32_t nameLength;
+			uint32_t hasMesh;
+			uint32_t meshNameOffset;
+			uint32_t meshNameLength;
+			uint32_t firstPrimitive;
+			uint32_t primitiveCount;
+			float translation[3];
+			float rotation[4];
+			float scale[3];
+			float matrix[16];
+		};
+
+		struct PrimitiveRecord {
+			uint32_t firstIndex;
+			uint32_t indexCount;
+			int32_t material;
+			float min[3];
+			float max[3];
+		};
+
+		/** @brief Get the cache file name for a glTF file */
+		inline std::string getCacheFilename(const std::string& filename)
+		{
+			return filename + ".vkcache";
+		}
+
+		/** @brief Get size and modification time of a file */
+		inline bool getFileStamp(const std::string& filename, uint64_t& size, int64_t& time)
+		{
+			struct stat fileStat;
+			if (stat(filename.c_str(), &fileStat) != 0) {
+				return false;
+			}
+			size = static_cast<uint64_t>(fileStat.st_size);
+			time = static_cast<int64_t>(fileStat.st_mtime);
+			return true;
+		}
+
+		/** @brief 64 bit FNV-1a hash of a file's contents, 0 if the file can't be read */
+		inline uint64_t hashFile(const std::string& filename)
+		{
+			vks::MappedFile file;
+			if (!file.open(filename)) {
+				return 0;
+			}
+			uint64_t hash = 14695981039346656037ull;
+			const uint8_t* data = file.data();
+			for (size_t i = 0; i < file.size(); i++) {
+				hash = (hash ^ data[i]) * 1099511628211ull;
+			}
+			return hash;
+		}
+
+		/** @brief Section data for writing a cache file */
+		struct CacheData {
+			uint32_t flags = 0;
+			float scale = 1.0f;
+			uint32_t vertexSize = 0;
+			std::vector<std::string> dependencies;
+			std::vector<ImageRecord> images;
+			std::vector<const uint8_t*> imageData;
+			std::vector<MaterialRecord> materials;
+			std::vector<NodeRecord> nodes;
+			std::vector<PrimitiveRecord> primitives;
+			std::string strings;
+			const void* vertices = nullptr;
+			uint32_t vertexCount = 0;
+			const uint32_t* indices = nullptr;
+			uint32_t indexCount = 0;
+
+			/** @brief Append a string to the string table */
+			void addString(const std::string& string, uint32_t& offset, uint32_t& length)
+			{
+				offset = static_cast<uint32_t>(strings.size());
+				length = static_cast<uint32_t>(string.size());
+				strings += string;
+			}
+		};
+
+		/**
+		* Write a cache file
+		*
+		* @return False if the file couldn't be written (e.g. the asset directory is read only), the model can still be used without a cache
+		*/
+		inline bool write(const std::string& filename, CacheData& data)
+		{
+			std::vector<DependencyRecord> dependencies;
+			for (auto& dependency : data.dependencies) {
+				DependencyRecord record{};
+				if (!getFileStamp(dependency, record.size, record.time)) {
+					return false;
+				}
+				record.hash = hashFile(dependency);
+				data.addString(dependency, record.nameOffset, record.nameLength);
+				dependencies.push_back(record);
+			}
+
+			Header header{};
+			header.magic = magic;
+			header.version = version;
+			header.vertexSize = data.vertexSize;
+			header.flags = data.flags;
+			header.scale = data.scale;
+			header.dependencyCount = static_cast<uint32_t>(dependencies.size());
+			header.imageCount = static_cast<uint32_t>(data.images.size());
+			header.materialCount = static_cast<uint32_t>(data.materials.size());
+			header.nodeCount = static_cast<uint32_t>(data.nodes.size());
+			header.primitiveCount = static_cast<uint32_t>(data.primitives.size());
+			header.vertexCount = data.vertexCount;
+			header.indexCount = data.indexCount;
+			header.stringsSize = data.strings.size();
+
+			// Lay out the sections
+			uint64_t offset = sizeof(Header);
+			auto section = [&](uint64_t size) {
+				offset = (offset + sectionAlignment - 1) / sectionAlignment * sectionAlignment;
+				const uint64_t sectionOffset = offset;
+				offset += size;
+				return sectionOffset;
+			};
+			header.dependencyOffset = section(dependencies.size() * sizeof(DependencyRecord));
+			header.imageOffset = section(data.images.size() * sizeof(ImageRecord));
+			header.materialOffset = section(data.materials.size() * sizeof(MaterialRecord));
+			header.nodeOffset = section(data.nodes.size() * sizeof(NodeRecord));
+			header.primitiveOffset = section(data.primitives.size() * sizeof(PrimitiveRecord));
+			header.stringsOffset = section(data.strings.size());
+			header.vertexOffset = section((uint64_t)data.vertexCount * data.vertexSize);
+			header.indexOffset = section((uint64_t)data.indexCount * sizeof(uint32_t));
+			for (auto& image : data.images) {
+				image.offset = section(image.size);
+			}
+
+			// Written to a temporary file first, so a partially written cache is never picked up
+			const std::string tempFilename = filename + ".tmp";
+			std::ofstream file(tempFilename, std::ios::binary | std::ios::trunc);
+			if (!file.is_open()) {
+				return false;
+			}
+			auto put = [&](uint64_t target, const void* bytes, uint64_t size) {
+				static const char padding[sectionAlignment] = {};
+				const uint64_t position = static_cast<uint64_t>(file.tellp());
+				file.write(padding, static_cast<std::streamsize>(target - position));
+				if (size > 0) {
+					file.write(static_cast<const char*>(bytes), static_cast<std::streamsize>(size));
+				}
+			};
+			put(0, &header, sizeof(Header));
+			put(header.dependencyOffset, dependencies.data(), dependencies.size() * sizeof(DependencyRecord));
+			put(header.imageOffset, data.images.data(), data.images.size() * sizeof(ImageRecord));
+			put(header.materialOffset, data.materials.data(), data.materials.size() * sizeof(MaterialRecord));
+			put(header.nodeOffset, data.nodes.data(), data.nodes.size() * sizeof(NodeRecord));
+			put(header.primitiveOffset, data.primitives.data(), data.primitives.size() * sizeof(PrimitiveRecord));
+			put(header.stringsOffset, data.strings.data(), data.strings.size());
+			put(header.vertexOffset, data.vertices, (uint64_t)data.vertexCount * data.vertexSize);
+			put(header.indexOffset, data.indices, (uint64_t)data.indexCount * sizeof(uint32_t));
+			for (size_t i = 0; i < data.images.size(); i++) {
+				put(data.images[i].offset, data.imageData[i], data.images[i].size);
+			}
+			const bool written = file.good();
+			file.close();
+			if (!written) {
+				remove(tempFilename.c_str());
+				return false;
+			}
+			remove(filename.c_str());
+			return rename(tempFilename.c_str(), filename.c_str()) == 0;
+		}
+
+		/**
+		* @brief Mapped cache file, all records point into the mapping
+		* Doesn't touch any Vulkan objects, so caches can be loaded from any thread
+		*/
+		class CookedModel
+		{
+		private:
+			vks::MappedFile file;
+
+			template<typename T>
+			bool getSection(uint64_t offset, uint64_t count, const T*& records)
+			{
+				if (offset % sectionAlignment != 0 || offset > file.size() || count * sizeof(T) > file.size() - offset) {
+					return false;
+				}
+				records = reinterpret_cast<const T*>(file.data() + offset);
+				return true;
+			}
+
+			bool isUpToDate(const DependencyRecord& dependency) const
+			{
+				const std::string filename = getString(dependency.nameOffset, dependency.nameLength);
+				uint64_t size;
+				int64_t time;
+				if (!getFileStamp(filename, size, time) || size != dependency.size) {
+					return false;
+				}
+				// Time stamps change on copies and checkouts, so compare the contents before discarding the cache
+				return time == dependency.time || hashFile(filename) == dependency.hash;
+			}
+
+		public:
+			const Header* header = nullptr;
+			const ImageRecord* images = nullptr;
+			const MaterialRecord* materials = nullptr;
+			const NodeRecord* nodes = nullptr;
+			const PrimitiveRecord* primitives = nullptr;
+			const uint8_t* vertices = nullptr;
+			const uint32_t* indices = nullptr;
+
+			/**
+			* Map and validate a cache file
+			*
+			* @param filename Cache file to load
+			* @param scale Scale the model is loaded with
+			* @param vertexSize Size of the vertex layout the model uses
+			*
+			* @return False if there is no cache file or it's outdated
+			*/
+			bool load(const std::string& filename, float scale, uint32_t vertexSize)
+			{
+				if (!file.open(filename) || file.size() < sizeof(Header)) {
+					return false;
+				}
+				header = reinterpret_cast<const Header*>(file.data());
+				const DependencyRecord* dependencies;
+				const char* strings;
+				bool valid = header->magic == magic && header->version == version && header->vertexSize == vertexSize && header->scale == scale
+					&& getSection(header->dependencyOffset, header->dependencyCount, dependencies)
+					&& getSection(header->imageOffset, header->imageCount, images)
+					&& getSection(header->materialOffset, header->materialCount, materials)
+					&& getSection(header->nodeOffset, header->nodeCount, nodes)
+					&& getSection(header->primitiveOffset, header->primitiveCount, primitives)
+					&& getSection(header->stringsOffset, header->stringsSize, strings)
+					&& getSection(header->vertexOffset, (uint64_t)header->vertexCount * vertexSize, vertices)
+					&& getSection(header->indexOffset, header->indexCount, indices);
+				for (uint32_t i = 0; valid && i < header->imageCount; i++) {
+					const uint8_t* pixels;
+					valid = getSection(images[i].offset, images[i].size, pixels) && images[i].size == (uint64_t)images[i].width * images[i].height * 4;
+				}
+				// Indices between records are resolved without further checks when creating the model
+				for (uint32_t i = 0; valid && i < header->nodeCount; i++) {
+					const NodeRecord& node = nodes[i];
+					valid = node.parent < static_cast<int32_t>(header->nodeCount) && (uint64_t)node.firstPrimitive + node.primitiveCount <= header->primitiveCount;
+				}
+				for (uint32_t i = 0; valid && i < header->primitiveCount; i++) {
+					valid = primitives[i].material >= 0 && primitives[i].material < static_cast<int32_t>(header->materialCount)
+						&& (uint64_t)primitives[i].firstIndex + primitives[i].indexCount <= header->indexCount;
+				}
+				for (uint32_t i = 0; valid && i < header->dependencyCount; i++) {
+					valid = isUpToDate(dependencies[i]);
+				}
+				if (!valid) {
+					file.close();
+					header = nullptr;
+				}
+				return valid;
+			}
+
+			std::string getString(uint32_t offset, uint32_t length) const
+			{
+				const char* strings = reinterpret_cast<const char*>(file.data() + header->stringsOffset);
+				return (offset + length <= header->stringsSize) ? std::string(strings + offset, length) : std::string();
+			}
+
+			const uint8_t* getImageData(uint32_t index) const
+			{
+				return file.data() + images[index].offset;
+			}
+		};
+	}
+}
@@ -12,9 +12,17 @@
 #include <string>
 #include <fstream>
 #include <vector>
+#include <map>
+#include <tuple>
 
 #include "vulkan/vulkan.h"
 #include "VulkanDevice.hpp"
+#include "VulkanStagingUploader.hpp"
+#include "VulkanMappedFile.hpp"
+#include "VulkanglTFCache.hpp"
+#include "frustum.hpp"
+#include "threadpool.hpp"
+#include "VulkanInstrumentation.hpp"
 
 #define GLM_FORCE_RADIANS
 #define GLM_FORCE_DEPTH_ZERO_TO_ONE
@@ -22,6 +30,11 @@
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define VKGLTF_SSE
+#include <xmmintrin.h>
+#endif
+
 #define TINYGLTF_IMPLEMENTATION
 #define STB_IMAGE_IMPLEMENTATION
 #define TINYGLTF_NO_STB_IMAGE_WRITE
@@ -35,6 +48,27 @@ namespace vkglTF
 {
 	struct Node;
 
+	/** @brief Computes a * b, matrices are column major */
+	inline void multiplyMatrices(const glm::mat4 &a, const glm::mat4 &b, glm::mat4 &result)
+	{
+#if defined(VKGLTF_SSE)
+		const __m128 a0 = _mm_loadu_ps(&a[0][0]);
+		const __m128 a1 = _mm_loadu_ps(&a[1][0]);
+		const __m128 a2 = _mm_loadu_ps(&a[2][0]);
+		const __m128 a3 = _mm_loadu_ps(&a[3][0]);
+		for (uint32_t i = 0; i < 4; i++) {
+			// Column i of the result is a linear combination of a's columns weighted by column i of b
+			__m128 column = _mm_mul_ps(a0, _mm_set1_ps(b[i][0]));
+			column = _mm_add_ps(column, _mm_mul_ps(a1, _mm_set1_ps(b[i][1])));
+			column = _mm_add_ps(column, _mm_mul_ps(a2, _mm_set1_ps(b[i][2])));
+			column = _mm_add_ps(column, _mm_mul_ps(a3, _mm_set1_ps(b[i][3])));
+			_mm_storeu_ps(&result[i][0], column);
+		}
+#else
+		result = a * b;
+#endif
+	}
+
 	/*
 		glTF texture loading class
 	*/
@@ -42,7 +76,7 @@ namespace vkglTF
 		vks::VulkanDevice *device;
 		VkImage image;
 		VkImageLayout imageLayout;
-		VkDeviceMemory deviceMemory;
+		vks::Allocation deviceMemory;
 		VkImageView view;
 		uint32_t width, height;
 		uint32_t mipLevels;
@@ -61,28 +95,23 @@ namespace vkglTF
 		{
 			vkDestroyImageView(device->logicalDevice, view, nullptr);
 			vkDestroyImage(device->logicalDevice, image, nullptr);
-			vkFreeMemory(device->logicalDevice, deviceMemory, nullptr);
+			device->freeMemory(deviceMemory);
 			vkDestroySampler(device->logicalDevice, sampler, nullptr);
 		}
 
 		/*
-			Load a texture from a glTF image (stored as vector of chars loaded via stb_image)
-			Also generates the mip chain as glTF images are stored as jpg or png without any mips
+			Get the RGBA pixels of a glTF image (stored as vector of chars loaded via stb_image)
+			Returns a pointer to the image's own data if no conversion is required, otherwise the converted pixels are stored in rgbaBuffer
 		*/
-		void fromglTfImage(tinygltf::Image &gltfimage, vks::VulkanDevice *device, VkQueue copyQueue)
+		static const unsigned char* getRGBA(const tinygltf::Image &gltfimage, std::vector<unsigned char> &rgbaBuffer, VkDeviceSize &bufferSize)
 		{
-			this->device = device;
-
-			unsigned char* buffer = nullptr;
-			VkDeviceSize bufferSize = 0;
-			bool deleteBuffer = false;
 			if (gltfimage.component == 3) {
 				// Most devices don't support RGB only on Vulkan so convert if necessary
 				// TODO: Check actual format support and transform only if required
 				bufferSize = gltfimage.width * gltfimage.height * 4;
-				buffer = new unsigned char[bufferSize];
-				unsigned char* rgba = buffer;
-				unsigned char* rgb = &gltfimage.image[0];
+				rgbaBuffer.resize(bufferSize);
+				unsigned char* rgba = rgbaBuffer.data();
+				const unsigned char* rgb = &gltfimage.image[0];
 				for (size_t i = 0; i< gltfimage.width * gltfimage.height; ++i) {
 					for (int32_t j = 0; j < 3; ++j) {
 						rgba[j] = rgb[j];
@@ -90,49 +119,43 @@ namespace vkglTF
 					rgba += 4;
 					rgb += 3;
 				}
-				deleteBuffer = true;
-			}
-			else {
-				buffer = &gltfimage.image[0];
-				bufferSize = gltfimage.image.size();
+				return rgbaBuffer.data();
 			}
+			bufferSize = gltfimage.image.size();
+			return &gltfimage.image[0];
+		}
+
+		/*
+			Load a texture from a glTF image
+			Also generates the mip chain as glTF images are stored as jpg or png without any mips
+		*/
+		void fromglTfImage(tinygltf::Image &gltfimage, vks::VulkanDevice *device, VkQueue copyQueue)
+		{
+			std::vector<unsigned char> rgbaBuffer;
+			VkDeviceSize bufferSize;
+			const unsigned char* buffer = getRGBA(gltfimage, rgbaBuffer, bufferSize);
+			fromRGBA(buffer, bufferSize, gltfimage.width, gltfimage.height, device, copyQueue);
+		}
+
+		/*
+			Create a texture from RGBA8 pixels and generate the mip chain
+		*/
+		void fromRGBA(const unsigned char* buffer, VkDeviceSize bufferSize, uint32_t width, uint32_t height, vks::VulkanDevice *device, VkQueue copyQueue)
+		{
+			this->device = device;
 
 			VkFormat format = VK_FORMAT_R8G8B8A8_UNORM;
 
 			VkFormatProperties formatProperties;
 
-			width = gltfimage.width;
-			height = gltfimage.height;
+			this->width = width;
+			this->height = height;
 			mipLevels = static_cast<uint32_t>(floor(log2(std::max(width, height))) + 1.0);
 
 			vkGetPhysicalDeviceFormatProperties(device->physicalDevice, format, &formatProperties);
 			assert(formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_BLIT_SRC_BIT);
 			assert(formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_BLIT_DST_BIT);
 
-			VkMemoryAllocateInfo memAllocInfo{};
-			memAllocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-			VkMemoryRequirements memReqs{};
-
-			VkBuffer stagingBuffer;
-			VkDeviceMemory stagingMemory;
-
-			VkBufferCreateInfo bufferCreateInfo{};
-			bufferCreateInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-			bufferCreateInfo.size = bufferSize;
-			bufferCreateInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
-			bufferCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-			VK_CHECK_RESULT(vkCreateBuffer(device->logicalDevice, &bufferCreateInfo, nullptr, &stagingBuffer));
-			vkGetBufferMemoryRequirements(device->logicalDevice, stagingBuffer, &memReqs);
-			memAllocInfo.allocationSize = memReqs.size;
-			memAllocInfo.memoryTypeIndex = device->getMemoryType(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-			VK_CHECK_RESULT(vkAllocateMemory(device->logicalDevice, &memAllocInfo, nullptr, &stagingMemory));
-			VK_CHECK_RESULT(vkBindBufferMemory(device->logicalDevice, stagingBuffer, stagingMemory, 0));
-
-			uint8_t *data;
-			VK_CHECK_RESULT(vkMapMemory(device->logicalDevice, stagingMemory, 0, memReqs.size, 0, (void **)&data));
-			memcpy(data, buffer, bufferSize);
-			vkUnmapMemory(device->logicalDevice, stagingMemory);
-
 			VkImageCreateInfo imageCreateInfo{};
 			imageCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
 			imageCreateInfo.imageType = VK_IMAGE_TYPE_2D;
@@ -147,31 +170,13 @@ namespace vkglTF
 			imageCreateInfo.extent = { width, height, 1 };
 			imageCreateInfo.usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
 			VK_CHECK_RESULT(vkCreateImage(device->logicalDevice, &imageCreateInfo, nullptr, &image));
-			vkGetImageMemoryRequirements(device->logicalDevice, image, &memReqs);
-			memAllocInfo.allocationSize = memReqs.size;
-			memAllocInfo.memoryTypeIndex = device->getMemoryType(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-			VK_CHECK_RESULT(vkAllocateMemory(device->logicalDevice, &memAllocInfo, nullptr, &deviceMemory));
-			VK_CHECK_RESULT(vkBindImageMemory(device->logicalDevice, image, deviceMemory, 0));
-
-			VkCommandBuffer copyCmd = device->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
+			deviceMemory = device->allocateImageMemory(image, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
 
 			VkImageSubresourceRange subresourceRange = {};
 			subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
 			subresourceRange.levelCount = 1;
 			subresourceRange.layerCount = 1;
 
-			{
-				VkImageMemoryBarrier imageMemoryBarrier{};
-				imageMemoryBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-				imageMemoryBarrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-				imageMemoryBarrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-				imageMemoryBarrier.srcAccessMask = 0;
-				imageMemoryBarrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-				imageMemoryBarrier.image = image;
-				imageMemoryBarrier.subresourceRange = subresourceRange;
-				vkCmdPipelineBarrier(copyCmd, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, nullptr, 0, nullptr, 1, &imageMemoryBarrier);
-			}
-
 			VkBufferImageCopy bufferCopyRegion = {};
 			bufferCopyRegion.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
 			bufferCopyRegion.imageSubresource.mipLevel = 0;
@@ -181,27 +186,12 @@ namespace vkglTF
 			bufferCopyRegion.imageExtent.height = height;
 			bufferCopyRegion.imageExtent.depth = 1;
 
-			vkCmdCopyBufferToImage(copyCmd, stagingBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &bufferCopyRegion);
-
-			{
-				VkImageMemoryBarrier imageMemoryBarrier{};
-				imageMemoryBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-				imageMemoryBarrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-				imageMemoryBarrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
-				imageMemoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-				imageMemoryBarrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
-				imageMemoryBarrier.image = image;
-				imageMemoryBarrier.subresourceRange = subresourceRange;
-				vkCmdPipelineBarrier(copyCmd, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, nullptr, 0, nullptr, 1, &imageMemoryBarrier);
-			}
-
-			device->flushCommandBuffer(copyCmd, copyQueue, true);
-
-			vkFreeMemory(device->logicalDevice, stagingMemory, nullptr);
-			vkDestroyBuffer(device->logicalDevice, stagingBuffer, nullptr);
+			// The first level is left in transfer source layout for the blits below
+			device->stagingUploader->uploadImage(image, buffer, bufferSize, { bufferCopyRegion }, subresourceRange, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
 
 			// Generate the mip chain (glTF uses jpg and png, so we need to create this manually)
-			VkCommandBuffer blitCmd = device->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
+			// Blits need a graphics queue and are recorded into the graphics part of the upload batch
+			VkCommandBuffer blitCmd = device->stagingUploader->getGraphicsCommandBuffer();
 			for (uint32_t i = 1; i < mipLevels; i++) {
 				VkImageBlit imageBlit{};
 
@@ -267,8 +257,6 @@ namespace vkglTF
 				vkCmdPipelineBarrier(blitCmd, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, nullptr, 0, nullptr, 1, &imageMemoryBarrier);
 			}
 
-			device->flushCommandBuffer(blitCmd, copyQueue, true);
-
 			VkSamplerCreateInfo samplerInfo{};
 			samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
 			samplerInfo.magFilter = VK_FILTER_LINEAR;
@@ -357,42 +345,23 @@ namespace vkglTF
 		glTF mesh
 	*/
 	struct Mesh {
-		vks::VulkanDevice *device;
-
 		std::vector<Primitive*> primitives;
 		std::string name;
 
-		struct UniformBuffer {
-			VkBuffer buffer;
-			VkDeviceMemory memory;
-			VkDescriptorBufferInfo descriptor;
-			VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
-			void *mapped;
-		} uniformBuffer;
-
-		struct UniformBlock {
-			glm::mat4 matrix;
-			glm::mat4 jointMatrix[64]{};
-			float jointcount{ 0 };
-		} uniformBlock;
+		// World matrix of the mesh's node, copied to the model's instance data by Model::updateInstances
+		glm::mat4 matrix;
+		// Range of this mesh's joint matrices in the model's joint buffer
+		uint32_t jointOffset = 0;
+		uint32_t jointCount = 0;
 
-		Mesh(vks::VulkanDevice *device, glm::mat4 matrix) {
-			this->device = device;
-			this->uniformBlock.matrix = matrix;
-			VK_CHECK_RESULT(device->createBuffer(
-				VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-				VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-				sizeof(uniformBlock),
-				&uniformBuffer.buffer,
-				&uniformBuffer.memory,
-				&uniformBlock));
-			VK_CHECK_RESULT(vkMapMemory(device->logicalDevice, uniformBuffer.memory, 0, sizeof(uniformBlock), 0, &uniformBuffer.mapped));
-			uniformBuffer.descriptor = { uniformBuffer.buffer, 0, sizeof(uniformBlock) };
+		Mesh(glm::mat4 matrix) {
+			this->matrix = matrix;
 		};
 
 		~Mesh() {
-			vkDestroyBuffer(device->logicalDevice, uniformBuffer.buffer, nullptr);
-			vkFreeMemory(device->logicalDevice, uniformBuffer.memory, nullptr);
+			for (auto primitive : primitives) {
+				delete primitive;
+			}
 		}
 
 	};
@@ -422,43 +391,38 @@ namespace vkglTF
 		glm::vec3 translation{};
 		glm::vec3 scale{ 1.0f };
 		glm::quat rotation{};
+		// Cached world matrix, only recomputed by update() if the local transform of the node or one of it's parents has changed
+		glm::mat4 worldMatrix{ 1.0f };
+		// Has to be set whenever translation, rotation, scale or matrix are changed
+		bool dirty = true;
+		// Set if the last update() changed the world matrix
+		bool changed = false;
 
 		glm::mat4 localMatrix() {
 			return glm::translate(glm::mat4(1.0f), translation) * glm::mat4(rotation) * glm::scale(glm::mat4(1.0f), scale) * matrix;
 		}
 
-		glm::mat4 getMatrix() {
-			glm::mat4 m = localMatrix();
-			vkglTF::Node *p = parent;
-			while (p) {
-				m = p->localMatrix() * m;
-				p = p->parent;
-			}
-			return m;
+		/** @brief World matrix as of the last update() */
+		const glm::mat4& getMatrix() const {
+			return worldMatrix;
 		}
 
-		void update() {
-			if (mesh) {
-				glm::mat4 m = getMatrix();
-				if (skin) {
-					mesh->uniformBlock.matrix = m;
-					// Update join matrices
-					glm::mat4 inverseTransform = glm::inverse(m);
-					for (size_t i = 0; i < skin->joints.size(); i++) {
-						vkglTF::Node *jointNode = skin->joints[i];
-						glm::mat4 jointMat = jointNode->getMatrix() * skin->inverseBindMatrices[i];
-						jointMat = inverseTransform * jointMat;
-						mesh->uniformBlock.jointMatrix[i] = jointMat;
-					}
-					mesh->uniformBlock.jointcount = (float)skin->joints.size();
-					memcpy(mesh->uniformBuffer.mapped, &mesh->uniformBlock, sizeof(mesh->uniformBlock));
+		/** @brief Update the world matrices of this node and it's children top-down, has to be called on root nodes */
+		void update(bool parentChanged = false) {
+			changed = dirty || parentChanged;
+			if (changed) {
+				if (parent) {
+					multiplyMatrices(parent->worldMatrix, localMatrix(), worldMatrix);
 				} else {
-					memcpy(mesh->uniformBuffer.mapped, &m, sizeof(glm::mat4));
+					worldMatrix = localMatrix();
+				}
+				if (mesh) {
+					mesh->matrix = worldMatrix;
 				}
+				dirty = false;
 			}
-
 			for (auto& child : children) {
-				child->update();
+				child->update(changed);
 			}
 		}
 
@@ -509,8 +473,9 @@ namespace vkglTF
 	struct Model {
 
 		vks::VulkanDevice *device;
-		VkDescriptorPool descriptorPool;
-		VkDescriptorSetLayout descriptorSetLayout;
+		VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
+		// Instance data (binding 0) and joint matrices (binding 1) as storage buffers for the vertex shader
+		VkDescriptorSetLayout descriptorSetLayout = VK_NULL_HANDLE;
 
 		struct Vertex {
 			glm::vec3 pos;
@@ -522,12 +487,12 @@ namespace vkglTF
 
 		struct Vertices {
 			VkBuffer buffer;
-			VkDeviceMemory memory;
+			vks::Allocation memory;
 		} vertices;
 		struct Indices {
 			int count;
 			VkBuffer buffer;
-			VkDeviceMemory memory;
+			vks::Allocation memory;
 		} indices;
 
 		std::vector<Node*> nodes;
@@ -539,6 +504,60 @@ namespace vkglTF
 		std::vector<Material> materials;
 		std::vector<Animation> animations;
 
+		// Per instance data in the instance storage buffer (std430 layout)
+		struct InstanceData {
+			glm::mat4 matrix;
+			glm::vec4 baseColorFactor;
+			uint32_t jointOffset;
+			uint32_t jointCount;
+			uint32_t pad[2];
+		};
+
+		/*
+			Flattened draw list, built once the nodes have been loaded
+			Primitives with the same index range and material (nodes referencing the same glTF mesh) are drawn as instances of a single draw
+		*/
+		struct DrawBatch {
+			uint32_t firstIndex;
+			uint32_t indexCount;
+			Material *material;
+			// Range of the batch's instances in the instance buffer
+			uint32_t firstInstance;
+			uint32_t instanceCount;
+			// Bounding sphere of the primitive in model space
+			glm::vec3 center;
+			float radius;
+		};
+		std::vector<DrawBatch> drawBatches;
+		// Node of each instance, instances of a batch are stored next to each other
+		std::vector<Node*> instanceNodes;
+		// Nodes with a skinned mesh, in the order of their joint ranges
+		std::vector<Node*> skinnedNodes;
+		uint32_t jointCount = 0;
+		// Number of skins updated by a single job in updateJoints
+		uint32_t skinBatchSize = 4;
+
+		struct StorageBuffer {
+			VkBuffer buffer = VK_NULL_HANDLE;
+			vks::Allocation memory;
+		};
+		// Instance data and joint matrices, updated on the host whenever node transforms change
+		std::vector<InstanceData> instanceData;
+		std::vector<glm::mat4> jointMatrices;
+		// Incremented on every change of the instance data or joint matrices
+		uint32_t dataVersion = 0;
+		// Host visible copies of the instance data and joint matrices, one per frame in flight so a copy the GPU may still read is never written
+		struct FrameBuffers {
+			StorageBuffer instances;
+			StorageBuffer joints;
+			VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+			uint32_t dataVersion = 0;
+		};
+		std::vector<FrameBuffers> frameBuffers;
+		// Draw commands and instance indices (per instance vertex attribute) drawing all instances, for drawing without culling
+		StorageBuffer drawCommandBuffer;
+		StorageBuffer instanceIndexBuffer;
+
 		struct Dimensions {
 			glm::vec3 min = glm::vec3(FLT_MAX);
 			glm::vec3 max = glm::vec3(-FLT_MAX);
@@ -554,9 +573,14 @@ namespace vkglTF
 		~Model() 
 		{
 			vkDestroyBuffer(device->logicalDevice, vertices.buffer, nullptr);
-			vkFreeMemory(device->logicalDevice, vertices.memory, nullptr);
+			device->freeMemory(vertices.memory);
 			vkDestroyBuffer(device->logicalDevice, indices.buffer, nullptr);
-			vkFreeMemory(device->logicalDevice, indices.memory, nullptr);
+			device->freeMemory(indices.memory);
+			destroyFrameBuffers();
+			for (auto buffer : { &drawCommandBuffer, &instanceIndexBuffer }) {
+				vkDestroyBuffer(device->logicalDevice, buffer->buffer, nullptr);
+				device->freeMemory(buffer->memory);
+			}
 			for (auto texture : textures) {
 				texture.destroy();
 			}
@@ -564,9 +588,11 @@ namespace vkglTF
 				delete node;
 			}
 			vkDestroyDescriptorSetLayout(device->logicalDevice, descriptorSetLayout, nullptr);
-			vkDestroyDescriptorPool(device->logicalDevice, descriptorPool, nullptr);
 		}
 
+		// Meshes already loaded by loadNode, indexed by glTF mesh
+		std::map<int, Mesh*> loadedMeshes;
+
 		void loadNode(vkglTF::Node *parent, const tinygltf::Node &node, uint32_t nodeIndex, const tinygltf::Model &model, std::vector<uint32_t>& indexBuffer, std::vector<Vertex>& vertexBuffer, float globalscale)
 		{
 			vkglTF::Node *newNode = new Node{};
@@ -606,10 +632,22 @@ namespace vkglTF
 				}
 			}
 
+			// Node references a mesh that has already been loaded, share it's vertices and indices so both are drawn as instances
+			if ((node.mesh > -1) && (loadedMeshes.find(node.mesh) != loadedMeshes.end())) {
+				const Mesh *sharedMesh = loadedMeshes[node.mesh];
+				Mesh *newMesh = new Mesh(newNode->matrix);
+				newMesh->name = sharedMesh->name;
+				for (auto primitive : sharedMesh->primitives) {
+					Primitive *newPrimitive = new Primitive(primitive->firstIndex, primitive->indexCount, primitive->material);
+					newPrimitive->setDimensions(primitive->dimensions.min, primitive->dimensions.max);
+					newMesh->primitives.push_back(newPrimitive);
+				}
+				newNode->mesh = newMesh;
+			}
 			// Node contains mesh data
-			if (node.mesh > -1) {
+			else if (node.mesh > -1) {
 				const tinygltf::Mesh mesh = model.meshes[node.mesh];
-				Mesh *newMesh = new Mesh(device, newNode->matrix);
+				Mesh *newMesh = new Mesh(newNode->matrix);
 				newMesh->name = mesh.name;
 				for (size_t j = 0; j < mesh.primitives.size(); j++) {
 					const tinygltf::Primitive &primitive = mesh.primitives[j];
@@ -721,6 +759,7 @@ namespace vkglTF
 					newMesh->primitives.push_back(newPrimitive);
 				}
 				newNode->mesh = newMesh;
+				loadedMeshes[node.mesh] = newMesh;
 			}
 			if (parent) {
 				parent->children.push_back(newNode);
@@ -929,59 +968,302 @@ namespace vkglTF
 			}
 		}
 
-		void loadFromFile(std::string filename, vks::VulkanDevice *device, VkQueue transferQueue, float scale = 1.0f)
+		// Directory external buffers and images are loaded from
+		static std::string getBaseDir(const std::string &filename)
+		{
+#if defined(__ANDROID__)
+			return "";
+#else
+			const size_t separator = filename.find_last_of("/\\");
+			return (separator != std::string::npos) ? filename.substr(0, separator) : "";
+#endif
+		}
+
+		/*
+			Parse a glTF (.gltf or binary .glb) file including its buffers and images
+			Doesn't touch any Vulkan objects, so it can be called from any thread
+		*/
+		static bool loadglTFFile(std::string filename, tinygltf::Model &gltfModel)
 		{
-			tinygltf::Model gltfModel;
 			tinygltf::TinyGLTF gltfContext;
 			std::string error, warning;
 
-			this->device = device;
+			// The file is parsed straight from the file mapping, external buffers and images are still read by tinygltf
+			vks::MappedFile file;
+			if (!file.open(filename)) {
+				std::cerr << "Could not open gltf file: " << filename << std::endl;
+				return false;
+			}
+			const std::string baseDir = getBaseDir(filename);
+			bool fileLoaded;
+			// Binary files start with the magic "glTF"
+			if (file.size() >= 4 && memcmp(file.data(), "glTF", 4) == 0) {
+				fileLoaded = gltfContext.LoadBinaryFromMemory(&gltfModel, &error, &warning, file.data(), static_cast<unsigned int>(file.size()), baseDir);
+			} else {
+				fileLoaded = gltfContext.LoadASCIIFromString(&gltfModel, &error, &warning, reinterpret_cast<const char*>(file.data()), static_cast<unsigned int>(file.size()), baseDir);
+			}
+			if (!fileLoaded) {
+				// TODO: throw
+				std::cerr << "Could not load gltf file: " << error << std::endl;
+			}
+			return fileLoaded;
+		}
 
+		/*
+			Load a glTF model, if useCache is set the model is loaded from its cooked cache if it's up to date (and the cache is written otherwise)
+		*/
+		void loadFromFile(std::string filename, vks::VulkanDevice *device, VkQueue transferQueue, float scale = 1.0f, bool useCache = false)
+		{
+			if (useCache) {
+				cache::CookedModel cookedModel;
+				if (loadCachedFile(filename, cookedModel, scale)) {
+					loadFromCookedModel(cookedModel, device, transferQueue);
+					return;
+				}
+			}
+			tinygltf::Model gltfModel;
+			if (loadglTFFile(filename, gltfModel)) {
+				loadFromglTFModel(gltfModel, device, transferQueue, scale, useCache ? filename : "");
+			}
+		}
+
+		/*
+			Map the cooked cache of a glTF file
+			Returns false if there is no up to date cache, doesn't touch any Vulkan objects so it can be called from any thread
+		*/
+		static bool loadCachedFile(const std::string &filename, cache::CookedModel &cookedModel, float scale = 1.0f)
+		{
 #if defined(__ANDROID__)
-			AAsset* asset = AAssetManager_open(androidApp->activity->assetManager, filename.c_str(), AASSET_MODE_STREAMING);
-			assert(asset);
-			size_t size = AAsset_getLength(asset);
-			assert(size > 0);
-			char* fileData = new char[size];
-			AAsset_read(asset, fileData, size);
-			AAsset_close(asset);
-			std::string baseDir;
-			bool fileLoaded = gltfContext.LoadASCIIFromString(&gltfModel, &error, &warning, fileData, size, baseDir);
-			free(fileData);
+			// Assets are read only and don't have time stamps
+			return false;
 #else
-			bool fileLoaded = gltfContext.LoadASCIIFromFile(&gltfModel, &error, &warning, filename);
+			return cookedModel.load(cache::getCacheFilename(filename), scale, sizeof(Vertex));
 #endif
-			std::vector<uint32_t> indexBuffer;
-			std::vector<Vertex> vertexBuffer;
+		}
 
-			if (fileLoaded) {
-				loadImages(gltfModel, device, transferQueue);
-				loadMaterials(gltfModel);
-				const tinygltf::Scene &scene = gltfModel.scenes[gltfModel.defaultScene > -1 ? gltfModel.defaultScene : 0];
-				for (size_t i = 0; i < scene.nodes.size(); i++) {
-					const tinygltf::Node node = gltfModel.nodes[scene.nodes[i]];
-					loadNode(nullptr, node, scene.nodes[i], gltfModel, indexBuffer, vertexBuffer, scale);
+		/*
+			Write the final vertex and index data, images, materials and nodes to the cooked cache of a glTF file
+			Models with skins or animations are not cached
+		*/
+		bool writeCache(const std::string &filename, const tinygltf::Model &gltfModel, const std::vector<Vertex> &vertexBuffer, const std::vector<uint32_t> &indexBuffer, float scale)
+		{
+#if defined(__ANDROID__)
+			return false;
+#else
+			if (!skins.empty() || !animations.empty() || vertexBuffer.empty() || indexBuffer.empty()) {
+				return false;
+			}
+			cache::CacheData data;
+			data.flags = metallicRoughnessWorkflow ? cache::flagMetallicRoughnessWorkflow : 0;
+			data.scale = scale;
+			data.vertexSize = sizeof(Vertex);
+			data.vertices = vertexBuffer.data();
+			data.vertexCount = static_cast<uint32_t>(vertexBuffer.size());
+			data.indices = indexBuffer.data();
+			data.indexCount = static_cast<uint32_t>(indexBuffer.size());
+
+			// The glTF file and all external files it references
+			const std::string baseDir = getBaseDir(filename);
+			data.dependencies.push_back(filename);
+			for (auto &buffer : gltfModel.buffers) {
+				if (!buffer.uri.empty() && buffer.uri.compare(0, 5, "data:") != 0) {
+					data.dependencies.push_back(baseDir.empty() ? buffer.uri : baseDir + "/" + buffer.uri);
 				}
-				if (gltfModel.animations.size() > 0) {
-					loadAnimations(gltfModel);
+			}
+			for (auto &image : gltfModel.images) {
+				if (!image.uri.empty() && image.uri.compare(0, 5, "data:") != 0) {
+					data.dependencies.push_back(baseDir.empty() ? image.uri : baseDir + "/" + image.uri);
 				}
-				loadSkins(gltfModel);
+			}
 
-				for (auto node : linearNodes) {
-					// Assign skins
-					if (node->skinIndex > -1) {
-						node->skin = skins[node->skinIndex];
+			std::vector<std::vector<unsigned char>> rgbaBuffers(gltfModel.images.size());
+			for (size_t i = 0; i < gltfModel.images.size(); i++) {
+				const tinygltf::Image &image = gltfModel.images[i];
+				cache::ImageRecord record{};
+				record.width = image.width;
+				record.height = image.height;
+				VkDeviceSize size;
+				data.imageData.push_back(Texture::getRGBA(image, rgbaBuffers[i], size));
+				record.size = size;
+				if (record.size != (uint64_t)record.width * record.height * 4) {
+					return false;
+				}
+				data.images.push_back(record);
+			}
+
+			auto textureIndex = [this](const vkglTF::Texture *texture) {
+				return texture ? static_cast<int32_t>(texture - textures.data()) : -1;
+			};
+			for (auto &material : materials) {
+				cache::MaterialRecord record{};
+				record.alphaMode = material.alphaMode;
+				record.alphaCutoff = material.alphaCutoff;
+				record.metallicFactor = material.metallicFactor;
+				record.roughnessFactor = material.roughnessFactor;
+				memcpy(record.baseColorFactor, glm::value_ptr(material.baseColorFactor), sizeof(record.baseColorFactor));
+				record.textures[cache::textureBaseColor] = textureIndex(material.baseColorTexture);
+				record.textures[cache::textureMetallicRoughness] = textureIndex(material.metallicRoughnessTexture);
+				record.textures[cache::textureNormal] = textureIndex(material.normalTexture);
+				record.textures[cache::textureOcclusion] = textureIndex(material.occlusionTexture);
+				record.textures[cache::textureEmissive] = textureIndex(material.emissiveTexture);
+				record.textures[cache::textureSpecularGlossiness] = textureIndex(material.specularGlossinessTexture);
+				record.textures[cache::textureDiffuse] = textureIndex(material.diffuseTexture);
+				data.materials.push_back(record);
+			}
+
+			for (auto node : linearNodes) {
+				cache::NodeRecord record{};
+				record.parent = -1;
+				if (node->parent) {
+					record.parent = static_cast<int32_t>(std::find(linearNodes.begin(), linearNodes.end(), node->parent) - linearNodes.begin());
+				}
+				record.index = node->index;
+				record.skinIndex = node->skinIndex;
+				data.addString(node->name, record.nameOffset, record.nameLength);
+				memcpy(record.translation, glm::value_ptr(node->translation), sizeof(record.translation));
+				record.rotation[0] = node->rotation.x;
+				record.rotation[1] = node->rotation.y;
+				record.rotation[2] = node->rotation.z;
+				record.rotation[3] = node->rotation.w;
+				memcpy(record.scale, glm::value_ptr(node->scale), sizeof(record.scale));
+				memcpy(record.matrix, glm::value_ptr(node->matrix), sizeof(record.matrix));
+				if (node->mesh) {
+					record.hasMesh = 1;
+					data.addString(node->mesh->name, record.meshNameOffset, record.meshNameLength);
+					record.firstPrimitive = static_cast<uint32_t>(data.primitives.size());
+					record.primitiveCount = static_cast<uint32_t>(node->mesh->primitives.size());
+					for (auto primitive : node->mesh->primitives) {
+						cache::PrimitiveRecord primitiveRecord{};
+						primitiveRecord.firstIndex = primitive->firstIndex;
+						primitiveRecord.indexCount = primitive->indexCount;
+						primitiveRecord.material = static_cast<int32_t>(&primitive->material - materials.data());
+						memcpy(primitiveRecord.min, glm::value_ptr(primitive->dimensions.min), sizeof(primitiveRecord.min));
+						memcpy(primitiveRecord.max, glm::value_ptr(primitive->dimensions.max), sizeof(primitiveRecord.max));
+						data.primitives.push_back(primitiveRecord);
 					}
-					// Initial pose
-					if (node->mesh) {
-						node->update();
+				}
+				data.nodes.push_back(record);
+			}
+
+			const bool written = cache::write(cache::getCacheFilename(filename), data);
+			if (!written) {
+				std::cout << "Could not write model cache for " << filename << std::endl;
+			}
+			return written;
+#endif
+		}
+
+		/*
+			Create the model from a cooked cache, vertex, index and image data are uploaded straight from the cache file's mapping
+		*/
+		void loadFromCookedModel(const cache::CookedModel &cookedModel, vks::VulkanDevice *device, VkQueue transferQueue)
+		{
+			this->device = device;
+			const cache::Header &header = *cookedModel.header;
+
+			for (uint32_t i = 0; i < header.imageCount; i++) {
+				const cache::ImageRecord &record = cookedModel.images[i];
+				vkglTF::Texture texture;
+				texture.fromRGBA(cookedModel.getImageData(i), record.size, record.width, record.height, device, transferQueue);
+				textures.push_back(texture);
+			}
+
+			auto texture = [this](int32_t index) {
+				return (index >= 0 && index < static_cast<int32_t>(textures.size())) ? &textures[index] : nullptr;
+			};
+			for (uint32_t i = 0; i < header.materialCount; i++) {
+				const cache::MaterialRecord &record = cookedModel.materials[i];
+				vkglTF::Material material{};
+				material.alphaMode = static_cast<Material::AlphaMode>(record.alphaMode);
+				material.alphaCutoff = record.alphaCutoff;
+				material.metallicFactor = record.metallicFactor;
+				material.roughnessFactor = record.roughnessFactor;
+				material.baseColorFactor = glm::make_vec4(record.baseColorFactor);
+				material.baseColorTexture = texture(record.textures[cache::textureBaseColor]);
+				material.metallicRoughnessTexture = texture(record.textures[cache::textureMetallicRoughness]);
+				material.normalTexture = texture(record.textures[cache::textureNormal]);
+				material.occlusionTexture = texture(record.textures[cache::textureOcclusion]);
+				material.emissiveTexture = texture(record.textures[cache::textureEmissive]);
+				material.specularGlossinessTexture = texture(record.textures[cache::textureSpecularGlossiness]);
+				material.diffuseTexture = texture(record.textures[cache::textureDiffuse]);
+				materials.push_back(material);
+			}
+			metallicRoughnessWorkflow = (header.flags & cache::flagMetallicRoughnessWorkflow) != 0;
+
+			// Children are stored before their parents, in the order they were attached
+			for (uint32_t i = 0; i < header.nodeCount; i++) {
+				const cache::NodeRecord &record = cookedModel.nodes[i];
+				vkglTF::Node *newNode = new Node{};
+				newNode->index = record.index;
+				newNode->name = cookedModel.getString(record.nameOffset, record.nameLength);
+				newNode->skinIndex = record.skinIndex;
+				newNode->translation = glm::make_vec3(record.translation);
+				newNode->rotation = glm::quat(record.rotation[3], record.rotation[0], record.rotation[1], record.rotation[2]);
+				newNode->scale = glm::make_vec3(record.scale);
+				newNode->matrix = glm::make_mat4x4(record.matrix);
+				if (record.hasMesh) {
+					Mesh *newMesh = new Mesh(newNode->matrix);
+					newMesh->name = cookedModel.getString(record.meshNameOffset, record.meshNameLength);
+					for (uint32_t j = 0; j < record.primitiveCount; j++) {
+						const cache::PrimitiveRecord &primitiveRecord = cookedModel.primitives[record.firstPrimitive + j];
+						assert(primitiveRecord.material >= 0 && primitiveRecord.material < static_cast<int32_t>(materials.size()));
+						Primitive *newPrimitive = new Primitive(primitiveRecord.firstIndex, primitiveRecord.indexCount, materials[primitiveRecord.material]);
+						newPrimitive->setDimensions(glm::make_vec3(primitiveRecord.min), glm::make_vec3(primitiveRecord.max));
+						newMesh->primitives.push_back(newPrimitive);
 					}
+					newNode->mesh = newMesh;
 				}
+				linearNodes.push_back(newNode);
 			}
-			else {
-				// TODO: throw
-				std::cerr << "Could not load gltf file: " << error << std::endl;
-				return;
+			for (uint32_t i = 0; i < header.nodeCount; i++) {
+				const int32_t parent = cookedModel.nodes[i].parent;
+				if (parent >= 0) {
+					linearNodes[i]->parent = linearNodes[parent];
+					linearNodes[parent]->children.push_back(linearNodes[i]);
+				} else {
+					nodes.push_back(linearNodes[i]);
+				}
+			}
+			for (auto node : nodes) {
+				node->update();
+			}
+
+			prepareBuffers(cookedModel.vertices, header.vertexCount * sizeof(Vertex), cookedModel.indices, header.indexCount);
+		}
+
+		/*
+			Create the model's nodes, textures and buffers from an already parsed glTF file
+			If cacheSource is set, a cooked cache for that glTF file is written after loading
+		*/
+		void loadFromglTFModel(tinygltf::Model &gltfModel, vks::VulkanDevice *device, VkQueue transferQueue, float scale = 1.0f, const std::string& cacheSource = "")
+		{
+			this->device = device;
+
+			std::vector<uint32_t> indexBuffer;
+			std::vector<Vertex> vertexBuffer;
+
+			loadImages(gltfModel, device, transferQueue);
+			loadMaterials(gltfModel);
+			const tinygltf::Scene &scene = gltfModel.scenes[gltfModel.defaultScene > -1 ? gltfModel.defaultScene : 0];
+			for (size_t i = 0; i < scene.nodes.size(); i++) {
+				const tinygltf::Node node = gltfModel.nodes[scene.nodes[i]];
+				loadNode(nullptr, node, scene.nodes[i], gltfModel, indexBuffer, vertexBuffer, scale);
+			}
+			loadedMeshes.clear();
+			if (gltfModel.animations.size() > 0) {
+				loadAnimations(gltfModel);
+			}
+			loadSkins(gltfModel);
+
+			// Assign skins
+			for (auto node : linearNodes) {
+				if (node->skinIndex > -1) {
+					node->skin = skins[node->skinIndex];
+				}
+			}
+			// Initial pose
+			for (auto node : nodes) {
+				node->update();
 			}
 
 			for (auto extension : gltfModel.extensionsUsed) {
@@ -991,34 +1273,22 @@ namespace vkglTF
 				}
 			}
 
-			size_t vertexBufferSize = vertexBuffer.size() * sizeof(Vertex);
-			size_t indexBufferSize = indexBuffer.size() * sizeof(uint32_t);
-			indices.count = static_cast<uint32_t>(indexBuffer.size());
+			if (!cacheSource.empty()) {
+				writeCache(cacheSource, gltfModel, vertexBuffer, indexBuffer, scale);
+			}
 
-			assert((vertexBufferSize > 0) && (indexBufferSize > 0));
+			prepareBuffers(vertexBuffer.data(), vertexBuffer.size() * sizeof(Vertex), indexBuffer.data(), indexBuffer.size());
+		}
 
-			struct StagingBuffer {
-				VkBuffer buffer;
-				VkDeviceMemory memory;
-			} vertexStaging, indexStaging;
+		/*
+			Create and upload the vertex and index buffers and setup the node descriptors
+		*/
+		void prepareBuffers(const void* vertexData, size_t vertexBufferSize, const uint32_t* indexData, uint32_t indexCount)
+		{
+			size_t indexBufferSize = indexCount * sizeof(uint32_t);
+			indices.count = static_cast<int>(indexCount);
 
-			// Create staging buffers
-			// Vertex data
-			VK_CHECK_RESULT(device->createBuffer(
-				VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-				VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-				vertexBufferSize,
-				&vertexStaging.buffer,
-				&vertexStaging.memory,
-				vertexBuffer.data()));
-			// Index data
-			VK_CHECK_RESULT(device->createBuffer(
-				VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-				VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-				indexBufferSize,
-				&indexStaging.buffer,
-				&indexStaging.memory,
-				indexBuffer.data()));
+			assert((vertexBufferSize > 0) && (indexBufferSize > 0));
 
 			// Create device local buffers
 			// Vertex buffer
@@ -1036,71 +1306,335 @@ namespace vkglTF
 				&indices.buffer,
 				&indices.memory));
 
-			// Copy from staging buffers
-			VkCommandBuffer copyCmd = device->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
-
-			VkBufferCopy copyRegion = {};
-
-			copyRegion.size = vertexBufferSize;
-			vkCmdCopyBuffer(copyCmd, vertexStaging.buffer, vertices.buffer, 1, &copyRegion);
-
-			copyRegion.size = indexBufferSize;
-			vkCmdCopyBuffer(copyCmd, indexStaging.buffer, indices.buffer, 1, &copyRegion);
-
-			device->flushCommandBuffer(copyCmd, transferQueue, true);
-
-			vkDestroyBuffer(device->logicalDevice, vertexStaging.buffer, nullptr);
-			vkFreeMemory(device->logicalDevice, vertexStaging.memory, nullptr);
-			vkDestroyBuffer(device->logicalDevice, indexStaging.buffer, nullptr);
-			vkFreeMemory(device->logicalDevice, indexStaging.memory, nullptr);
+			// Copy through the staging ring, the graphics queue picks up the data with the next batch
+			device->stagingUploader->uploadBuffer(vertices.buffer, vertexData, vertexBufferSize, 0, VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT);
+			device->stagingUploader->uploadBuffer(indices.buffer, indexData, indexBufferSize, 0, VK_ACCESS_INDEX_READ_BIT);
 
 			getSceneDimensions();
+			prepareDrawList();
+		}
 
-			// Setup descriptors
-			uint32_t uboCount{ 0 };
+		/*
+			Flatten the node tree into draw batches and create the instance and joint buffers (for a single frame in flight, see setFrameCount)
+		*/
+		void prepareDrawList()
+		{
+			// Group the primitives of all nodes by index range and material, ordered by their position in the index buffer
+			std::map<std::tuple<uint32_t, uint32_t, Material*>, std::vector<Node*>> batches;
 			for (auto node : linearNodes) {
-				if (node->mesh) {
-					uboCount++;
+				if (!node->mesh) {
+					continue;
+				}
+				for (Primitive *primitive : node->mesh->primitives) {
+					batches[std::make_tuple(primitive->firstIndex, primitive->indexCount, &primitive->material)].push_back(node);
+				}
+			}
+			drawBatches.clear();
+			instanceNodes.clear();
+			std::vector<InstanceData> instances;
+			for (auto& batch : batches) {
+				DrawBatch drawBatch{};
+				drawBatch.firstIndex = std::get<0>(batch.first);
+				drawBatch.indexCount = std::get<1>(batch.first);
+				drawBatch.material = std::get<2>(batch.first);
+				drawBatch.firstInstance = static_cast<uint32_t>(instanceNodes.size());
+				drawBatch.instanceCount = static_cast<uint32_t>(batch.second.size());
+				for (Primitive *primitive : batch.second[0]->mesh->primitives) {
+					if (primitive->firstIndex == drawBatch.firstIndex && primitive->indexCount == drawBatch.indexCount) {
+						drawBatch.center = primitive->dimensions.center;
+						drawBatch.radius = primitive->dimensions.radius;
+					}
+				}
+				for (auto node : batch.second) {
+					InstanceData instance{};
+					instance.baseColorFactor = drawBatch.material->baseColorFactor;
+					instances.push_back(instance);
+					instanceNodes.push_back(node);
+				}
+				drawBatches.push_back(drawBatch);
+			}
+
+			// Skinned meshes get a range of the joint buffer
+			jointCount = 0;
+			skinnedNodes.clear();
+			for (auto node : linearNodes) {
+				if (node->mesh && node->skin) {
+					node->mesh->jointOffset = jointCount;
+					node->mesh->jointCount = static_cast<uint32_t>(node->skin->joints.size());
+					jointCount += node->mesh->jointCount;
+					skinnedNodes.push_back(node);
 				}
 			}
-			std::vector<VkDescriptorPoolSize> poolSizes = {
-				vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, uboCount),
-			};
-			VkDescriptorPoolCreateInfo descriptorPoolCI = vks::initializers::descriptorPoolCreateInfo(static_cast<uint32_t>(poolSizes.size()), poolSizes.data(), uboCount);
-			VK_CHECK_RESULT(vkCreateDescriptorPool(device->logicalDevice, &descriptorPoolCI, nullptr, &descriptorPool));
 
+			// Buffers can't be empty, models without meshes or skins still get a single element
+			const size_t instanceCount = std::max(instances.size(), (size_t)1);
+			instances.resize(instanceCount);
+			instanceData = instances;
+			jointMatrices.assign(std::max(jointCount, 1u), glm::mat4(1.0f));
+			updateJoints();
+			updateInstances();
+
+			// Draw commands and instance indices for drawing all instances
+			std::vector<VkDrawIndexedIndirectCommand> commands(std::max(drawBatches.size(), (size_t)1));
+			std::vector<uint32_t> instanceIndices(instanceCount);
+			updateDrawCommands(commands.data(), instanceIndices.data(), glm::mat4(1.0f), false);
+			VK_CHECK_RESULT(device->createBuffer(
+				VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+				VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+				commands.size() * sizeof(VkDrawIndexedIndirectCommand),
+				&drawCommandBuffer.buffer,
+				&drawCommandBuffer.memory));
+			VK_CHECK_RESULT(device->createBuffer(
+				VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+				VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+				instanceIndices.size() * sizeof(uint32_t),
+				&instanceIndexBuffer.buffer,
+				&instanceIndexBuffer.memory));
+			device->stagingUploader->uploadBuffer(drawCommandBuffer.buffer, commands.data(), commands.size() * sizeof(VkDrawIndexedIndirectCommand), 0, VK_ACCESS_INDIRECT_COMMAND_READ_BIT);
+			device->stagingUploader->uploadBuffer(instanceIndexBuffer.buffer, instanceIndices.data(), instanceIndices.size() * sizeof(uint32_t), 0, VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT);
+
+			// Setup descriptors
 			std::vector<VkDescriptorSetLayoutBinding> setLayoutBindings = {
-				vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_VERTEX_BIT, 0),
+				vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_VERTEX_BIT, 0),
+				vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_VERTEX_BIT, 1),
 			};
 			VkDescriptorSetLayoutCreateInfo descriptorLayoutCI{};
 			descriptorLayoutCI.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
 			descriptorLayoutCI.bindingCount = static_cast<uint32_t>(setLayoutBindings.size());
 			descriptorLayoutCI.pBindings = setLayoutBindings.data();
 			VK_CHECK_RESULT(vkCreateDescriptorSetLayout(device->logicalDevice, &descriptorLayoutCI, nullptr, &descriptorSetLayout));
-			for (auto node : nodes) {
-				prepareNodeDescriptor(node, descriptorSetLayout);
+
+			setFrameCount(1);
+		}
+
+		void destroyFrameBuffers()
+		{
+			for (auto& frame : frameBuffers) {
+				for (auto buffer : { &frame.instances, &frame.joints }) {
+					vkDestroyBuffer(device->logicalDevice, buffer->buffer, nullptr);
+					device->freeMemory(buffer->memory);
+				}
 			}
+			frameBuffers.clear();
+			// Destroying the pool frees all sets allocated from it
+			vkDestroyDescriptorPool(device->logicalDevice, descriptorPool, nullptr);
+			descriptorPool = VK_NULL_HANDLE;
 		}
 
-		void drawNode(Node *node, VkCommandBuffer commandBuffer)
+		/**
+		* (Re)create the instance and joint buffers and their descriptor sets for the given number of frames in flight
+		* The buffers must not be in use by the GPU
+		*
+		* @param count Number of frames in flight, typically the number of swap chain images
+		*/
+		void setFrameCount(uint32_t count)
 		{
-			if (node->mesh) {
-				for (Primitive *primitive : node->mesh->primitives) {
-					vkCmdDrawIndexed(commandBuffer, primitive->indexCount, 1, primitive->firstIndex, 0, 0);
+			assert(count > 0);
+			destroyFrameBuffers();
+
+			std::vector<VkDescriptorPoolSize> poolSizes = {
+				vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 2 * count),
+			};
+			VkDescriptorPoolCreateInfo descriptorPoolCI = vks::initializers::descriptorPoolCreateInfo(static_cast<uint32_t>(poolSizes.size()), poolSizes.data(), count);
+			VK_CHECK_RESULT(vkCreateDescriptorPool(device->logicalDevice, &descriptorPoolCI, nullptr, &descriptorPool));
+
+			frameBuffers.resize(count);
+			for (auto& frame : frameBuffers) {
+				VK_CHECK_RESULT(device->createBuffer(
+					VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+					VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+					instanceData.size() * sizeof(InstanceData),
+					&frame.instances.buffer,
+					&frame.instances.memory,
+					instanceData.data()));
+				VK_CHECK_RESULT(device->createBuffer(
+					VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+					VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+					jointMatrices.size() * sizeof(glm::mat4),
+					&frame.joints.buffer,
+					&frame.joints.memory,
+					jointMatrices.data()));
+				frame.dataVersion = dataVersion;
+
+				VkDescriptorSetAllocateInfo descriptorSetAllocInfo = vks::initializers::descriptorSetAllocateInfo(descriptorPool, &descriptorSetLayout, 1);
+				VK_CHECK_RESULT(vkAllocateDescriptorSets(device->logicalDevice, &descriptorSetAllocInfo, &frame.descriptorSet));
+				VkDescriptorBufferInfo instanceDescriptor = { frame.instances.buffer, 0, VK_WHOLE_SIZE };
+				VkDescriptorBufferInfo jointDescriptor = { frame.joints.buffer, 0, VK_WHOLE_SIZE };
+				std::vector<VkWriteDescriptorSet> writeDescriptorSets = {
+					vks::initializers::writeDescriptorSet(frame.descriptorSet, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 0, &instanceDescriptor),
+					vks::initializers::writeDescriptorSet(frame.descriptorSet, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, &jointDescriptor),
+				};
+				vkUpdateDescriptorSets(device->logicalDevice, static_cast<uint32_t>(writeDescriptorSets.size()), writeDescriptorSets.data(), 0, nullptr);
+			}
+		}
+
+		/**
+		* Copy the instance data and joint matrices to a frame's buffers if they have changed since that frame was last updated
+		* Has to be called once the GPU has finished the frame's previous use of the buffers
+		*
+		* @param frameIndex Frame whose buffers are updated
+		*/
+		void updateFrame(uint32_t frameIndex)
+		{
+			FrameBuffers& frame = frameBuffers[frameIndex];
+			if (frame.dataVersion != dataVersion) {
+				memcpy(frame.instances.memory.mapped, instanceData.data(), instanceData.size() * sizeof(InstanceData));
+				memcpy(frame.joints.memory.mapped, jointMatrices.data(), jointMatrices.size() * sizeof(glm::mat4));
+				frame.dataVersion = dataVersion;
+			}
+		}
+
+		VkDescriptorSet getDescriptorSet(uint32_t frameIndex) const { return frameBuffers[frameIndex].descriptorSet; }
+
+		/*
+			Copy the current node transforms to the instance data
+		*/
+		void updateInstances()
+		{
+			InstanceData *instances = instanceData.data();
+			dataVersion++;
+			for (size_t i = 0; i < instanceNodes.size(); i++) {
+				const Mesh *mesh = instanceNodes[i]->mesh;
+				instances[i].matrix = mesh->matrix;
+				instances[i].jointOffset = mesh->jointOffset;
+				instances[i].jointCount = mesh->jointCount;
+			}
+		}
+
+		/*
+			Update the joint matrices of all skinned meshes whose node or joints have changed
+			Node world matrices have to be up to date, skins are distributed across the workers of threadPool if one is passed
+		*/
+		void updateJoints(vks::ThreadPool *threadPool = nullptr)
+		{
+			glm::mat4 *joints = jointMatrices.data();
+			dataVersion++;
+			auto skinNodes = [this, joints](uint32_t begin, uint32_t end) {
+				for (uint32_t i = begin; i < end; i++) {
+					const Node *node = skinnedNodes[i];
+					const Skin *skin = node->skin;
+					bool changed = node->changed;
+					for (size_t j = 0; j < skin->joints.size() && !changed; j++) {
+						changed = skin->joints[j]->changed;
+					}
+					if (!changed) {
+						continue;
+					}
+					const glm::mat4 inverseTransform = glm::inverse(node->worldMatrix);
+					glm::mat4 *nodeJoints = joints + node->mesh->jointOffset;
+					for (size_t j = 0; j < skin->joints.size(); j++) {
+						glm::mat4 jointMatrix;
+						multiplyMatrices(skin->joints[j]->worldMatrix, skin->inverseBindMatrices[j], jointMatrix);
+						multiplyMatrices(inverseTransform, jointMatrix, nodeJoints[j]);
+					}
 				}
+			};
+			const uint32_t skinCount = static_cast<uint32_t>(skinnedNodes.size());
+			if (threadPool && skinCount > skinBatchSize) {
+				threadPool->parallelFor(skinCount, skinBatchSize, skinNodes);
+			} else {
+				skinNodes(0, skinCount);
 			}
-			for (auto& child : node->children) {
-				drawNode(child, commandBuffer);
+		}
+
+		uint32_t getDrawCount() const { return static_cast<uint32_t>(drawBatches.size()); }
+		uint32_t getInstanceCount() const { return static_cast<uint32_t>(instanceNodes.size()); }
+
+		/**
+		* Write one indirect draw command per batch and the indices of the batch's visible instances
+		*
+		* @param commands Destination for getDrawCount() draw commands (e.g. a mapped indirect buffer)
+		* @param instanceIndices Destination for getInstanceCount() instance indices, visible instances are compacted at the start of each batch's range
+		* @param viewProjection Matrix transforming model positions into clip space
+		* @param frustumCulling Skip instances whose bounding sphere is outside of the frustum
+		*
+		* @return Number of visible instances
+		*/
+		uint32_t updateDrawCommands(VkDrawIndexedIndirectCommand *commands, uint32_t *instanceIndices, const glm::mat4 &viewProjection, bool frustumCulling = true)
+		{
+			vks::Frustum frustum;
+			frustum.update(viewProjection);
+			uint32_t visibleCount = 0;
+			for (size_t i = 0; i < drawBatches.size(); i++) {
+				const DrawBatch &batch = drawBatches[i];
+				VkDrawIndexedIndirectCommand &command = commands[i];
+				command.indexCount = batch.indexCount;
+				command.firstIndex = batch.firstIndex;
+				command.vertexOffset = 0;
+				// Without support for a first instance in indirect draws, drawIndirect offsets the instance index buffer per batch instead
+				command.firstInstance = device->enabledFeatures.drawIndirectFirstInstance ? batch.firstInstance : 0;
+				command.instanceCount = 0;
+				for (uint32_t j = batch.firstInstance; j < batch.firstInstance + batch.instanceCount; j++) {
+					if (frustumCulling) {
+						const glm::mat4 &matrix = instanceNodes[j]->mesh->matrix;
+						const float scale = std::max(glm::length(glm::vec3(matrix[0])), std::max(glm::length(glm::vec3(matrix[1])), glm::length(glm::vec3(matrix[2]))));
+						if (!frustum.checkSphere(glm::vec3(matrix * glm::vec4(batch.center, 1.0f)), batch.radius * scale)) {
+							continue;
+						}
+					}
+					instanceIndices[batch.firstInstance + command.instanceCount] = j;
+					command.instanceCount++;
+				}
+				visibleCount += command.instanceCount;
 			}
+			return visibleCount;
 		}
 
+		/*
+			Draw all batches without instance data, for pipelines that don't read the instance buffer (all instances are drawn at the same position)
+		*/
 		void draw(VkCommandBuffer commandBuffer)
 		{
 			const VkDeviceSize offsets[1] = { 0 };
 			vkCmdBindVertexBuffers(commandBuffer, 0, 1, &vertices.buffer, offsets);
 			vkCmdBindIndexBuffer(commandBuffer, indices.buffer, 0, VK_INDEX_TYPE_UINT32);
-			for (auto& node : nodes) {
-				drawNode(node, commandBuffer);
+			for (auto& batch : drawBatches) {
+				vkCmdDrawIndexed(commandBuffer, batch.indexCount, batch.instanceCount, batch.firstIndex, 0, 0);
+			}
+			VKS_COUNTER_ADD("Draw calls recorded", drawBatches.size());
+		}
+
+		/**
+		* Draw the batches through indirect draw commands
+		* The instance index is passed as a per instance vertex attribute (binding 1), the vertex shader uses it to look up the instance data
+		*
+		* @param commandBuffer Command buffer to record to
+		* @param drawBuffer Buffer with getDrawCount() draw commands written by updateDrawCommands, VK_NULL_HANDLE draws all instances
+		* @param drawOffset Offset of the draw commands in drawBuffer
+		* @param instanceIndexBuffer Buffer with the instance indices written by updateDrawCommands
+		* @param instanceIndexOffset Offset of the instance indices in instanceIndexBuffer
+		*/
+		void drawIndirect(VkCommandBuffer commandBuffer, VkBuffer drawBuffer = VK_NULL_HANDLE, VkDeviceSize drawOffset = 0, VkBuffer instanceIndices = VK_NULL_HANDLE, VkDeviceSize instanceIndexOffset = 0)
+		{
+			if (drawBatches.empty()) {
+				return;
+			}
+			if (drawBuffer == VK_NULL_HANDLE) {
+				drawBuffer = drawCommandBuffer.buffer;
+				drawOffset = 0;
+				instanceIndices = instanceIndexBuffer.buffer;
+				instanceIndexOffset = 0;
+			}
+			const VkBuffer vertexBuffers[2] = { vertices.buffer, instanceIndices };
+			const VkDeviceSize offsets[2] = { 0, instanceIndexOffset };
+			vkCmdBindVertexBuffers(commandBuffer, 0, 2, vertexBuffers, offsets);
+			vkCmdBindIndexBuffer(commandBuffer, indices.buffer, 0, VK_INDEX_TYPE_UINT32);
+			const uint32_t stride = sizeof(VkDrawIndexedIndirectCommand);
+			if (!device->enabledFeatures.drawIndirectFirstInstance) {
+				for (uint32_t i = 0; i < getDrawCount(); i++) {
+					const VkDeviceSize offset = instanceIndexOffset + drawBatches[i].firstInstance * sizeof(uint32_t);
+					vkCmdBindVertexBuffers(commandBuffer, 1, 1, &instanceIndices, &offset);
+					vkCmdDrawIndexedIndirect(commandBuffer, drawBuffer, drawOffset + i * stride, 1, stride);
+				}
+				VKS_COUNTER_ADD("Draw calls recorded", getDrawCount());
+			} else if (device->enabledFeatures.multiDrawIndirect) {
+				vkCmdDrawIndexedIndirect(commandBuffer, drawBuffer, drawOffset, getDrawCount(), stride);
+				VKS_COUNTER_ADD("Draw calls recorded", 1);
+			} else {
+				for (uint32_t i = 0; i < getDrawCount(); i++) {
+					vkCmdDrawIndexedIndirect(commandBuffer, drawBuffer, drawOffset + i * stride, 1, stride);
+				}
+				VKS_COUNTER_ADD("Draw calls recorded", getDrawCount());
 			}
 		}
 
@@ -1135,7 +1669,12 @@ namespace vkglTF
 			dimensions.radius = glm::distance(dimensions.min, dimensions.max) / 2.0f;
 		}
 
-		void updateAnimation(uint32_t index, float time) 
+		/**
+		* Apply an animation at the given time and update the world matrices, skins and instances of all affected nodes
+		*
+		* @param threadPool Optional thread pool the joint matrices of the skins are computed on
+		*/
+		void updateAnimation(uint32_t index, float time, vks::ThreadPool *threadPool = nullptr) 
 		{
 			if (index > static_cast<uint32_t>(animations.size()) - 1) {
 				std::cout << "No animation with index " << index << std::endl;
@@ -1180,6 +1719,7 @@ namespace vkglTF
 								break;
 							}
 							}
+							channel.node->dirty = true;
 							updated = true;
 						}
 					}
@@ -1189,6 +1729,8 @@ namespace vkglTF
 				for (auto &node : nodes) {
 					node->update();
 				}
+				updateJoints(threadPool);
+				updateInstances();
 			}
 		}
 
@@ -1219,29 +1761,5 @@ namespace vkglTF
 			}
 			return nodeFound;
 		}
-
-		void prepareNodeDescriptor(vkglTF::Node *node, VkDescriptorSetLayout descriptorSetLayout) {
-			if (node->mesh) {
-				VkDescriptorSetAllocateInfo descriptorSetAllocInfo{};
-				descriptorSetAllocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-				descriptorSetAllocInfo.descriptorPool = descriptorPool;
-				descriptorSetAllocInfo.pSetLayouts = &descriptorSetLayout;
-				descriptorSetAllocInfo.descriptorSetCount = 1;
-				VK_CHECK_RESULT(vkAllocateDescriptorSets(device->logicalDevice, &descriptorSetAllocInfo, &node->mesh->uniformBuffer.descriptorSet));
-
-				VkWriteDescriptorSet writeDescriptorSet{};
-				writeDescriptorSet.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-				writeDescriptorSet.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-				writeDescriptorSet.descriptorCount = 1;
-				writeDescriptorSet.dstSet = node->mesh->uniformBuffer.descriptorSet;
-				writeDescriptorSet.dstBinding = 0;
-				writeDescriptorSet.pBufferInfo = &node->mesh->uniformBuffer.descriptor;
-
-				vkUpdateDescriptorSets(device->logicalDevice, 1, &writeDescriptorSet, 0, nullptr);
-			}
-			for (auto& child : node->children) {
-				prepareNodeDescriptor(child, descriptorSetLayout);
-			}
-		}
 	};
 }
\ No newline at end of file
@@ -13,13 +13,60 @@
 #include <functional>
 #include <chrono>
 #include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <numeric>
+#include <utility>
+#include <cmath>
+#include <assert.h>
+#include <glm/glm.hpp>
 
 namespace vks
 {
 	class Benchmark {
+	public:
+		/** @brief Camera pose at a point in time of a camera path */
+		struct CameraKey {
+			double time;
+			glm::vec3 position;
+			glm::vec3 rotation;
+		};
+
+		struct Statistics {
+			double min = 0.0;
+			double avg = 0.0;
+			double p50 = 0.0;
+			double p95 = 0.0;
+			double p99 = 0.0;
+			double max = 0.0;
+		};
+
 	private:
 		FILE *stream;
 		VkPhysicalDeviceProperties deviceProps;
+		bool measuring = false;
+
+		// Nearest rank percentile of sorted values
+		static double percentile(const std::vector<double>& sorted, double p) {
+			const size_t rank = static_cast<size_t>(std::ceil(p / 100.0 * sorted.size()));
+			return sorted[std::min(std::max(rank, (size_t)1), sorted.size()) - 1];
+		}
+
+		static std::string escapeJson(const std::string& value) {
+			std::string escaped;
+			for (char c : value) {
+				if (c == '"' || c == '\\') {
+					escaped += '\\';
+				}
+				escaped += c;
+			}
+			return escaped;
+		}
+
+		static void writeJson(std::ostream& stream, const Statistics& statistics) {
+			stream << "{ \"min\": " << statistics.min << ", \"avg\": " << statistics.avg << ", \"p50\": " << statistics.p50 << ", \"p95\": " << statistics.p95 << ", \"p99\": " << statistics.p99 << ", \"max\": " << statistics.max << " }";
+		}
+
 	public:
 		bool active = false;
 		bool outputFrameTimes = false;
@@ -27,10 +74,123 @@ namespace vks
 		uint32_t duration = 10;
 		std::vector<double> frameTimes;
 		std::string filename = "";
+		// Machine readable results, written in addition to the CSV file
+		std::string jsonFilename = "";
 
 		double runtime = 0.0;
 		uint32_t frameCount = 0;
 
+		// GPU time of each frame with results and the times of the profiled passes in ms
+		std::vector<double> gpuFrameTimes;
+		std::vector<std::string> passNames;
+		std::vector<std::vector<double>> passTimes;
+
+		/*
+			Camera path replayed by the benchmark
+			Frames advance the path by a fixed time step instead of the measured frame time, so every run renders the same sequence of frames
+		*/
+		std::vector<CameraKey> cameraPath;
+		double cameraPathStep = 1.0 / 60.0;
+		// Called with the camera pose before each frame if a camera path has been loaded
+		std::function<void(const glm::vec3& position, const glm::vec3& rotation)> setCamera;
+
+		// Settings the run was made with (e.g. feature toggles), written to the JSON results to tell runs apart
+		std::vector<std::pair<std::string, std::string>> settings;
+
+		/**
+		* Load a camera path from a text file, each line is either
+		* "key <time> <position xyz> <rotation xyz>" for a key frame the camera moves through (times in seconds, ascending)
+		* "view <seconds> <position xyz> <rotation xyz>" for a fixed viewpoint rendered for the given time after the previous keys
+		* Empty lines and lines starting with # are ignored
+		*/
+		bool loadCameraPath(const std::string& filename) {
+			std::ifstream file(filename);
+			if (!file.is_open()) {
+				std::cerr << "Could not open camera path \"" << filename << "\"" << std::endl;
+				return false;
+			}
+			cameraPath.clear();
+			std::string line;
+			while (std::getline(file, line)) {
+				std::istringstream stream(line);
+				std::string type;
+				if (!(stream >> type) || type[0] == '#') {
+					continue;
+				}
+				double time;
+				CameraKey key;
+				if (!(stream >> time >> key.position.x >> key.position.y >> key.position.z >> key.rotation.x >> key.rotation.y >> key.rotation.z) || (type != "key" && type != "view")) {
+					std::cerr << "Invalid camera path entry \"" << line << "\"" << std::endl;
+					cameraPath.clear();
+					return false;
+				}
+				const double end = cameraPath.empty() ? 0.0 : cameraPath.back().time;
+				if (type == "key") {
+					key.time = std::max(time, end);
+					cameraPath.push_back(key);
+				} else {
+					// Both keys of a viewpoint use the same pose, with a single step in between to jump there
+					key.time = cameraPath.empty() ? 0.0 : end + cameraPathStep;
+					cameraPath.push_back(key);
+					key.time += time;
+					cameraPath.push_back(key);
+				}
+			}
+			return !cameraPath.empty();
+		}
+
+		/** @brief Camera pose of the path at the given time, linearly interpolated between the surrounding keys */
+		void getCameraPose(double time, glm::vec3& position, glm::vec3& rotation) const {
+			assert(!cameraPath.empty());
+			auto next = std::find_if(cameraPath.begin(), cameraPath.end(), [time](const CameraKey& key) { return key.time > time; });
+			if (next == cameraPath.begin() || next == cameraPath.end()) {
+				const CameraKey& key = (next == cameraPath.end()) ? cameraPath.back() : cameraPath.front();
+				position = key.position;
+				rotation = key.rotation;
+				return;
+			}
+			const CameraKey& prev = *(next - 1);
+			const float t = static_cast<float>((time - prev.time) / (next->time - prev.time));
+			position = glm::mix(prev.position, next->position, t);
+			rotation = glm::mix(prev.rotation, next->rotation, t);
+		}
+
+		/** @brief Add the GPU times of a frame, times added during the warm up are ignored */
+		void addGpuTimes(double frameTime, const std::vector<std::string>& names, const std::vector<double>& times) {
+			if (!measuring) {
+				return;
+			}
+			if (passNames.empty()) {
+				passNames = names;
+			}
+			assert(names.size() == passNames.size() && times.size() == passNames.size());
+			gpuFrameTimes.push_back(frameTime);
+			passTimes.push_back(times);
+		}
+
+		static Statistics getStatistics(std::vector<double> values) {
+			Statistics statistics;
+			if (values.empty()) {
+				return statistics;
+			}
+			std::sort(values.begin(), values.end());
+			statistics.min = values.front();
+			statistics.max = values.back();
+			statistics.avg = std::accumulate(values.begin(), values.end(), 0.0) / (double)values.size();
+			statistics.p50 = percentile(values, 50.0);
+			statistics.p95 = percentile(values, 95.0);
+			statistics.p99 = percentile(values, 99.0);
+			return statistics;
+		}
+
+		Statistics getPassStatistics(size_t pass) const {
+			std::vector<double> values;
+			for (auto& times : passTimes) {
+				values.push_back(times[pass]);
+			}
+			return getStatistics(values);
+		}
+
 		void run(std::function<void()> renderFunc, VkPhysicalDeviceProperties deviceProps) {
 			active = true;
 			this->deviceProps = deviceProps;
@@ -41,8 +201,15 @@ namespace vks
 #endif
 			std::cout << std::fixed << std::setprecision(3);
 
+			const bool replayPath = !cameraPath.empty() && setCamera;
+			glm::vec3 position, rotation;
+
 			// Warm up phase to get more stable frame rates
 			{
+				if (replayPath) {
+					getCameraPose(0.0, position, rotation);
+					setCamera(position, rotation);
+				}
 				double tMeasured = 0.0;
 				while (tMeasured < (warmup * 1000)) {
 					auto tStart = std::chrono::high_resolution_clock::now();
@@ -52,9 +219,14 @@ namespace vks
 				};
 			}
 
-			// Benchmark phase
+			// Benchmark phase, runs for the length of the camera path if there is one
 			{
-				while (runtime < (duration * 1000.0)) {
+				measuring = true;
+				while (replayPath ? (frameCount * cameraPathStep <= cameraPath.back().time) : (runtime < (duration * 1000.0))) {
+					if (replayPath) {
+						getCameraPose(frameCount * cameraPathStep, position, rotation);
+						setCamera(position, rotation);
+					}
 					auto tStart = std::chrono::high_resolution_clock::now();
 					renderFunc();
 					auto tDiff = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - tStart).count();
@@ -62,11 +234,18 @@ namespace vks
 					frameTimes.push_back(tDiff);
 					frameCount++;
 				};
+				measuring = false;
+				const Statistics cpu = getStatistics(frameTimes);
 				std::cout << "Benchmark finished" << std::endl;
 				std::cout << "device : " << deviceProps.deviceName << " (driver version: " << deviceProps.driverVersion << ")" << std::endl;
 				std::cout << "runtime: " << (runtime / 1000.0) << std::endl;
 				std::cout << "frames : " << frameCount << std::endl;
 				std::cout << "fps    : " << frameCount / (runtime / 1000.0) << std::endl;
+				std::cout << "cpu    : p50 " << cpu.p50 << " ms, p95 " << cpu.p95 << " ms, p99 " << cpu.p99 << " ms" << std::endl;
+				if (!gpuFrameTimes.empty()) {
+					const Statistics gpu = getStatistics(gpuFrameTimes);
+					std::cout << "gpu    : p50 " << gpu.p50 << " ms, p95 " << gpu.p95 << " ms, p99 " << gpu.p99 << " ms" << std::endl;
+				}
 			}
 		}
 
@@ -75,20 +254,43 @@ namespace vks
 			if (result.is_open()) {
 				result << std::fixed << std::setprecision(4);
 
-				result << "device,driverversion,duration (ms),frames,fps" << std::endl;
-				result << deviceProps.deviceName << "," << deviceProps.driverVersion << "," << runtime << "," << frameCount << "," << frameCount / (runtime / 1000.0) << std::endl;
+				const Statistics cpu = getStatistics(frameTimes);
+				const Statistics gpu = getStatistics(gpuFrameTimes);
+				result << "device,driverversion,duration (ms),frames,fps,cpu p50 (ms),cpu p95 (ms),cpu p99 (ms),gpu p50 (ms),gpu p95 (ms),gpu p99 (ms)" << std::endl;
+				result << deviceProps.deviceName << "," << deviceProps.driverVersion << "," << runtime << "," << frameCount << "," << frameCount / (runtime / 1000.0) << ","
+					<< cpu.p50 << "," << cpu.p95 << "," << cpu.p99 << "," << gpu.p50 << "," << gpu.p95 << "," << gpu.p99 << std::endl;
+
+				if (!passTimes.empty()) {
+					result << std::endl << "pass,gpu avg (ms),gpu min (ms),gpu max (ms),gpu p50 (ms),gpu p95 (ms),gpu p99 (ms)" << std::endl;
+					for (size_t i = 0; i < passNames.size(); i++) {
+						const Statistics pass = getPassStatistics(i);
+						result << passNames[i] << "," << pass.avg << "," << pass.min << "," << pass.max << "," << pass.p50 << "," << pass.p95 << "," << pass.p99 << std::endl;
+					}
+				}
 
 				if (outputFrameTimes) {
 					result << std::endl << "frame,ms" << std::endl;
 					for (size_t i = 0; i < frameTimes.size(); i++) {
 						result << i << "," << frameTimes[i] << std::endl;
 					}
-					double tMin = *std::min_element(frameTimes.begin(), frameTimes.end());
-					double tMax = *std::max_element(frameTimes.begin(), frameTimes.end());
-					double tAvg = std::accumulate(frameTimes.begin(), frameTimes.end(), 0.0) / (double)frameTimes.size();
-					std::cout << "best   : " << (1000.0 / tMin) << " fps (" << tMin << " ms)" << std::endl;
-					std::cout << "worst  : " << (1000.0 / tMax) << " fps (" << tMax << " ms)" << std::endl;
-					std::cout << "avg    : " << (1000.0 / tAvg) << " fps (" << tAvg << " ms)" << std::endl;
+					if (!passTimes.empty()) {
+						// GPU results arrive a few frames late, so these are numbered separately
+						result << std::endl << "gpu frame";
+						for (auto& name : passNames) {
+							result << "," << name << " (ms)";
+						}
+						result << std::endl;
+						for (size_t i = 0; i < passTimes.size(); i++) {
+							result << i;
+							for (auto time : passTimes[i]) {
+								result << "," << time;
+							}
+							result << std::endl;
+						}
+					}
+					std::cout << "best   : " << (1000.0 / cpu.min) << " fps (" << cpu.min << " ms)" << std::endl;
+					std::cout << "worst  : " << (1000.0 / cpu.max) << " fps (" << cpu.max << " ms)" << std::endl;
+					std::cout << "avg    : " << (1000.0 / cpu.avg) << " fps (" << cpu.avg << " ms)" << std::endl;
 					std::cout << std::endl;
 				}
 
@@ -98,5 +300,37 @@ namespace vks
 #endif
 			}
 		}
+
+		/** @brief Write the results as JSON, for comparing runs across devices and builds */
+		void saveJsonResults() {
+			std::ofstream result(jsonFilename, std::ios::out);
+			if (!result.is_open()) {
+				std::cerr << "Could not write benchmark results to \"" << jsonFilename << "\"" << std::endl;
+				return;
+			}
+			result << std::fixed << std::setprecision(4);
+			result << "{" << std::endl;
+			result << "\t\"device\": \"" << escapeJson(deviceProps.deviceName) << "\"," << std::endl;
+			result << "\t\"driverVersion\": " << deviceProps.driverVersion << "," << std::endl;
+			result << "\t\"settings\": {";
+			for (size_t i = 0; i < settings.size(); i++) {
+				result << (i > 0 ? ", " : " ") << "\"" << escapeJson(settings[i].first) << "\": \"" << escapeJson(settings[i].second) << "\"";
+			}
+			result << " }," << std::endl;
+			result << "\t\"cameraPath\": " << (cameraPath.empty() ? "false" : "true") << "," << std::endl;
+			result << "\t\"runtime\": " << runtime << "," << std::endl;
+			result << "\t\"frames\": " << frameCount << "," << std::endl;
+			result << "\t\"fps\": " << frameCount / (runtime / 1000.0) << "," << std::endl;
+			result << "\t\"cpu\": ";
+			writeJson(result, getStatistics(frameTimes));
+			result << "," << std::endl << "\t\"gpu\": ";
+			writeJson(result, getStatistics(gpuFrameTimes));
+			result << "," << std::endl << "\t\"passes\": {";
+			for (size_t i = 0; i < passNames.size(); i++) {
+				result << (i > 0 ? "," : "") << std::endl << "\t\t\"" << escapeJson(passNames[i]) << "\": ";
+				writeJson(result, getPassStatistics(i));
+			}
+			result << std::endl << "\t}" << std::endl << "}" << std::endl;
+		}
 	};
-}
\ No newline at end of file
+}
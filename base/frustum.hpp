@@ -6,8 +6,11 @@
 * This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
 */
 
+#pragma once
+
 #include <array>
 #include <math.h>
+#include <float.h>
 #include <glm/glm.hpp>
 
 namespace vks
@@ -68,5 +71,72 @@ namespace vks
 			}
 			return true;
 		}
+
+		// Test an axis aligned bounding box against the frustum planes
+		// If ignoreDepth is set, the near and far planes are skipped (e.g. for passes using depth clamp)
+		bool checkBox(const glm::vec3 &min, const glm::vec3 &max, bool ignoreDepth = false)
+		{
+			const size_t planeCount = ignoreDepth ? BACK : planes.size();
+			for (size_t i = 0; i < planeCount; i++)
+			{
+				// Only the corner furthest along the plane normal needs to be checked
+				const glm::vec3 corner = glm::vec3(
+					planes[i].x >= 0.0f ? max.x : min.x,
+					planes[i].y >= 0.0f ? max.y : min.y,
+					planes[i].z >= 0.0f ? max.z : min.z);
+				if ((planes[i].x * corner.x) + (planes[i].y * corner.y) + (planes[i].z * corner.z) + planes[i].w < 0.0f)
+				{
+					return false;
+				}
+			}
+			return true;
+		}
+
+		/**
+		* Get the screen rectangle covered by an axis aligned bounding box
+		*
+		* @param viewProjection Matrix transforming the box into clip space, with a depth range of [0, 1]
+		* @param rect Bounds of the box in normalized device coordinates clamped to the screen (min x, min y, max x, max y)
+		*
+		* @return False if the box is outside of the screen or behind the viewer
+		*/
+		static bool getScreenRect(const glm::mat4 &viewProjection, const glm::vec3 &min, const glm::vec3 &max, glm::vec4 &rect)
+		{
+			std::array<glm::vec4, 8> corners;
+			for (uint32_t i = 0; i < 8; i++)
+			{
+				corners[i] = viewProjection * glm::vec4((i & 1) ? max.x : min.x, (i & 2) ? max.y : min.y, (i & 4) ? max.z : min.z, 1.0f);
+			}
+			glm::vec2 lower(FLT_MAX);
+			glm::vec2 upper(-FLT_MAX);
+			auto addPoint = [&lower, &upper](const glm::vec4 &clip) {
+				const glm::vec2 ndc = glm::vec2(clip) / clip.w;
+				lower = glm::min(lower, ndc);
+				upper = glm::max(upper, ndc);
+			};
+			// Corners behind the near plane would project to the wrong side, so edges crossing it are clipped
+			for (uint32_t i = 0; i < 8; i++)
+			{
+				if (corners[i].z >= 0.0f)
+				{
+					addPoint(corners[i]);
+				}
+				for (uint32_t axis = 1; axis < 8; axis <<= 1)
+				{
+					const uint32_t j = i | axis;
+					if (j != i && (corners[i].z >= 0.0f) != (corners[j].z >= 0.0f))
+					{
+						const float t = corners[i].z / (corners[i].z - corners[j].z);
+						addPoint(corners[i] + (corners[j] - corners[i]) * t);
+					}
+				}
+			}
+			if (lower.x > upper.x || lower.x > 1.0f || lower.y > 1.0f || upper.x < -1.0f || upper.y < -1.0f)
+			{
+				return false;
+			}
+			rect = glm::vec4(glm::max(lower, glm::vec2(-1.0f)), glm::min(upper, glm::vec2(1.0f)));
+			return true;
+		}
 	};
 }
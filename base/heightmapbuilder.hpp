@@ -0,0 +1,214 @@
+/*
+* Heightmap terrain mesh builder
+*
+* Samples a 16 bit heightmap into a grid of heights and normals, one row at a time
+* Rows are independent, so ranges of rows can be built in parallel
+*
+* Copyright (C) by Sascha Willems - www.saschawillems.de
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include <assert.h>
+#include <stdint.h>
+#include <glm/glm.hpp>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define VKS_HEIGHTMAP_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace vks
+{
+	// Provides the heights for builders that don't read them from a single block of memory (e.g. from the tiles of a tile file)
+	class HeightSource
+	{
+	public:
+		virtual ~HeightSource() {}
+		// 16 bit height at texel (x, y) of the full resolution height map
+		virtual uint16_t getHeight(uint32_t x, uint32_t y) const = 0;
+	};
+
+	class HeightMapBuilder
+	{
+	private:
+		const uint16_t* heightdata = nullptr;
+		const HeightSource* source = nullptr;
+		uint32_t dim;
+		uint32_t scale;
+		uint32_t patchsize;
+		float heightFactor;
+
+		/**
+		* Writes the heights of the grid columns [x0, x1) of row y to row[1..x1 - x0]
+		* row[0] and row[x1 - x0 + 1] get the neighbouring columns, so normals at the borders of a window match the ones of the full grid
+		*/
+		void fetchRow(uint32_t y, uint32_t x0, uint32_t x1, float* row) const
+		{
+			const uint32_t first = (x0 > 0) ? x0 - 1 : x0;
+			const uint32_t last = (x1 < patchsize) ? x1 + 1 : x1;
+			float* dst = row + 1 - (x0 - first);
+			uint32_t x = first;
+			if (source) {
+				for (; x < last; x++) {
+					dst[x - first] = source->getHeight(x * scale, y * scale) * heightFactor;
+				}
+			} else {
+				const uint16_t* src = heightdata + (size_t)y * scale * dim;
+#if defined(VKS_HEIGHTMAP_SSE2)
+				if (simd && scale == 1) {
+					// Contiguous samples, convert eight at a time
+					const __m128 factor = _mm_set1_ps(heightFactor);
+					const __m128i zero = _mm_setzero_si128();
+					for (; x + 8 <= last; x += 8) {
+						__m128i samples = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + x));
+						__m128 lo = _mm_cvtepi32_ps(_mm_unpacklo_epi16(samples, zero));
+						__m128 hi = _mm_cvtepi32_ps(_mm_unpackhi_epi16(samples, zero));
+						_mm_storeu_ps(dst + x - first, _mm_mul_ps(lo, factor));
+						_mm_storeu_ps(dst + x - first + 4, _mm_mul_ps(hi, factor));
+					}
+				}
+#endif
+				for (; x < last; x++) {
+					dst[x - first] = src[(size_t)x * scale] * heightFactor;
+				}
+			}
+			// Linear extrapolation at the borders of the grid, so central differences match one-sided differences scaled by two
+			const uint32_t count = x1 - x0;
+			if (x0 == 0) {
+				row[0] = 2.0f * row[1] - row[2];
+			}
+			if (x1 == patchsize) {
+				row[count + 1] = 2.0f * row[count] - row[count - 1];
+			}
+		}
+
+		// Extrapolated row outside of the grid
+		void extrapolateRow(const float* edge, const float* inner, uint32_t count, float* row) const
+		{
+			for (uint32_t x = 0; x < count + 2; x++) {
+				row[x] = 2.0f * edge[x] - inner[x];
+			}
+		}
+
+		// Heights and normals of one row from the rows above, at and below it
+		void computeRow(const float* above, const float* center, const float* below, uint32_t count, float* heights, glm::vec3* normals) const
+		{
+			uint32_t x = 0;
+#if defined(VKS_HEIGHTMAP_SSE2)
+			if (simd) {
+				const __m128 one = _mm_set1_ps(1.0f);
+				const __m128 signMask = _mm_set1_ps(-0.0f);
+				for (; x + 4 <= count; x += 4) {
+					__m128 h = _mm_loadu_ps(center + x + 1);
+					__m128 dx = _mm_sub_ps(_mm_loadu_ps(center + x + 2), _mm_loadu_ps(center + x));
+					__m128 dy = _mm_sub_ps(_mm_loadu_ps(below + x + 1), _mm_loadu_ps(above + x + 1));
+					// normalize(cross((1, 0, dx), (0, 1, dy))) = (-dx, -dy, 1) / length
+					__m128 lengthSq = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), one);
+					__m128 invLength = _mm_div_ps(one, _mm_sqrt_ps(lengthSq));
+					alignas(16) float nx[4], ny[4], nz[4];
+					_mm_store_ps(nx, _mm_xor_ps(_mm_mul_ps(dx, invLength), signMask));
+					_mm_store_ps(ny, _mm_xor_ps(_mm_mul_ps(dy, invLength), signMask));
+					_mm_store_ps(nz, invLength);
+					_mm_storeu_ps(heights + x, h);
+					for (uint32_t i = 0; i < 4; i++) {
+						normals[x + i] = glm::vec3(nx[i], ny[i], nz[i]);
+					}
+				}
+			}
+#endif
+			for (; x < count; x++) {
+				const float dx = center[x + 2] - center[x];
+				const float dy = below[x + 1] - above[x + 1];
+				heights[x] = center[x + 1];
+				normals[x] = glm::vec3(-dx, -dy, 1.0f) / std::sqrt(dx * dx + dy * dy + 1.0f);
+			}
+		}
+
+	public:
+		// Use SSE2 for converting heights and computing normals (if available)
+		bool simd = true;
+
+		HeightMapBuilder(const uint16_t* heightdata, uint32_t dim, uint32_t patchsize, float heightScale)
+		{
+			assert(patchsize >= 2 && patchsize <= dim);
+			this->heightdata = heightdata;
+			this->dim = dim;
+			this->scale = dim / patchsize;
+			this->patchsize = patchsize;
+			this->heightFactor = heightScale / 65535.0f;
+		}
+
+		// Heights are fetched from the source texel by texel instead of from memory (no SIMD conversion)
+		HeightMapBuilder(const HeightSource* source, uint32_t dim, uint32_t patchsize, float heightScale) : HeightMapBuilder(static_cast<const uint16_t*>(nullptr), dim, patchsize, heightScale)
+		{
+			this->source = source;
+		}
+
+		/**
+		* Build heights and normals for the grid rows [y0, y1)
+		*
+		* @param heights Destination for (y1 - y0) * patchsize heights, row by row
+		* @param normals Destination for (y1 - y0) * patchsize normals, row by row, nullptr to only build the heights
+		*/
+		void build(uint32_t y0, uint32_t y1, float* heights, glm::vec3* normals) const
+		{
+			build(0, patchsize, y0, y1, heights, normals);
+		}
+
+		/**
+		* Build heights and normals for the window of grid columns [x0, x1) and rows [y0, y1), only the heights inside and around the window are read
+		*
+		* @param heights Destination for (x1 - x0) * (y1 - y0) heights, row by row
+		* @param normals Destination for (x1 - x0) * (y1 - y0) normals, row by row, nullptr to only build the heights
+		*/
+		void build(uint32_t x0, uint32_t x1, uint32_t y0, uint32_t y1, float* heights, glm::vec3* normals) const
+		{
+			assert(y0 < y1 && y1 <= patchsize);
+			assert(x0 + 2 <= x1 && x1 <= patchsize);
+			const uint32_t count = x1 - x0;
+			const uint32_t rowSize = count + 2;
+			if (!normals) {
+				// Heights don't depend on the neighbouring rows
+				std::vector<float> row(rowSize);
+				for (uint32_t y = y0; y < y1; y++) {
+					fetchRow(y, x0, x1, row.data());
+					std::copy(row.begin() + 1, row.begin() + 1 + count, heights + (size_t)(y - y0) * count);
+				}
+				return;
+			}
+			// Sliding window of the rows above, at and below the current row
+			std::vector<float> rows(rowSize * 3);
+			float* above = rows.data();
+			float* center = above + rowSize;
+			float* below = center + rowSize;
+
+			fetchRow(y0, x0, x1, center);
+			if (y0 > 0) {
+				fetchRow(y0 - 1, x0, x1, above);
+			} else {
+				fetchRow(1, x0, x1, below);
+				extrapolateRow(center, below, count, above);
+			}
+			for (uint32_t y = y0; y < y1; y++) {
+				if (y + 1 < patchsize) {
+					fetchRow(y + 1, x0, x1, below);
+				} else {
+					extrapolateRow(center, above, count, below);
+				}
+				const size_t offset = (size_t)(y - y0) * count;
+				computeRow(above, center, below, count, heights + offset, normals + offset);
+				// Advance the window
+				float* recycled = above;
+				above = center;
+				center = below;
+				below = recycled;
+			}
+		}
+	};
+}
@@ -0,0 +1,389 @@
+/*
+* Min/max quadtree over the grid heights of a height map
+*
+* Level 0 stores the height range of each grid cell (the quad between four grid vertices), every following level halves the resolution
+* Ray casts descend the hierarchy front to back and intersect the bilinear surface of the cells they reach exactly
+* All queries are read only, so they can be issued from multiple threads at once
+*
+* Copyright (C) by Sascha Willems - www.saschawillems.de
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <float.h>
+#include <assert.h>
+#include <stdint.h>
+#include <glm/glm.hpp>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define VKS_HEIGHTMAP_QUADTREE_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace vks
+{
+	class HeightMapQuadtree
+	{
+	public:
+		struct RayHit {
+			// Distance along the ray in multiples of the ray's direction
+			float t;
+			glm::vec3 position;
+			glm::vec3 normal;
+		};
+
+	private:
+		struct Level {
+			uint32_t width;
+			uint32_t height;
+			// Minimum and maximum height of each node
+			std::vector<glm::vec2> ranges;
+		};
+		std::vector<Level> levels;
+		// Grid heights, row by row
+		std::vector<float> heights;
+		uint32_t size = 0;
+		// World space position of the first grid vertex and distance between grid vertices on the xz plane
+		glm::vec2 origin;
+		glm::vec2 spacing;
+
+		float gridHeight(uint32_t x, uint32_t y) const
+		{
+			return heights[x + (size_t)y * size];
+		}
+
+		// Cell containing a world space position (clamped to the grid) and the position within the cell
+		void locate(const glm::vec2 &pos, uint32_t &x, uint32_t &y, glm::vec2 &f) const
+		{
+			const glm::vec2 grid = glm::clamp((pos - origin) / spacing, glm::vec2(0.0f), glm::vec2((float)(size - 1)));
+			x = std::min(static_cast<uint32_t>(grid.x), size - 2);
+			y = std::min(static_cast<uint32_t>(grid.y), size - 2);
+			f = grid - glm::vec2((float)x, (float)y);
+		}
+
+		float bilinear(uint32_t x, uint32_t y, const glm::vec2 &f) const
+		{
+			const float h0 = glm::mix(gridHeight(x, y), gridHeight(x + 1, y), f.x);
+			const float h1 = glm::mix(gridHeight(x, y + 1), gridHeight(x + 1, y + 1), f.x);
+			return glm::mix(h0, h1, f.y);
+		}
+
+		// Normal of the bilinear surface, pointing away from the ground (the world's up axis is -y)
+		glm::vec3 bilinearNormal(uint32_t x, uint32_t y, const glm::vec2 &f) const
+		{
+			const float h00 = gridHeight(x, y);
+			const float h10 = gridHeight(x + 1, y);
+			const float h01 = gridHeight(x, y + 1);
+			const float h11 = gridHeight(x + 1, y + 1);
+			const float dx = glm::mix(h10 - h00, h11 - h01, f.y) / spacing.x;
+			const float dz = glm::mix(h01 - h00, h11 - h10, f.x) / spacing.y;
+			return glm::normalize(glm::vec3(dx, -1.0f, dz));
+		}
+
+		// Grid cells covered by a node
+		void nodeCells(uint32_t level, uint32_t x, uint32_t y, uint32_t &x0, uint32_t &y0, uint32_t &x1, uint32_t &y1) const
+		{
+			const uint32_t cells = 1u << level;
+			x0 = x * cells;
+			y0 = y * cells;
+			x1 = std::min(x0 + cells, levels[0].width);
+			y1 = std::min(y0 + cells, levels[0].height);
+		}
+
+		void accumulateRange(uint32_t level, uint32_t x, uint32_t y, uint32_t qx0, uint32_t qy0, uint32_t qx1, uint32_t qy1, glm::vec2 &range) const
+		{
+			uint32_t x0, y0, x1, y1;
+			nodeCells(level, x, y, x0, y0, x1, y1);
+			if (x1 <= qx0 || y1 <= qy0 || x0 >= qx1 || y0 >= qy1) {
+				return;
+			}
+			if (x0 >= qx0 && y0 >= qy0 && x1 <= qx1 && y1 <= qy1) {
+				const glm::vec2 &node = levels[level].ranges[x + y * levels[level].width];
+				range = glm::vec2(std::min(range.x, node.x), std::max(range.y, node.y));
+				return;
+			}
+			// Cells are either inside or outside of the query, so only nodes above level 0 get here
+			const Level &child = levels[level - 1];
+			for (uint32_t cy = y * 2; cy < std::min(y * 2 + 2, child.height); cy++) {
+				for (uint32_t cx = x * 2; cx < std::min(x * 2 + 2, child.width); cx++) {
+					accumulateRange(level - 1, cx, cy, qx0, qy0, qx1, qy1, range);
+				}
+			}
+		}
+
+		// Parameter range [t0, t1] in which a ray in grid space overlaps one axis of a box
+		static bool clipSlab(float origin, float direction, float lower, float upper, float &t0, float &t1)
+		{
+			if (std::abs(direction) < 1e-12f) {
+				return origin >= lower && origin <= upper;
+			}
+			float tNear = (lower - origin) / direction;
+			float tFar = (upper - origin) / direction;
+			if (tNear > tFar) {
+				std::swap(tNear, tFar);
+			}
+			t0 = std::max(t0, tNear);
+			t1 = std::min(t1, tFar);
+			return t0 <= t1;
+		}
+
+		/*
+			Intersect a ray in grid space with the bilinear surface of a cell within [t0, t1]
+			Along the ray, the surface height is a quadratic function of t, so the first crossing of the ray's height is a root of a quadratic
+			Rays starting below the surface (y greater than the height) hit at t0
+		*/
+		bool intersectCell(uint32_t x, uint32_t y, const glm::vec3 &o, const glm::vec3 &d, float t0, float t1, float &t) const
+		{
+			const float h00 = gridHeight(x, y);
+			const float a = gridHeight(x + 1, y) - h00;
+			const float b = gridHeight(x, y + 1) - h00;
+			const float c = h00 - gridHeight(x + 1, y) - gridHeight(x, y + 1) + gridHeight(x + 1, y + 1);
+			// Parameterized from the cell's entry point, which keeps the coefficients small for distant ray origins
+			const float u = o.x + d.x * t0 - (float)x;
+			const float v = o.z + d.z * t0 - (float)y;
+			const float py = o.y + d.y * t0;
+			// f(s) = ray height - surface height = A s^2 + B s + C
+			const float A = -c * d.x * d.z;
+			const float B = d.y - (a * d.x + b * d.z + c * (u * d.z + v * d.x));
+			const float C = py - (h00 + a * u + b * v + c * u * v);
+			if (C >= 0.0f) {
+				t = t0;
+				return true;
+			}
+			const float range = t1 - t0;
+			float s = FLT_MAX;
+			if (std::abs(A) < 1e-12f) {
+				if (B > 0.0f) {
+					s = -C / B;
+				}
+			} else {
+				const float discriminant = B * B - 4.0f * A * C;
+				if (discriminant < 0.0f) {
+					return false;
+				}
+				// Avoids the cancellation of the textbook formula for nearly linear height changes (small A)
+				const float q = -0.5f * (B + (B >= 0.0f ? 1.0f : -1.0f) * std::sqrt(discriminant));
+				const float s0 = q / A;
+				const float s1 = (q != 0.0f) ? C / q : -1.0f;
+				for (float candidate : { s0, s1 }) {
+					if (candidate >= 0.0f && candidate < s) {
+						s = candidate;
+					}
+				}
+			}
+			if (s > range) {
+				return false;
+			}
+			t = t0 + s;
+			return true;
+		}
+
+	public:
+		// Use SSE2 for batched height queries (if available)
+		bool simd = true;
+
+		/**
+		* Build the hierarchy from a square grid of heights
+		*
+		* @param heights World space heights (y) of size * size grid vertices, row by row
+		* @param origin World space xz position of the first grid vertex
+		* @param spacing World space distance between neighbouring grid vertices along x and z
+		*/
+		void build(const float *heights, uint32_t size, const glm::vec2 &origin, const glm::vec2 &spacing)
+		{
+			assert(size >= 2);
+			this->heights.assign(heights, heights + (size_t)size * size);
+			this->size = size;
+			this->origin = origin;
+			this->spacing = spacing;
+
+			levels.clear();
+			Level cells;
+			cells.width = cells.height = size - 1;
+			cells.ranges.resize((size_t)cells.width * cells.height);
+			for (uint32_t y = 0; y < cells.height; y++) {
+				for (uint32_t x = 0; x < cells.width; x++) {
+					const float h00 = gridHeight(x, y), h10 = gridHeight(x + 1, y), h01 = gridHeight(x, y + 1), h11 = gridHeight(x + 1, y + 1);
+					cells.ranges[x + y * cells.width] = glm::vec2(std::min(std::min(h00, h10), std::min(h01, h11)), std::max(std::max(h00, h10), std::max(h01, h11)));
+				}
+			}
+			levels.push_back(cells);
+
+			while (levels.back().width > 1 || levels.back().height > 1) {
+				const Level &child = levels.back();
+				Level level;
+				level.width = (child.width + 1) / 2;
+				level.height = (child.height + 1) / 2;
+				level.ranges.assign((size_t)level.width * level.height, glm::vec2(FLT_MAX, -FLT_MAX));
+				for (uint32_t y = 0; y < child.height; y++) {
+					for (uint32_t x = 0; x < child.width; x++) {
+						glm::vec2 &node = level.ranges[x / 2 + (y / 2) * level.width];
+						const glm::vec2 &range = child.ranges[x + y * child.width];
+						node = glm::vec2(std::min(node.x, range.x), std::max(node.y, range.y));
+					}
+				}
+				levels.push_back(level);
+			}
+		}
+
+		bool empty() const { return levels.empty(); }
+		uint32_t getLevelCount() const { return static_cast<uint32_t>(levels.size()); }
+
+		/** @brief Minimum and maximum height of the grid cells [x0, x1) x [y0, y1), e.g. for the bounding box of a chunk */
+		glm::vec2 getHeightRange(uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1) const
+		{
+			assert(!empty() && x0 < x1 && y0 < y1);
+			glm::vec2 range(FLT_MAX, -FLT_MAX);
+			accumulateRange(getLevelCount() - 1, 0, 0, x0, y0, x1, y1, range);
+			return range;
+		}
+
+		/** @brief Bilinear height at a world space xz position, positions outside of the grid are clamped to it's borders */
+		float getHeight(const glm::vec2 &pos) const
+		{
+			uint32_t x, y;
+			glm::vec2 f;
+			locate(pos, x, y, f);
+			return bilinear(x, y, f);
+		}
+
+		glm::vec3 getNormal(const glm::vec2 &pos) const
+		{
+			uint32_t x, y;
+			glm::vec2 f;
+			locate(pos, x, y, f);
+			return bilinearNormal(x, y, f);
+		}
+
+		/** @brief Bilinear heights for a batch of world space xz positions */
+		void getHeights(const glm::vec2 *positions, float *heights, size_t count) const
+		{
+			size_t i = 0;
+#if defined(VKS_HEIGHTMAP_QUADTREE_SSE2)
+			if (simd) {
+				// Cell coordinates are computed four at a time, only the corner heights are fetched one by one
+				const __m128 originX = _mm_set1_ps(origin.x);
+				const __m128 originZ = _mm_set1_ps(origin.y);
+				const __m128 invSpacingX = _mm_set1_ps(1.0f / spacing.x);
+				const __m128 invSpacingZ = _mm_set1_ps(1.0f / spacing.y);
+				const __m128 zero = _mm_setzero_ps();
+				const __m128 maxCoord = _mm_set1_ps((float)(size - 1));
+				const __m128 maxCell = _mm_set1_ps((float)(size - 2));
+				alignas(16) int32_t cx[4], cy[4];
+				alignas(16) float h00[4], h10[4], h01[4], h11[4];
+				for (; i + 4 <= count; i += 4) {
+					const float *src = reinterpret_cast<const float*>(positions + i);
+					const __m128 p01 = _mm_loadu_ps(src);
+					const __m128 p23 = _mm_loadu_ps(src + 4);
+					const __m128 px = _mm_shuffle_ps(p01, p23, _MM_SHUFFLE(2, 0, 2, 0));
+					const __m128 pz = _mm_shuffle_ps(p01, p23, _MM_SHUFFLE(3, 1, 3, 1));
+					const __m128 gx = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_sub_ps(px, originX), invSpacingX), zero), maxCoord);
+					const __m128 gz = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_sub_ps(pz, originZ), invSpacingZ), zero), maxCoord);
+					// Coordinates are positive, so truncation rounds down
+					const __m128 fx = _mm_min_ps(_mm_cvtepi32_ps(_mm_cvttps_epi32(gx)), maxCell);
+					const __m128 fz = _mm_min_ps(_mm_cvtepi32_ps(_mm_cvttps_epi32(gz)), maxCell);
+					_mm_store_si128(reinterpret_cast<__m128i*>(cx), _mm_cvttps_epi32(fx));
+					_mm_store_si128(reinterpret_cast<__m128i*>(cy), _mm_cvttps_epi32(fz));
+					for (uint32_t j = 0; j < 4; j++) {
+						const float *row = &this->heights[cx[j] + (size_t)cy[j] * size];
+						h00[j] = row[0];
+						h10[j] = row[1];
+						h01[j] = row[size];
+						h11[j] = row[size + 1];
+					}
+					const __m128 u = _mm_sub_ps(gx, fx);
+					const __m128 v = _mm_sub_ps(gz, fz);
+					const __m128 a00 = _mm_load_ps(h00);
+					const __m128 a01 = _mm_load_ps(h01);
+					const __m128 top = _mm_add_ps(a00, _mm_mul_ps(_mm_sub_ps(_mm_load_ps(h10), a00), u));
+					const __m128 bottom = _mm_add_ps(a01, _mm_mul_ps(_mm_sub_ps(_mm_load_ps(h11), a01), u));
+					_mm_storeu_ps(heights + i, _mm_add_ps(top, _mm_mul_ps(_mm_sub_ps(bottom, top), v)));
+				}
+			}
+#endif
+			for (; i < count; i++) {
+				heights[i] = getHeight(positions[i]);
+			}
+		}
+
+		/** @brief Bilinear surface normals for a batch of world space xz positions */
+		void getNormals(const glm::vec2 *positions, glm::vec3 *normals, size_t count) const
+		{
+			for (size_t i = 0; i < count; i++) {
+				normals[i] = getNormal(positions[i]);
+			}
+		}
+
+		/**
+		* Find the first intersection of a ray with the terrain's bilinear surface
+		*
+		* @param origin World space origin of the ray
+		* @param direction World space direction of the ray, doesn't need to be normalized
+		* @param maxT Maximum distance along the ray in multiples of the direction
+		*
+		* @return True if the ray hits the terrain within [0, maxT], rays starting below the surface hit at their origin
+		*/
+		bool raycast(const glm::vec3 &origin, const glm::vec3 &direction, float maxT, RayHit &hit) const
+		{
+			assert(!empty());
+			// The grid mapping only scales and offsets x and z, so distances along the ray are the same in grid space
+			const glm::vec3 o((origin.x - this->origin.x) / spacing.x, origin.y, (origin.z - this->origin.y) / spacing.y);
+			const glm::vec3 d(direction.x / spacing.x, direction.y, direction.z / spacing.y);
+			// Children are visited front to back, so the first cell hit is the closest one
+			const uint32_t flipX = d.x < 0.0f ? 1 : 0;
+			const uint32_t flipY = d.z < 0.0f ? 1 : 0;
+
+			struct Node {
+				uint32_t level, x, y;
+			};
+			Node stack[64];
+			uint32_t stackSize = 0;
+			stack[stackSize++] = { getLevelCount() - 1, 0, 0 };
+			while (stackSize > 0) {
+				const Node node = stack[--stackSize];
+				uint32_t x0, y0, x1, y1;
+				nodeCells(node.level, node.x, node.y, x0, y0, x1, y1);
+				const glm::vec2 &range = levels[node.level].ranges[node.x + node.y * levels[node.level].width];
+				// Everything below the node's lowest point (positive y) is inside the terrain, so the box extends downwards
+				float t0 = 0.0f;
+				float t1 = maxT;
+				if (!clipSlab(o.x, d.x, (float)x0, (float)x1, t0, t1) || !clipSlab(o.z, d.z, (float)y0, (float)y1, t0, t1) || !clipSlab(o.y, d.y, range.x, FLT_MAX, t0, t1)) {
+					continue;
+				}
+				if (node.level == 0) {
+					float t;
+					if (intersectCell(node.x, node.y, o, d, t0, t1, t)) {
+						hit.t = t;
+						hit.position = origin + direction * t;
+						hit.normal = getNormal(glm::vec2(hit.position.x, hit.position.z));
+						return true;
+					}
+					continue;
+				}
+				// Push the far children first, so the near ones are popped first
+				const Level &child = levels[node.level - 1];
+				for (uint32_t n = 4; n-- > 0;) {
+					const uint32_t cx = node.x * 2 + ((n & 1) ^ flipX);
+					const uint32_t cy = node.y * 2 + (((n >> 1) & 1) ^ flipY);
+					if (cx < child.width && cy < child.height) {
+						assert(stackSize < 64);
+						stack[stackSize++] = { node.level - 1, cx, cy };
+					}
+				}
+			}
+			return false;
+		}
+
+		/** @brief Line of sight test, true if the terrain blocks the segment between two world space points */
+		bool occluded(const glm::vec3 &from, const glm::vec3 &to) const
+		{
+			RayHit hit;
+			return raycast(from, to - from, 1.0f, hit);
+		}
+	};
+}
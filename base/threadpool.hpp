@@ -1,17 +1,29 @@
 /*
-* Basic C++11 based thread pool with per-thread job queues
+* Work stealing C++11 job system
+*
+* Each worker owns a lock-free job deque (Chase-Lev), pushing and popping jobs at the bottom while idle workers steal from the top
+* Jobs are fixed size and allocated from per-worker ring buffers, so submitting a job doesn't allocate any memory
 *
 * Copyright (C) 2016 by Sascha Willems - www.saschawillems.de
 *
 * This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
 */
 
+#pragma once
+
 #include <vector>
+#include <memory>
 #include <thread>
-#include <queue>
+#include <atomic>
 #include <mutex>
 #include <condition_variable>
-#include <functional>
+#include <chrono>
+#include <algorithm>
+#include <new>
+#include <utility>
+#include <type_traits>
+#include <assert.h>
+#include <stdint.h>
 
 // make_unique is not available in C++11
 // Taken from Herb Sutter's blog (https://herbsutter.com/gotw/_102/)
@@ -23,98 +35,388 @@ std::unique_ptr<T> make_unique(Args&& ...args)
 
 namespace vks
 {
-	class Thread
+	// Fixed size job, the callable is stored inline
+	struct Job
+	{
+		static const uint32_t maxDependents = 4;
+		typedef void(*Function)(Job*);
+
+		Function function;
+		// Parent jobs are finished once all of their children have finished
+		Job* parent;
+		// This job plus all of it's unfinished children
+		std::atomic<int32_t> unfinishedJobs;
+		// Dependencies that haven't finished yet, plus one until the job has been passed to run()
+		std::atomic<int32_t> pendingDependencies;
+		// Jobs waiting for this job to finish
+		std::atomic<uint32_t> dependentCount;
+		Job* dependents[maxDependents];
+		alignas(8) unsigned char data[64];
+		Job() : function(nullptr), parent(nullptr), unfinishedJobs(0), pendingDependencies(0), dependentCount(0) {}
+	};
+
+	// Lock-free work stealing deque with fixed capacity
+	// Only the owning worker may push and pop, any worker may steal
+	class JobQueue
 	{
 	private:
-		bool destroying = false;
-		std::thread worker;
-		std::queue<std::function<void()>> jobQueue;
-		std::mutex queueMutex;
-		std::condition_variable condition;
+		static const int64_t capacity = 4096;
+		std::atomic<int64_t> top;
+		std::atomic<int64_t> bottom;
+		std::atomic<Job*> jobs[capacity];
+	public:
+		JobQueue() : top(0), bottom(0) {}
 
-		// Loop through all remaining jobs
-		void queueLoop()
+		void push(Job* job)
 		{
-			while (true)
-			{
-				std::function<void()> job;
-				{
-					std::unique_lock<std::mutex> lock(queueMutex);
-					condition.wait(lock, [this] { return !jobQueue.empty() || destroying; });
-					if (destroying)
-					{
-						break;
-					}
-					job = jobQueue.front();
+			const int64_t b = bottom.load(std::memory_order_relaxed);
+			const int64_t t = top.load(std::memory_order_acquire);
+			assert(b - t < capacity);
+			jobs[b & (capacity - 1)].store(job, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_release);
+			bottom.store(b + 1, std::memory_order_relaxed);
+		}
+
+		Job* pop()
+		{
+			const int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+			bottom.store(b, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			int64_t t = top.load(std::memory_order_relaxed);
+			if (t > b) {
+				// Empty
+				bottom.store(b + 1, std::memory_order_relaxed);
+				return nullptr;
+			}
+			Job* job = jobs[b & (capacity - 1)].load(std::memory_order_relaxed);
+			if (t == b) {
+				// Last job, race against thieves
+				if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+					job = nullptr;
 				}
+				bottom.store(b + 1, std::memory_order_relaxed);
+			}
+			return job;
+		}
+
+		Job* steal()
+		{
+			int64_t t = top.load(std::memory_order_acquire);
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			const int64_t b = bottom.load(std::memory_order_acquire);
+			if (t >= b) {
+				return nullptr;
+			}
+			Job* job = jobs[t & (capacity - 1)].load(std::memory_order_relaxed);
+			if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+				// Lost against the owner or another thief
+				return nullptr;
+			}
+			return job;
+		}
+	};
+
+	class ThreadPool
+	{
+	private:
+		// Number of jobs each worker can have in flight before it's ring buffer wraps around
+		static const uint32_t jobsPerWorker = 4096;
+
+		struct Worker
+		{
+			JobQueue queue;
+			std::unique_ptr<Job[]> jobs;
+			uint32_t nextJob = 0;
+			std::thread thread;
+			// Time spent executing jobs since the last utilization query
+			std::atomic<uint64_t> busyTime;
+			Worker() : jobs(new Job[jobsPerWorker]), busyTime(0) {}
+		};
+		// Worker 0 is the thread that called setThreadCount, it only executes jobs while waiting
+		std::vector<std::unique_ptr<Worker>> workers;
+
+		std::atomic<bool> destroying;
+		// Jobs that have been created but not finished yet
+		std::atomic<int32_t> unfinishedJobs;
+		// Jobs sitting in one of the queues, used to put idle workers to sleep
+		std::atomic<int32_t> queuedJobs;
+		std::atomic<uint32_t> sleepingWorkers;
+		std::mutex sleepMutex;
+		std::condition_variable sleepCondition;
 
-				job();
+		std::chrono::high_resolution_clock::time_point utilizationStart;
 
-				{
-					std::lock_guard<std::mutex> lock(queueMutex);
-					jobQueue.pop();
-					condition.notify_one();
+		struct WorkerContext
+		{
+			ThreadPool* pool;
+			uint32_t index;
+		};
+		static WorkerContext& workerContext()
+		{
+			static thread_local WorkerContext context = { nullptr, 0 };
+			return context;
+		}
+
+		Worker& currentWorker()
+		{
+			WorkerContext& context = workerContext();
+			assert(context.pool == this);
+			return *workers[context.index];
+		}
+
+		Job* allocateJob()
+		{
+			Worker& worker = currentWorker();
+			Job* job = &worker.jobs[worker.nextJob];
+			worker.nextJob = (worker.nextJob + 1) % jobsPerWorker;
+			// Wrapping onto a job that's still in flight means that too many jobs have been created without waiting
+			assert(job->unfinishedJobs.load(std::memory_order_relaxed) == 0);
+			return job;
+		}
+
+		void push(Job* job)
+		{
+			queuedJobs.fetch_add(1);
+			currentWorker().queue.push(job);
+			if (sleepingWorkers.load() > 0) {
+				std::lock_guard<std::mutex> lock(sleepMutex);
+				sleepCondition.notify_one();
+			}
+		}
+
+		Job* getJob()
+		{
+			Worker& worker = currentWorker();
+			Job* job = worker.queue.pop();
+			if (!job) {
+				// Own queue is empty, try to steal from the other workers
+				const uint32_t workerCount = static_cast<uint32_t>(workers.size());
+				const uint32_t start = workerContext().index;
+				for (uint32_t i = 1; i < workerCount && !job; i++) {
+					job = workers[(start + i) % workerCount]->queue.steal();
 				}
 			}
+			if (job) {
+				queuedJobs.fetch_sub(1);
+			}
+			return job;
 		}
 
-	public:
-		Thread()
+		void finish(Job* job)
 		{
-			worker = std::thread(&Thread::queueLoop, this);
+			// Once the counter hits zero a waiting thread may return and the job slot can be reused,
+			// so everything needed afterwards has to be read before the decrement
+			Job* parent = job->parent;
+			const uint32_t dependentCount = job->dependentCount.load();
+			Job* dependents[Job::maxDependents];
+			std::copy(job->dependents, job->dependents + dependentCount, dependents);
+			if (job->unfinishedJobs.fetch_sub(1) != 1) {
+				return;
+			}
+			// Release jobs that depend on this one
+			for (uint32_t i = 0; i < dependentCount; i++) {
+				release(dependents[i]);
+			}
+			if (parent) {
+				finish(parent);
+			}
+			unfinishedJobs.fetch_sub(1);
 		}
 
-		~Thread()
+		void release(Job* job)
 		{
-			if (worker.joinable())
+			if (job->pendingDependencies.fetch_sub(1) == 1) {
+				push(job);
+			}
+		}
+
+		void execute(Job* job)
+		{
+			auto tStart = std::chrono::high_resolution_clock::now();
+			job->function(job);
+			finish(job);
+			auto tEnd = std::chrono::high_resolution_clock::now();
+			currentWorker().busyTime.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(tEnd - tStart).count(), std::memory_order_relaxed);
+		}
+
+		void workerLoop(uint32_t index)
+		{
+			workerContext() = { this, index };
+			while (!destroying.load()) {
+				Job* job = getJob();
+				if (job) {
+					execute(job);
+					continue;
+				}
+				// Sleep until new jobs are pushed
+				std::unique_lock<std::mutex> lock(sleepMutex);
+				sleepingWorkers.fetch_add(1);
+				sleepCondition.wait(lock, [this] { return queuedJobs.load() > 0 || destroying.load(); });
+				sleepingWorkers.fetch_sub(1);
+			}
+			workerContext() = { nullptr, 0 };
+		}
+
+		void destroyWorkers()
+		{
+			if (workers.empty()) {
+				return;
+			}
+			wait();
 			{
-				wait();
-				queueMutex.lock();
+				std::lock_guard<std::mutex> lock(sleepMutex);
 				destroying = true;
-				condition.notify_one();
-				queueMutex.unlock();
-				worker.join();
+				sleepCondition.notify_all();
 			}
+			for (auto& worker : workers) {
+				if (worker->thread.joinable()) {
+					worker->thread.join();
+				}
+			}
+			workers.clear();
+			workerContext() = { nullptr, 0 };
 		}
 
-		// Add a new job to the thread's queue
-		void addJob(std::function<void()> function)
+		template<typename F>
+		static void invoke(Job* job)
 		{
-			std::lock_guard<std::mutex> lock(queueMutex);
-			jobQueue.push(std::move(function));
-			condition.notify_one();
+			F* function = reinterpret_cast<F*>(job->data);
+			(*function)();
+			function->~F();
 		}
 
-		// Wait until all work items have been finished
-		void wait()
+	public:
+		ThreadPool() : destroying(false), unfinishedJobs(0), queuedJobs(0), sleepingWorkers(0) {}
+
+		~ThreadPool()
 		{
-			std::unique_lock<std::mutex> lock(queueMutex);
-			condition.wait(lock, [this]() { return jobQueue.empty(); });
+			destroyWorkers();
 		}
-	};
-	
-	class ThreadPool
-	{
-	public:
-		std::vector<std::unique_ptr<Thread>> threads;
 
-		// Sets the number of threads to be allocted in this pool
+		// Sets the number of worker threads to be allocted in this pool
+		// The calling thread becomes an additional worker that executes jobs while it waits
 		void setThreadCount(uint32_t count)
 		{
-			threads.clear();
-			for (auto i = 0; i < count; i++)
-			{
-				threads.push_back(make_unique<Thread>());
+			destroyWorkers();
+			destroying = false;
+			workerContext() = { this, 0 };
+			for (uint32_t i = 0; i <= count; i++) {
+				workers.push_back(make_unique<Worker>());
+			}
+			for (uint32_t i = 1; i <= count; i++) {
+				workers[i]->thread = std::thread(&ThreadPool::workerLoop, this, i);
+			}
+			utilizationStart = std::chrono::high_resolution_clock::now();
+		}
+
+		// Number of workers including the calling thread
+		uint32_t getWorkerCount()
+		{
+			return static_cast<uint32_t>(workers.size());
+		}
+
+		// Creates a job without starting it, the callable is stored inside the job and must fit into Job::data
+		// If a parent is given, the parent only finishes after this job has finished
+		template<typename F>
+		Job* createJob(F&& function, Job* parent = nullptr)
+		{
+			typedef typename std::decay<F>::type Callable;
+			static_assert(sizeof(Callable) <= sizeof(Job::data), "Job callable exceeds the job's inline storage");
+			static_assert(std::alignment_of<Callable>::value <= 8, "Job callable alignment exceeds the job's inline storage");
+			Job* job = allocateJob();
+			new (job->data) Callable(std::forward<F>(function));
+			job->function = &invoke<Callable>;
+			job->parent = parent;
+			job->unfinishedJobs = 1;
+			job->pendingDependencies = 1;
+			job->dependentCount = 0;
+			if (parent) {
+				parent->unfinishedJobs.fetch_add(1);
+			}
+			unfinishedJobs.fetch_add(1);
+			return job;
+		}
+
+		// Creates an empty job, e.g. to be used as a parent for grouping jobs
+		Job* createJob(Job* parent = nullptr)
+		{
+			return createJob([] {}, parent);
+		}
+
+		// Makes job wait for dependency to finish
+		// Has to be called before either of the jobs is passed to run()
+		void addDependency(Job* job, Job* dependency)
+		{
+			const uint32_t index = dependency->dependentCount.fetch_add(1);
+			assert(index < Job::maxDependents);
+			dependency->dependents[index] = job;
+			job->pendingDependencies.fetch_add(1);
+		}
+
+		// Starts the job, jobs with dependencies are queued once all of their dependencies have finished
+		void run(Job* job)
+		{
+			release(job);
+		}
+
+		bool finished(Job* job)
+		{
+			return job->unfinishedJobs.load() == 0;
+		}
+
+		// Executes queued jobs until the given job (and all of it's children) has finished
+		void wait(Job* job)
+		{
+			while (!finished(job)) {
+				Job* next = getJob();
+				if (next) {
+					execute(next);
+				} else {
+					std::this_thread::yield();
+				}
 			}
 		}
 
-		// Wait until all threads have finished their work items
+		// Executes queued jobs until all jobs have finished
 		void wait()
 		{
-			for (auto &thread : threads)
-			{
-				thread->wait();
+			while (unfinishedJobs.load() > 0) {
+				Job* next = getJob();
+				if (next) {
+					execute(next);
+				} else {
+					std::this_thread::yield();
+				}
+			}
+		}
+
+		// Calls function(begin, end) for consecutive ranges of at most batchSize elements in parallel and waits for all of them
+		template<typename F>
+		void parallelFor(uint32_t count, uint32_t batchSize, const F& function)
+		{
+			assert(batchSize > 0);
+			Job* root = createJob();
+			for (uint32_t begin = 0; begin < count; begin += batchSize) {
+				const uint32_t end = std::min(begin + batchSize, count);
+				const F* f = &function;
+				run(createJob([f, begin, end] { (*f)(begin, end); }, root));
+			}
+			run(root);
+			wait(root);
+		}
+
+		// Returns the fraction of time each worker spent executing jobs since the last call
+		std::vector<float> getUtilization()
+		{
+			auto now = std::chrono::high_resolution_clock::now();
+			const double elapsed = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(now - utilizationStart).count();
+			utilizationStart = now;
+			std::vector<float> utilization;
+			for (auto& worker : workers) {
+				const uint64_t busyTime = worker->busyTime.exchange(0);
+				utilization.push_back(elapsed > 0.0 ? (float)std::min((double)busyTime / elapsed, 1.0) : 0.0f);
 			}
+			return utilization;
 		}
 	};
 
@@ -0,0 +1,87 @@
+/*
+* Heightmap mesh builder micro benchmark
+*
+* Builds heights and normals for synthetic heightmaps and reports vertices per second
+* for the scalar and SIMD paths, single threaded and split across the job system
+*
+* Usage: heightmapbuilder_benchmark [dim] [iterations] [threads]
+*
+* Copyright (C) by Sascha Willems - www.saschawillems.de
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <vector>
+#include <string>
+
+#include "heightmapbuilder.hpp"
+#include "threadpool.hpp"
+
+// Build the full grid once, either on the calling thread or with one job per row range
+double run(const vks::HeightMapBuilder& builder, uint32_t patchsize, vks::ThreadPool* threadPool, uint32_t rowsPerJob, std::vector<float>& heights, std::vector<glm::vec3>& normals)
+{
+	auto tStart = std::chrono::high_resolution_clock::now();
+	if (threadPool) {
+		threadPool->parallelFor(patchsize, rowsPerJob, [&](uint32_t y0, uint32_t y1) {
+			builder.build(y0, y1, heights.data() + (size_t)y0 * patchsize, normals.data() + (size_t)y0 * patchsize);
+		});
+	} else {
+		builder.build(0, patchsize, heights.data(), normals.data());
+	}
+	auto tEnd = std::chrono::high_resolution_clock::now();
+	return std::chrono::duration<double>(tEnd - tStart).count();
+}
+
+int main(int argc, char* argv[])
+{
+	const uint32_t dims[] = { 4096, 8192 };
+	std::vector<uint32_t> benchmarkDims(dims, dims + 2);
+	uint32_t iterations = 5;
+	uint32_t threadCount = std::max(std::thread::hardware_concurrency(), 2u) - 1;
+	if (argc > 1) {
+		benchmarkDims = { (uint32_t)atoi(argv[1]) };
+	}
+	if (argc > 2) {
+		iterations = std::max(atoi(argv[2]), 1);
+	}
+	if (argc > 3) {
+		threadCount = (uint32_t)atoi(argv[3]);
+	}
+
+	vks::ThreadPool threadPool;
+	threadPool.setThreadCount(threadCount);
+
+	for (auto dim : benchmarkDims) {
+		// Smooth synthetic terrain with some noise
+		std::vector<uint16_t> heightdata((size_t)dim * dim);
+		for (uint32_t y = 0; y < dim; y++) {
+			for (uint32_t x = 0; x < dim; x++) {
+				const float h = 0.5f + 0.25f * sinf(x * 0.01f) * cosf(y * 0.013f) + 0.05f * (rand() / (float)RAND_MAX);
+				heightdata[x + (size_t)y * dim] = (uint16_t)(h * 65535.0f);
+			}
+		}
+
+		const uint32_t patchsize = dim;
+		const size_t vertexCount = (size_t)patchsize * patchsize;
+		std::vector<float> heights(vertexCount);
+		std::vector<glm::vec3> normals(vertexCount);
+		vks::HeightMapBuilder builder(heightdata.data(), dim, patchsize, 4.0f);
+
+		printf("Heightmap %u x %u (%zu vertices), %u iterations, %u worker threads + main thread\n", dim, dim, vertexCount, iterations, threadCount);
+		for (uint32_t simd = 0; simd < 2; simd++) {
+			for (uint32_t threaded = 0; threaded < 2; threaded++) {
+				builder.simd = simd == 1;
+				double best = 0.0;
+				for (uint32_t i = 0; i < iterations; i++) {
+					const double seconds = run(builder, patchsize, threaded ? &threadPool : nullptr, 32, heights, normals);
+					best = (i == 0) ? seconds : std::min(best, seconds);
+				}
+				printf("  %-6s %-15s %8.2f ms  %8.2f Mvertices/s\n", simd ? "simd" : "scalar", threaded ? "multi threaded" : "single threaded", best * 1000.0, vertexCount / best / 1.0e6);
+			}
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,18 @@
+#version 450
+
+layout (binding = 0) uniform sampler2D fontSampler;
+
+layout (location = 0) in vec2 inUV;
+layout (location = 1) in vec4 inColor;
+layout (location = 2) flat in vec4 inClipRect;
+
+layout (location = 0) out vec4 outColor;
+
+void main() 
+{
+	// Replaces the per draw scissor of the direct path
+	if (any(lessThan(gl_FragCoord.xy, inClipRect.xy)) || any(greaterThanEqual(gl_FragCoord.xy, inClipRect.zw))) {
+		discard;
+	}
+	outColor = inColor * texture(fontSampler, inUV);
+}
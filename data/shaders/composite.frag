@@ -0,0 +1,16 @@
+#version 450
+
+// Copies the scene color and depth rendered to offscreen targets into the frame buffer, so the water plane can be depth tested against the scene
+
+layout (set = 0, binding = 1) uniform sampler2D samplerColor;
+layout (set = 0, binding = 2) uniform sampler2D samplerDepth;
+
+layout (location = 0) out vec4 outFragColor;
+
+void main()
+{
+	// The offscreen targets have the size of the frame buffer
+	const ivec2 coord = ivec2(gl_FragCoord.xy);
+	outFragColor = texelFetch(samplerColor, coord, 0);
+	gl_FragDepth = texelFetch(samplerDepth, coord, 0).r;
+}
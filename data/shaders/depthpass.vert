@@ -3,8 +3,8 @@
 layout (location = 0) in vec3 inPos;
 layout (location = 2) in vec2 inUV;
 
-// todo: pass via specialization constant
-#define SHADOW_MAP_CASCADE_COUNT 4
+// Uniform block size, the number of cascades actually rendered is a runtime setting
+#define MAX_SHADOW_MAP_CASCADE_COUNT 4
 
 layout(push_constant) uniform PushConsts {
 	vec4 position;
@@ -12,7 +12,7 @@ layout(push_constant) uniform PushConsts {
 } pushConsts;
 
 layout (binding = 0) uniform UBO {
-	mat4[SHADOW_MAP_CASCADE_COUNT] cascadeViewProjMat;
+	mat4[MAX_SHADOW_MAP_CASCADE_COUNT] cascadeViewProjMat;
 } ubo;
 
 layout (location = 0) out vec2 outUV;
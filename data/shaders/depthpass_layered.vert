@@ -0,0 +1,30 @@
+#version 450
+
+#extension GL_ARB_shader_viewport_layer_array : require
+
+layout (location = 0) in vec3 inPos;
+layout (location = 2) in vec2 inUV;
+
+// Uniform block size, the number of cascades actually rendered is a runtime setting
+#define MAX_SHADOW_MAP_CASCADE_COUNT 4
+
+layout(push_constant) uniform PushConsts {
+	vec4 position;
+	uint cascadeIndex;
+} pushConsts;
+
+layout (binding = 0) uniform UBO {
+	mat4[MAX_SHADOW_MAP_CASCADE_COUNT] cascadeViewProjMat;
+} ubo;
+
+layout (location = 0) out vec2 outUV;
+
+void main()
+{
+	// One instance per cascade, each rendering into its own layer of the depth map
+	uint cascadeIndex = gl_InstanceIndex;
+	outUV = inUV;
+	vec3 pos = inPos + pushConsts.position.xyz;
+	gl_Position = ubo.cascadeViewProjMat[cascadeIndex] * vec4(pos, 1.0);
+	gl_Layer = int(cascadeIndex);
+}
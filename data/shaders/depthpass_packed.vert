@@ -0,0 +1,39 @@
+#version 450
+
+// Packed terrain vertex, see terrain_packed.vert
+layout (location = 0) in uvec2 inGridPos;
+layout (location = 2) in float inHeight;
+
+layout (constant_id = 0) const float GRID_SCALE_X = 1.0;
+layout (constant_id = 1) const float GRID_SCALE_Z = 1.0;
+layout (constant_id = 2) const float GRID_OFFSET_X = 0.0;
+layout (constant_id = 3) const float GRID_OFFSET_Z = 0.0;
+layout (constant_id = 4) const float HEIGHT_MIN = 0.0;
+layout (constant_id = 5) const float HEIGHT_RANGE = 1.0;
+layout (constant_id = 6) const float UV_SCALE = 1.0;
+
+// Uniform block size, the number of cascades actually rendered is a runtime setting
+#define MAX_SHADOW_MAP_CASCADE_COUNT 4
+
+layout(push_constant) uniform PushConsts {
+	vec4 position;
+	uint cascadeIndex;
+} pushConsts;
+
+layout (binding = 0) uniform UBO {
+	mat4[MAX_SHADOW_MAP_CASCADE_COUNT] cascadeViewProjMat;
+} ubo;
+
+layout (location = 0) out vec2 outUV;
+
+out gl_PerVertex {
+	vec4 gl_Position;   
+};
+
+void main()
+{
+	vec2 gridPos = vec2(inGridPos);
+	outUV = gridPos * UV_SCALE;
+	vec3 pos = vec3(gridPos.x * GRID_SCALE_X + GRID_OFFSET_X, HEIGHT_MIN + inHeight * HEIGHT_RANGE, gridPos.y * GRID_SCALE_Z + GRID_OFFSET_Z) + pushConsts.position.xyz;
+	gl_Position =  ubo.cascadeViewProjMat[pushConsts.cascadeIndex] * vec4(pos, 1.0);
+}
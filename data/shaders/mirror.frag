@@ -1,8 +1,14 @@
 #version 450
 
-#define SHADOW_MAP_CASCADE_COUNT 4
+// Uniform block size, the number of cascades actually used is passed via a specialization constant
+#define MAX_SHADOW_MAP_CASCADE_COUNT 4
 #define ambient 0.2
 
+// Same constant ids as the terrain fragment shader
+layout (constant_id = 0) const uint SHADOW_MAP_CASCADE_COUNT = 4;
+layout (constant_id = 2) const bool ENABLE_SHADOWS = true;
+layout (constant_id = 3) const int SHADOW_FILTER_RANGE = 0;
+
 layout (binding = 0) uniform UBO 
 {
 	mat4 projection;
@@ -14,7 +20,7 @@ layout (binding = 0) uniform UBO
 
 layout (binding = 5) uniform UBOCSM {
 	vec4 cascadeSplits;
-	mat4 cascadeViewProjMat[SHADOW_MAP_CASCADE_COUNT];
+	mat4 cascadeViewProjMat[MAX_SHADOW_MAP_CASCADE_COUNT];
 	mat4 inverseViewMat;
 	vec4 lightDir;
 } uboCSM;
@@ -64,10 +70,9 @@ float filterPCF(vec4 sc, uint cascadeIndex)
 
 	float shadowFactor = 0.0;
 	int count = 0;
-	int range = 1;
 	
-	for (int x = -range; x <= range; x++) {
-		for (int y = -range; y <= range; y++) {
+	for (int x = -SHADOW_FILTER_RANGE; x <= SHADOW_FILTER_RANGE; x++) {
+		for (int y = -SHADOW_FILTER_RANGE; y <= SHADOW_FILTER_RANGE; y++) {
 			shadowFactor += textureProj(sc, vec2(dx*x, dy*y), cascadeIndex);
 			count++;
 		}
@@ -77,6 +82,10 @@ float filterPCF(vec4 sc, uint cascadeIndex)
 
 float shadowMapping()
 {
+	if (!ENABLE_SHADOWS) {
+		return 1.0;
+	}
+
 	// Get cascade index for the current fragment's view position
 	uint cascadeIndex = 0;
 	for(uint i = 0; i < SHADOW_MAP_CASCADE_COUNT - 1; ++i) {
@@ -88,13 +97,10 @@ float shadowMapping()
 	// Depth compare for shadowing
 	vec4 shadowCoord = (biasMat * uboCSM.cascadeViewProjMat[cascadeIndex]) * vec4(inLPos, 1.0);	
 
-	float shadow = 0;
-	bool enablePCF = false;
-	if (enablePCF) {
+	if (SHADOW_FILTER_RANGE > 0) {
 		return filterPCF(shadowCoord / shadowCoord.w, cascadeIndex);
-	} else {
-		return textureProj(shadowCoord / shadowCoord.w, vec2(0.0), cascadeIndex);
 	}
+	return textureProj(shadowCoord / shadowCoord.w, vec2(0.0), cascadeIndex);
 }
 
 float fog(float density)
@@ -0,0 +1,59 @@
+#version 450
+
+layout (location = 0) in vec3 inPos;
+layout (location = 1) in vec3 inNormal;
+layout (location = 2) in vec2 inUV;
+// Index into the instance buffer, fetched per instance from the culled instance list
+layout (location = 3) in uint inInstanceIndex;
+
+layout (set = 0, binding = 0) uniform UBO 
+{
+	mat4 projection;
+	mat4 modelview;
+	vec4 lightDir;
+} ubo;
+
+struct Instance {
+	mat4 matrix;
+	vec4 baseColorFactor;
+	uint jointOffset;
+	uint jointCount;
+};
+
+layout (std430, set = 1, binding = 0) readonly buffer Instances
+{
+	Instance instances[];
+};
+
+layout (location = 0) out vec3 outNormal;
+layout (location = 1) out vec3 outColor;
+layout (location = 2) out vec3 outEyePos;
+layout (location = 3) out vec3 outLightVec;
+
+layout(push_constant) uniform PushConsts {
+	mat4 scale;
+	vec4 clipPlane;
+	uint shadows;
+} pushConsts;
+
+void main(void)
+{
+	Instance instance = instances[inInstanceIndex];
+	vec4 pos = instance.matrix * vec4(inPos, 1.0);
+	if (pushConsts.scale[1][1] < 0) {
+		pos.y *= -1.0f;
+	}
+	outNormal = normalize(mat3(instance.matrix) * inNormal);
+	outNormal.y *= sign(pushConsts.scale[1][1]);
+	outColor = instance.baseColorFactor.rgb;
+	gl_Position = ubo.projection * ubo.modelview * pos;
+	outEyePos = vec3(ubo.modelview * pos);
+	outLightVec = normalize(ubo.lightDir.xyz);
+
+	// Clip against reflection plane
+	if (length(pushConsts.clipPlane) != 0.0)  {
+		gl_ClipDistance[0] = dot(pos, pushConsts.clipPlane);
+	} else {
+		gl_ClipDistance[0] = 0.0f;
+	}
+}
@@ -20,7 +20,8 @@ layout(push_constant) uniform PushConsts {
 
 void main(void)
 {
-	gl_Position = ubo.projection * ubo.modelview * pushConsts.scale * vec4(inPos.xyz, 1.0);
+	// Projected onto the far plane, so the sky is drawn last and only covers fragments without scene geometry
+	gl_Position = (ubo.projection * ubo.modelview * pushConsts.scale * vec4(inPos.xyz, 1.0)).xyww;
 	outUV = inUV;
 	outUV.t = 1.0f - outUV.t;
 }
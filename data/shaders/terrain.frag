@@ -3,21 +3,46 @@
 layout (set = 0, binding = 1) uniform sampler2D samplerHeight; 
 layout (set = 0, binding = 2) uniform sampler2DArray samplerLayers;
 layout (set = 0, binding = 3) uniform sampler2DArray shadowMap;
+// Normals baked from the height map on the GPU, one texel per grid vertex
+layout (set = 0, binding = 5) uniform sampler2D samplerNormal;
+// Full resolution height map tiles streamed in around the viewer, samplerHeight only holds a coarse level of the height map then
+layout (set = 0, binding = 6) uniform sampler2DArray samplerHeightTiles;
+// Slot of each tile in samplerHeightTiles + 1, 0 while the tile isn't resident
+layout (std430, set = 0, binding = 7) readonly buffer HeightPageTable {
+	uint heightPages[];
+};
+
+// Uniform block sizes, the number of cascades and layers actually used is passed via specialization constants
+#define MAX_SHADOW_MAP_CASCADE_COUNT 4
+#define MAX_TERRAIN_LAYER_COUNT 6
+
+layout (constant_id = 0) const uint SHADOW_MAP_CASCADE_COUNT = 4;
+layout (constant_id = 1) const int TERRAIN_LAYER_COUNT = 6;
+// Variants without shadows are used for the refraction and reflection passes
+layout (constant_id = 2) const bool ENABLE_SHADOWS = true;
+// Size of the PCF kernel is (2 * range + 1)^2, a range of 0 takes a single sample
+layout (constant_id = 3) const int SHADOW_FILTER_RANGE = 0;
+// Use the baked normal map instead of the interpolated vertex normals
+layout (constant_id = 4) const bool NORMAL_MAP = false;
+// Sample the height map through the page table of the streamed tiles
+layout (constant_id = 5) const bool HEIGHT_TILE_STREAMING = false;
+// Texels per tile side without the tile's border, and tiles per side of the height map
+layout (constant_id = 6) const uint HEIGHT_TILE_SIZE = 1;
+layout (constant_id = 7) const uint HEIGHT_TILES_PER_SIDE = 1;
 
 layout (set = 0, binding = 0) uniform UBO 
 {
 	mat4 projection;
 	mat4 modelview;
 	vec4 lightDir;
-	vec4 layers[6];
+	vec4 layers[MAX_TERRAIN_LAYER_COUNT];
 } ubo;
 
-#define SHADOW_MAP_CASCADE_COUNT 4
 #define ambient 0.2
 
 layout (binding = 4) uniform UBOCSM {
 	vec4 cascadeSplits;
-	mat4 cascadeViewProjMat[SHADOW_MAP_CASCADE_COUNT];
+	mat4 cascadeViewProjMat[MAX_SHADOW_MAP_CASCADE_COUNT];
 	mat4 inverseViewMat;
 	vec4 lightDir;
 } uboCSM;
@@ -25,6 +50,7 @@ layout (binding = 4) uniform UBOCSM {
 layout(push_constant) uniform PushConsts {
 	mat4 scale;
 	vec4 clipPlane;
+	// Replaced by ENABLE_SHADOWS, kept for the push constant layout
 	uint shadows;
 } pushConsts;
 
@@ -69,10 +95,9 @@ float filterPCF(vec4 sc, uint cascadeIndex)
 
 	float shadowFactor = 0.0;
 	int count = 0;
-	int range = 1;
 	
-	for (int x = -range; x <= range; x++) {
-		for (int y = -range; y <= range; y++) {
+	for (int x = -SHADOW_FILTER_RANGE; x <= SHADOW_FILTER_RANGE; x++) {
+		for (int y = -SHADOW_FILTER_RANGE; y <= SHADOW_FILTER_RANGE; y++) {
 			shadowFactor += textureProj(sc, vec2(dx*x, dy*y), cascadeIndex);
 			count++;
 		}
@@ -80,14 +105,29 @@ float filterPCF(vec4 sc, uint cascadeIndex)
 	return shadowFactor / count;
 }
 
+float sampleHeightMap(vec2 uv)
+{
+	if (HEIGHT_TILE_STREAMING) {
+		vec2 texel = uv * float(HEIGHT_TILE_SIZE * HEIGHT_TILES_PER_SIDE);
+		uvec2 tile = uvec2(clamp(floor(texel / float(HEIGHT_TILE_SIZE)), vec2(0.0), vec2(float(HEIGHT_TILES_PER_SIDE - 1))));
+		uint page = heightPages[tile.x + tile.y * HEIGHT_TILES_PER_SIDE];
+		if (page > 0) {
+			// Tiles have a one texel border, so filtering inside a tile matches filtering the full height map
+			vec2 tileUV = (texel - vec2(tile * HEIGHT_TILE_SIZE) + 1.0) / float(HEIGHT_TILE_SIZE + 2);
+			return textureLod(samplerHeightTiles, vec3(tileUV, float(page - 1)), 0.0).r;
+		}
+	}
+	return textureLod(samplerHeight, uv, 0.0).r;
+}
+
 vec3 sampleTerrainLayer()
 {
 	vec3 color = vec3(0.0);
 	
 	// Get height from displacement map
-	float height = textureLod(samplerHeight, inUV, 0.0).r * 255.0;
+	float height = sampleHeightMap(inUV) * 255.0;
 	
-	for (int i = 0; i < ubo.layers.length(); i++) {
+	for (int i = 0; i < TERRAIN_LAYER_COUNT; i++) {
 		float start = ubo.layers[i].x - ubo.layers[i].y / 2.0;
 		float end = ubo.layers[i].x + ubo.layers[i].y / 2.0;
 
@@ -108,10 +148,10 @@ float fog(float density)
 	return 1.0 - clamp(exp2(d * d * LOG2), 0.0, 1.0);
 }
 
-void main()
+float shadowMapping(out uint cascadeIndex)
 {
 	// Get cascade index for the current fragment's view position
-	uint cascadeIndex = 0;
+	cascadeIndex = 0;
 	for(uint i = 0; i < SHADOW_MAP_CASCADE_COUNT - 1; ++i) {
 		if(inViewPos.z < uboCSM.cascadeSplits[i]) {	
 			cascadeIndex = i + 1;
@@ -121,24 +161,31 @@ void main()
 	// Depth compare for shadowing
 	vec4 shadowCoord = (biasMat * uboCSM.cascadeViewProjMat[cascadeIndex]) * vec4(inPos, 1.0);	
 
-	float shadow = 0;
-	bool enablePCF = false;
-	if (pushConsts.shadows > 0) {
-		if (enablePCF) {
-			shadow = filterPCF(shadowCoord / shadowCoord.w, cascadeIndex);
-		} else {
-			shadow = textureProj(shadowCoord / shadowCoord.w, vec2(0.0), cascadeIndex);
-		}
-		if (inPos.y > 0.0f) {
-			shadow = 1.0f;
-		}
-	} else {
-		shadow =  1.0f;
+	if (inPos.y > 0.0f) {
+		return 1.0f;
+	}
+	if (SHADOW_FILTER_RANGE > 0) {
+		return filterPCF(shadowCoord / shadowCoord.w, cascadeIndex);
+	}
+	return textureProj(shadowCoord / shadowCoord.w, vec2(0.0), cascadeIndex);
+}
+
+void main()
+{
+	// Shadows are compiled out of the variants that don't use them
+	uint cascadeIndex = 0;
+	float shadow = 1.0f;
+	if (ENABLE_SHADOWS) {
+		shadow = shadowMapping(cascadeIndex);
 	}
 
 	const vec3 fogColor = vec3(0.47, 0.5, 0.67);
 	// Directional light
 	vec3 N = normalize(inNormal);
+	if (NORMAL_MAP) {
+		// Grid vertex i has the uv i / size, offset to the texel's center
+		N = normalize(texture(samplerNormal, inUV + 0.5 / vec2(textureSize(samplerNormal, 0))).xyz * 2.0 - 1.0);
+	}
 	vec3 L = normalize(-ubo.lightDir.xyz);
 	float diffuse = dot(N, L);
 	vec3 color = (ambient.rrr + (shadow) * (diffuse/* + specular*/)) * sampleTerrainLayer();
@@ -25,6 +25,9 @@ layout(push_constant) uniform PushConsts {
 	uint shadows;
 } pushConsts;
 
+// Also used by the terrain depth pre-pass, the shading pass tests for equal depth
+invariant gl_Position;
+
 void main(void)
 {
 	outUV = inUV;
@@ -0,0 +1,72 @@
+#version 450
+
+// Packed terrain vertex: grid position, octahedral encoded normal and normalized height
+layout (location = 0) in uvec2 inGridPos;
+layout (location = 1) in vec2 inNormal;
+layout (location = 2) in float inHeight;
+
+// Decode constants (see vks::HeightMap::VertexDecodeConstants)
+layout (constant_id = 0) const float GRID_SCALE_X = 1.0;
+layout (constant_id = 1) const float GRID_SCALE_Z = 1.0;
+layout (constant_id = 2) const float GRID_OFFSET_X = 0.0;
+layout (constant_id = 3) const float GRID_OFFSET_Z = 0.0;
+layout (constant_id = 4) const float HEIGHT_MIN = 0.0;
+layout (constant_id = 5) const float HEIGHT_RANGE = 1.0;
+layout (constant_id = 6) const float UV_SCALE = 1.0;
+
+layout (set = 0, binding = 0) uniform UBO 
+{
+	mat4 projection;
+	mat4 modelview;
+	vec4 lightDir;
+} ubo;
+
+layout (location = 0) out vec3 outNormal;
+layout (location = 1) out vec2 outUV;
+layout (location = 2) out vec3 outViewVec;
+layout (location = 3) out vec3 outLightVec;
+layout (location = 4) out vec3 outEyePos;
+layout (location = 5) out vec3 outViewPos;
+layout (location = 6) out vec3 outPos;
+
+layout(push_constant) uniform PushConsts {
+	mat4 scale;
+	vec4 clipPlane;
+	uint shadows;
+} pushConsts;
+
+// Also used by the terrain depth pre-pass, the shading pass tests for equal depth
+invariant gl_Position;
+
+vec3 decodeOctahedral(vec2 e)
+{
+	vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+	float t = max(-n.z, 0.0);
+	n.x += n.x >= 0.0 ? -t : t;
+	n.y += n.y >= 0.0 ? -t : t;
+	return normalize(n);
+}
+
+void main(void)
+{
+	vec2 gridPos = vec2(inGridPos);
+	outUV = gridPos * UV_SCALE;
+	outNormal = decodeOctahedral(inNormal);
+	vec4 pos = vec4(gridPos.x * GRID_SCALE_X + GRID_OFFSET_X, HEIGHT_MIN + inHeight * HEIGHT_RANGE, gridPos.y * GRID_SCALE_Z + GRID_OFFSET_Z, 1.0);
+	if (pushConsts.scale[1][1] < 0) {
+		pos.y *= -1.0f;
+	}
+	gl_Position = ubo.projection * ubo.modelview * pos;
+	outPos = pos.xyz;
+	outViewVec = -pos.xyz;
+	outLightVec = normalize(ubo.lightDir.xyz + outViewVec);
+	outEyePos = vec3(ubo.modelview * pos);
+	outViewPos = (ubo.modelview * vec4(pos.xyz, 1.0)).xyz;
+
+	// Clip against reflection plane
+	if (length(pushConsts.clipPlane) != 0.0)  {
+		gl_ClipDistance[0] = dot(pos, pushConsts.clipPlane);
+	} else {
+		gl_ClipDistance[0] = 0.0f;
+	}
+}
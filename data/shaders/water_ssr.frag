@@ -0,0 +1,234 @@
+#version 450
+
+// Screen space reflections for the water plane (see mirror.frag for planar reflections)
+// Reflections are traced in view space against the depth of the scene, rays leaving the screen fall back to the fog color
+
+// Uniform block size, the number of cascades actually used is passed via a specialization constant
+#define MAX_SHADOW_MAP_CASCADE_COUNT 4
+#define ambient 0.2
+
+// Same constant ids as the terrain fragment shader
+layout (constant_id = 0) const uint SHADOW_MAP_CASCADE_COUNT = 4;
+layout (constant_id = 2) const bool ENABLE_SHADOWS = true;
+layout (constant_id = 3) const int SHADOW_FILTER_RANGE = 0;
+
+layout (binding = 0) uniform UBO 
+{
+	mat4 projection;
+	mat4 model;
+	vec4 cameraPos;
+	vec4 lightDir;
+	float time;
+} ubo;
+
+layout (binding = 5) uniform UBOCSM {
+	vec4 cascadeSplits;
+	mat4 cascadeViewProjMat[MAX_SHADOW_MAP_CASCADE_COUNT];
+	mat4 inverseViewMat;
+	vec4 lightDir;
+} uboCSM;
+
+// Color and depth of the scene without the water plane
+layout (set = 0, binding = 1) uniform sampler2D samplerSceneColor;
+layout (set = 0, binding = 2) uniform sampler2D samplerSceneDepth;
+layout (set = 0, binding = 3) uniform sampler2D samplerWaterNormalMap;
+layout (set = 0, binding = 4) uniform sampler2DArray shadowMap;
+
+layout (location = 0) in vec2 inUV;
+layout (location = 1) in vec4 inPos;
+layout (location = 2) in vec3 inNormal;
+layout (location = 3) in vec3 inEyePos;
+layout (location = 5) in vec3 inViewPos;
+layout (location = 6) in vec3 inLPos;
+
+layout (location = 0) out vec4 outFragColor;
+
+#define MAX_STEPS 48
+#define REFINE_STEPS 6
+// Maximum distance of a reflection ray in view space units
+#define MAX_DISTANCE 24.0
+// Rays passing behind the scene by more than this are not considered to hit it
+#define THICKNESS 0.5
+
+const mat4 biasMat = mat4( 
+	0.5, 0.0, 0.0, 0.0,
+	0.0, 0.5, 0.0, 0.0,
+	0.0, 0.0, 1.0, 0.0,
+	0.5, 0.5, 0.0, 1.0 
+);
+
+float textureProj(vec4 shadowCoord, vec2 offset, uint cascadeIndex)
+{
+	float shadow = 1.0;
+	float bias = 0.005;
+
+	if ( shadowCoord.z > -1.0 && shadowCoord.z < 1.0 ) {
+		float dist = texture(shadowMap, vec3(shadowCoord.st + offset, cascadeIndex)).r;
+		if (shadowCoord.w > 0 && dist < shadowCoord.z - bias) {
+			shadow = ambient;
+		}
+	}
+	return shadow;
+
+}
+
+float filterPCF(vec4 sc, uint cascadeIndex)
+{
+	ivec2 texDim = textureSize(shadowMap, 0).xy;
+	float scale = 0.75;
+	float dx = scale * 1.0 / float(texDim.x);
+	float dy = scale * 1.0 / float(texDim.y);
+
+	float shadowFactor = 0.0;
+	int count = 0;
+	
+	for (int x = -SHADOW_FILTER_RANGE; x <= SHADOW_FILTER_RANGE; x++) {
+		for (int y = -SHADOW_FILTER_RANGE; y <= SHADOW_FILTER_RANGE; y++) {
+			shadowFactor += textureProj(sc, vec2(dx*x, dy*y), cascadeIndex);
+			count++;
+		}
+	}
+	return shadowFactor / count;
+}
+
+float shadowMapping()
+{
+	if (!ENABLE_SHADOWS) {
+		return 1.0;
+	}
+
+	// Get cascade index for the current fragment's view position
+	uint cascadeIndex = 0;
+	for(uint i = 0; i < SHADOW_MAP_CASCADE_COUNT - 1; ++i) {
+		if(inViewPos.z < uboCSM.cascadeSplits[i]) {	
+			cascadeIndex = i + 1;
+		}
+	}
+
+	// Depth compare for shadowing
+	vec4 shadowCoord = (biasMat * uboCSM.cascadeViewProjMat[cascadeIndex]) * vec4(inLPos, 1.0);	
+
+	if (SHADOW_FILTER_RANGE > 0) {
+		return filterPCF(shadowCoord / shadowCoord.w, cascadeIndex);
+	}
+	return textureProj(shadowCoord / shadowCoord.w, vec2(0.0), cascadeIndex);
+}
+
+float fog(float density)
+{
+	const float LOG2 = -1.442695;
+	float dist = gl_FragCoord.z / gl_FragCoord.w * 0.1;
+	float d = density * dist;
+	return 1.0 - clamp(exp2(d * d * LOG2), 0.0, 1.0);
+}
+
+vec2 projectToScreen(vec3 viewPos)
+{
+	vec4 clip = ubo.projection * vec4(viewPos, 1.0);
+	return clip.xy / clip.w * 0.5 + 0.5;
+}
+
+// View space depth of the scene, from the inverse of the projection's depth mapping
+float sceneDepth(vec2 uv)
+{
+	float depth = textureLod(samplerSceneDepth, uv, 0.0).r;
+	return ubo.projection[3][2] / -(depth + ubo.projection[2][2]);
+}
+
+bool onScreen(vec2 uv)
+{
+	return all(greaterThanEqual(uv, vec2(0.0))) && all(lessThanEqual(uv, vec2(1.0)));
+}
+
+// March the ray until it passes behind the scene, then refine the intersection with a binary search
+// lastUV is the last position of the ray on screen, which is used for rays that miss the scene geometry (e.g. reflecting the sky)
+bool traceReflection(vec3 origin, vec3 dir, out vec2 hitUV, out vec2 lastUV)
+{
+	const float stepSize = MAX_DISTANCE / float(MAX_STEPS);
+	hitUV = vec2(-1.0);
+	lastUV = vec2(-1.0);
+	vec3 prev = origin;
+	for (int i = 1; i <= MAX_STEPS; i++) {
+		vec3 pos = origin + dir * stepSize * float(i);
+		if (pos.z >= 0.0) {
+			break;
+		}
+		vec2 uv = projectToScreen(pos);
+		if (!onScreen(uv)) {
+			break;
+		}
+		lastUV = uv;
+		float delta = sceneDepth(uv) - pos.z;
+		if (delta > 0.0 && delta < THICKNESS) {
+			vec3 front = prev;
+			vec3 back = pos;
+			for (int j = 0; j < REFINE_STEPS; j++) {
+				vec3 mid = (front + back) * 0.5;
+				if (sceneDepth(projectToScreen(mid)) - mid.z > 0.0) {
+					back = mid;
+				} else {
+					front = mid;
+				}
+			}
+			hitUV = projectToScreen(back);
+			return true;
+		}
+		prev = pos;
+	}
+	return false;
+}
+
+// Fade reflections out towards the screen borders, where the traced scene ends
+float edgeFade(vec2 uv)
+{
+	vec2 dist = min(uv, 1.0 - uv);
+	return clamp(min(dist.x, dist.y) / 0.1, 0.0, 1.0);
+}
+
+void main() 
+{
+	const vec3 fogColor = vec3(0.47, 0.5, 0.67);
+
+	const vec4 tangent = vec4(1.0, 0.0, 0.0, 0.0);
+	const vec4 viewNormal = vec4(0.0, -1.0, 0.0, 0.0);
+	const vec4 bitangent = vec4(0.0, 0.0, 1.0, 0.0);
+	const float distortAmount = 0.05;
+
+	vec2 projCoord = inPos.xy / inPos.w * 0.5 + 0.5;
+
+	vec4 normal = texture(samplerWaterNormalMap, inUV * 8.0 + ubo.time);
+	normal = normalize(normal * 2.0 - 1.0);
+
+	vec4 viewDir = normalize(vec4(inEyePos, 1.0));
+	vec4 viewTanSpace = normalize(vec4(dot(viewDir, tangent), dot(viewDir, bitangent), dot(viewDir, viewNormal), 1.0));	
+	vec4 viewReflection = normalize(reflect(-1.0 * viewTanSpace, normal));
+	float fresnel = dot(normal, viewReflection);	
+
+	vec4 dudv = normal * distortAmount;
+
+	if (gl_FrontFacing) {
+		float shadow = shadowMapping();
+		// The scene below the water plane is visible in the scene color
+		vec3 refraction = texture(samplerSceneColor, projCoord + dudv.st).rgb;
+
+		// Surface normal in view space, perturbed by the normal map (the world's up axis is -y)
+		vec3 surfaceNormal = normalize(mat3(ubo.model) * normalize(vec3(dudv.s, -1.0, dudv.t)));
+		vec3 rayDir = reflect(normalize(inViewPos), surfaceNormal);
+		vec2 hitUV;
+		vec2 lastUV;
+		vec3 reflection = fogColor;
+		if (traceReflection(inViewPos, rayDir, hitUV, lastUV)) {
+			reflection = mix(fogColor, textureLod(samplerSceneColor, hitUV, 0.0).rgb, edgeFade(hitUV));
+		} else if (lastUV.x >= 0.0 && textureLod(samplerSceneDepth, lastUV, 0.0).r >= 1.0) {
+			// The ray ended in front of the sky
+			reflection = mix(fogColor, textureLod(samplerSceneColor, lastUV, 0.0).rgb, edgeFade(lastUV));
+		}
+		outFragColor.rgb = mix(refraction, reflection, fresnel) * (ambient + shadow);
+	} else{
+		outFragColor.rgb = vec3(0.0);
+	}
+
+	outFragColor.rgb = mix(outFragColor.rgb, fogColor, fog(0.5));
+
+	outFragColor.a = 1.0;
+}
@@ -23,18 +23,28 @@
 #include "VulkanglTFModel.hpp"
 #include "VulkanBuffer.hpp"
 #include "VulkanHeightmap.hpp"
+#include "VulkanTiledTexture.hpp"
+#include "VulkanAssetLoader.hpp"
+#include "threadpool.hpp"
 
 #include "Pipeline.hpp"
 #include "PipelineLayout.hpp"
 #include "DescriptorSet.hpp"
 #include "DescriptorSetLayout.hpp"
 #include "RenderPass.hpp"
+#include "CommandPool.hpp"
+#include "CommandBuffer.hpp"
 #include "DescriptorPool.hpp"
 #include "Image.hpp"
 #include "ImageView.hpp"
+#include "RenderGraph.hpp"
+#include "VulkanDynamicResolution.hpp"
+#include "VulkanGpuProfiler.hpp"
+#include "VulkanMipGenerator.hpp"
 
 #define ENABLE_VALIDATION false
 
+// Default sizes, can be changed on the command line
 #define FB_DIM 1024
 
 #define TERRAIN_LAYER_COUNT 6
@@ -45,7 +55,8 @@
 #define SHADOWMAP_DIM 4096
 #endif
 
-#define SHADOW_MAP_CASCADE_COUNT 4
+// Size of the cascade arrays in the uniform blocks, the number of cascades used is a runtime setting
+#define MAX_SHADOW_MAP_CASCADE_COUNT 4
 
 class VulkanExample : public VulkanExampleBase
 {
@@ -53,28 +64,101 @@ public:
 	bool debugDisplayReflection = false;
 	bool debugDisplayRefraction = false;
 
+	// Startup settings, can be changed on the command line so a single binary can be used to compare them
+	uint32_t shadowMapSize = SHADOWMAP_DIM;
+	uint32_t cascadeCount = MAX_SHADOW_MAP_CASCADE_COUNT;
+	uint32_t offscreenSize = FB_DIM;
+	// Without reflections the water plane isn't drawn and the graph culls the offscreen passes
+	bool reflections = true;
+	// Planar reflections render the scene mirrored and refracted into offscreen targets, screen space reflections trace the depth of the main pass instead
+	enum ReflectionMode { reflectionModePlanar = 0, reflectionModeScreenSpace = 1 };
+	int32_t reflectionMode = reflectionModePlanar;
+	// Requires the composite and water screen space reflection shaders, and a sampleable depth format
+	bool screenSpaceReflectionsSupported = false;
+	// Skip the offscreen passes on frames the water plane isn't visible on
+	bool waterCulling = true;
+	struct WaterVisibility {
+		bool visible = true;
+		// Bounds of the water plane in normalized device coordinates (min x, min y, max x, max y)
+		glm::vec4 screenRect = glm::vec4(-1.0f, -1.0f, 1.0f, 1.0f);
+		// Fraction of the screen covered by the plane's bounds
+		float coverage = 1.0f;
+	} waterVisibility;
+	// Overrides the height map's default LOD distance if set
+	float terrainLodDistance = 0.0f;
+	// Only keep the full detail vertices and height map tiles of the terrain chunks near the camera on the device
+	bool terrainStreaming = false;
+
 	vks::HeightMap* heightMap;
+	// Full resolution height map tiles streamed in around the camera, the height map texture only holds a coarse level with streaming enabled
+	vks::TiledTexture* heightMapTiles = nullptr;
+	// Number of terrain grid vertices per side
+	const uint32_t terrainPatchSize = 256;
+	// Set if the terrain normal map has been baked on the GPU, the terrain shaders use the vertex normals otherwise
+	bool terrainNormalMapBaked = false;
+	// Coarse quad patch mesh for the tessellated terrain, detail is displaced from the height map texture
+	vks::HeightMap* heightMapTessellated = nullptr;
+	bool tessellation = false;
+	// PCF kernel range for the terrain and water shadows (0 = single sample), compiled into the pipelines
+	int32_t shadowFilterRange = 0;
+	// Lay down the terrain's depth before shading it, so the terrain fragment shader only runs once per pixel
+	bool depthPrepass = false;
+	// Terrain vertices use vks::HeightMap::PackedVertex
+	bool packedTerrainVertices = false;
+	// Chunk indices shared by all height maps
+	vks::HeightMapIndexCache terrainIndexCache;
 
 	glm::vec4 lightPos;
 
 	enum class SceneDrawType { sceneDrawTypeRefract, sceneDrawTypeReflect, sceneDrawTypeDisplay };
-	enum class FramebufferType { Color, DepthStencil };
+
+	// Culled terrain chunk draw lists, each holding one indirect draw command per chunk
+	// Refraction uses the camera list, as it only differs from the display pass by its clip plane
+	// The layered list draws a chunk into all cascades (one instance per cascade) if it's visible in any of them
+	enum TerrainDrawList { terrainDrawListCamera = 0, terrainDrawListReflect = 1, terrainDrawListCascade = 2, terrainDrawListCascadesLayered = 2 + MAX_SHADOW_MAP_CASCADE_COUNT, terrainDrawListCount = 3 + MAX_SHADOW_MAP_CASCADE_COUNT };
+	// Per swap chain image, updated right before submission like the uniform buffers
+	std::vector<vks::Buffer> terrainDrawBuffers;
+	uint32_t terrainVisibleChunks = 0;
+
+	// Culled prop (test scene) draw lists, holding one indirect draw command per draw batch and the indices of the visible instances
+	enum PropDrawList { propDrawListCamera = 0, propDrawListReflect = 1, propDrawListCount = 2 };
+	struct PropDrawBuffers {
+		vks::Buffer commands;
+		vks::Buffer instanceIndices;
+	};
+	// Per swap chain image, updated right before submission like the terrain draw lists
+	std::vector<PropDrawBuffers> propDrawBuffers;
+	bool propFrustumCulling = true;
+	uint32_t propVisibleInstances = 0;
 
 	struct CascadeDebug {
 		bool enabled = false;
 		int32_t cascadeIndex = 0;
-		Pipeline* pipeline;
+		Pipeline* pipeline = nullptr;
 		PipelineLayout* pipelineLayout;
 		DescriptorSet* descriptorSet;
 		DescriptorSetLayout* descriptorSetLayout;
 	} cascadeDebug;
 
 	struct {
-		Pipeline* debug;
-		Pipeline* mirror;
-		Pipeline* terrain;
-		Pipeline* sky;
-		Pipeline* depthpass;
+		Pipeline* debug = nullptr;
+		Pipeline* mirror = nullptr;
+		// Screen space reflections: copies the offscreen scene into the frame buffer, then draws the water plane tracing it
+		Pipeline* composite = nullptr;
+		Pipeline* mirrorScreenSpace = nullptr;
+		// Terrain variants with shadows for the scene and without shadows for the refraction and reflection passes
+		Pipeline* terrain = nullptr;
+		Pipeline* terrainNoShadows = nullptr;
+		// Depth only terrain pass and the shading variant testing for equal depth
+		Pipeline* terrainDepthPrepass = nullptr;
+		Pipeline* terrainDepthEqual = nullptr;
+		Pipeline* terrainTessellation = nullptr;
+		Pipeline* terrainTessellationNoShadows = nullptr;
+		Pipeline* sky = nullptr;
+		// Instanced props, drawn from the flattened glTF draw list
+		Pipeline* props = nullptr;
+		Pipeline* depthpass = nullptr;
+		Pipeline* depthpassLayered = nullptr;
 	} pipelines;
 
 	struct Textures {
@@ -82,6 +166,7 @@ public:
 		vks::Texture2D skySphere;
 		vks::Texture2D waterNormalMap;
 		vks::Texture2DArray terrainArray;
+		vks::Texture2D terrainNormalMap;
 	} textures;
 
 	std::vector<vks::Texture2D> skyspheres;
@@ -93,7 +178,8 @@ public:
 		vkglTF::Model testscene;
 	} models;
 
-	struct {
+	// One copy per swap chain image, so a frame in flight never reads uniforms that are updated for the next frame
+	struct UniformBuffers {
 		vks::Buffer vsShared;
 		vks::Buffer vsMirror;
 		vks::Buffer vsOffScreen;
@@ -101,7 +187,8 @@ public:
 		vks::Buffer terrain;
 		vks::Buffer sky;
 		vks::Buffer CSM;
-	} uniformBuffers;
+	};
+	std::vector<UniformBuffers> uniformBuffers;
 
 	struct UBO {
 		glm::mat4 projection;
@@ -114,11 +201,16 @@ public:
 		glm::mat4 model;
 		glm::vec4 lightDir = glm::vec4(10.0f, 10.0f, 10.0f, 1.0f);
 		glm::vec4 layers[TERRAIN_LAYER_COUNT];
+		// Only used by the tessellation shaders
+		glm::vec4 frustumPlanes[6];
+		// x = tessellation factor, y = displacement scale, z = tessellated edge size (in pixels), w = normal sample distance (in uv)
+		glm::vec4 tessellation = glm::vec4(0.75f, 4.0f, 20.0f, 1.0f / 256.0f);
+		glm::vec2 viewportDim;
 	} uboTerrain;
 
 	struct UBOCSM {
-		float cascadeSplits[SHADOW_MAP_CASCADE_COUNT];
-		glm::mat4 cascadeViewProjMat[SHADOW_MAP_CASCADE_COUNT];
+		float cascadeSplits[MAX_SHADOW_MAP_CASCADE_COUNT];
+		glm::mat4 cascadeViewProjMat[MAX_SHADOW_MAP_CASCADE_COUNT];
 		glm::mat4 inverseViewMat;
 		glm::vec3 lightDir;
 	} uboCSM;
@@ -136,16 +228,21 @@ public:
 		PipelineLayout* textured;
 		PipelineLayout* terrain;
 		PipelineLayout* sky;
+		PipelineLayout* props;
 	} pipelineLayouts;
 
 	DescriptorPool* descriptorPool;
 
 	struct DescriptorSets {
 		DescriptorSet* waterplane;
+		// Water plane sampling the scene color and depth for screen space reflections
+		DescriptorSet* waterplaneScreenSpace;
 		DescriptorSet* debugquad;
 		DescriptorSet* terrain;
 		DescriptorSet* skysphere;
-	} descriptorSets;
+	};
+	// Per swap chain image, referencing that image's uniform buffers
+	std::vector<DescriptorSets> descriptorSets;
 
 	struct {
 		DescriptorSetLayout* textured;
@@ -153,20 +250,51 @@ public:
 		DescriptorSetLayout* skysphere;
 	} descriptorSetLayouts;
 
-	// Framebuffer for offscreen rendering
-	struct FrameBufferAttachment {
-		VkFramebuffer frameBuffer;
-		ImageView* view;
-		Image* image;
+	// Offscreen passes for rendering the refracted and reflected scene, attachments and barriers are managed by the render graph
+	struct OffscreenTarget {
+		RenderGraph::PassHandle pass;
+		RenderGraph::ResourceHandle color;
+		RenderGraph::ResourceHandle depth;
 		VkDescriptorImageInfo descriptor;
 	};
 	struct OffscreenPass {
-		int32_t width, height;
-		FrameBufferAttachment reflection, refraction, depth;
-		RenderPass* renderPass;
+		OffscreenTarget reflection, refraction;
+		// One graph per dynamic resolution level, created up front so switching levels doesn't allocate
+		// All graphs are built the same way, so pass and attachment handles are valid for each of them
+		std::vector<RenderGraph*> graphs;
+		// Graph of the current level
+		RenderGraph* graph = nullptr;
+		// Level the descriptor sets and command buffers of each swap chain image were last set up for
+		std::vector<uint32_t> imageLevels;
+		// Used on frames the water plane is culled on, only contains the scene pass
+		RenderGraph* waterCulledGraph = nullptr;
+		// Scene without the water plane at the size of the frame buffer, for screen space reflections
+		OffscreenTarget scene;
+		VkDescriptorImageInfo sceneDepthDescriptor;
+		RenderGraph* screenSpaceGraph = nullptr;
 		VkSampler sampler;
+		// Unfiltered sampler for the scene depth
+		VkSampler depthSampler;
 	} offscreenPass;
 
+	// Scales the offscreen targets based on the GPU frame time
+	vks::DynamicResolution dynamicResolution;
+	int32_t dynamicResolutionLevel = 0;
+
+	// GPU times of the passes, with one set of queries per swap chain image
+	vks::GpuProfiler* profiler = nullptr;
+	struct ProfilerScopes {
+		std::array<uint32_t, MAX_SHADOW_MAP_CASCADE_COUNT> cascades;
+		uint32_t layeredShadows;
+		uint32_t refraction;
+		uint32_t reflection;
+		uint32_t opaque;
+		uint32_t scene;
+		uint32_t ui;
+		// Primary command buffer, from the first offscreen pass to the end of the scene
+		uint32_t frame;
+	} profilerScopes;
+
 	/* CSM */
 
 	float cascadeSplitLambda = 0.95f;
@@ -183,11 +311,12 @@ public:
 		RenderPass* renderPass;
 		PipelineLayout* pipelineLayout;
 		VkPipeline pipeline;
-		vks::Buffer uniformBuffer;
+		// Per swap chain image
+		std::vector<vks::Buffer> uniformBuffers;
 		DescriptorSetLayout* descriptorSetLayout;
-		DescriptorSet* descriptorSet;
+		std::vector<DescriptorSet*> descriptorSets;
 		struct UniformBlock {
-			std::array<glm::mat4, SHADOW_MAP_CASCADE_COUNT> cascadeViewProjMat;
+			std::array<glm::mat4, MAX_SHADOW_MAP_CASCADE_COUNT> cascadeViewProjMat;
 		} ubo;
 	} depthPass;
 	// Layered depth image containing the shadow cascade depths
@@ -195,10 +324,16 @@ public:
 		Image* image;
 		ImageView* view;
 		VkSampler sampler;
+		// Layered framebuffer covering all cascades for single pass rendering
+		VkFramebuffer frameBuffer = VK_NULL_HANDLE;
 		void destroy(VkDevice device) {
 			vkDestroySampler(device, sampler, nullptr);
+			vkDestroyFramebuffer(device, frameBuffer, nullptr);
 		}
 	} depth;
+	// Render all cascades in a single pass, selecting the layer from the vertex shader (requires VK_EXT_shader_viewport_index_layer)
+	bool layeredShadowPassSupported = false;
+	bool layeredShadowPass = true;
 
 	// Contains all resources required for a single shadow map cascade
 	struct Cascade {
@@ -206,12 +341,63 @@ public:
 		DescriptorSet* descriptorSet;
 		ImageView* view;
 		float splitDepth;
+		// Matrix the cascade's depth layer was last rendered with (also used for shadow lookups)
 		glm::mat4 viewProjMatrix;
+		// Matrix calculated for the current camera, applied once the cascade is re-rendered
+		glm::mat4 pendingViewProjMatrix;
+		bool dirty = true;
+		bool rendered = false;
 		void destroy(VkDevice device) {
 			vkDestroyFramebuffer(device, frameBuffer, nullptr);
 		}
 	};
-	std::array<Cascade, SHADOW_MAP_CASCADE_COUNT> cascades;
+	std::array<Cascade, MAX_SHADOW_MAP_CASCADE_COUNT> cascades;
+	// Cascades are only re-rendered if their (texel snapped) projection changed
+	bool cachedCascades = true;
+	// Update at most one of the far cascades per frame
+	bool roundRobinCascades = true;
+	uint32_t cascadeRoundRobinIndex = 1;
+	uint32_t cascadesUpdated = 0;
+	// Cascades rendered this frame
+	std::array<bool, MAX_SHADOW_MAP_CASCADE_COUNT> cascadesSubmitted{};
+	// Shadow map passes are recorded into separate command buffers that are only submitted when a cascade needs to be updated
+	struct ShadowCommandBuffers {
+		std::array<CommandBuffer*, MAX_SHADOW_MAP_CASCADE_COUNT> cascades;
+		CommandBuffer* layered;
+	};
+	// Per swap chain image
+	std::vector<ShadowCommandBuffers> shadowCommandBuffers;
+
+	// Passes are recorded in parallel as jobs on the thread pool
+	vks::ThreadPool threadPool;
+	// Fraction of time each worker spent executing jobs, sampled once per second
+	std::vector<float> workerUtilization;
+	// Per asset timings of the startup asset loading
+	std::vector<vks::AssetLoader::Timing> assetLoadTimings;
+	double assetLoadTime = 0.0;
+	// Time spent compiling the scene's pipelines (mostly pipeline cache hits after the first run)
+	double pipelineCreationTime = 0.0;
+	uint32_t pipelineCount = 0;
+	// Each command buffer recorded by a job has it's own command pool, as the job may run on any worker
+	// Pools are grouped per swap chain image, so that all of an image's command buffers can be reset at once
+	std::vector<std::vector<CommandPool*>> recordingCommandPools;
+	// Record the command buffers of the acquired image every frame instead of rebuilding those of all images on changes
+	bool perFrameRecording = false;
+	// CPU time spent recording command buffers in milliseconds, for the last frame when recording per frame
+	double recordingTime = 0.0;
+	// Secondary command buffers executed by the primary command buffer, per swap chain image
+	struct SecondaryCommandBuffers {
+		CommandBuffer* refraction;
+		CommandBuffer* reflection;
+		// Scene without the water plane for screen space reflections
+		CommandBuffer* opaque;
+		CommandBuffer* scene;
+		// Scene variant for frames the water plane is culled on
+		CommandBuffer* sceneWaterCulled;
+	};
+	std::vector<SecondaryCommandBuffers> secondaryCommandBuffers;
+	// Primary command buffers executing the water culled graph, per swap chain image
+	std::vector<CommandBuffer*> waterCulledCommandBuffers;
 
 	VulkanExample() : VulkanExampleBase(ENABLE_VALIDATION)
 	{
@@ -247,56 +433,199 @@ public:
 		uboTerrain.layers[3] = glm::vec4(87.5f, 25.0f, glm::vec2(0.0));
 		uboTerrain.layers[4] = glm::vec4(117.5f, 45.0f, glm::vec2(0.0));
 		uboTerrain.layers[5] = glm::vec4(165.0f, 50.0f, glm::vec2(0.0));
+
+		parseSettings();
+	}
+
+	// Example specific command line arguments, mainly used to sweep settings in benchmark runs
+	void parseSettings()
+	{
+		for (size_t i = 0; i < args.size(); i++) {
+			const std::string arg = args[i];
+			const bool hasValue = i + 1 < args.size();
+			if (arg == "--cascades" && hasValue) {
+				cascadeCount = glm::clamp((uint32_t)atoi(args[i + 1]), 1u, (uint32_t)MAX_SHADOW_MAP_CASCADE_COUNT);
+			}
+			if (arg == "--shadowmapsize" && hasValue) {
+				shadowMapSize = std::max((uint32_t)atoi(args[i + 1]), 256u);
+			}
+			if (arg == "--offscreensize" && hasValue) {
+				offscreenSize = std::max((uint32_t)atoi(args[i + 1]), 64u);
+			}
+			if (arg == "--noreflections") {
+				reflections = false;
+			}
+			if (arg == "--ssr") {
+				reflectionMode = reflectionModeScreenSpace;
+			}
+			if (arg == "--nowaterculling") {
+				waterCulling = false;
+			}
+			if (arg == "--perframerecording") {
+				perFrameRecording = true;
+			}
+			if (arg == "--depthprepass") {
+				depthPrepass = true;
+			}
+			if (arg == "--terrainstreaming") {
+				terrainStreaming = true;
+			}
+			if (arg == "--terrainlod" && hasValue) {
+				terrainLodDistance = (float)atof(args[i + 1]);
+			}
+		}
+		benchmark.settings = {
+			{ "cascades", std::to_string(cascadeCount) },
+			{ "shadowMapSize", std::to_string(shadowMapSize) },
+			{ "offscreenSize", std::to_string(offscreenSize) },
+			{ "reflections", reflections ? "true" : "false" },
+			{ "reflectionMode", reflectionMode == reflectionModeScreenSpace ? "screen space" : "planar" },
+			{ "waterCulling", waterCulling ? "true" : "false" },
+			{ "terrainLod", terrainLodDistance > 0.0f ? std::to_string(terrainLodDistance) : "default" },
+			{ "perFrameRecording", perFrameRecording ? "true" : "false" },
+			{ "terrainStreaming", terrainStreaming ? "true" : "false" },
+			{ "depthPrepass", depthPrepass ? "true" : "false" },
+		};
 	}
 
 	~VulkanExample()
 	{
+		for (RenderGraph* graph : offscreenPass.graphs) {
+			delete graph;
+		}
+		delete offscreenPass.waterCulledGraph;
+		delete offscreenPass.screenSpaceGraph;
+		delete profiler;
 		vkDestroySampler(device, offscreenPass.sampler, nullptr);
-		uniformBuffers.vsShared.destroy();
-		uniformBuffers.vsMirror.destroy();
-		uniformBuffers.vsOffScreen.destroy();
-		uniformBuffers.vsDebugQuad.destroy();
+		vkDestroySampler(device, offscreenPass.depthSampler, nullptr);
+		for (auto& buffers : uniformBuffers) {
+			buffers.vsShared.destroy();
+			buffers.vsMirror.destroy();
+			buffers.vsOffScreen.destroy();
+			buffers.vsDebugQuad.destroy();
+		}
+		for (auto& buffers : propDrawBuffers) {
+			buffers.commands.destroy();
+			buffers.instanceIndices.destroy();
+		}
+		terrainIndexCache.destroy();
+		delete heightMapTiles;
+		// Releases the pipelines' shader modules
+		for (Pipeline* pipeline : { pipelines.debug, pipelines.mirror, pipelines.composite, pipelines.mirrorScreenSpace, pipelines.terrain, pipelines.terrainNoShadows, pipelines.terrainDepthPrepass, pipelines.terrainDepthEqual, pipelines.terrainTessellation, pipelines.terrainTessellationNoShadows, pipelines.sky, pipelines.props, pipelines.depthpass, pipelines.depthpassLayered, cascadeDebug.pipeline }) {
+			delete pipeline;
+		}
 	}
 
-	void createFrameBufferImage(FrameBufferAttachment& target, FramebufferType type)
+	/*
+		Setup the render graph for rendering the mirrored scene
+		The refracted and reflected scene are rendered to color attachments that are sampled in the fragment shader of the final pass
+		Both passes declare their own depth attachment, which the graph aliases to a single image as they are not used at the same time
+	*/
+	RenderGraph* createOffscreenGraph(uint32_t size, VkFormat depthFormat)
 	{
-		VkFormat format = VK_FORMAT_UNDEFINED;
-		VkImageAspectFlags aspectMask;
-		VkImageUsageFlags usageFlags;
-		switch (type) {
-		case FramebufferType::Color:
-			format = swapChain.colorFormat;
-			usageFlags = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
-			aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-			break;
-		case FramebufferType::DepthStencil:
-			VkBool32 validDepthFormat = vks::tools::getSupportedDepthFormat(physicalDevice, &format);
-			usageFlags = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
-			aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT;
-			break;
+		// The offscreen pipelines are created for the main render pass, so the attachment formats have to match it
+		RenderGraph* graph = new RenderGraph(vulkanDevice);
+		OffscreenTarget& refraction = offscreenPass.refraction;
+		OffscreenTarget& reflection = offscreenPass.reflection;
+		refraction.color = graph->addAttachment("refraction", swapChain.colorFormat, size, size);
+		refraction.depth = graph->addAttachment("refraction depth", depthFormat, size, size);
+		reflection.color = graph->addAttachment("reflection", swapChain.colorFormat, size, size);
+		reflection.depth = graph->addAttachment("reflection depth", depthFormat, size, size);
+
+		refraction.pass = graph->addPass("refraction", [this](CommandBuffer* cb, uint32_t imageIndex) {
+			cb->executeCommands({ secondaryCommandBuffers[imageIndex].refraction });
+		}, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+		graph->addColorOutput(refraction.pass, refraction.color);
+		graph->setDepthStencilOutput(refraction.pass, refraction.depth);
+
+		reflection.pass = graph->addPass("reflection", [this](CommandBuffer* cb, uint32_t imageIndex) {
+			cb->executeCommands({ secondaryCommandBuffers[imageIndex].reflection });
+		}, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+		graph->addColorOutput(reflection.pass, reflection.color);
+		graph->setDepthStencilOutput(reflection.pass, reflection.depth);
+
+		// Scene rendering with reflection, refraction and shadows into the swap chain
+		RenderGraph::PassHandle scenePass = graph->addExternalPass("scene", [this](CommandBuffer* cb, uint32_t imageIndex) {
+			cb->beginRenderPass(renderPass, frameBuffers[imageIndex], VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+			cb->executeCommands({ secondaryCommandBuffers[imageIndex].scene });
+			cb->endRenderPass();
+		});
+		if (reflections) {
+			graph->addTextureInput(scenePass, refraction.color);
+			graph->addTextureInput(scenePass, reflection.color);
 		}
-		assert(format != VK_FORMAT_UNDEFINED);
 
-		target.image = new Image(vulkanDevice);
-		target.image->setType(VK_IMAGE_TYPE_2D);
-		target.image->setFormat(format);
-		target.image->setExtent({ (uint32_t)offscreenPass.width, (uint32_t)offscreenPass.height, 1 });
-		target.image->setTiling(VK_IMAGE_TILING_OPTIMAL);
-		target.image->setUsage(usageFlags);
-		target.image->create();
+		graph->compile();
+		return graph;
+	}
 
-		target.view = new ImageView(vulkanDevice);
-		target.view->setType(VK_IMAGE_VIEW_TYPE_2D);
-		target.view->setFormat(format);
-		target.view->setSubResourceRange({ aspectMask, 0, 1, 0, 1});
-		target.view->setImage(target.image);
-		target.view->create();
+	/*
+		Setup the render graph for frames the water plane isn't visible on
+		Only contains the scene pass, so none of the offscreen passes are recorded or executed
+	*/
+	RenderGraph* createWaterCulledGraph()
+	{
+		RenderGraph* graph = new RenderGraph(vulkanDevice);
+		graph->addExternalPass("scene", [this](CommandBuffer* cb, uint32_t imageIndex) {
+			cb->beginRenderPass(renderPass, frameBuffers[imageIndex], VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+			cb->executeCommands({ secondaryCommandBuffers[imageIndex].sceneWaterCulled });
+			cb->endRenderPass();
+		});
+		graph->compile();
+		return graph;
+	}
+
+	/*
+		Setup the render graph for screen space reflections
+		The scene without the water plane is rendered once into frame buffer sized targets
+		The scene pass copies them into the swap chain and draws the water plane, which traces its reflections against the scene's depth
+	*/
+	RenderGraph* createScreenSpaceGraph(VkFormat depthFormat)
+	{
+		RenderGraph* graph = new RenderGraph(vulkanDevice);
+		OffscreenTarget& scene = offscreenPass.scene;
+		scene.color = graph->addAttachment("scene", swapChain.colorFormat, width, height);
+		scene.depth = graph->addAttachment("scene depth", depthFormat, width, height);
+
+		scene.pass = graph->addPass("opaque", [this](CommandBuffer* cb, uint32_t imageIndex) {
+			cb->executeCommands({ secondaryCommandBuffers[imageIndex].opaque });
+		}, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+		graph->addColorOutput(scene.pass, scene.color);
+		graph->setDepthStencilOutput(scene.pass, scene.depth);
+
+		RenderGraph::PassHandle scenePass = graph->addExternalPass("scene", [this](CommandBuffer* cb, uint32_t imageIndex) {
+			cb->beginRenderPass(renderPass, frameBuffers[imageIndex], VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+			cb->executeCommands({ secondaryCommandBuffers[imageIndex].scene });
+			cb->endRenderPass();
+		});
+		graph->addTextureInput(scenePass, scene.color);
+		graph->addTextureInput(scenePass, scene.depth);
 
-		target.descriptor = { offscreenPass.sampler, target.view->handle, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL };
+		graph->compile();
+		return graph;
+	}
+
+	// Point the offscreen descriptors at the attachments of a level's graph
+	void updateOffscreenDescriptors(uint32_t level)
+	{
+		RenderGraph* graph = offscreenPass.graphs[level];
+		if (offscreenPass.screenSpaceGraph) {
+			offscreenPass.scene.descriptor = { offscreenPass.sampler, offscreenPass.screenSpaceGraph->getImageView(offscreenPass.scene.color)->handle, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL };
+			offscreenPass.sceneDepthDescriptor = { offscreenPass.depthSampler, offscreenPass.screenSpaceGraph->getSampledImageView(offscreenPass.scene.depth)->handle, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL };
+		} else {
+			offscreenPass.scene.descriptor = textures.waterNormalMap.descriptor;
+			offscreenPass.sceneDepthDescriptor = textures.waterNormalMap.descriptor;
+		}
+		if (!reflections) {
+			// The offscreen attachments don't exist, the descriptors still need to point at a valid image
+			offscreenPass.refraction.descriptor = textures.waterNormalMap.descriptor;
+			offscreenPass.reflection.descriptor = textures.waterNormalMap.descriptor;
+			return;
+		}
+		offscreenPass.refraction.descriptor = { offscreenPass.sampler, graph->getImageView(offscreenPass.refraction.color)->handle, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL };
+		offscreenPass.reflection.descriptor = { offscreenPass.sampler, graph->getImageView(offscreenPass.reflection.color)->handle, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL };
 	}
 
-	// Setup the offscreen framebuffer for rendering the mirrored scene
-	// The color attachment of this framebuffer will then be used to sample from in the fragment shader of the final pass
 	void prepareOffscreen()
 	{
 		// Find a suitable depth format
@@ -304,78 +633,6 @@ public:
 		VkBool32 validDepthFormat = vks::tools::getSupportedDepthFormat(physicalDevice, &fbDepthFormat);
 		assert(validDepthFormat);
 
-		VkAttachmentReference colorReference = { 0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL };
-		VkAttachmentReference depthReference = { 1, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL };
-
-		offscreenPass.renderPass = new RenderPass(device);
-		offscreenPass.renderPass->setDimensions(FB_DIM, FB_DIM);
-
-		offscreenPass.renderPass->addSubpassDescription({
-			0,
-			VK_PIPELINE_BIND_POINT_GRAPHICS,
-			0,
-			nullptr,
-			1,
-			&colorReference,
-			nullptr,
-			&depthReference,
-			0,
-			nullptr
-		});
-
-		// Color attachment
-		offscreenPass.renderPass->addAttachmentDescription({
-			0,
-			swapChain.colorFormat,
-			VK_SAMPLE_COUNT_1_BIT,
-			VK_ATTACHMENT_LOAD_OP_CLEAR,
-			VK_ATTACHMENT_STORE_OP_STORE,
-			VK_ATTACHMENT_LOAD_OP_DONT_CARE,
-			VK_ATTACHMENT_STORE_OP_DONT_CARE,
-			VK_IMAGE_LAYOUT_UNDEFINED,
-			VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
-		});
-		// Depth attachment
-		offscreenPass.renderPass->addAttachmentDescription({
-			0,
-			fbDepthFormat,
-			VK_SAMPLE_COUNT_1_BIT,
-			VK_ATTACHMENT_LOAD_OP_CLEAR,
-			VK_ATTACHMENT_STORE_OP_STORE,
-			VK_ATTACHMENT_LOAD_OP_DONT_CARE,
-			VK_ATTACHMENT_STORE_OP_DONT_CARE,
-			VK_IMAGE_LAYOUT_UNDEFINED,
-			VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL
-		});
-		// Subpass dependencies
-		offscreenPass.renderPass->addSubpassDependency({
-			VK_SUBPASS_EXTERNAL,
-			0,
-			VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
-			VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
-			VK_ACCESS_SHADER_READ_BIT,
-			VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
-			VK_DEPENDENCY_BY_REGION_BIT,
-		});
-		offscreenPass.renderPass->addSubpassDependency({
-			0,
-			VK_SUBPASS_EXTERNAL,
-			VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
-			VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
-			VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
-			VK_ACCESS_SHADER_READ_BIT,
-			VK_DEPENDENCY_BY_REGION_BIT,
-		});
-
-		offscreenPass.renderPass->setColorClearValue(0, { 0.0f, 0.0f, 0.0f, 0.0f });
-		offscreenPass.renderPass->setDepthStencilClearValue(1, 1.0f, 0.0f);
-		offscreenPass.renderPass->create();
-
-		offscreenPass.width = FB_DIM;
-		offscreenPass.height = FB_DIM;
-
-		/* Renderpass */
-	
 		/* Shared sampler */
 
 		VkSamplerCreateInfo samplerInfo = vks::initializers::samplerCreateInfo();
@@ -391,33 +648,118 @@ public:
 		samplerInfo.maxLod = 1.0f;
 		samplerInfo.borderColor = VK_BORDER_COLOR_FLOAT_OPAQUE_WHITE;
 		VK_CHECK_RESULT(vkCreateSampler(device, &samplerInfo, nullptr, &offscreenPass.sampler));
+		samplerInfo.magFilter = VK_FILTER_NEAREST;
+		samplerInfo.minFilter = VK_FILTER_NEAREST;
+		samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+		VK_CHECK_RESULT(vkCreateSampler(device, &samplerInfo, nullptr, &offscreenPass.depthSampler));
 
-		/* Framebuffer images */
+		/* Render graphs */
 
-		createFrameBufferImage(offscreenPass.refraction, FramebufferType::Color);
-		createFrameBufferImage(offscreenPass.reflection, FramebufferType::Color);
-		createFrameBufferImage(offscreenPass.depth, FramebufferType::DepthStencil);
+		for (uint32_t i = 0; i < dynamicResolution.getLevelCount(); i++) {
+			const uint32_t size = static_cast<uint32_t>(offscreenSize * dynamicResolution.getScale(i));
+			offscreenPass.graphs.push_back(createOffscreenGraph(size, fbDepthFormat));
+		}
+		offscreenPass.graph = offscreenPass.graphs[dynamicResolution.getLevel()];
+		offscreenPass.waterCulledGraph = createWaterCulledGraph();
+
+		// Screen space reflections (optional, skipped if the shaders haven't been compiled to SPIR-V)
+		VkFormatProperties depthFormatProperties;
+		vkGetPhysicalDeviceFormatProperties(physicalDevice, fbDepthFormat, &depthFormatProperties);
+		screenSpaceReflectionsSupported = (depthFormatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT) &&
+			vks::tools::fileExists(getAssetPath() + "shaders/composite.frag.spv") && vks::tools::fileExists(getAssetPath() + "shaders/water_ssr.frag.spv");
+		if (reflections && screenSpaceReflectionsSupported) {
+			offscreenPass.screenSpaceGraph = createScreenSpaceGraph(fbDepthFormat);
+		} else if (reflectionMode == reflectionModeScreenSpace) {
+			if (reflections) {
+				std::cout << "Screen space reflections are not supported, using planar reflections" << std::endl;
+			}
+			reflectionMode = reflectionModePlanar;
+		}
+	}
 
-		/* Framebuffers */
+	void prepareProfiler()
+	{
+		profiler = new vks::GpuProfiler(vulkanDevice, static_cast<uint32_t>(commandBuffers.size()));
+		for (uint32_t i = 0; i < cascadeCount; i++) {
+			profilerScopes.cascades[i] = profiler->addScope("Shadow cascade " + std::to_string(i));
+		}
+		profilerScopes.layeredShadows = profiler->addScope("Shadow cascades (layered)");
+		profilerScopes.refraction = profiler->addScope("Refraction");
+		profilerScopes.reflection = profiler->addScope("Reflection");
+		profilerScopes.opaque = profiler->addScope("Scene (screen space reflections)");
+		profilerScopes.scene = profiler->addScope("Scene");
+		profilerScopes.ui = profiler->addScope("UI");
+		profilerScopes.frame = profiler->addScope("Offscreen + scene");
+		if (!profiler->supported()) {
+			std::cout << "Dynamic resolution requires timestamp queries and is disabled" << std::endl;
+		}
+	}
 
-		VkImageView attachments[2];
-		attachments[0] = offscreenPass.refraction.view->handle;
-		attachments[1] = offscreenPass.depth.view->handle;
+	// Called once the command buffers of a swap chain image have finished executing
+	void collectProfilerResults(uint32_t imageIndex)
+	{
+		if (!profiler->collect(imageIndex)) {
+			return;
+		}
+		const vks::GpuProfiler::Scope& frame = profiler->getScope(profilerScopes.frame);
+		if (frame.valid && dynamicResolution.update(static_cast<float>(frame.time))) {
+			setOffscreenResolution(dynamicResolution.getLevel());
+		}
+		if (benchmark.active) {
+			// Scopes that weren't submitted with the frame (e.g. cached cascades) didn't cost anything
+			std::vector<std::string> names;
+			std::vector<double> times;
+			double frameTime = 0.0;
+			for (uint32_t i = 0; i < profiler->getScopes().size(); i++) {
+				const vks::GpuProfiler::Scope& scope = profiler->getScope(i);
+				names.push_back(scope.name);
+				times.push_back(scope.updated ? scope.time : 0.0);
+				// The offscreen and scene passes are part of the frame scope
+				const bool shadows = std::find(profilerScopes.cascades.begin(), profilerScopes.cascades.begin() + cascadeCount, i) != profilerScopes.cascades.begin() + cascadeCount || i == profilerScopes.layeredShadows;
+				if (i == profilerScopes.frame || shadows) {
+					frameTime += times.back();
+				}
+			}
+			benchmark.addGpuTimes(frameTime, names, times);
+		}
+	}
 
-		VkFramebufferCreateInfo frameBufferCI = vks::initializers::framebufferCreateInfo();
-		frameBufferCI.renderPass = offscreenPass.renderPass->handle;
-		frameBufferCI.attachmentCount = 2;
-		frameBufferCI.pAttachments = attachments;
-		frameBufferCI.width = offscreenPass.width;
-		frameBufferCI.height = offscreenPass.height;
-		frameBufferCI.layers = 1;
-		VK_CHECK_RESULT(vkCreateFramebuffer(device, &frameBufferCI, nullptr, &offscreenPass.refraction.frameBuffer));
+	/*
+		Switch to the render targets of another dynamic resolution level
+		The descriptor sets and command buffers sampling the targets are per swap chain image, each image is switched over by applyOffscreenResolution once it's acquired again
+	*/
+	void setOffscreenResolution(uint32_t level)
+	{
+		dynamicResolution.setLevel(level);
+		dynamicResolutionLevel = static_cast<int32_t>(level);
+		offscreenPass.graph = offscreenPass.graphs[level];
+	}
 
-		attachments[0] = offscreenPass.reflection.view->handle;
-		VK_CHECK_RESULT(vkCreateFramebuffer(device, &frameBufferCI, nullptr, &offscreenPass.reflection.frameBuffer));
+	/*
+		Move an image over to the current dynamic resolution level
+		Has to be called after the image's previous submission has finished, images still in flight keep using the targets of their own level
+	*/
+	void applyOffscreenResolution(uint32_t imageIndex)
+	{
+		const uint32_t level = dynamicResolution.getLevel();
+		if (offscreenPass.imageLevels[imageIndex] == level) {
+			return;
+		}
+		offscreenPass.imageLevels[imageIndex] = level;
+		updateOffscreenDescriptors(level);
+		descriptorSets[imageIndex].waterplane->update();
+		descriptorSets[imageIndex].debugquad->update();
+		// The acquired image's command buffers are recorded right before they are submitted
+		if (perFrameRecording || !reflections || reflectionMode == reflectionModeScreenSpace) {
+			return;
+		}
+		// Only the offscreen passes and the primary executing them reference the level's targets
+		buildOffscreenCommandBuffer(secondaryCommandBuffers[imageIndex].refraction, offscreenPass.refraction.pass, imageIndex, SceneDrawType::sceneDrawTypeRefract);
+		buildOffscreenCommandBuffer(secondaryCommandBuffers[imageIndex].reflection, offscreenPass.reflection.pass, imageIndex, SceneDrawType::sceneDrawTypeReflect);
+		buildPrimaryCommandBuffer(commandBuffers[imageIndex], getFrameGraph(imageIndex, true), imageIndex);
 	}
 
-	void drawScene(CommandBuffer* cb, SceneDrawType drawType)
+	void drawScene(CommandBuffer* cb, uint32_t imageIndex, SceneDrawType drawType)
 	{
 		// @todo: rename to localMat
 		struct PushConst {
@@ -440,27 +782,223 @@ public:
 			break;
 		}
 
-		// Skysphere
+		// Terrain, the offscreen passes don't use shadows and use variants with the shadow mapping compiled out
+		const bool shadows = (drawType == SceneDrawType::sceneDrawTypeDisplay);
+		cb->bindDescriptorSets(pipelineLayouts.terrain, { descriptorSets[imageIndex].terrain }, 0);
+		cb->updatePushConstant(pipelineLayouts.terrain, 0, &pushConst);
+		// The depth pre-pass only pays off for the shadowed display pass, the tessellated terrain isn't pre-passed
+		const bool prepass = depthPrepass && shadows && !tessellation;
+		if (prepass) {
+			cb->bindPipeline(pipelines.terrainDepthPrepass);
+			heightMap->drawIndirect(cb->handle, terrainDrawBuffers[imageIndex].buffer, terrainDrawListOffset(terrainDrawListCamera));
+			cb->bindPipeline(pipelines.terrainDepthEqual);
+		} else {
+			cb->bindPipeline(shadows ? pipelines.terrain : pipelines.terrainNoShadows);
+		}
+		if (tessellation) {
+			// Patches are culled in the tessellation control shader
+			cb->bindPipeline(shadows ? pipelines.terrainTessellation : pipelines.terrainTessellationNoShadows);
+			heightMapTessellated->draw(cb->handle);
+		} else {
+			heightMap->drawIndirect(cb->handle, terrainDrawBuffers[imageIndex].buffer, terrainDrawListOffset(drawType == SceneDrawType::sceneDrawTypeReflect ? terrainDrawListReflect : terrainDrawListCamera));
+		}
+
+		// Props, all instances of the test scene are drawn from one indirect buffer
+		if (pipelines.props) {
+			const uint32_t list = (drawType == SceneDrawType::sceneDrawTypeReflect) ? propDrawListReflect : propDrawListCamera;
+			const VkDescriptorSet propSet = models.testscene.getDescriptorSet(imageIndex);
+			cb->bindPipeline(pipelines.props);
+			cb->bindDescriptorSets(pipelineLayouts.props, { descriptorSets[imageIndex].terrain }, 0);
+			vkCmdBindDescriptorSets(cb->handle, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayouts.props->handle, 1, 1, &propSet, 0, nullptr);
+			VKS_COUNTER_ADD("Descriptor sets bound", 1);
+			cb->updatePushConstant(pipelineLayouts.props, 0, &pushConst);
+			models.testscene.drawIndirect(cb->handle, propDrawBuffers[imageIndex].commands.buffer, propDrawCommandOffset(list), propDrawBuffers[imageIndex].instanceIndices.buffer, propInstanceIndexOffset(list));
+		}
+
+		// Skysphere, drawn last at the far plane so fragments covered by the scene are rejected by the depth test
 		cb->bindPipeline(pipelines.sky);
-		cb->bindDescriptorSets(pipelineLayouts.sky, { descriptorSets.skysphere }, 0);
+		cb->bindDescriptorSets(pipelineLayouts.sky, { descriptorSets[imageIndex].skysphere }, 0);
 		cb->updatePushConstant(pipelineLayouts.sky, 0, &pushConst);
 		models.skysphere.draw(cb->handle);
-		
-		// Terrain
-		cb->bindPipeline(pipelines.terrain);
-		cb->bindDescriptorSets(pipelineLayouts.terrain, { descriptorSets.terrain }, 0);
-		cb->updatePushConstant(pipelineLayouts.terrain, 0, &pushConst);
-		heightMap->draw(cb->handle);
 	}
 
-	void drawShadowCasters(CommandBuffer* cb, uint32_t cascadeIndex = 0) {
+	void drawShadowCasters(CommandBuffer* cb, uint32_t imageIndex, uint32_t cascadeIndex = 0) {
 		const CascadePushConstBlock pushConst = { glm::vec4(0.0f), cascadeIndex };
 		cb->bindPipeline(pipelines.depthpass);
-		cb->bindDescriptorSets(depthPass.pipelineLayout, { depthPass.descriptorSet }, 0);
+		cb->bindDescriptorSets(depthPass.pipelineLayout, { depthPass.descriptorSets[imageIndex] }, 0);
 		cb->updatePushConstant(depthPass.pipelineLayout, 0, &pushConst);
-		heightMap->draw(cb->handle);
+		heightMap->drawIndirect(cb->handle, terrainDrawBuffers[imageIndex].buffer, terrainDrawListOffset(terrainDrawListCascade + cascadeIndex));
+	}
+
+	/*
+		Terrain chunk culling
+	*/
+
+	VkDeviceSize terrainDrawListOffset(uint32_t list)
+	{
+		return list * heightMap->chunks.size() * sizeof(VkDrawIndexedIndirectCommand);
+	}
+
+	void prepareTerrainDrawBuffers()
+	{
+		terrainDrawBuffers.resize(swapChain.imageCount);
+		for (auto& buffer : terrainDrawBuffers) {
+			VK_CHECK_RESULT(vulkanDevice->createBuffer(VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &buffer, terrainDrawListOffset(terrainDrawListCount)));
+			VK_CHECK_RESULT(buffer.map());
+		}
+		// Also bound without streaming, the shaders then never read them
+		heightMapTiles->createPageTables(swapChain.imageCount);
+	}
+
+	// Cull and LOD select the terrain chunks for all views that render the terrain
+	void updateTerrainDrawBuffers(uint32_t imageIndex)
+	{
+		VKS_ZONE("Terrain culling");
+		VkDrawIndexedIndirectCommand* commands = (VkDrawIndexedIndirectCommand*)terrainDrawBuffers[imageIndex].mapped;
+		const size_t chunkCount = heightMap->chunks.size();
+		const glm::vec3 viewPos = glm::vec3(glm::inverse(camera.matrices.view)[3]);
+		const glm::mat4 viewProj = camera.matrices.perspective * camera.matrices.view;
+		// Streamed chunks have to be uploaded before the draw commands pointing to their slots are written
+		heightMap->updateStreaming(viewPos, static_cast<uint32_t>(waitFences.size()));
+		// The height map tiles under the chunks that need their full detail are streamed in along with them, in tessellation mode too
+		if (heightMapTiles->loaded) {
+			const uint32_t texelsPerQuad = heightMapTiles->width / terrainPatchSize;
+			for (auto& chunk : heightMap->chunks) {
+				if (heightMap->isDetailRequested(chunk, viewPos)) {
+					heightMapTiles->request(chunk.x0 * texelsPerQuad, chunk.y0 * texelsPerQuad, (chunk.x0 + chunk.width) * texelsPerQuad, (chunk.y0 + chunk.height) * texelsPerQuad, heightMap->getChunkDistance(chunk, viewPos));
+				}
+			}
+			heightMapTiles->update(imageIndex, static_cast<uint32_t>(waitFences.size()));
+		}
+		terrainVisibleChunks = heightMap->updateDrawCommands(commands + terrainDrawListCamera * chunkCount, viewProj, viewPos);
+		// The reflection pass mirrors the terrain at the water plane in the vertex shader
+		heightMap->updateDrawCommands(commands + terrainDrawListReflect * chunkCount, viewProj * glm::scale(glm::mat4(1.0f), glm::vec3(1.0f, -1.0f, 1.0f)), viewPos);
+		// Shadow casters in front of the cascade's near plane are kept by depth clamping
+		for (uint32_t i = 0; i < cascadeCount; i++) {
+			heightMap->updateDrawCommands(commands + (terrainDrawListCascade + i) * chunkCount, cascades[i].viewProjMatrix, viewPos, true);
+		}
+		// The LOD only depends on the viewer, so all cascade lists use the same index ranges
+		VkDrawIndexedIndirectCommand* layered = commands + terrainDrawListCascadesLayered * chunkCount;
+		for (size_t j = 0; j < chunkCount; j++) {
+			layered[j] = commands[terrainDrawListCascade * chunkCount + j];
+			layered[j].instanceCount = 0;
+			for (uint32_t i = 0; i < cascadeCount; i++) {
+				if (commands[(terrainDrawListCascade + i) * chunkCount + j].instanceCount > 0) {
+					layered[j].instanceCount = cascadeCount;
+					break;
+				}
+			}
+		}
+	}
+
+	/*
+		Prop culling
+	*/
+
+	VkDeviceSize propDrawCommandOffset(uint32_t list)
+	{
+		return list * models.testscene.getDrawCount() * sizeof(VkDrawIndexedIndirectCommand);
+	}
+
+	VkDeviceSize propInstanceIndexOffset(uint32_t list)
+	{
+		return list * models.testscene.getInstanceCount() * sizeof(uint32_t);
+	}
+
+	void preparePropDrawBuffers()
+	{
+		// The instance and joint buffers of the props are written on the host, so each image gets it's own copy like the draw buffers
+		models.testscene.setFrameCount(swapChain.imageCount);
+		propDrawBuffers.resize(swapChain.imageCount);
+		for (auto& buffers : propDrawBuffers) {
+			VK_CHECK_RESULT(vulkanDevice->createBuffer(VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &buffers.commands, std::max(propDrawCommandOffset(propDrawListCount), (VkDeviceSize)sizeof(VkDrawIndexedIndirectCommand))));
+			VK_CHECK_RESULT(buffers.commands.map());
+			VK_CHECK_RESULT(vulkanDevice->createBuffer(VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &buffers.instanceIndices, std::max(propInstanceIndexOffset(propDrawListCount), (VkDeviceSize)sizeof(uint32_t))));
+			VK_CHECK_RESULT(buffers.instanceIndices.map());
+		}
+	}
+
+	// Cull the prop instances for the views that render them, visible instances of each draw batch are compacted
+	void updatePropDrawBuffers(uint32_t imageIndex)
+	{
+		VKS_ZONE("Prop culling");
+		VkDrawIndexedIndirectCommand* commands = (VkDrawIndexedIndirectCommand*)propDrawBuffers[imageIndex].commands.mapped;
+		uint32_t* instanceIndices = (uint32_t*)propDrawBuffers[imageIndex].instanceIndices.mapped;
+		const uint32_t drawCount = models.testscene.getDrawCount();
+		const uint32_t instanceCount = models.testscene.getInstanceCount();
+		const glm::mat4 viewProj = camera.matrices.perspective * camera.matrices.view;
+		models.testscene.updateFrame(imageIndex);
+		propVisibleInstances = models.testscene.updateDrawCommands(commands + propDrawListCamera * drawCount, instanceIndices + propDrawListCamera * instanceCount, viewProj, propFrustumCulling);
+		models.testscene.updateDrawCommands(commands + propDrawListReflect * drawCount, instanceIndices + propDrawListReflect * instanceCount, viewProj * glm::scale(glm::mat4(1.0f), glm::vec3(1.0f, -1.0f, 1.0f)), propFrustumCulling);
+	}
+
+#if defined(VKS_INSTRUMENTATION)
+	// Non-empty draws and triangles of an indirect draw list
+	static void countDrawList(const VkDrawIndexedIndirectCommand* commands, size_t count, int64_t& draws, int64_t& triangles)
+	{
+		for (size_t i = 0; i < count; i++) {
+			if (commands[i].instanceCount > 0) {
+				draws++;
+				triangles += (int64_t)(commands[i].indexCount / 3) * commands[i].instanceCount;
+			}
+		}
 	}
 
+	/*
+		Draw calls and triangles of the passes submitted this frame
+		Terrain and props are culled on the CPU, so the counts are taken from the draw lists instead of the (possibly prerecorded) command buffers
+		The tessellated terrain is culled on the GPU and the sky, water plane and overlay aren't counted
+	*/
+	void countSubmittedDraws(uint32_t imageIndex)
+	{
+		const VkDrawIndexedIndirectCommand* terrain = (const VkDrawIndexedIndirectCommand*)terrainDrawBuffers[imageIndex].mapped;
+		const VkDrawIndexedIndirectCommand* props = (const VkDrawIndexedIndirectCommand*)propDrawBuffers[imageIndex].commands.mapped;
+		const size_t chunkCount = heightMap->chunks.size();
+		const size_t propDrawCount = pipelines.props ? models.testscene.getDrawCount() : 0;
+
+		// The screen space reflection's opaque pass draws the same lists as the scene
+		int64_t sceneDraws = 0, sceneTriangles = 0;
+		if (!tessellation) {
+			countDrawList(terrain + terrainDrawListCamera * chunkCount, chunkCount, sceneDraws, sceneTriangles);
+			if (depthPrepass) {
+				countDrawList(terrain + terrainDrawListCamera * chunkCount, chunkCount, sceneDraws, sceneTriangles);
+			}
+		}
+		countDrawList(props + propDrawListCamera * propDrawCount, propDrawCount, sceneDraws, sceneTriangles);
+		VKS_COUNTER_ADD("Draw calls (scene)", sceneDraws);
+		VKS_COUNTER_ADD("Triangles (scene)", sceneTriangles);
+
+		if (waterVisibility.visible && reflectionMode == reflectionModePlanar) {
+			int64_t refractionDraws = 0, refractionTriangles = 0, reflectionDraws = 0, reflectionTriangles = 0;
+			if (!tessellation) {
+				countDrawList(terrain + terrainDrawListCamera * chunkCount, chunkCount, refractionDraws, refractionTriangles);
+				countDrawList(terrain + terrainDrawListReflect * chunkCount, chunkCount, reflectionDraws, reflectionTriangles);
+			}
+			countDrawList(props + propDrawListCamera * propDrawCount, propDrawCount, refractionDraws, refractionTriangles);
+			countDrawList(props + propDrawListReflect * propDrawCount, propDrawCount, reflectionDraws, reflectionTriangles);
+			VKS_COUNTER_ADD("Draw calls (refraction)", refractionDraws);
+			VKS_COUNTER_ADD("Triangles (refraction)", refractionTriangles);
+			VKS_COUNTER_ADD("Draw calls (reflection)", reflectionDraws);
+			VKS_COUNTER_ADD("Triangles (reflection)", reflectionTriangles);
+		}
+
+		int64_t shadowDraws = 0, shadowTriangles = 0;
+		if (layeredShadowPass && pipelines.depthpassLayered) {
+			if (cascadesUpdated > 0) {
+				countDrawList(terrain + terrainDrawListCascadesLayered * chunkCount, chunkCount, shadowDraws, shadowTriangles);
+			}
+		} else {
+			for (uint32_t i = 0; i < cascadeCount; i++) {
+				if (cascadesSubmitted[i]) {
+					countDrawList(terrain + (terrainDrawListCascade + i) * chunkCount, chunkCount, shadowDraws, shadowTriangles);
+				}
+			}
+		}
+		VKS_COUNTER_ADD("Draw calls (shadows)", shadowDraws);
+		VKS_COUNTER_ADD("Triangles (shadows)", shadowTriangles);
+	}
+#endif
+
 	/*
 		CSM
 	*/
@@ -477,7 +1015,7 @@ public:
 		VkAttachmentReference depthReference = { 0, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL };
 
 		depthPass.renderPass = new RenderPass(device);
-		depthPass.renderPass->setDimensions(SHADOWMAP_DIM, SHADOWMAP_DIM);
+		depthPass.renderPass->setDimensions(shadowMapSize, shadowMapSize);
 		depthPass.renderPass->addSubpassDescription({
 			0,
 			VK_PIPELINE_BIND_POINT_GRAPHICS,
@@ -531,8 +1069,8 @@ public:
 		depth.image = new Image(vulkanDevice);
 		depth.image->setType(VK_IMAGE_TYPE_2D);
 		depth.image->setFormat(depthFormat);
-		depth.image->setExtent({ SHADOWMAP_DIM, SHADOWMAP_DIM, 1 });
-		depth.image->setNumArrayLayers(SHADOW_MAP_CASCADE_COUNT);
+		depth.image->setExtent({ shadowMapSize, shadowMapSize, 1 });
+		depth.image->setNumArrayLayers(cascadeCount);
 		depth.image->setUsage(VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT);
 		depth.image->setTiling(VK_IMAGE_TILING_OPTIMAL);
 		depth.image->create();
@@ -542,11 +1080,11 @@ public:
 		depth.view->setImage(depth.image);
 		depth.view->setType(VK_IMAGE_VIEW_TYPE_2D_ARRAY);
 		depth.view->setFormat(depthFormat);
-		depth.view->setSubResourceRange({ VK_IMAGE_ASPECT_DEPTH_BIT, 0, 1, 0, SHADOW_MAP_CASCADE_COUNT });
+		depth.view->setSubResourceRange({ VK_IMAGE_ASPECT_DEPTH_BIT, 0, 1, 0, cascadeCount });
 		depth.view->create();
 
 		// One image and framebuffer per cascade
-		for (uint32_t i = 0; i < SHADOW_MAP_CASCADE_COUNT; i++) {
+		for (uint32_t i = 0; i < cascadeCount; i++) {
 			// Image view for this cascade's layer (inside the depth map) this view is used to render to that specific depth image layer
 			cascades[i].view = new ImageView(vulkanDevice);
 			cascades[i].view->setImage(depth.image);
@@ -559,12 +1097,24 @@ public:
 			framebufferInfo.renderPass = depthPass.renderPass->handle;
 			framebufferInfo.attachmentCount = 1;
 			framebufferInfo.pAttachments = &cascades[i].view->handle;
-			framebufferInfo.width = SHADOWMAP_DIM;
-			framebufferInfo.height = SHADOWMAP_DIM;
+			framebufferInfo.width = shadowMapSize;
+			framebufferInfo.height = shadowMapSize;
 			framebufferInfo.layers = 1;
 			VK_CHECK_RESULT(vkCreateFramebuffer(device, &framebufferInfo, nullptr, &cascades[i].frameBuffer));
 		}
 
+		// Layered framebuffer for rendering all cascades at once
+		if (layeredShadowPassSupported) {
+			VkFramebufferCreateInfo framebufferInfo = vks::initializers::framebufferCreateInfo();
+			framebufferInfo.renderPass = depthPass.renderPass->handle;
+			framebufferInfo.attachmentCount = 1;
+			framebufferInfo.pAttachments = &depth.view->handle;
+			framebufferInfo.width = shadowMapSize;
+			framebufferInfo.height = shadowMapSize;
+			framebufferInfo.layers = cascadeCount;
+			VK_CHECK_RESULT(vkCreateFramebuffer(device, &framebufferInfo, nullptr, &depth.frameBuffer));
+		}
+
 		// Shared sampler for cascade deoth reads
 		VkSamplerCreateInfo sampler = vks::initializers::samplerCreateInfo();
 		sampler.magFilter = VK_FILTER_LINEAR;
@@ -587,7 +1137,8 @@ public:
 	*/
 	void updateCascades()
 	{
-		float cascadeSplits[SHADOW_MAP_CASCADE_COUNT];
+		VKS_ZONE("Update cascades");
+		float cascadeSplits[MAX_SHADOW_MAP_CASCADE_COUNT];
 
 		float nearClip = camera.getNearClip();
 		float farClip = camera.getFarClip();
@@ -601,8 +1152,8 @@ public:
 
 		// Calculate split depths based on view camera furstum
 		// Based on method presentd in https://developer.nvidia.com/gpugems/GPUGems3/gpugems3_ch10.html
-		for (uint32_t i = 0; i < SHADOW_MAP_CASCADE_COUNT; i++) {
-			float p = (i + 1) / static_cast<float>(SHADOW_MAP_CASCADE_COUNT);
+		for (uint32_t i = 0; i < cascadeCount; i++) {
+			float p = (i + 1) / static_cast<float>(cascadeCount);
 			float log = minZ * std::pow(ratio, p);
 			float uniform = minZ + range * p;
 			float d = cascadeSplitLambda * (log - uniform) + uniform;
@@ -611,7 +1162,7 @@ public:
 
 		// Calculate orthographic projection matrix for each cascade
 		float lastSplitDist = 0.0;
-		for (uint32_t i = 0; i < SHADOW_MAP_CASCADE_COUNT; i++) {
+		for (uint32_t i = 0; i < cascadeCount; i++) {
 			float splitDist = cascadeSplits[i];
 
 			glm::vec3 frustumCorners[8] = {
@@ -656,130 +1207,547 @@ public:
 			glm::vec3 minExtents = -maxExtents;
 
 			glm::vec3 lightDir = glm::normalize(-lightPos);
+
+			// Snap the center to shadow map texel increments in light space, so the projection only changes in whole texel steps
+			// This removes shimmering of shadow edges and lets cascades be reused while the camera stays within a texel
+			const float texelSize = (maxExtents.x - minExtents.x) / (float)shadowMapSize;
+			glm::mat4 lightRotation = glm::lookAt(glm::vec3(0.0f), lightDir, glm::vec3(0.0f, 1.0f, 0.0f));
+			glm::vec3 lightSpaceCenter = glm::vec3(lightRotation * glm::vec4(frustumCenter, 1.0f));
+			lightSpaceCenter = glm::floor(lightSpaceCenter / texelSize) * texelSize;
+			frustumCenter = glm::vec3(glm::inverse(lightRotation) * glm::vec4(lightSpaceCenter, 1.0f));
+
 			glm::mat4 lightViewMatrix = glm::lookAt(frustumCenter - lightDir * -minExtents.z, frustumCenter, glm::vec3(0.0f, 1.0f, 0.0f));
 			glm::mat4 lightOrthoMatrix = glm::ortho(minExtents.x, maxExtents.x, minExtents.y, maxExtents.y, 0.0f, maxExtents.z - minExtents.z);
 
 			// Store split distance and matrix in cascade
 			cascades[i].splitDepth = (camera.getNearClip() + splitDist * clipRange) * -1.0f;
-			cascades[i].viewProjMatrix = lightOrthoMatrix * lightViewMatrix;
+			const glm::mat4 viewProjMatrix = lightOrthoMatrix * lightViewMatrix;
+			cascades[i].pendingViewProjMatrix = viewProjMatrix;
+			cascades[i].dirty = !cascades[i].rendered || (viewProjMatrix != cascades[i].viewProjMatrix);
 
 			lastSplitDist = cascadeSplits[i];
 		}
 	}
 
-	void drawCSM(CommandBuffer *cb) {
-		/*
-			Generate depth map cascades
+	CommandBuffer* createRecordingCommandBuffer(VkCommandBufferLevel level, uint32_t imageIndex)
+	{
+		// Per frame recording resets the whole pool, the flag is still needed to rebuild single command buffers
+		CommandPool* pool = new CommandPool(device);
+		pool->setFlags(VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT | VK_COMMAND_POOL_CREATE_TRANSIENT_BIT);
+		pool->setQueueFamilyIndex(swapChain.queueNodeIndex);
+		pool->create();
+		recordingCommandPools[imageIndex].push_back(pool);
+		CommandBuffer* cb = new CommandBuffer(device);
+		cb->setPool(pool);
+		cb->setLevel(level);
+		cb->create();
+		return cb;
+	}
 
-			Uses multiple passes with each pass rendering the scene to the cascade's depth image layer
-			Could be optimized using a geometry shader (and layered frame buffer) on devices that support geometry shaders
-		*/
-		VkClearValue clearValues[1];
-		clearValues[0].depthStencil = { 1.0f, 0 };
-
-		cb->setViewport(0, 0, (float)SHADOWMAP_DIM, (float)SHADOWMAP_DIM, 0.0f, 1.0f);
-		cb->setScissor(0, 0, SHADOWMAP_DIM, SHADOWMAP_DIM);
-		// One pass per cascade
-		// The layer that this pass renders to is defined by the cascade's image view (selected via the cascade's decsriptor set)
-		for (uint32_t j = 0; j < SHADOW_MAP_CASCADE_COUNT; j++) {
-			cb->beginRenderPass(depthPass.renderPass, cascades[j].frameBuffer);
-			drawShadowCasters(cb, j);
-			cb->endRenderPass();
+	void prepareThreadedCommandBuffers()
+	{
+		// Shadow cascades are submitted separately, so these are primary command buffers
+		shadowCommandBuffers.resize(commandBuffers.size());
+		secondaryCommandBuffers.resize(commandBuffers.size());
+		recordingCommandPools.resize(commandBuffers.size());
+		for (uint32_t i = 0; i < commandBuffers.size(); i++) {
+			for (auto& cb : shadowCommandBuffers[i].cascades) {
+				cb = createRecordingCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, i);
+			}
+			shadowCommandBuffers[i].layered = createRecordingCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, i);
+			secondaryCommandBuffers[i].refraction = createRecordingCommandBuffer(VK_COMMAND_BUFFER_LEVEL_SECONDARY, i);
+			secondaryCommandBuffers[i].reflection = createRecordingCommandBuffer(VK_COMMAND_BUFFER_LEVEL_SECONDARY, i);
+			secondaryCommandBuffers[i].opaque = createRecordingCommandBuffer(VK_COMMAND_BUFFER_LEVEL_SECONDARY, i);
+			secondaryCommandBuffers[i].scene = createRecordingCommandBuffer(VK_COMMAND_BUFFER_LEVEL_SECONDARY, i);
+			secondaryCommandBuffers[i].sceneWaterCulled = createRecordingCommandBuffer(VK_COMMAND_BUFFER_LEVEL_SECONDARY, i);
+			waterCulledCommandBuffers.push_back(createRecordingCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, i));
+		}
+	}
+
+	void destroyThreadedCommandBuffers()
+	{
+		for (auto& buffers : shadowCommandBuffers) {
+			for (auto cb : buffers.cascades) {
+				delete cb;
+			}
+			delete buffers.layered;
+		}
+		for (auto& buffers : secondaryCommandBuffers) {
+			for (auto cb : { buffers.refraction, buffers.reflection, buffers.opaque, buffers.scene, buffers.sceneWaterCulled }) {
+				delete cb;
+			}
+		}
+		for (auto cb : waterCulledCommandBuffers) {
+			delete cb;
 		}
+		for (auto& pools : recordingCommandPools) {
+			for (auto pool : pools) {
+				vkDestroyCommandPool(device, pool->handle, nullptr);
+				delete pool;
+			}
+		}
+		shadowCommandBuffers.clear();
+		secondaryCommandBuffers.clear();
+		waterCulledCommandBuffers.clear();
+		recordingCommandPools.clear();
 	}
 
 	/*
-		Sample
+		The swap chain may come back with a different number of images after it has been recreated
+		Everything that is kept per swap chain image is recreated for the new image count, the device is idle at this point
 	*/
-
-	void buildCommandBuffers()
+	void recreatePerImageResources()
 	{
-		for (int32_t i = 0; i < commandBuffers.size(); i++) {
-			CommandBuffer *cb = commandBuffers[i];
-			cb->begin();
-
-			/*
-				CSM
-			*/
-			drawCSM(cb);
-
-			/*
-				Render refraction
-			*/	
-			{
-				cb->beginRenderPass(offscreenPass.renderPass, offscreenPass.refraction.frameBuffer);
-				cb->setViewport(0.0f, 0.0f, (float)offscreenPass.width, (float)offscreenPass.height, 0.0f, 1.0f);
-				cb->setScissor(0, 0, offscreenPass.width, offscreenPass.height);
-				drawScene(cb, SceneDrawType::sceneDrawTypeRefract);
-				cb->endRenderPass();
+		destroyThreadedCommandBuffers();
+		delete profiler;
+		for (auto& buffers : uniformBuffers) {
+			for (vks::Buffer* buffer : { &buffers.vsShared, &buffers.vsMirror, &buffers.vsOffScreen, &buffers.vsDebugQuad, &buffers.terrain, &buffers.sky, &buffers.CSM }) {
+				buffer->destroy();
 			}
-
-			/*
-				Render reflection
-			*/
-			{
-				cb->beginRenderPass(offscreenPass.renderPass, offscreenPass.reflection.frameBuffer);
-				cb->setViewport(0.0f, 0.0f, (float)offscreenPass.width, (float)offscreenPass.height, 0.0f, 1.0f);
-				cb->setScissor(0, 0, offscreenPass.width, offscreenPass.height);
-				drawScene(cb, SceneDrawType::sceneDrawTypeReflect);
-				cb->endRenderPass();
+		}
+		for (auto& buffer : depthPass.uniformBuffers) {
+			buffer.destroy();
+		}
+		for (auto& buffer : terrainDrawBuffers) {
+			buffer.destroy();
+		}
+		for (auto& buffers : propDrawBuffers) {
+			buffers.commands.destroy();
+			buffers.instanceIndices.destroy();
+		}
+		// Destroying the pool frees all sets allocated from it
+		vkDestroyDescriptorPool(device, descriptorPool->handle, nullptr);
+		delete descriptorPool;
+		for (auto& sets : descriptorSets) {
+			for (auto set : { sets.waterplane, sets.waterplaneScreenSpace, sets.debugquad, sets.terrain, sets.skysphere }) {
+				delete set;
 			}
+		}
+		for (auto set : depthPass.descriptorSets) {
+			delete set;
+		}
+		for (auto& cascade : cascades) {
+			delete cascade.descriptorSet;
+		}
+		delete cascadeDebug.descriptorSet;
 
-			/*
-				Scene rendering with reflection, refraction and shadows
-			*/
-			{
-				cb->beginRenderPass(renderPass, frameBuffers[i]);
-				cb->setViewport(0.0f, 0.0f, (float)width, (float)height, 0.0f, 1.0f);
-				cb->setScissor(0, 0, width, height);			
-				drawScene(cb, SceneDrawType::sceneDrawTypeDisplay);
-				// Reflection plane
-				cb->bindDescriptorSets(pipelineLayouts.textured, { descriptorSets.waterplane }, 0);
-				cb->bindPipeline(pipelines.mirror);
-				models.plane.draw(cb->handle);
-
-				if (debugDisplayReflection) {
-					uint32_t val0 = 0;
-					cb->bindDescriptorSets(pipelineLayouts.textured, { descriptorSets.debugquad }, 0);
-					cb->bindPipeline(pipelines.debug);
-					cb->updatePushConstant(pipelineLayouts.debug, 0, &val0);
-					cb->draw(6, 1, 0, 0);
-				}
+		prepareTerrainDrawBuffers();
+		preparePropDrawBuffers();
+		prepareUniformBuffers();
+		setupDescriptorPool();
+		setupDescriptorSet();
+		prepareThreadedCommandBuffers();
+		prepareProfiler();
+	}
 
-				if (debugDisplayRefraction) {
-					uint32_t val1 = 1;
-					cb->bindDescriptorSets(pipelineLayouts.textured, { descriptorSets.debugquad }, 0);
-					cb->bindPipeline(pipelines.debug);
-					cb->updatePushConstant(pipelineLayouts.debug, 0, &val1);
-					cb->draw(6, 1, 0, 0);
-				}
+	void buildShadowCommandBuffer(uint32_t imageIndex, uint32_t cascadeIndex)
+	{
+		VKS_ZONE("Record shadow cascade");
+		// The layer that this pass renders to is defined by the cascade's frame buffer
+		CommandBuffer* cb = shadowCommandBuffers[imageIndex].cascades[cascadeIndex];
+		const uint32_t scope = profilerScopes.cascades[cascadeIndex];
+		cb->begin();
+		profiler->reset(cb->handle, imageIndex, scope);
+		profiler->begin(cb->handle, imageIndex, scope);
+		cb->beginRenderPass(depthPass.renderPass, cascades[cascadeIndex].frameBuffer);
+		cb->setViewport(0, 0, (float)shadowMapSize, (float)shadowMapSize, 0.0f, 1.0f);
+		cb->setScissor(0, 0, shadowMapSize, shadowMapSize);
+		drawShadowCasters(cb, imageIndex, cascadeIndex);
+		cb->endRenderPass();
+		profiler->end(cb->handle, imageIndex, scope);
+		cb->end();
+	}
+
+	void buildLayeredShadowCommandBuffer(uint32_t imageIndex)
+	{
+		VKS_ZONE("Record shadow cascades");
+		// Single pass into the layered framebuffer, with the vertex shader selecting the cascade's layer by instance index
+		const CascadePushConstBlock pushConst = { glm::vec4(0.0f), 0 };
+		CommandBuffer* cb = shadowCommandBuffers[imageIndex].layered;
+		cb->begin();
+		profiler->reset(cb->handle, imageIndex, profilerScopes.layeredShadows);
+		profiler->begin(cb->handle, imageIndex, profilerScopes.layeredShadows);
+		cb->beginRenderPass(depthPass.renderPass, depth.frameBuffer);
+		cb->setViewport(0, 0, (float)shadowMapSize, (float)shadowMapSize, 0.0f, 1.0f);
+		cb->setScissor(0, 0, shadowMapSize, shadowMapSize);
+		cb->bindPipeline(pipelines.depthpassLayered);
+		cb->bindDescriptorSets(depthPass.pipelineLayout, { depthPass.descriptorSets[imageIndex] }, 0);
+		cb->updatePushConstant(depthPass.pipelineLayout, 0, &pushConst);
+		heightMap->drawIndirect(cb->handle, terrainDrawBuffers[imageIndex].buffer, terrainDrawListOffset(terrainDrawListCascadesLayered));
+		cb->endRenderPass();
+		profiler->end(cb->handle, imageIndex, profilerScopes.layeredShadows);
+		cb->end();
+	}
 
-				if (cascadeDebug.enabled) {
-					const CascadePushConstBlock pushConst = { glm::vec4(0.0f), cascadeDebug.cascadeIndex };
-					cb->bindDescriptorSets(cascadeDebug.pipelineLayout, { cascadeDebug.descriptorSet }, 0);
-					cb->bindPipeline(cascadeDebug.pipeline);
-					cb->updatePushConstant(cascadeDebug.pipelineLayout, 0, &pushConst);
-					cb->draw(6, 1, 0, 0);
+	void buildOffscreenCommandBuffer(CommandBuffer* cb, RenderGraph::PassHandle pass, uint32_t imageIndex, SceneDrawType drawType)
+	{
+		VKS_ZONE("Record offscreen pass");
+		// The queries are reset by the primary command buffer, as secondaries are executed inside the render pass
+		const uint32_t scope = (drawType == SceneDrawType::sceneDrawTypeRefract) ? profilerScopes.refraction : profilerScopes.reflection;
+		RenderGraph* graph = getOffscreenGraph(imageIndex);
+		cb->setInheritanceInfo(graph->getRenderPass(pass), graph->getFramebuffer(pass));
+		cb->begin();
+		profiler->begin(cb->handle, imageIndex, scope);
+		const VkExtent2D extent = graph->getExtent(pass);
+		const VkRect2D scissor = getOffscreenScissor(extent);
+		cb->setViewport(0.0f, 0.0f, (float)extent.width, (float)extent.height, 0.0f, 1.0f);
+		cb->setScissor(scissor.offset.x, scissor.offset.y, scissor.extent.width, scissor.extent.height);
+		drawScene(cb, imageIndex, drawType);
+		profiler->end(cb->handle, imageIndex, scope);
+		cb->end();
+	}
+
+	/*
+		Part of the offscreen targets sampled by the water plane
+		Only applied when recording per frame, as prerecorded command buffers can't follow the camera
+		Both targets are sampled at the plane's screen position (see mirror.frag), the margin covers the normal map distortion
+	*/
+	VkRect2D getOffscreenScissor(VkExtent2D extent)
+	{
+		VkRect2D scissor = { { 0, 0 }, extent };
+		if (!perFrameRecording || !waterCulling) {
+			return scissor;
+		}
+		const float margin = 0.05f;
+		const glm::vec4 uv = waterVisibility.screenRect * 0.5f + 0.5f;
+		const glm::vec2 lower = glm::clamp(glm::vec2(uv.x, uv.y) - margin, 0.0f, 1.0f);
+		const glm::vec2 upper = glm::clamp(glm::vec2(uv.z, uv.w) + margin, 0.0f, 1.0f);
+		scissor.offset.x = static_cast<int32_t>(floor(lower.x * extent.width));
+		scissor.offset.y = static_cast<int32_t>(floor(lower.y * extent.height));
+		scissor.extent.width = static_cast<uint32_t>(ceil(upper.x * extent.width)) - scissor.offset.x;
+		scissor.extent.height = static_cast<uint32_t>(ceil(upper.y * extent.height)) - scissor.offset.y;
+		return scissor;
+	}
+
+	// Scene without the water plane, rendered into the screen space reflection graph's targets
+	void buildOpaqueCommandBuffer(uint32_t imageIndex)
+	{
+		VKS_ZONE("Record opaque pass");
+		CommandBuffer* cb = secondaryCommandBuffers[imageIndex].opaque;
+		RenderGraph* graph = offscreenPass.screenSpaceGraph;
+		cb->setInheritanceInfo(graph->getRenderPass(offscreenPass.scene.pass), graph->getFramebuffer(offscreenPass.scene.pass));
+		cb->begin();
+		profiler->begin(cb->handle, imageIndex, profilerScopes.opaque);
+		cb->setViewport(0.0f, 0.0f, (float)width, (float)height, 0.0f, 1.0f);
+		cb->setScissor(0, 0, width, height);
+		drawScene(cb, imageIndex, SceneDrawType::sceneDrawTypeDisplay);
+		profiler->end(cb->handle, imageIndex, profilerScopes.opaque);
+		cb->end();
+	}
+
+	// The water culled variant draws neither the water plane nor the debug displays of the offscreen targets, as these aren't rendered
+	void buildSceneCommandBuffer(uint32_t imageIndex, bool water)
+	{
+		VKS_ZONE("Record scene pass");
+		CommandBuffer* cb = water ? secondaryCommandBuffers[imageIndex].scene : secondaryCommandBuffers[imageIndex].sceneWaterCulled;
+		const bool drawWater = water && reflections;
+		const bool screenSpace = drawWater && reflectionMode == reflectionModeScreenSpace;
+		// The offscreen targets are only rendered for planar reflections
+		const bool offscreenTargets = drawWater && !screenSpace;
+		cb->setInheritanceInfo(renderPass, frameBuffers[imageIndex]);
+		cb->begin();
+		profiler->begin(cb->handle, imageIndex, profilerScopes.scene);
+		cb->setViewport(0.0f, 0.0f, (float)width, (float)height, 0.0f, 1.0f);
+		cb->setScissor(0, 0, width, height);
+		if (screenSpace) {
+			// The scene has already been rendered by the opaque pass, copy it's color and depth so the water is depth tested against it
+			cb->bindDescriptorSets(pipelineLayouts.textured, { descriptorSets[imageIndex].waterplaneScreenSpace }, 0);
+			cb->bindPipeline(pipelines.composite);
+			cb->draw(3, 1, 0, 0);
+			cb->bindPipeline(pipelines.mirrorScreenSpace);
+			models.plane.draw(cb->handle);
+		} else {
+			drawScene(cb, imageIndex, SceneDrawType::sceneDrawTypeDisplay);
+		}
+		// Reflection plane
+		if (offscreenTargets) {
+			cb->bindDescriptorSets(pipelineLayouts.textured, { descriptorSets[imageIndex].waterplane }, 0);
+			cb->bindPipeline(pipelines.mirror);
+			models.plane.draw(cb->handle);
+		}
+
+		if (debugDisplayReflection && offscreenTargets) {
+			uint32_t val0 = 0;
+			cb->bindDescriptorSets(pipelineLayouts.textured, { descriptorSets[imageIndex].debugquad }, 0);
+			cb->bindPipeline(pipelines.debug);
+			cb->updatePushConstant(pipelineLayouts.debug, 0, &val0);
+			cb->draw(6, 1, 0, 0);
+		}
+
+		if (debugDisplayRefraction && offscreenTargets) {
+			uint32_t val1 = 1;
+			cb->bindDescriptorSets(pipelineLayouts.textured, { descriptorSets[imageIndex].debugquad }, 0);
+			cb->bindPipeline(pipelines.debug);
+			cb->updatePushConstant(pipelineLayouts.debug, 0, &val1);
+			cb->draw(6, 1, 0, 0);
+		}
+
+		if (cascadeDebug.enabled) {
+			const CascadePushConstBlock pushConst = { glm::vec4(0.0f), cascadeDebug.cascadeIndex };
+			cb->bindDescriptorSets(cascadeDebug.pipelineLayout, { cascadeDebug.descriptorSet }, 0);
+			cb->bindPipeline(cascadeDebug.pipeline);
+			cb->updatePushConstant(cascadeDebug.pipelineLayout, 0, &pushConst);
+			cb->draw(6, 1, 0, 0);
+		}
+
+		profiler->end(cb->handle, imageIndex, profilerScopes.scene);
+
+		profiler->begin(cb->handle, imageIndex, profilerScopes.ui);
+		drawUI(cb->handle, imageIndex);
+		profiler->end(cb->handle, imageIndex, profilerScopes.ui);
+		cb->end();
+	}
+
+	// Selects the cascades to be re-rendered this frame, applies their new matrices and adds their command buffers to the submission
+	void selectCascadeUpdates(uint32_t imageIndex, std::vector<VkCommandBuffer>& submitCommandBuffers)
+	{
+		std::array<bool, MAX_SHADOW_MAP_CASCADE_COUNT> update{};
+		if (!cachedCascades) {
+			update.fill(true);
+		} else {
+			// The nearest cascade is always kept up to date
+			update[0] = cascades[0].dirty;
+			bool farCascadeSelected = false;
+			for (uint32_t n = 0; n < cascadeCount - 1; n++) {
+				const uint32_t i = 1 + (cascadeRoundRobinIndex - 1 + n) % (cascadeCount - 1);
+				if (!cascades[i].dirty) {
+					continue;
+				}
+				// Cascades that have never been rendered can't be deferred
+				if (!roundRobinCascades || !cascades[i].rendered) {
+					update[i] = true;
+					continue;
+				}
+				// Otherwise only take the next dirty far cascade
+				if (!farCascadeSelected) {
+					update[i] = true;
+					farCascadeSelected = true;
+					cascadeRoundRobinIndex = i % (cascadeCount - 1) + 1;
 				}
+			}
+		}
+
+		const bool layered = layeredShadowPass && pipelines.depthpassLayered;
+		if (layered && std::find(update.begin(), update.end(), true) != update.end()) {
+			// The layered pass clears and renders all cascades at once
+			update.fill(true);
+		}
+
+		cascadesSubmitted = update;
+		cascadesUpdated = 0;
+		for (uint32_t i = 0; i < cascadeCount; i++) {
+			if (!update[i]) {
+				continue;
+			}
+			cascades[i].viewProjMatrix = cascades[i].pendingViewProjMatrix;
+			cascades[i].dirty = false;
+			cascades[i].rendered = true;
+			cascadesUpdated++;
+			if (!layered) {
+				submitCommandBuffers.push_back(shadowCommandBuffers[imageIndex].cascades[i]->handle);
+				profiler->submitted(imageIndex, profilerScopes.cascades[i]);
+			}
+		}
+		if (layered && cascadesUpdated > 0) {
+			submitCommandBuffers.push_back(shadowCommandBuffers[imageIndex].layered->handle);
+			profiler->submitted(imageIndex, profilerScopes.layeredShadows);
+		}
+	}
+
+	/*
+		Sample
+	*/
 
-				drawUI(cb->handle);
+	/*
+		Record all passes of a swap chain image as jobs on the thread pool, jobs of multiple images may be in flight at once
 
-				cb->endRenderPass();
+		Shadow cascades are primary command buffers that are only submitted if a cascade needs to be updated (see selectCascadeUpdates)
+		Refraction, reflection and the scene are recorded to secondary command buffers executed by the swap chain image's primary command buffer
+		If supported, all cascades can also be rendered in a single pass into a layered frame buffer (layer selected in the vertex shader)
+		The passes of frames with a visible water plane and the scene of frames with a culled water plane are recorded separately
+	*/
+	void recordPasses(uint32_t imageIndex, const std::array<bool, MAX_SHADOW_MAP_CASCADE_COUNT>& cascadeMask, bool layered, bool waterVisible, bool waterCulled)
+	{
+		const uint32_t i = imageIndex;
+		for (uint32_t j = 0; j < cascadeCount; j++) {
+			if (cascadeMask[j]) {
+				threadPool.run(threadPool.createJob([=] { buildShadowCommandBuffer(i, j); }));
+			}
+		}
+		if (layered) {
+			threadPool.run(threadPool.createJob([=] { buildLayeredShadowCommandBuffer(i); }));
+		}
+		if (waterVisible && reflections) {
+			if (reflectionMode == reflectionModeScreenSpace) {
+				threadPool.run(threadPool.createJob([=] { buildOpaqueCommandBuffer(i); }));
+			} else {
+				threadPool.run(threadPool.createJob([=] {
+					buildOffscreenCommandBuffer(secondaryCommandBuffers[i].refraction, offscreenPass.refraction.pass, i, SceneDrawType::sceneDrawTypeRefract);
+				}));
+				threadPool.run(threadPool.createJob([=] {
+					buildOffscreenCommandBuffer(secondaryCommandBuffers[i].reflection, offscreenPass.reflection.pass, i, SceneDrawType::sceneDrawTypeReflect);
+				}));
 			}
-			cb->end();
+		}
+		if (waterVisible) {
+			threadPool.run(threadPool.createJob([=] { buildSceneCommandBuffer(i, true); }));
+		}
+		if (waterCulled) {
+			threadPool.run(threadPool.createJob([=] { buildSceneCommandBuffer(i, false); }));
+		}
+	}
+
+	// Graph of the dynamic resolution level an image was last set up for
+	RenderGraph* getOffscreenGraph(uint32_t imageIndex)
+	{
+		return offscreenPass.graphs[offscreenPass.imageLevels[imageIndex]];
+	}
+
+	// Graph of the current reflection mode, or the one without offscreen passes if the water plane isn't visible
+	RenderGraph* getFrameGraph(uint32_t imageIndex, bool waterVisible)
+	{
+		if (!waterVisible) {
+			return offscreenPass.waterCulledGraph;
+		}
+		return (reflectionMode == reflectionModeScreenSpace) ? offscreenPass.screenSpaceGraph : getOffscreenGraph(imageIndex);
+	}
+
+	CommandBuffer* getFrameCommandBuffer(uint32_t imageIndex)
+	{
+		return waterVisibility.visible ? commandBuffers[imageIndex] : waterCulledCommandBuffers[imageIndex];
+	}
+
+	// Executes the secondary command buffers of an image, which have to be recorded before
+	void buildPrimaryCommandBuffer(CommandBuffer* cb, RenderGraph* graph, uint32_t imageIndex)
+	{
+		VKS_ZONE("Record primary");
+		cb->begin();
+		for (uint32_t scope : { profilerScopes.refraction, profilerScopes.reflection, profilerScopes.opaque, profilerScopes.scene, profilerScopes.ui, profilerScopes.frame }) {
+			profiler->reset(cb->handle, imageIndex, scope);
+		}
+		profiler->begin(cb->handle, imageIndex, profilerScopes.frame);
+		// Offscreen passes and the scene in dependency order, with the barriers between them
+		graph->execute(cb, imageIndex);
+		profiler->end(cb->handle, imageIndex, profilerScopes.frame);
+		cb->end();
+	}
+
+	void buildCommandBuffers()
+	{
+		if (shadowCommandBuffers.size() != commandBuffers.size()) {
+			recreatePerImageResources();
+		}
+		// The acquired image's command buffers are recorded right before they are submitted
+		if (perFrameRecording) {
+			return;
+		}
+		VKS_ZONE("Command buffer recording");
+		auto tStart = std::chrono::high_resolution_clock::now();
+		std::array<bool, MAX_SHADOW_MAP_CASCADE_COUNT> allCascades;
+		allCascades.fill(true);
+		// Both water plane variants are recorded, draw selects the one to submit
+		for (uint32_t i = 0; i < commandBuffers.size(); i++) {
+			recordPasses(i, allCascades, pipelines.depthpassLayered != nullptr, true, true);
+		}
+		threadPool.wait();
+		for (uint32_t i = 0; i < commandBuffers.size(); i++) {
+			buildPrimaryCommandBuffer(commandBuffers[i], getFrameGraph(i, true), i);
+			buildPrimaryCommandBuffer(waterCulledCommandBuffers[i], getFrameGraph(i, false), i);
+		}
+		recordingTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - tStart).count();
+	}
+
+	/*
+		Record the command buffers of an image for the current frame
+		The image's previous submission has finished, so all of it's pools can be reset at once instead of resetting each command buffer
+		Only the shadow cascades that are submitted this frame and the water plane variant of this frame are recorded
+	*/
+	void recordFrameCommandBuffers(uint32_t imageIndex, const std::vector<VkCommandBuffer>& submitCommandBuffers)
+	{
+		VKS_ZONE("Command buffer recording");
+		auto tStart = std::chrono::high_resolution_clock::now();
+		for (auto pool : recordingCommandPools[imageIndex]) {
+			pool->reset();
+		}
+		auto submitted = [&submitCommandBuffers](CommandBuffer* cb) {
+			return std::find(submitCommandBuffers.begin(), submitCommandBuffers.end(), cb->handle) != submitCommandBuffers.end();
+		};
+		std::array<bool, MAX_SHADOW_MAP_CASCADE_COUNT> cascadeMask{};
+		for (uint32_t j = 0; j < cascadeCount; j++) {
+			cascadeMask[j] = submitted(shadowCommandBuffers[imageIndex].cascades[j]);
+		}
+		recordPasses(imageIndex, cascadeMask, submitted(shadowCommandBuffers[imageIndex].layered), waterVisibility.visible, !waterVisibility.visible);
+		threadPool.wait();
+		buildPrimaryCommandBuffer(getFrameCommandBuffer(imageIndex), getFrameGraph(imageIndex, waterVisibility.visible), imageIndex);
+		recordingTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - tStart).count();
+	}
+
+	virtual void getEnabledFeatures()
+	{
+		// Allows drawing all terrain chunks with a single indirect draw
+		if (deviceFeatures.multiDrawIndirect) {
+			enabledFeatures.multiDrawIndirect = VK_TRUE;
+		}
+		// Allows drawing all prop batches with a single indirect draw, without rebinding the instance indices per batch
+		if (deviceFeatures.drawIndirectFirstInstance) {
+			enabledFeatures.drawIndirectFirstInstance = VK_TRUE;
+		}
+		// Block compressed texture formats, the textures fall back to uncompressed files if none are supported
+		if (deviceFeatures.textureCompressionBC) {
+			enabledFeatures.textureCompressionBC = VK_TRUE;
+		}
+		if (deviceFeatures.textureCompressionASTC_LDR) {
+			enabledFeatures.textureCompressionASTC_LDR = VK_TRUE;
+		}
+		if (deviceFeatures.textureCompressionETC2) {
+			enabledFeatures.textureCompressionETC2 = VK_TRUE;
+		}
+		// Optional tessellated terrain
+		if (deviceFeatures.tessellationShader) {
+			enabledFeatures.tessellationShader = VK_TRUE;
+		}
+		// Optional single pass cascade rendering
+		if (vulkanDevice->extensionSupported(VK_EXT_SHADER_VIEWPORT_INDEX_LAYER_EXTENSION_NAME)) {
+			enabledDeviceExtensions.push_back(VK_EXT_SHADER_VIEWPORT_INDEX_LAYER_EXTENSION_NAME);
+			layeredShadowPassSupported = true;
 		}
 	}
 
 	void loadAssets()
 	{
-		models.skysphere.loadFromFile(getAssetPath() + "scenes/geosphere.gltf", vulkanDevice, queue);
-		models.plane.loadFromFile(getAssetPath() + "scenes/plane.gltf", vulkanDevice, queue);
-		models.testscene.loadFromFile(getAssetPath() + "scenes/testscene.gltf", vulkanDevice, queue);
-				
-		textures.skySphere.loadFromFile(getAssetPath() + "textures/skysphere_02.ktx", VK_FORMAT_R8G8B8A8_UNORM, vulkanDevice, queue);
-		textures.terrainArray.loadFromFile(getAssetPath() + "textures/terrain_layers_01_rgba.ktx", VK_FORMAT_R8G8B8A8_UNORM, vulkanDevice, queue);
-		textures.heightMap.loadFromFile(getAssetPath() + "heightmap.ktx", VK_FORMAT_R16_UNORM, vulkanDevice, queue);
-		textures.waterNormalMap.loadFromFile(getAssetPath() + "textures/water_normal_rgba.ktx", VK_FORMAT_R8G8B8A8_UNORM, vulkanDevice, queue);
+		// Files are decoded on the thread pool, the height map file is shared by the texture and the terrain meshes
+		vks::AssetLoader assetLoader(vulkanDevice, queue, &threadPool);
+		assetLoader.addModel(&models.skysphere, getAssetPath() + "scenes/geosphere.gltf");
+		assetLoader.addModel(&models.plane, getAssetPath() + "scenes/plane.gltf");
+		assetLoader.addModel(&models.testscene, getAssetPath() + "scenes/testscene.gltf");
+
+		// Color textures use a block compressed copy if there is one in a format the device supports, falling back to the uncompressed RGBA file
+		// The water normal map uses all four channels in the shader, so it's not stored in a two channel format like BC5
+		auto selectColorTexture = [this](const std::string& basename, const std::string& uncompressedSuffix, std::string& filename) {
+			std::vector<vks::TextureVariant> variants = vks::getCompressedColorVariants();
+			variants.push_back({ uncompressedSuffix, VK_FORMAT_R8G8B8A8_UNORM });
+			return vks::selectTextureVariant(physicalDevice, getAssetPath() + basename, variants, filename);
+		};
+		std::string filename;
+		VkFormat format = selectColorTexture("textures/skysphere_02", "", filename);
+		assetLoader.addTexture2D(&textures.skySphere, filename, format);
+		format = selectColorTexture("textures/terrain_layers_01", "_rgba", filename);
+		assetLoader.addTexture2DArray(&textures.terrainArray, filename, format);
+		heightMapTiles = new vks::TiledTexture(vulkanDevice, queue);
+		if (terrainStreaming) {
+			// One coarse texel per terrain grid vertex, which is all the normal map bake reads
+			assetLoader.addTiledTexture(heightMapTiles, &textures.heightMap, getAssetPath() + "heightmap.ktx", VK_FORMAT_R16_UNORM, terrainPatchSize);
+		} else {
+			assetLoader.addTexture2D(&textures.heightMap, getAssetPath() + "heightmap.ktx", VK_FORMAT_R16_UNORM);
+		}
+		format = selectColorTexture("textures/water_normal", "_rgba", filename);
+		assetLoader.addTexture2D(&textures.waterNormalMap, filename, format);
+		generateTerrain(assetLoader);
+
+		assetLoader.load();
+		assetLoader.printTimings();
+		assetLoadTimings = assetLoader.timings;
+		assetLoadTime = assetLoader.totalTime;
 
 		VkSamplerCreateInfo samplerInfo = vks::initializers::samplerCreateInfo();
 
@@ -821,25 +1789,185 @@ public:
 	}
 
 	// Generate a terrain quad patch for feeding to the tessellation control shader
-	void generateTerrain()
+	// The meshes are built by the asset loader once the height map file has been loaded
+	void generateTerrain(vks::AssetLoader &assetLoader)
 	{
 		const glm::vec3 scale = glm::vec3(0.15f * 0.25f, 1.0f, 0.15f * 0.25f);
-		const uint32_t patchSize = 256;
+		const uint32_t patchSize = terrainPatchSize;
 		heightMap = new vks::HeightMap(vulkanDevice, queue);
-#if defined(__ANDROID__)
-		heightMap->loadFromFile(getAssetPath() + "heightmap.ktx", patchSize, androidApp->activity->assetManager, scale, vks::HeightMap::topologyTriangles);
-#else
-		heightMap->loadFromFile(getAssetPath() + "heightmap.ktx", patchSize, scale, vks::HeightMap::topologyTriangles);
-#endif
+		heightMap->threadPool = &threadPool;
+		if (terrainLodDistance > 0.0f) {
+			heightMap->lodDistance = terrainLodDistance;
+		}
+		heightMap->indexCache = &terrainIndexCache;
+		heightMap->triangleStrips = true;
+		heightMap->streaming = terrainStreaming;
+		// Assets of the same file are created in the order they were added, so the tiles are loaded before the height map reads its streamed chunks from them
+		if (terrainStreaming) {
+			heightMap->streamingTiles = heightMapTiles;
+		}
+		// The terrain fragment shader takes the normals from the baked normal map instead
+		heightMap->vertexNormals = !terrainNormalBakeSupported();
+		// Use the compact vertex layout if the shaders decoding it have been compiled to SPIR-V
+		packedTerrainVertices = vks::tools::fileExists(getAssetPath() + "shaders/terrain_packed.vert.spv") && vks::tools::fileExists(getAssetPath() + "shaders/depthpass_packed.vert.spv");
+		heightMap->vertexFormat = packedTerrainVertices ? vks::HeightMap::vertexFormatPacked : vks::HeightMap::vertexFormatFloat;
+		assetLoader.addHeightMap(heightMap, getAssetPath() + "heightmap.ktx", patchSize, scale, vks::HeightMap::topologyTriangles);
+		if (deviceFeatures.tessellationShader) {
+			// A quarter of the resolution, with the quads covering the same area as the triangle mesh
+			const uint32_t tessPatchSize = patchSize / 4;
+			const glm::vec3 tessScale = scale * glm::vec3((float)(patchSize - 1) / (float)(tessPatchSize - 1), 1.0f, (float)(patchSize - 1) / (float)(tessPatchSize - 1));
+			heightMapTessellated = new vks::HeightMap(vulkanDevice, queue);
+			heightMapTessellated->threadPool = &threadPool;
+			heightMapTessellated->indexCache = &terrainIndexCache;
+			// The evaluation shader derives the normals from the height map
+			heightMapTessellated->vertexNormals = false;
+			assetLoader.addHeightMap(heightMapTessellated, getAssetPath() + "heightmap.ktx", tessPatchSize, tessScale, vks::HeightMap::topologyQuads);
+			uboTerrain.tessellation.y = heightMapTessellated->heightScale * scale.y;
+			uboTerrain.tessellation.w = 1.0f / (float)patchSize;
+		}
+	}
+
+	// The normal map can only be baked if the compute shaders have been compiled to SPIR-V
+	bool terrainNormalBakeSupported()
+	{
+		return vks::tools::fileExists(getAssetPath() + "shaders/terrain_normals.comp.spv") && vks::tools::fileExists(getAssetPath() + "shaders/base/downsample.comp.spv") && vks::MipGenerator::supported(vulkanDevice);
+	}
+
+	/*
+		Bake the terrain normals from the height map texture with a compute shader and generate the normal map's mip chain on the GPU
+		The vertex normals are only built on the CPU if the compute shaders are not available, the terrain shaders use them instead of the normal map then
+		As the normals are derived from the height map on the device, edits to the height map only require running the bake again
+	*/
+	void bakeTerrainNormalMap()
+	{
+		const std::string normalShader = getAssetPath() + "shaders/terrain_normals.comp.spv";
+		const std::string downsampleShader = getAssetPath() + "shaders/base/downsample.comp.spv";
+		if (!terrainNormalBakeSupported()) {
+			return;
+		}
+
+		vks::Texture2D& normalMap = textures.terrainNormalMap;
+		normalMap.device = vulkanDevice;
+		normalMap.width = terrainPatchSize;
+		normalMap.height = terrainPatchSize;
+		normalMap.mipLevels = static_cast<uint32_t>(floor(log2(terrainPatchSize))) + 1;
+		normalMap.layerCount = 1;
+		normalMap.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		VkImageCreateInfo imageCI = vks::initializers::imageCreateInfo();
+		imageCI.imageType = VK_IMAGE_TYPE_2D;
+		imageCI.format = VK_FORMAT_R8G8B8A8_UNORM;
+		imageCI.extent = { normalMap.width, normalMap.height, 1 };
+		imageCI.mipLevels = normalMap.mipLevels;
+		imageCI.arrayLayers = 1;
+		imageCI.samples = VK_SAMPLE_COUNT_1_BIT;
+		imageCI.tiling = VK_IMAGE_TILING_OPTIMAL;
+		imageCI.usage = VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+		VK_CHECK_RESULT(vkCreateImage(device, &imageCI, nullptr, &normalMap.image));
+		normalMap.deviceMemory = vulkanDevice->allocateImageMemory(normalMap.image, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+		VkImageViewCreateInfo viewCI = vks::initializers::imageViewCreateInfo();
+		viewCI.viewType = VK_IMAGE_VIEW_TYPE_2D;
+		viewCI.format = imageCI.format;
+		viewCI.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, normalMap.mipLevels, 0, 1 };
+		viewCI.image = normalMap.image;
+		VK_CHECK_RESULT(vkCreateImageView(device, &viewCI, nullptr, &normalMap.view));
+		// The bake writes the first level through a storage view of that level only
+		VkImageView storageView;
+		viewCI.subresourceRange.levelCount = 1;
+		VK_CHECK_RESULT(vkCreateImageView(device, &viewCI, nullptr, &storageView));
+
+		VkSamplerCreateInfo samplerInfo = vks::initializers::samplerCreateInfo();
+		samplerInfo.magFilter = VK_FILTER_LINEAR;
+		samplerInfo.minFilter = VK_FILTER_LINEAR;
+		samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+		samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+		samplerInfo.addressModeV = samplerInfo.addressModeU;
+		samplerInfo.addressModeW = samplerInfo.addressModeU;
+		samplerInfo.compareOp = VK_COMPARE_OP_NEVER;
+		samplerInfo.minLod = 0.0f;
+		samplerInfo.maxLod = (float)normalMap.mipLevels;
+		samplerInfo.borderColor = VK_BORDER_COLOR_FLOAT_OPAQUE_WHITE;
+		VK_CHECK_RESULT(vkCreateSampler(device, &samplerInfo, nullptr, &normalMap.sampler));
+		normalMap.updateDescriptor();
+
+		// Compute resources are only needed for the bake
+		DescriptorSetLayout* setLayout = new DescriptorSetLayout(device);
+		setLayout->addBinding(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_COMPUTE_BIT);
+		setLayout->addBinding(1, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, VK_SHADER_STAGE_COMPUTE_BIT);
+		setLayout->create();
+		struct PushConstants {
+			int32_t patchSize;
+			int32_t stride;
+			float heightScale;
+		} pushConstants;
+		PipelineLayout* layout = new PipelineLayout(device);
+		layout->addLayout(setLayout);
+		layout->addPushConstantRange(sizeof(PushConstants), 0, VK_SHADER_STAGE_COMPUTE_BIT);
+		layout->create();
+		Pipeline* pipeline = new Pipeline(device);
+		pipeline->setCache(pipelineCache);
+		pipeline->setLayout(layout);
+		pipeline->addShader(normalShader);
+		pipeline->create();
+		DescriptorPool* pool = new DescriptorPool(device);
+		pool->setMaxSets(1);
+		pool->addPoolSize(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1);
+		pool->addPoolSize(VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1);
+		pool->create();
+		VkDescriptorImageInfo storageDescriptor = { VK_NULL_HANDLE, storageView, VK_IMAGE_LAYOUT_GENERAL };
+		DescriptorSet* set = new DescriptorSet(device);
+		set->setPool(pool);
+		set->addLayout(setLayout);
+		set->addDescriptor(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, &textures.heightMap.descriptor);
+		set->addDescriptor(1, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, &storageDescriptor);
+		set->create();
+		vks::MipGenerator* mipGenerator = new vks::MipGenerator(vulkanDevice, downsampleShader, pipelineCache, 1);
+
+		// Recorded after the height map upload on the graphics queue
+		vks::StagingUploader* uploader = vulkanDevice->stagingUploader;
+		VkCommandBuffer commandBuffer = uploader->getGraphicsCommandBuffer();
+		VkImageMemoryBarrier imageBarrier = vks::initializers::imageMemoryBarrier();
+		imageBarrier.image = normalMap.image;
+		imageBarrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+		imageBarrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		imageBarrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+		imageBarrier.srcAccessMask = 0;
+		imageBarrier.dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &imageBarrier);
+		pushConstants.patchSize = static_cast<int32_t>(terrainPatchSize);
+		// 1 for the coarse level of a streamed height map, which keeps exactly the texels read here
+		pushConstants.stride = static_cast<int32_t>(textures.heightMap.width / terrainPatchSize);
+		pushConstants.heightScale = heightMap->heightScale;
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline->getHandle());
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, layout->handle, 0, 1, &set->handle, 0, nullptr);
+		vkCmdPushConstants(commandBuffer, layout->handle, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(PushConstants), &pushConstants);
+		vkCmdDispatch(commandBuffer, (terrainPatchSize + 15) / 16, (terrainPatchSize + 15) / 16, 1);
+		mipGenerator->generate(commandBuffer, normalMap.image, normalMap.width, normalMap.height, normalMap.mipLevels, VK_IMAGE_LAYOUT_GENERAL, normalMap.imageLayout);
+		uploader->waitIdle();
+
+		delete mipGenerator;
+		vkDestroyImageView(device, storageView, nullptr);
+		vkDestroyDescriptorPool(device, pool->handle, nullptr);
+		vkDestroyPipelineLayout(device, layout->handle, nullptr);
+		vkDestroyDescriptorSetLayout(device, setLayout->handle, nullptr);
+		delete set;
+		delete pool;
+		delete pipeline;
+		delete layout;
+		delete setLayout;
+		terrainNormalMapBaked = true;
 	}
 
 	void setupDescriptorPool()
 	{
 		// @todo: proper sizes
+		// Scene and depth pass sets are allocated per swap chain image
+		const uint32_t imageCount = static_cast<uint32_t>(uniformBuffers.size());
 		descriptorPool = new DescriptorPool(device);
-		descriptorPool->setMaxSets(16);
-		descriptorPool->addPoolSize(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 32);
-		descriptorPool->addPoolSize(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 32);
+		descriptorPool->setMaxSets(8 * imageCount + 8);
+		descriptorPool->addPoolSize(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 8 * imageCount + 8);
+		descriptorPool->addPoolSize(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 20 * imageCount + 16);
+		descriptorPool->addPoolSize(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, imageCount);
 		descriptorPool->create();
 	}
 
@@ -867,16 +1995,20 @@ public:
 
 		// Terrain
 		descriptorSetLayouts.terrain = new DescriptorSetLayout(device);
-		descriptorSetLayouts.terrain->addBinding(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT);
-		descriptorSetLayouts.terrain->addBinding(1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT);
+		descriptorSetLayouts.terrain->addBinding(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_TESSELLATION_CONTROL_BIT | VK_SHADER_STAGE_TESSELLATION_EVALUATION_BIT | VK_SHADER_STAGE_FRAGMENT_BIT);
+		descriptorSetLayouts.terrain->addBinding(1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_TESSELLATION_CONTROL_BIT | VK_SHADER_STAGE_TESSELLATION_EVALUATION_BIT | VK_SHADER_STAGE_FRAGMENT_BIT);
 		descriptorSetLayouts.terrain->addBinding(2, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT);
 		descriptorSetLayouts.terrain->addBinding(3, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT);
 		descriptorSetLayouts.terrain->addBinding(4, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT);
+		descriptorSetLayouts.terrain->addBinding(5, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT);
+		// Streamed height map tiles and the page table locating them
+		descriptorSetLayouts.terrain->addBinding(6, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_TESSELLATION_EVALUATION_BIT | VK_SHADER_STAGE_FRAGMENT_BIT);
+		descriptorSetLayouts.terrain->addBinding(7, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_TESSELLATION_EVALUATION_BIT | VK_SHADER_STAGE_FRAGMENT_BIT);
 		descriptorSetLayouts.terrain->create();
 
 		pipelineLayouts.terrain = new PipelineLayout(device);
 		pipelineLayouts.terrain->addLayout(descriptorSetLayouts.terrain);
-		pipelineLayouts.terrain->addPushConstantRange(sizeof(glm::mat4) + sizeof(glm::vec4) + sizeof(uint32_t), 0, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT);
+		pipelineLayouts.terrain->addPushConstantRange(sizeof(glm::mat4) + sizeof(glm::vec4) + sizeof(uint32_t), 0, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_TESSELLATION_CONTROL_BIT | VK_SHADER_STAGE_TESSELLATION_EVALUATION_BIT | VK_SHADER_STAGE_FRAGMENT_BIT);
 		pipelineLayouts.terrain->create();
 
 		// Skysphere
@@ -890,6 +2022,13 @@ public:
 		pipelineLayouts.sky->addPushConstantRange(sizeof(glm::mat4) + sizeof(glm::vec4) + sizeof(uint32_t), 0, VK_SHADER_STAGE_VERTEX_BIT);
 		pipelineLayouts.sky->create();
 
+		// Props use the terrain's scene uniforms and the instance data of the model
+		pipelineLayouts.props = new PipelineLayout(device);
+		pipelineLayouts.props->addLayout(descriptorSetLayouts.terrain);
+		pipelineLayouts.props->addLayout(models.testscene.descriptorSetLayout);
+		pipelineLayouts.props->addPushConstantRange(sizeof(glm::mat4) + sizeof(glm::vec4) + sizeof(uint32_t), 0, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_TESSELLATION_CONTROL_BIT | VK_SHADER_STAGE_TESSELLATION_EVALUATION_BIT | VK_SHADER_STAGE_FRAGMENT_BIT);
+		pipelineLayouts.props->create();
+
 		// Depth pass
 		depthPass.descriptorSetLayout = new DescriptorSetLayout(device);
 		depthPass.descriptorSetLayout->addBinding(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_VERTEX_BIT);
@@ -916,44 +2055,70 @@ public:
 	{
 		VkDescriptorImageInfo depthMapDescriptor = vks::initializers::descriptorImageInfo(depth.sampler, depth.view->handle, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL);
 
-		// Water plane
-		descriptorSets.waterplane = new DescriptorSet(device);
-		descriptorSets.waterplane->setPool(descriptorPool);
-		descriptorSets.waterplane->addLayout(descriptorSetLayouts.textured);
-		descriptorSets.waterplane->addDescriptor(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, &uniformBuffers.vsMirror.descriptor);
-		descriptorSets.waterplane->addDescriptor(1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, &offscreenPass.refraction.descriptor);
-		descriptorSets.waterplane->addDescriptor(2, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, &offscreenPass.reflection.descriptor);
-		descriptorSets.waterplane->addDescriptor(3, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, &textures.waterNormalMap.descriptor);
-		descriptorSets.waterplane->addDescriptor(4, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, &depthMapDescriptor);
-		descriptorSets.waterplane->addDescriptor(5, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, &uniformBuffers.CSM.descriptor);
-		descriptorSets.waterplane->create();
-			   			   		
-		// Debug quad
-		descriptorSets.debugquad = new DescriptorSet(device);
-		descriptorSets.debugquad->setPool(descriptorPool);
-		descriptorSets.debugquad->addLayout(descriptorSetLayouts.textured);
-		descriptorSets.debugquad->addDescriptor(1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, &offscreenPass.reflection.descriptor);
-		descriptorSets.debugquad->addDescriptor(2, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, &offscreenPass.refraction.descriptor);
-		descriptorSets.debugquad->create();
-
-		// Terrain
-		descriptorSets.terrain = new DescriptorSet(device);
-		descriptorSets.terrain->setPool(descriptorPool);
-		descriptorSets.terrain->addLayout(descriptorSetLayouts.terrain);
-		descriptorSets.terrain->addDescriptor(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, &uniformBuffers.terrain.descriptor);
-		descriptorSets.terrain->addDescriptor(1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, &textures.heightMap.descriptor);
-		descriptorSets.terrain->addDescriptor(2, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, &textures.terrainArray.descriptor);
-		descriptorSets.terrain->addDescriptor(3, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, &depthMapDescriptor);
-		descriptorSets.terrain->addDescriptor(4, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, &uniformBuffers.CSM.descriptor);
-		descriptorSets.terrain->create();
-
-		// Skysphere
-		descriptorSets.skysphere = new DescriptorSet(device);
-		descriptorSets.skysphere->setPool(descriptorPool);
-		descriptorSets.skysphere->addLayout(descriptorSetLayouts.skysphere);
-		descriptorSets.skysphere->addDescriptor(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, &uniformBuffers.sky.descriptor);
-		descriptorSets.skysphere->addDescriptor(1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, &textures.skySphere.descriptor);
-		descriptorSets.skysphere->create();
+		// All images start out at the current dynamic resolution level
+		updateOffscreenDescriptors(dynamicResolution.getLevel());
+		offscreenPass.imageLevels.assign(uniformBuffers.size(), dynamicResolution.getLevel());
+		descriptorSets.resize(uniformBuffers.size());
+		for (size_t i = 0; i < descriptorSets.size(); i++) {
+			DescriptorSets& sets = descriptorSets[i];
+			UniformBuffers& buffers = uniformBuffers[i];
+
+			// Water plane
+			sets.waterplane = new DescriptorSet(device);
+			sets.waterplane->setPool(descriptorPool);
+			sets.waterplane->addLayout(descriptorSetLayouts.textured);
+			sets.waterplane->addDescriptor(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, &buffers.vsMirror.descriptor);
+			sets.waterplane->addDescriptor(1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, &offscreenPass.refraction.descriptor);
+			sets.waterplane->addDescriptor(2, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, &offscreenPass.reflection.descriptor);
+			sets.waterplane->addDescriptor(3, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, &textures.waterNormalMap.descriptor);
+			sets.waterplane->addDescriptor(4, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, &depthMapDescriptor);
+			sets.waterplane->addDescriptor(5, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, &buffers.CSM.descriptor);
+			sets.waterplane->create();
+
+			// Water plane with screen space reflections
+			sets.waterplaneScreenSpace = new DescriptorSet(device);
+			sets.waterplaneScreenSpace->setPool(descriptorPool);
+			sets.waterplaneScreenSpace->addLayout(descriptorSetLayouts.textured);
+			sets.waterplaneScreenSpace->addDescriptor(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, &buffers.vsMirror.descriptor);
+			sets.waterplaneScreenSpace->addDescriptor(1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, &offscreenPass.scene.descriptor);
+			sets.waterplaneScreenSpace->addDescriptor(2, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, &offscreenPass.sceneDepthDescriptor);
+			sets.waterplaneScreenSpace->addDescriptor(3, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, &textures.waterNormalMap.descriptor);
+			sets.waterplaneScreenSpace->addDescriptor(4, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, &depthMapDescriptor);
+			sets.waterplaneScreenSpace->addDescriptor(5, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, &buffers.CSM.descriptor);
+			sets.waterplaneScreenSpace->create();
+
+			// Debug quad
+			sets.debugquad = new DescriptorSet(device);
+			sets.debugquad->setPool(descriptorPool);
+			sets.debugquad->addLayout(descriptorSetLayouts.textured);
+			sets.debugquad->addDescriptor(1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, &offscreenPass.reflection.descriptor);
+			sets.debugquad->addDescriptor(2, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, &offscreenPass.refraction.descriptor);
+			sets.debugquad->create();
+
+			// Terrain
+			sets.terrain = new DescriptorSet(device);
+			sets.terrain->setPool(descriptorPool);
+			sets.terrain->addLayout(descriptorSetLayouts.terrain);
+			sets.terrain->addDescriptor(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, &buffers.terrain.descriptor);
+			sets.terrain->addDescriptor(1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, &textures.heightMap.descriptor);
+			sets.terrain->addDescriptor(2, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, &textures.terrainArray.descriptor);
+			sets.terrain->addDescriptor(3, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, &depthMapDescriptor);
+			sets.terrain->addDescriptor(4, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, &buffers.CSM.descriptor);
+			// Not sampled without a baked normal map, the binding still needs a valid descriptor
+			sets.terrain->addDescriptor(5, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, terrainNormalMapBaked ? &textures.terrainNormalMap.descriptor : &textures.heightMap.descriptor);
+			// Same for the tiles without streaming, any array texture will do
+			sets.terrain->addDescriptor(6, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, heightMapTiles->loaded ? &heightMapTiles->cache.descriptor : &textures.terrainArray.descriptor);
+			sets.terrain->addDescriptor(7, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, &heightMapTiles->pageTables[i].descriptor);
+			sets.terrain->create();
+
+			// Skysphere
+			sets.skysphere = new DescriptorSet(device);
+			sets.skysphere->setPool(descriptorPool);
+			sets.skysphere->addLayout(descriptorSetLayouts.skysphere);
+			sets.skysphere->addDescriptor(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, &buffers.sky.descriptor);
+			sets.skysphere->addDescriptor(1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, &textures.skySphere.descriptor);
+			sets.skysphere->create();
+		}
 
 		// Shadow map cascades (one set per cascade)
 		// @todo: Doesn't make sense, all refer to same depth
@@ -962,17 +2127,20 @@ public:
 			cascades[i].descriptorSet = new DescriptorSet(device);
 			cascades[i].descriptorSet->setPool(descriptorPool);
 			cascades[i].descriptorSet->addLayout(descriptorSetLayouts.textured);
-			cascades[i].descriptorSet->addDescriptor(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, &depthPass.uniformBuffer.descriptor);
+			cascades[i].descriptorSet->addDescriptor(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, &depthPass.uniformBuffers[0].descriptor);
 			cascades[i].descriptorSet->addDescriptor(1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, &cascadeImageInfo);
 			cascades[i].descriptorSet->create();
 		}
 
 		// Depth pass
-		depthPass.descriptorSet = new DescriptorSet(device);
-		depthPass.descriptorSet->setPool(descriptorPool);
-		depthPass.descriptorSet->addLayout(depthPass.descriptorSetLayout);
-		depthPass.descriptorSet->addDescriptor(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, &depthPass.uniformBuffer.descriptor);
-		depthPass.descriptorSet->create();
+		depthPass.descriptorSets.resize(depthPass.uniformBuffers.size());
+		for (size_t i = 0; i < depthPass.descriptorSets.size(); i++) {
+			depthPass.descriptorSets[i] = new DescriptorSet(device);
+			depthPass.descriptorSets[i]->setPool(descriptorPool);
+			depthPass.descriptorSets[i]->addLayout(depthPass.descriptorSetLayout);
+			depthPass.descriptorSets[i]->addDescriptor(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, &depthPass.uniformBuffers[i].descriptor);
+			depthPass.descriptorSets[i]->create();
+		}
 
 		// Cascade debug
 		cascadeDebug.descriptorSet = new DescriptorSet(device);
@@ -1023,6 +2191,27 @@ public:
 		rasterizationState.cullMode = VK_CULL_MODE_NONE;
 		depthStencilState.depthTestEnable = VK_FALSE;
 
+		// Pipelines are only set up here and compiled together at the end
+		std::vector<Pipeline*> pipelineList;
+		// Height map tile streaming, read by the terrain evaluation and fragment shaders
+		auto heightConstants = [this]() {
+			vks::SpecializationConstants constants;
+			constants.set(5, static_cast<uint32_t>(heightMapTiles->loaded ? VK_TRUE : VK_FALSE));
+			constants.set(6, heightMapTiles->loaded ? heightMapTiles->tileSize : 1u);
+			constants.set(7, heightMapTiles->loaded ? heightMapTiles->tilesPerSide : 1u);
+			return constants;
+		};
+		// Fragment shader variants for the terrain and the water, constant ids are shared by both shaders
+		auto fragmentConstants = [this, heightConstants](bool shadows) {
+			vks::SpecializationConstants constants = heightConstants();
+			constants.set(0, cascadeCount);
+			constants.set(1, static_cast<int32_t>(TERRAIN_LAYER_COUNT));
+			constants.set(2, static_cast<uint32_t>(shadows ? VK_TRUE : VK_FALSE));
+			constants.set(3, shadowFilterRange);
+			constants.set(4, static_cast<uint32_t>(terrainNormalMapBaked ? VK_TRUE : VK_FALSE));
+			return constants;
+		};
+
 		// Debug
 		pipelines.debug = new Pipeline(device);
 		pipelines.debug->setCreateInfo(pipelineCI);
@@ -1031,7 +2220,7 @@ public:
 		pipelines.debug->setRenderPass(renderPass);
 		pipelines.debug->addShader(getAssetPath() + "shaders/quad.vert.spv");
 		pipelines.debug->addShader(getAssetPath() + "shaders/quad.frag.spv");
-		pipelines.debug->create();
+		pipelineList.push_back(pipelines.debug);
 		// Debug cascades
 		cascadeDebug.pipeline = new Pipeline(device);
 		cascadeDebug.pipeline->setCreateInfo(pipelineCI);
@@ -1040,7 +2229,7 @@ public:
 		cascadeDebug.pipeline->setRenderPass(renderPass);
 		cascadeDebug.pipeline->addShader(getAssetPath() + "shaders/debug_csm.vert.spv");
 		cascadeDebug.pipeline->addShader(getAssetPath() + "shaders/debug_csm.frag.spv");
-		cascadeDebug.pipeline->create();
+		pipelineList.push_back(cascadeDebug.pipeline);
 
 		depthStencilState.depthTestEnable = VK_TRUE;
 
@@ -1052,20 +2241,135 @@ public:
 		pipelines.mirror->setLayout(pipelineLayouts.textured);
 		pipelines.mirror->setRenderPass(renderPass);
 		pipelines.mirror->addShader(getAssetPath() + "shaders/mirror.vert.spv");
-		pipelines.mirror->addShader(getAssetPath() + "shaders/mirror.frag.spv");
-		pipelines.mirror->create();
+		pipelines.mirror->addShader(getAssetPath() + "shaders/mirror.frag.spv", fragmentConstants(true));
+		pipelineList.push_back(pipelines.mirror);
+
+		// Screen space reflections (optional, see prepareOffscreen)
+		if (screenSpaceReflectionsSupported) {
+			pipelines.mirrorScreenSpace = new Pipeline(device);
+			pipelines.mirrorScreenSpace->setCreateInfo(pipelineCI);
+			pipelines.mirrorScreenSpace->setCache(pipelineCache);
+			pipelines.mirrorScreenSpace->setLayout(pipelineLayouts.textured);
+			pipelines.mirrorScreenSpace->setRenderPass(renderPass);
+			pipelines.mirrorScreenSpace->addShader(getAssetPath() + "shaders/mirror.vert.spv");
+			pipelines.mirrorScreenSpace->addShader(getAssetPath() + "shaders/water_ssr.frag.spv", fragmentConstants(true));
+			pipelineList.push_back(pipelines.mirrorScreenSpace);
+			// Full screen triangle without vertex input, writes the depth of the opaque pass
+			VkPipelineVertexInputStateCreateInfo emptyInputState = vks::initializers::pipelineVertexInputStateCreateInfo();
+			pipelineCI.pVertexInputState = &emptyInputState;
+			depthStencilState.depthCompareOp = VK_COMPARE_OP_ALWAYS;
+			pipelines.composite = new Pipeline(device);
+			pipelines.composite->setCreateInfo(pipelineCI);
+			pipelines.composite->setCache(pipelineCache);
+			pipelines.composite->setLayout(pipelineLayouts.textured);
+			pipelines.composite->setRenderPass(renderPass);
+			pipelines.composite->addShader(getAssetPath() + "shaders/composite.vert.spv");
+			pipelines.composite->addShader(getAssetPath() + "shaders/composite.frag.spv");
+			pipelineList.push_back(pipelines.composite);
+			depthStencilState.depthCompareOp = VK_COMPARE_OP_LESS_OR_EQUAL;
+			pipelineCI.pVertexInputState = &vertexInputState;
+		}
+
+		// Terrain pipelines use the vertex layout of the height map
+		std::vector<VkVertexInputBindingDescription> terrainVertexInputBindings;
+		std::vector<VkVertexInputAttributeDescription> terrainVertexInputAttributes;
+		heightMap->getVertexInputDescriptions(terrainVertexInputBindings, terrainVertexInputAttributes);
+		VkPipelineVertexInputStateCreateInfo terrainVertexInputState = vks::initializers::pipelineVertexInputStateCreateInfo();
+		terrainVertexInputState.vertexBindingDescriptionCount = static_cast<uint32_t>(terrainVertexInputBindings.size());
+		terrainVertexInputState.pVertexBindingDescriptions = terrainVertexInputBindings.data();
+		terrainVertexInputState.vertexAttributeDescriptionCount = static_cast<uint32_t>(terrainVertexInputAttributes.size());
+		terrainVertexInputState.pVertexAttributeDescriptions = terrainVertexInputAttributes.data();
+		const VkSpecializationInfo* terrainSpecializationInfo = packedTerrainVertices ? heightMap->getVertexSpecializationInfo() : nullptr;
+		const std::string terrainShaderSuffix = packedTerrainVertices ? "_packed" : "";
 
 		// Terrain
+		pipelineCI.pVertexInputState = &terrainVertexInputState;
+		inputAssemblyState.topology = heightMap->getPrimitiveTopology();
+		inputAssemblyState.primitiveRestartEnable = heightMap->primitiveRestart ? VK_TRUE : VK_FALSE;
 		pipelines.terrain = new Pipeline(device);
 		pipelines.terrain->setCreateInfo(pipelineCI);
 		pipelines.terrain->setCache(pipelineCache);
 		pipelines.terrain->setLayout(pipelineLayouts.terrain);
 		pipelines.terrain->setRenderPass(renderPass);
-		pipelines.terrain->addShader(getAssetPath() + "shaders/terrain.vert.spv");
-		pipelines.terrain->addShader(getAssetPath() + "shaders/terrain.frag.spv");
-		pipelines.terrain->create();
+		pipelines.terrain->addShader(getAssetPath() + "shaders/terrain" + terrainShaderSuffix + ".vert.spv", terrainSpecializationInfo);
+		pipelines.terrain->addShader(getAssetPath() + "shaders/terrain.frag.spv", fragmentConstants(true));
+		pipelineList.push_back(pipelines.terrain);
+		pipelines.terrainNoShadows = new Pipeline(device);
+		pipelines.terrainNoShadows->setCreateInfo(pipelineCI);
+		pipelines.terrainNoShadows->setCache(pipelineCache);
+		pipelines.terrainNoShadows->setLayout(pipelineLayouts.terrain);
+		pipelines.terrainNoShadows->setRenderPass(renderPass);
+		pipelines.terrainNoShadows->addShader(getAssetPath() + "shaders/terrain" + terrainShaderSuffix + ".vert.spv", terrainSpecializationInfo);
+		pipelines.terrainNoShadows->addShader(getAssetPath() + "shaders/terrain.frag.spv", fragmentConstants(false));
+		pipelineList.push_back(pipelines.terrainNoShadows);
+
+		// Terrain depth pre-pass, without a fragment shader and color writes
+		blendAttachmentState.colorWriteMask = 0;
+		pipelines.terrainDepthPrepass = new Pipeline(device);
+		pipelines.terrainDepthPrepass->setCreateInfo(pipelineCI);
+		pipelines.terrainDepthPrepass->setCache(pipelineCache);
+		pipelines.terrainDepthPrepass->setLayout(pipelineLayouts.terrain);
+		pipelines.terrainDepthPrepass->setRenderPass(renderPass);
+		pipelines.terrainDepthPrepass->addShader(getAssetPath() + "shaders/terrain" + terrainShaderSuffix + ".vert.spv", terrainSpecializationInfo);
+		pipelineList.push_back(pipelines.terrainDepthPrepass);
+		blendAttachmentState.colorWriteMask = 0xf;
+		// Shades the fragments left by the pre-pass, depth is already written
+		depthStencilState.depthWriteEnable = VK_FALSE;
+		depthStencilState.depthCompareOp = VK_COMPARE_OP_EQUAL;
+		pipelines.terrainDepthEqual = new Pipeline(device);
+		pipelines.terrainDepthEqual->setCreateInfo(pipelineCI);
+		pipelines.terrainDepthEqual->setCache(pipelineCache);
+		pipelines.terrainDepthEqual->setLayout(pipelineLayouts.terrain);
+		pipelines.terrainDepthEqual->setRenderPass(renderPass);
+		pipelines.terrainDepthEqual->addShader(getAssetPath() + "shaders/terrain" + terrainShaderSuffix + ".vert.spv", terrainSpecializationInfo);
+		pipelines.terrainDepthEqual->addShader(getAssetPath() + "shaders/terrain.frag.spv", fragmentConstants(true));
+		pipelineList.push_back(pipelines.terrainDepthEqual);
+		depthStencilState.depthWriteEnable = VK_TRUE;
+		depthStencilState.depthCompareOp = VK_COMPARE_OP_LESS_OR_EQUAL;
+
+		// Tessellated terrain (optional, skipped if the tessellation shaders haven't been compiled to SPIR-V)
+		if (heightMapTessellated && vks::tools::fileExists(getAssetPath() + "shaders/terrain.tesc.spv")) {
+			std::vector<VkVertexInputBindingDescription> tessVertexInputBindings;
+			std::vector<VkVertexInputAttributeDescription> tessVertexInputAttributes;
+			heightMapTessellated->getVertexInputDescriptions(tessVertexInputBindings, tessVertexInputAttributes);
+			VkPipelineVertexInputStateCreateInfo tessVertexInputState = vks::initializers::pipelineVertexInputStateCreateInfo();
+			tessVertexInputState.vertexBindingDescriptionCount = static_cast<uint32_t>(tessVertexInputBindings.size());
+			tessVertexInputState.pVertexBindingDescriptions = tessVertexInputBindings.data();
+			tessVertexInputState.vertexAttributeDescriptionCount = static_cast<uint32_t>(tessVertexInputAttributes.size());
+			tessVertexInputState.pVertexAttributeDescriptions = tessVertexInputAttributes.data();
+			pipelineCI.pVertexInputState = &tessVertexInputState;
+			VkPipelineTessellationStateCreateInfo tessellationState = vks::initializers::pipelineTessellationStateCreateInfo(4);
+			inputAssemblyState.topology = VK_PRIMITIVE_TOPOLOGY_PATCH_LIST;
+			inputAssemblyState.primitiveRestartEnable = VK_FALSE;
+			pipelineCI.pTessellationState = &tessellationState;
+			pipelines.terrainTessellation = new Pipeline(device);
+			pipelines.terrainTessellation->setCreateInfo(pipelineCI);
+			pipelines.terrainTessellation->setCache(pipelineCache);
+			pipelines.terrainTessellation->setLayout(pipelineLayouts.terrain);
+			pipelines.terrainTessellation->setRenderPass(renderPass);
+			pipelines.terrainTessellation->addShader(getAssetPath() + "shaders/terrain_tess.vert.spv");
+			pipelines.terrainTessellation->addShader(getAssetPath() + "shaders/terrain.tesc.spv");
+			pipelines.terrainTessellation->addShader(getAssetPath() + "shaders/terrain.tese.spv", heightConstants());
+			pipelines.terrainTessellation->addShader(getAssetPath() + "shaders/terrain.frag.spv", fragmentConstants(true));
+			pipelineList.push_back(pipelines.terrainTessellation);
+			pipelines.terrainTessellationNoShadows = new Pipeline(device);
+			pipelines.terrainTessellationNoShadows->setCreateInfo(pipelineCI);
+			pipelines.terrainTessellationNoShadows->setCache(pipelineCache);
+			pipelines.terrainTessellationNoShadows->setLayout(pipelineLayouts.terrain);
+			pipelines.terrainTessellationNoShadows->setRenderPass(renderPass);
+			pipelines.terrainTessellationNoShadows->addShader(getAssetPath() + "shaders/terrain_tess.vert.spv");
+			pipelines.terrainTessellationNoShadows->addShader(getAssetPath() + "shaders/terrain.tesc.spv");
+			pipelines.terrainTessellationNoShadows->addShader(getAssetPath() + "shaders/terrain.tese.spv", heightConstants());
+			pipelines.terrainTessellationNoShadows->addShader(getAssetPath() + "shaders/terrain.frag.spv", fragmentConstants(false));
+			pipelineList.push_back(pipelines.terrainTessellationNoShadows);
+			inputAssemblyState.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+			pipelineCI.pTessellationState = nullptr;
+		}
 
 		// Sky
+		pipelineCI.pVertexInputState = &vertexInputState;
+		inputAssemblyState.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+		inputAssemblyState.primitiveRestartEnable = VK_FALSE;
 		rasterizationState.cullMode = VK_CULL_MODE_NONE;
 		depthStencilState.depthWriteEnable = VK_FALSE;
 		pipelines.sky = new Pipeline(device);
@@ -1075,53 +2379,105 @@ public:
 		pipelines.sky->setRenderPass(renderPass);
 		pipelines.sky->addShader(getAssetPath() + "shaders/skysphere.vert.spv");
 		pipelines.sky->addShader(getAssetPath() + "shaders/skysphere.frag.spv");
-		pipelines.sky->create();
+		pipelineList.push_back(pipelines.sky);
 
 		depthStencilState.depthWriteEnable = VK_TRUE;
 
+		// Props, the visible instance indices are fed as a per-instance attribute
+		if (vks::tools::fileExists(getAssetPath() + "shaders/props.vert.spv")) {
+			const std::vector<VkVertexInputBindingDescription> propVertexInputBindings = {
+				vks::initializers::vertexInputBindingDescription(0, sizeof(vkglTF::Model::Vertex), VK_VERTEX_INPUT_RATE_VERTEX),
+				vks::initializers::vertexInputBindingDescription(1, sizeof(uint32_t), VK_VERTEX_INPUT_RATE_INSTANCE),
+			};
+			std::vector<VkVertexInputAttributeDescription> propVertexInputAttributes = vertexInputAttributes;
+			propVertexInputAttributes.push_back(vks::initializers::vertexInputAttributeDescription(1, 3, VK_FORMAT_R32_UINT, 0));
+			VkPipelineVertexInputStateCreateInfo propVertexInputState = vks::initializers::pipelineVertexInputStateCreateInfo();
+			propVertexInputState.vertexBindingDescriptionCount = static_cast<uint32_t>(propVertexInputBindings.size());
+			propVertexInputState.pVertexBindingDescriptions = propVertexInputBindings.data();
+			propVertexInputState.vertexAttributeDescriptionCount = static_cast<uint32_t>(propVertexInputAttributes.size());
+			propVertexInputState.pVertexAttributeDescriptions = propVertexInputAttributes.data();
+			pipelineCI.pVertexInputState = &propVertexInputState;
+			pipelines.props = new Pipeline(device);
+			pipelines.props->setCreateInfo(pipelineCI);
+			pipelines.props->setCache(pipelineCache);
+			pipelines.props->setLayout(pipelineLayouts.props);
+			pipelines.props->setRenderPass(renderPass);
+			pipelines.props->addShader(getAssetPath() + "shaders/props.vert.spv");
+			pipelines.props->addShader(getAssetPath() + "shaders/props.frag.spv");
+			pipelineList.push_back(pipelines.props);
+			pipelineCI.pVertexInputState = &vertexInputState;
+		}
+
 		// Shadow map depth pass
 		colorBlendState.attachmentCount = 0;
 		depthStencilState.depthCompareOp = VK_COMPARE_OP_LESS_OR_EQUAL;
 		// Enable depth clamp (if available)
 		rasterizationState.depthClampEnable = deviceFeatures.depthClamp;
+		pipelineCI.pVertexInputState = &terrainVertexInputState;
+		inputAssemblyState.topology = heightMap->getPrimitiveTopology();
+		inputAssemblyState.primitiveRestartEnable = heightMap->primitiveRestart ? VK_TRUE : VK_FALSE;
 		pipelines.depthpass = new Pipeline(device);
 		pipelines.depthpass->setCreateInfo(pipelineCI);
 		pipelines.depthpass->setCache(pipelineCache);
 		pipelines.depthpass->setLayout(depthPass.pipelineLayout);
 		pipelines.depthpass->setRenderPass(depthPass.renderPass);
-		pipelines.depthpass->addShader(getAssetPath() + "shaders/depthpass.vert.spv");
+		pipelines.depthpass->addShader(getAssetPath() + "shaders/depthpass" + terrainShaderSuffix + ".vert.spv", terrainSpecializationInfo);
 		pipelines.depthpass->addShader(getAssetPath() + "shaders/terrain_depthpass.frag.spv");
-		pipelines.depthpass->create();
+		pipelineList.push_back(pipelines.depthpass);
+
+		// Single pass layered shadow map depth pass (optional, skipped if the shader hasn't been compiled to SPIR-V)
+		const std::string layeredDepthPassShader = getAssetPath() + "shaders/depthpass_layered" + terrainShaderSuffix + ".vert.spv";
+		if (layeredShadowPassSupported && vks::tools::fileExists(layeredDepthPassShader)) {
+			pipelines.depthpassLayered = new Pipeline(device);
+			pipelines.depthpassLayered->setCreateInfo(pipelineCI);
+			pipelines.depthpassLayered->setCache(pipelineCache);
+			pipelines.depthpassLayered->setLayout(depthPass.pipelineLayout);
+			pipelines.depthpassLayered->setRenderPass(depthPass.renderPass);
+			pipelines.depthpassLayered->addShader(layeredDepthPassShader, terrainSpecializationInfo);
+			pipelines.depthpassLayered->addShader(getAssetPath() + "shaders/terrain_depthpass.frag.spv");
+			pipelineList.push_back(pipelines.depthpassLayered);
+		}
+
+		auto tStart = std::chrono::high_resolution_clock::now();
+		Pipeline::createPipelines(pipelineList, &threadPool);
+		pipelineCreationTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - tStart).count();
+		pipelineCount = static_cast<uint32_t>(pipelineList.size());
 	}
 
 	// Prepare and initialize uniform buffer containing shader uniforms
+	// Each swap chain image gets its own set of buffers, these are filled right before that image's command buffer is submitted
 	void prepareUniformBuffers()
-	{		
-		VK_CHECK_RESULT(vulkanDevice->createBuffer(VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &uniformBuffers.vsShared, sizeof(uboShared)));
-		VK_CHECK_RESULT(vulkanDevice->createBuffer(VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &uniformBuffers.vsMirror, sizeof(uboWaterPlane)));
-		VK_CHECK_RESULT(vulkanDevice->createBuffer(VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &uniformBuffers.vsOffScreen, sizeof(uboShared)));
-		VK_CHECK_RESULT(vulkanDevice->createBuffer(VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &uniformBuffers.vsDebugQuad, sizeof(uboShared)));
-		VK_CHECK_RESULT(vulkanDevice->createBuffer(VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &uniformBuffers.terrain, sizeof(uboShared)));
-		VK_CHECK_RESULT(vulkanDevice->createBuffer(VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &uniformBuffers.sky, sizeof(uboShared)));
-		VK_CHECK_RESULT(vulkanDevice->createBuffer(VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &depthPass.uniformBuffer, sizeof(depthPass.ubo)));
-		VK_CHECK_RESULT(vulkanDevice->createBuffer(VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &uniformBuffers.CSM, sizeof(uboCSM)));
-
-		// Map persistent
-		VK_CHECK_RESULT(uniformBuffers.vsShared.map());
-		VK_CHECK_RESULT(uniformBuffers.vsMirror.map());
-		VK_CHECK_RESULT(uniformBuffers.vsOffScreen.map());
-		VK_CHECK_RESULT(uniformBuffers.vsDebugQuad.map());
-		VK_CHECK_RESULT(uniformBuffers.terrain.map());
-		VK_CHECK_RESULT(uniformBuffers.sky.map());
-		VK_CHECK_RESULT(depthPass.uniformBuffer.map());
-		VK_CHECK_RESULT(uniformBuffers.CSM.map());
-
-		updateUniformBuffers();
-		updateUniformBufferOffscreen();
+	{
+		uniformBuffers.resize(swapChain.imageCount);
+		depthPass.uniformBuffers.resize(swapChain.imageCount);
+		for (size_t i = 0; i < uniformBuffers.size(); i++) {
+			UniformBuffers& buffers = uniformBuffers[i];
+			VK_CHECK_RESULT(vulkanDevice->createBuffer(VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &buffers.vsShared, sizeof(uboShared)));
+			VK_CHECK_RESULT(vulkanDevice->createBuffer(VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &buffers.vsMirror, sizeof(uboWaterPlane)));
+			VK_CHECK_RESULT(vulkanDevice->createBuffer(VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &buffers.vsOffScreen, sizeof(uboShared)));
+			VK_CHECK_RESULT(vulkanDevice->createBuffer(VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &buffers.vsDebugQuad, sizeof(uboShared)));
+			VK_CHECK_RESULT(vulkanDevice->createBuffer(VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &buffers.terrain, sizeof(uboTerrain)));
+			VK_CHECK_RESULT(vulkanDevice->createBuffer(VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &buffers.sky, sizeof(uboShared)));
+			VK_CHECK_RESULT(vulkanDevice->createBuffer(VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &depthPass.uniformBuffers[i], sizeof(depthPass.ubo)));
+			VK_CHECK_RESULT(vulkanDevice->createBuffer(VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &buffers.CSM, sizeof(uboCSM)));
+
+			// Map persistent
+			VK_CHECK_RESULT(buffers.vsShared.map());
+			VK_CHECK_RESULT(buffers.vsMirror.map());
+			VK_CHECK_RESULT(buffers.vsOffScreen.map());
+			VK_CHECK_RESULT(buffers.vsDebugQuad.map());
+			VK_CHECK_RESULT(buffers.terrain.map());
+			VK_CHECK_RESULT(buffers.sky.map());
+			VK_CHECK_RESULT(depthPass.uniformBuffers[i].map());
+			VK_CHECK_RESULT(buffers.CSM.map());
+		}
 	}
 
-	void updateUniformBuffers()
+	void updateUniformBuffers(uint32_t imageIndex)
 	{
+		VKS_ZONE("Update uniform buffers");
+		UniformBuffers& buffers = uniformBuffers[imageIndex];
+
 		float radius = 50.0f;
 		lightPos = glm::vec4(20.0f, -15.0f, -15.0f, 0.0f) * radius;
 		lightPos = glm::vec4(-20.0f, -15.0f, -15.0f, 0.0f) * radius;
@@ -1139,40 +2495,44 @@ public:
 		uboShared.model = camera.matrices.view * glm::mat4(1.0f);
 
 		// Mesh
-		memcpy(uniformBuffers.vsShared.mapped, &uboShared, sizeof(uboShared));
+		memcpy(buffers.vsShared.mapped, &uboShared, sizeof(uboShared));
 
 		// Mirror
 		uboWaterPlane.projection = camera.matrices.perspective;
 		uboWaterPlane.model = camera.matrices.view * glm::mat4(1.0f);
 		uboWaterPlane.cameraPos = glm::vec4(camera.position, 0.0f);
 		uboWaterPlane.time = sin(glm::radians(timer * 360.0f));
-		memcpy(uniformBuffers.vsMirror.mapped, &uboWaterPlane, sizeof(uboWaterPlane));
+		memcpy(buffers.vsMirror.mapped, &uboWaterPlane, sizeof(uboWaterPlane));
 
 		// Debug quad
 		uboShared.projection = glm::ortho(4.0f, 0.0f, 0.0f, 4.0f*(float)height / (float)width, -1.0f, 1.0f);
 		uboShared.model = glm::mat4(1.0f);
-		memcpy(uniformBuffers.vsDebugQuad.mapped, &uboShared, sizeof(uboShared));
+		memcpy(buffers.vsDebugQuad.mapped, &uboShared, sizeof(uboShared));
 
-		updateUniformBufferTerrain();
-		updateUniformBufferCSM();
+		updateUniformBufferTerrain(imageIndex);
+		updateUniformBufferCSM(imageIndex);
 
 		// Sky
 		uboSky.projection = camera.matrices.perspective;
 		uboSky.model = glm::mat4(glm::mat3(camera.matrices.view));
-		uniformBuffers.sky.copyTo(&uboSky, sizeof(uboSky));
+		buffers.sky.copyTo(&uboSky, sizeof(uboSky));
 	}
 
-	void updateUniformBufferTerrain() {
+	void updateUniformBufferTerrain(uint32_t imageIndex) {
 		uboTerrain.projection = camera.matrices.perspective;
 		uboTerrain.model = camera.matrices.view;
-		uniformBuffers.terrain.copyTo(&uboTerrain, sizeof(uboTerrain));
+		vks::Frustum frustum;
+		frustum.update(camera.matrices.perspective * camera.matrices.view);
+		memcpy(uboTerrain.frustumPlanes, frustum.planes.data(), sizeof(glm::vec4) * 6);
+		uboTerrain.viewportDim = glm::vec2((float)width, (float)height);
+		uniformBuffers[imageIndex].terrain.copyTo(&uboTerrain, sizeof(uboTerrain));
 	}
 
-	void updateUniformBufferCSM() {
+	void updateUniformBufferCSM(uint32_t imageIndex) {
 		for (auto i = 0; i < cascades.size(); i++) {
 			depthPass.ubo.cascadeViewProjMat[i] = cascades[i].viewProjMatrix;
 		}
-		memcpy(depthPass.uniformBuffer.mapped, &depthPass.ubo, sizeof(depthPass.ubo));
+		memcpy(depthPass.uniformBuffers[imageIndex].mapped, &depthPass.ubo, sizeof(depthPass.ubo));
 
 		for (auto i = 0; i < cascades.size(); i++) {
 			uboCSM.cascadeSplits[i] = cascades[i].splitDepth;
@@ -1180,36 +2540,93 @@ public:
 		}
 		uboCSM.inverseViewMat = glm::inverse(camera.matrices.view);
 		uboCSM.lightDir = normalize(-lightPos);
-		memcpy(uniformBuffers.CSM.mapped, &uboCSM, sizeof(uboCSM));
+		memcpy(uniformBuffers[imageIndex].CSM.mapped, &uboCSM, sizeof(uboCSM));
 	}
 
-	void updateUniformBufferOffscreen()
+	void updateUniformBufferOffscreen(uint32_t imageIndex)
 	{
+		VKS_ZONE("Update uniform buffers");
 		uboShared.projection = camera.matrices.perspective;
 		uboShared.model = camera.matrices.view * glm::mat4(1.0f);
 		uboShared.model = glm::scale(uboShared.model, glm::vec3(1.0f, -1.0f, 1.0f));
-		memcpy(uniformBuffers.vsOffScreen.mapped, &uboShared, sizeof(uboShared));
+		memcpy(uniformBuffers[imageIndex].vsOffScreen.mapped, &uboShared, sizeof(uboShared));
+	}
+
+	// Project the water plane's bounds to the screen, the offscreen passes are skipped on frames it's not visible on
+	void updateWaterVisibility()
+	{
+		glm::vec4 rect;
+		const bool onScreen = vks::Frustum::getScreenRect(camera.matrices.perspective * camera.matrices.view, models.plane.dimensions.min, models.plane.dimensions.max, rect);
+		waterVisibility.visible = reflections && (onScreen || !waterCulling);
+		waterVisibility.screenRect = onScreen ? rect : glm::vec4(0.0f);
+		waterVisibility.coverage = onScreen ? (rect.z - rect.x) * (rect.w - rect.y) * 0.25f : 0.0f;
 	}
 
 	void draw()
 	{
 		VulkanExampleBase::prepareFrame();
 
-		// Command buffer to be sumitted to the queue
-		submitInfo.commandBufferCount = 1;
-		submitInfo.pCommandBuffers = &commandBuffers[currentBuffer]->handle;
+		// This image's command buffers have finished executing, the profiled frame time drives the resolution of the offscreen targets
+		collectProfilerResults(currentBuffer);
+		applyOffscreenResolution(currentBuffer);
+		updateWaterVisibility();
+
+		// Shadow cascades that need to be re-rendered are submitted ahead of the scene
+		std::vector<VkCommandBuffer> submitCommandBuffers;
+		updateCascades();
+		selectCascadeUpdates(currentBuffer, submitCommandBuffers);
+		submitCommandBuffers.push_back(getFrameCommandBuffer(currentBuffer)->handle);
+		if (perFrameRecording) {
+			recordFrameCommandBuffers(currentBuffer, submitCommandBuffers);
+		}
+		// Without indirect drawing the overlay is drawn by a command buffer of it's own after the scene
+		addUICommandBuffer(submitCommandBuffers, currentBuffer);
+
+		// The GPU is done with this image's uniform buffers, so they can be updated for the new frame
+		updateUniformBuffers(currentBuffer);
+		updateUniformBufferOffscreen(currentBuffer);
+		updateTerrainDrawBuffers(currentBuffer);
+		updatePropDrawBuffers(currentBuffer);
+
+		// Command buffers to be sumitted to the queue
+		submitInfo.commandBufferCount = static_cast<uint32_t>(submitCommandBuffers.size());
+		submitInfo.pCommandBuffers = submitCommandBuffers.data();
+
+#if defined(VKS_INSTRUMENTATION)
+		countSubmittedDraws(currentBuffer);
+#endif
 
-		// Submit to queue
-		VK_CHECK_RESULT(vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE));
+		// Submit to queue, the fence signals once this frame's resources may be reused
+		{
+			VKS_ZONE("Queue submit");
+			VK_CHECK_RESULT(vkQueueSubmit(queue, 1, &submitInfo, waitFences[currentFrame]));
+		}
+		std::vector<uint32_t> submittedScopes = { profilerScopes.scene, profilerScopes.ui, profilerScopes.frame };
+		if (waterVisibility.visible) {
+			if (reflectionMode == reflectionModeScreenSpace) {
+				submittedScopes.push_back(profilerScopes.opaque);
+			} else {
+				submittedScopes.push_back(profilerScopes.refraction);
+				submittedScopes.push_back(profilerScopes.reflection);
+			}
+		}
+		for (uint32_t scope : submittedScopes) {
+			profiler->submitted(currentBuffer, scope);
+		}
 
 		VulkanExampleBase::submitFrame();
 	}
 
 	void prepare()
 	{
+		recordPerFrame = perFrameRecording;
 		VulkanExampleBase::prepare();
+		// The main thread also executes jobs while waiting for them
+		threadPool.setThreadCount(std::max(std::thread::hardware_concurrency(), 2u) - 1);
 		loadAssets();
-		generateTerrain();
+		bakeTerrainNormalMap();
+		prepareTerrainDrawBuffers();
+		preparePropDrawBuffers();
 		prepareOffscreen();
 		prepareCSM();
 		prepareUniformBuffers();
@@ -1217,27 +2634,41 @@ public:
 		preparePipelines();
 		setupDescriptorPool();
 		setupDescriptorSet();
+		prepareThreadedCommandBuffers();
+		prepareProfiler();
 		buildCommandBuffers();
 		prepared = true;
 	}
 
-	virtual void render()
+	// The screen space reflection targets have the size of the frame buffer
+	virtual void windowResized()
 	{
-		if (!prepared)
+		if (!offscreenPass.screenSpaceGraph || width == 0 || height == 0) {
 			return;
-		draw();
-		if (!paused || camera.updated)
-		{
-			updateCascades();
-			updateUniformBuffers();
-			updateUniformBufferOffscreen();
 		}
+		offscreenPass.screenSpaceGraph->resizeAttachment(offscreenPass.scene.color, width, height);
+		offscreenPass.screenSpaceGraph->resizeAttachment(offscreenPass.scene.depth, width, height);
+		offscreenPass.screenSpaceGraph->compile();
+		updateOffscreenDescriptors(dynamicResolution.getLevel());
+		for (auto& sets : descriptorSets) {
+			sets.waterplaneScreenSpace->update();
+		}
+		buildCommandBuffers();
 	}
 
-	virtual void viewChanged()
+	virtual void render()
 	{
-		updateUniformBuffers();
-		updateUniformBufferOffscreen();
+		if (!prepared)
+			return;
+		{
+			VKS_ZONE("Frame");
+			draw();
+		}
+		// Also called for benchmark and headless frames, which don't go through the base class' frame loop
+		VKS_FRAME_END();
+		if (frameCounter == 0) {
+			workerUtilization = threadPool.getUtilization();
+		}
 	}
 
 	virtual void OnUpdateUIOverlay(vks::UIOverlay *overlay)
@@ -1253,14 +2684,149 @@ public:
 			if (overlay->checkBox("Display cascades", &cascadeDebug.enabled)) {
 				buildCommandBuffers();
 			}
+			if (pipelines.depthpassLayered) {
+				if (overlay->checkBox("Single pass cascades", &layeredShadowPass)) {
+					buildCommandBuffers();
+				}
+			}
 			if (cascadeDebug.enabled) {
-				if (overlay->sliderInt("Cascade", &cascadeDebug.cascadeIndex, 0, SHADOW_MAP_CASCADE_COUNT - 1)) {
+				if (overlay->sliderInt("Cascade", &cascadeDebug.cascadeIndex, 0, (int32_t)cascadeCount - 1)) {
+					buildCommandBuffers();
+				}
+			}
+			// Cascades are recalculated every frame in draw
+			overlay->sliderFloat("Split lambda", &cascadeSplitLambda, 0.1f, 1.0f);
+			overlay->checkBox("Cache cascades", &cachedCascades);
+			if (cachedCascades) {
+				overlay->checkBox("Round robin far cascades", &roundRobinCascades);
+			}
+			overlay->text("Cascades rendered: %d / %d", cascadesUpdated, cascadeCount);
+		}
+		if (overlay->header("Terrain")) {
+			overlay->checkBox("Frustum culling", &heightMap->frustumCulling);
+			overlay->sliderFloat("LOD distance", &heightMap->lodDistance, 0.5f, 16.0f);
+			overlay->text("Visible chunks: %d / %d", terrainVisibleChunks, (uint32_t)heightMap->chunks.size());
+			overlay->text("Normals: %s", terrainNormalMapBaked ? "baked on the GPU" : "vertex normals");
+			if (heightMap->streaming) {
+				const vks::HeightMap::StreamingStats& stats = heightMap->streamingStats;
+				overlay->text("Streamed chunks: %d / %d slots (%d requested)", stats.residentChunks, heightMap->streamingSlotCount, stats.requestedChunks);
+				overlay->text("%d uploads, %d evictions", stats.uploads, stats.evictions);
+			}
+			if (heightMapTiles->loaded) {
+				const vks::TiledTexture::Stats& stats = heightMapTiles->stats;
+				overlay->text("Height tiles: %d / %d slots (%d requested)", stats.residentTiles, heightMapTiles->slotCount, stats.requestedTiles);
+				overlay->text("%d uploads, %d evictions", stats.uploads, stats.evictions);
+			}
+			if (overlay->checkBox("Depth pre-pass", &depthPrepass)) {
+				buildCommandBuffers();
+			}
+			overlay->checkBox("Prop frustum culling", &propFrustumCulling);
+			overlay->text("Visible props: %d / %d", propVisibleInstances, models.testscene.getInstanceCount());
+			if (pipelines.terrainTessellation) {
+				if (overlay->checkBox("Tessellation", &tessellation)) {
 					buildCommandBuffers();
 				}
+				if (tessellation) {
+					overlay->sliderFloat("Tessellation factor", &uboTerrain.tessellation.x, 0.0f, 4.0f);
+				}
+			}
+		}
+		if (overlay->header("GPU profiler") && profiler->supported()) {
+			double total = 0.0;
+			for (auto& scope : profiler->getScopes()) {
+				if (scope.valid && &scope != &profiler->getScope(profilerScopes.frame)) {
+					overlay->text("%s: %.2f ms", scope.name.c_str(), scope.average);
+					total += scope.average;
+				}
+			}
+			overlay->text("Total: %.2f ms", total);
+		}
+		if (overlay->header("Dynamic resolution") && profiler->supported() && reflections) {
+			overlay->checkBox("Enabled", &dynamicResolution.enabled);
+			if (dynamicResolution.enabled) {
+				overlay->sliderFloat("GPU budget (ms)", &dynamicResolution.targetTime, 2.0f, 33.3f);
+			} else if (overlay->sliderInt("Level", &dynamicResolutionLevel, 0, dynamicResolution.getLevelCount() - 1)) {
+				setOffscreenResolution(static_cast<uint32_t>(dynamicResolutionLevel));
+			}
+			const VkExtent2D extent = offscreenPass.graph->getExtent(offscreenPass.reflection.pass);
+			overlay->text("GPU frame: %.2f ms (%.2f ms smoothed)", profiler->getScope(profilerScopes.frame).time, dynamicResolution.getSmoothedTime());
+			overlay->text("Offscreen targets: %dx%d", extent.width, extent.height);
+		}
+		if (overlay->header("Water") && reflections) {
+			if (screenSpaceReflectionsSupported) {
+				if (overlay->comboBox("Reflections", &reflectionMode, { "Planar", "Screen space" })) {
+					buildCommandBuffers();
+				}
+			}
+			overlay->checkBox("Cull offscreen passes", &waterCulling);
+			if (waterVisibility.visible) {
+				overlay->text("Water plane: visible (%.0f %% of the screen)", waterVisibility.coverage * 100.0f);
+			} else {
+				overlay->text("Water plane: culled");
+			}
+		}
+		if (overlay->header("Render graph")) {
+			const RenderGraph::Stats& graphStats = getFrameGraph(currentBuffer, waterVisibility.visible)->getStats();
+			overlay->text("Passes: %d (%d culled)", graphStats.passCount, graphStats.culledPassCount);
+			overlay->text("Attachments: %d in %d images", graphStats.attachmentCount, graphStats.imageCount);
+			overlay->text("Memory: %.1f MB (%.1f MB unaliased)", graphStats.memorySize / (1024.0f * 1024.0f), graphStats.unaliasedMemorySize / (1024.0f * 1024.0f));
+			overlay->text("Barriers: %d", graphStats.barrierCount);
+		}
+#if defined(VKS_INSTRUMENTATION)
+		if (overlay->header("CPU instrumentation")) {
+			const vks::Instrumentation& instrumentation = vks::Instrumentation::get();
+			for (auto& zone : instrumentation.getZoneStats()) {
+				overlay->text("%s: %.3f ms (%dx)", zone.name, zone.average, zone.calls);
+			}
+			for (auto& counter : instrumentation.getCounterStats()) {
+				overlay->text("%s: %lld (%.1f avg)", counter.name, (long long)counter.value, counter.average);
+			}
+			if (instrumentation.isTracing()) {
+				overlay->text("Tracing to %s (%d frames)", instrumentation.getTraceFilename().c_str(), instrumentation.getTracedFrames());
+			}
+		}
+#endif
+		if (overlay->header("Job system")) {
+			for (uint32_t i = 0; i < workerUtilization.size(); i++) {
+				overlay->text("Worker %d: %.1f %%", i, workerUtilization[i] * 100.0f);
+			}
+		}
+		if (overlay->header("Command buffers")) {
+			if (overlay->checkBox("Per-frame recording", &perFrameRecording)) {
+				recordPerFrame = perFrameRecording;
+				// Frames in flight aren't waited for while recording per frame, and the prerecorded command buffers of all images are stale
+				if (!perFrameRecording) {
+					VK_CHECK_RESULT(vkDeviceWaitIdle(device));
+					buildCommandBuffers();
+				}
+			}
+			overlay->text("Recording: %.2f ms", recordingTime);
+		}
+		if (overlay->header("Asset loading")) {
+			overlay->text("Total: %.1f ms", assetLoadTime);
+			for (auto& timing : assetLoadTimings) {
+				overlay->text("%s: %.1f / %.1f / %.1f ms", timing.name.c_str(), timing.decode, timing.create, timing.upload);
+			}
+			overlay->text("Pipelines: %d in %.1f ms", pipelineCount, pipelineCreationTime);
+			const vks::ShaderModuleCache::Stats shaderStats = vks::ShaderModuleCache::get().getStats();
+			overlay->text("Shader modules: %d (%d files read, %d shared)", shaderStats.moduleCount, shaderStats.fileReads, shaderStats.pathHits + shaderStats.contentHits);
+		}
+		if (overlay->header("Device memory")) {
+			const std::vector<vks::MemoryAllocator::HeapStats> heapStats = vulkanDevice->memoryAllocator->getHeapStats();
+			for (uint32_t i = 0; i < heapStats.size(); i++) {
+				const vks::MemoryAllocator::HeapStats& stats = heapStats[i];
+				if (stats.reserved == 0) {
+					continue;
+				}
+				overlay->text("Heap %d (%s): %.1f / %.1f MB", i, vulkanDevice->memoryAllocator->isDeviceLocalHeap(i) ? "device" : "host", stats.used / (1024.0f * 1024.0f), stats.reserved / (1024.0f * 1024.0f));
+				overlay->text("%d allocations, %d blocks, %d dedicated", stats.allocationCount, stats.blockCount, stats.dedicatedCount);
 			}
-			if (overlay->sliderFloat("Split lambda", &cascadeSplitLambda, 0.1f, 1.0f)) {
-				updateCascades();
-				updateUniformBuffers();
+			const vks::StagingUploader* uploader = vulkanDevice->stagingUploader;
+			overlay->text("Uploads: %.1f MB in %d batches, %d stalls (%s queue)", uploader->stats.bytesUploaded / (1024.0f * 1024.0f), uploader->stats.submits, uploader->stats.stalls, uploader->hasDedicatedTransferQueue() ? "transfer" : "graphics");
+			if (overlay->indirect()) {
+				overlay->text("UI overlay: %d buffer grows, %d rebuilds (indirect)", overlay->stats.bufferGrows, overlay->stats.rebuilds);
+			} else {
+				overlay->text("UI overlay: %d buffer grows, %d recordings (direct)", overlay->stats.bufferGrows, overlay->stats.recordings);
 			}
 		}
 		if (overlay->header("Terrain layers")) {